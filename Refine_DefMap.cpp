@@ -47,6 +47,10 @@ wxEND_EVENT_TABLE()
 
 static const double DefDMSigmaX = 75;
 
+// a map marking more than one pixel in this many is not useful, and the highest
+// aggressiveness settings can mark millions of pixels
+static const unsigned int MaxDefectFraction = 100;
+
 inline static void StartRow(int& row, int& column)
 {
     ++row;
@@ -62,7 +66,7 @@ static void AddTableEntryPair(wxWindow *parent, wxFlexGridSizer *pTable, const w
 }
 
 RefineDefMap::RefineDefMap(wxWindow *parent) :
-    wxDialog(parent, wxID_ANY, _("Refine Bad-pixel Map"), wxDefaultPosition, wxSize(900, 400), wxCAPTION | wxCLOSE_BOX), m_profileId(-1)
+    wxDialog(parent, wxID_ANY, _("Refine Bad-pixel Map"), wxDefaultPosition, wxSize(900, 400), wxCAPTION | wxCLOSE_BOX), m_profileId(-1), m_previewStale(false)
 {
     SetSize(wxSize(900, 400));
 
@@ -334,11 +338,20 @@ void RefineDefMap::ShowStatus(const wxString& msg, bool appending)
 void RefineDefMap::ApplyNewMap()
 {
     m_builder.SetAggressiveness(pColdSlider->GetValue(), pHotSlider->GetValue());
+    if (TooManyDefects() &&
+        wxMessageBox(wxString::Format(_("The current settings mark %d pixels as defects. Guiding with such a map is not useful. "
+                                        "Build the bad-pixel map anyway?"), m_builder.GetHotPixelCnt() + m_builder.GetColdPixelCnt()),
+                     _("Bad-pixel Map"), wxYES_NO | wxICON_QUESTION, this) != wxYES)
+    {
+        ShowStatus(_("Bad-pixel map NOT rebuilt"), false);
+        return;
+    }
     // This can take a bit of time...
     pHotSlider->Enable(false);
     pColdSlider->Enable(false);
     ShowStatus(_("Building new bad-pixel map"), false);
     m_builder.BuildDefectMap(m_defectMap, true);
+    m_previewStale = false;
     ShowStatus(_("Saving new bad-pixel map file"), false);
     m_defectMap.Save(m_builder.GetMapInfo());
     ShowStatus(_("Loading new bad-pixel map"), false);
@@ -374,7 +387,7 @@ void RefineDefMap::OnGenerate(wxCommandEvent& evt)
     ApplyNewMap();
 }
 
-// Get the timestamp from the file modification timestamp of the defectmap .txt file
+// Get the timestamp from the file modification timestamp of the defect map file
 wxString RefineDefMap::DefectMapTimeString()
 {
     wxString dfFileName = DefectMap::DefectMapFileName(pConfig->GetCurrentProfileId());
@@ -398,7 +411,8 @@ void RefineDefMap::GetMiscInfo(MiscInfo& info)
     info.lastColdFactor = wxString::Format("%d", pConfig->Profile.GetInt("/camera/dmap_cold_factor", DefDMSigmaX));
 }
 
-// Recompute hot/cold pixel counts based on current aggressiveness settings
+// Recompute hot/cold pixel counts based on current aggressiveness settings. The
+// preview map is only rebuilt when it is shown, see RefreshPreview
 void RefineDefMap::Recalc()
 {
     if (manualPixelCount != 0)
@@ -407,21 +421,24 @@ void RefineDefMap::Recalc()
         pStatsGrid->SetCellValue(manualPixelLoc, "0");          // Manual pixels will always be discarded
     }
     GetBadPxCounts();
-    m_builder.BuildDefectMap(m_defectMap, false);
+    m_previewStale = true;
 }
 
 void RefineDefMap::OnHotChange(wxScrollEvent& evt)
 {
     Recalc();
     pStatsGrid->SetCellBackgroundColour(hotPixelLoc.GetRow(), hotPixelLoc.GetCol(), "light blue");
-    RefreshPreview();
+    // only the counts are updated while the slider is being dragged
+    if (evt.GetEventType() != wxEVT_SCROLL_THUMBTRACK)
+        RefreshPreview();
 }
 
 void RefineDefMap::OnColdChange(wxScrollEvent& evt)
 {
     Recalc();
     pStatsGrid->SetCellBackgroundColour(coldPixelLoc.GetRow(), coldPixelLoc.GetCol(), "light blue");
-    RefreshPreview();
+    if (evt.GetEventType() != wxEVT_SCROLL_THUMBTRACK)
+        RefreshPreview();
 }
 
 // Manually add a bad pixel to the currently loaded (in-memory) defect map - does NOT affect any future map generations
@@ -478,6 +495,7 @@ void RefineDefMap::OnReset(wxCommandEvent& evt)
 void RefineDefMap::LoadPreview()
 {
     m_defectMap.clear();
+    m_previewStale = false;
 
     wxCriticalSectionLocker lck(pCamera->DarkFrameLock);
     DefectMap *curMap = pCamera->CurrentDefectMap;
@@ -489,6 +507,18 @@ void RefineDefMap::LoadPreview()
 
 void RefineDefMap::RefreshPreview()
 {
+    if (pShowPreview->IsChecked() && m_previewStale)
+    {
+        if (TooManyDefects())
+        {
+            pFrame->pGuider->SetDefectMapPreview(0);
+            ShowStatus(_("Too many bad pixels to preview, reduce the aggressiveness"), false);
+            return;
+        }
+        m_builder.BuildDefectMap(m_defectMap, false);
+        m_previewStale = false;
+    }
+
     if (pShowPreview->IsChecked())
         pFrame->pGuider->SetDefectMapPreview(&m_defectMap);
     else
@@ -508,6 +538,12 @@ void RefineDefMap::GetBadPxCounts()
     pStatsGrid->SetCellValue(coldPixelLoc, wxString::Format("%d", m_builder.GetColdPixelCnt()));
 }
 
+bool RefineDefMap::TooManyDefects() const
+{
+    unsigned int const limit = std::max(m_darks.masterDark.NPixels / MaxDefectFraction, 1000U);
+    return (unsigned int) (m_builder.GetHotPixelCnt() + m_builder.GetColdPixelCnt()) > limit;
+}
+
 void RefineDefMap::OnDetails(wxCommandEvent& ev)
 {
     pInfoGroup->Show(pShowDetails->GetValue());
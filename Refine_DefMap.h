@@ -49,6 +49,7 @@ class RefineDefMap : public wxDialog
 
     int m_profileId;
     DefectMap m_defectMap;
+    bool m_previewStale;            // m_defectMap does not match the sliders yet
     DefectMapDarks m_darks;
     DefectMapBuilder m_builder;
 
@@ -92,6 +93,7 @@ public:
 private:
     void LoadFromProfile();
     void GetBadPxCounts();
+    bool TooManyDefects() const;
     void GetMiscInfo(MiscInfo& info);
     void OnGenerate(wxCommandEvent& evt);
     void OnHotChange(wxScrollEvent& evt);
@@ -0,0 +1,188 @@
+/*
+ *  star_kernel_benchmark.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+//
+// Micro-benchmark for the Star::Find pixel kernels. Each available
+// implementation is timed on a synthetic star field at search region sizes
+// 15, 30 and 50 and checked for bit-identical results against the scalar code.
+//
+// usage: StarKernelBenchmark [iterations]
+//
+
+#include "star_kernel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace StarKernel;
+
+struct Result
+{
+    PeakResult peak;
+    Background bg;
+    Moments m;
+};
+
+static bool SameResult(const Result& a, const Result& b)
+{
+    return a.peak.x == b.peak.x && a.peak.y == b.peak.y && a.peak.val == b.peak.val &&
+        std::memcmp(a.peak.max3, b.peak.max3, sizeof(a.peak.max3)) == 0 &&
+        std::memcmp(&a.bg.mean, &b.bg.mean, sizeof(double)) == 0 &&
+        std::memcmp(&a.bg.sigma2, &b.bg.sigma2, sizeof(double)) == 0 &&
+        a.bg.n == b.bg.n && a.bg.ok == b.bg.ok &&
+        a.m.n == b.m.n && a.m.sum == b.m.sum && a.m.sum2 == b.m.sum2 &&
+        a.m.sumdx == b.m.sumdx && a.m.sumdy == b.m.sumdy &&
+        a.m.sumdxv == b.m.sumdxv && a.m.sumdyv == b.m.sumdyv;
+}
+
+// the same sequence of kernel calls that Star::Find makes in FIND_CENTROID mode
+static void Measure(const std::vector<unsigned short>& img, int width, int height, int cx, int cy, int searchRegion, Result *res)
+{
+    Bounds const b = { 0, 0, width - 1, height - 1 };
+
+    SmoothedPeak(&img[0], width, cx - searchRegion, cy - searchRegion, cx + searchRegion, cy + searchRegion, &res->peak);
+    AnnulusBackground(&img[0], width, res->peak.x, res->peak.y, 7 * 7, 12 * 12, b, &res->bg);
+    unsigned short thresh = (unsigned short)(res->bg.mean + 3.0 * res->bg.sigma + 0.5);
+    ApertureMoments(&img[0], width, res->peak.x, res->peak.y, 7 * 7, b, thresh, &res->m);
+}
+
+static void MakeStarField(std::vector<unsigned short> *img, int width, int height, double sx, double sy, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> noise(0.0, 12.0);
+
+    img->resize(width * height);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            double dx = x - sx, dy = y - sy;
+            double v = 1000.0 + noise(rng) + 20000.0 * std::exp(-(dx * dx + dy * dy) / (2.0 * 1.8 * 1.8));
+            (*img)[y * width + x] = (unsigned short) std::min(65535.0, std::max(0.0, v));
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 5000;
+    if (iterations <= 0)
+        iterations = 5000;
+
+    int const width = 1280, height = 960;
+    int const cx = 640, cy = 480;
+
+    static const Impl impls[] = { IMPL_SCALAR, IMPL_SSE2, IMPL_AVX2, IMPL_NEON };
+    static const int sizes[] = { 15, 30, 50 };
+
+    bool ok = true;
+
+    // correctness over a set of sub-pixel star positions and edge-clipped windows
+    for (unsigned int seed = 1; seed <= 50; seed++)
+    {
+        std::vector<unsigned short> img;
+        MakeStarField(&img, width, height, cx + (seed % 7) * 0.13, cy - (seed % 5) * 0.21, seed);
+
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        {
+            int const px = seed % 2 ? cx : sizes[s] / 2 + 3; // near the left edge for even seeds
+            Result ref;
+            SetImpl(IMPL_SCALAR);
+            Measure(img, width, height, px, cy, sizes[s], &ref);
+
+            for (size_t i = 1; i < sizeof(impls) / sizeof(impls[0]); i++)
+            {
+                if (!SetImpl(impls[i]))
+                    continue;
+                Result r;
+                Measure(img, width, height, px, cy, sizes[s], &r);
+                if (!SameResult(ref, r))
+                {
+                    std::printf("MISMATCH: %s differs from scalar (seed %u, search region %d)\n", ImplName(impls[i]), seed, sizes[s]);
+                    ok = false;
+                }
+            }
+        }
+    }
+
+    std::vector<unsigned short> img;
+    MakeStarField(&img, width, height, cx + 0.3, cy - 0.4, 12345);
+
+    std::printf("%-8s %8s %12s %9s\n", "impl", "region", "usec/call", "speedup");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        double scalar_usec = 0.0;
+
+        for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+        {
+            if (!SetImpl(impls[i]))
+                continue;
+
+            Result r;
+            Measure(img, width, height, cx, cy, sizes[s], &r); // warm up
+
+            // best of several trials to reduce scheduling noise
+            double usec = 0.0;
+            for (int trial = 0; trial < 5; trial++)
+            {
+                auto t0 = std::chrono::steady_clock::now();
+                for (int n = 0; n < iterations; n++)
+                    Measure(img, width, height, cx + (n & 1), cy, sizes[s], &r);
+                auto t1 = std::chrono::steady_clock::now();
+
+                double t = std::chrono::duration<double, std::micro>(t1 - t0).count() / iterations;
+                if (trial == 0 || t < usec)
+                    usec = t;
+            }
+            if (impls[i] == IMPL_SCALAR)
+                scalar_usec = usec;
+
+            std::printf("%-8s %8d %12.3f %8.2fx\n", ImplName(impls[i]), sizes[s], usec, scalar_usec / usec);
+        }
+    }
+
+    if (!ok)
+    {
+        std::printf("FAILED: results are not bit-identical\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ *  buffered_file_sink.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "phd.h"
+
+#include <atomic>
+
+class BufferedFileSink::Writer : public wxThread
+{
+    BufferedFileSink *m_sink;
+    std::atomic<bool> m_stop;
+
+public:
+    Writer(BufferedFileSink *sink) : wxThread(wxTHREAD_JOINABLE), m_sink(sink), m_stop(false) { }
+
+    void Stop()
+    {
+        m_stop = true;
+        m_sink->m_wakeup.Post();
+        Wait(wxTHREAD_WAIT_BLOCK);
+    }
+
+protected:
+    ExitCode Entry() override
+    {
+        while (!m_stop)
+        {
+            m_sink->m_wakeup.WaitTimeout(FLUSH_INTERVAL_MS);
+
+            wxMutexLocker lock(m_sink->m_fileLock);
+            m_sink->WritePending();
+        }
+        return (ExitCode) 0;
+    }
+};
+
+BufferedFileSink::BufferedFileSink()
+    :
+    m_openedLength(0),
+    m_writer(nullptr)
+{
+}
+
+BufferedFileSink::~BufferedFileSink()
+{
+    Close();
+}
+
+bool BufferedFileSink::Open(const wxString& fileName)
+{
+    Close();
+
+    if (!m_file.Open(fileName, "ab"))
+        return true;
+
+    m_fileName = fileName;
+    m_openedLength = m_file.Length();
+
+    Writer *writer = new Writer(this);
+    if (writer->Create() != wxTHREAD_NO_ERROR || writer->Run() != wxTHREAD_NO_ERROR)
+    {
+        delete writer;
+        Debug.Write(wxString::Format("Could not start the writer thread for %s, writing synchronously\n", fileName));
+        return false;
+    }
+
+    m_writer = writer;
+    return false;
+}
+
+void BufferedFileSink::Close()
+{
+    if (m_writer)
+    {
+        m_writer->Stop();
+        delete m_writer;
+        m_writer = nullptr;
+    }
+
+    if (m_file.IsOpened())
+    {
+        Flush();
+        m_file.Close();
+    }
+}
+
+void BufferedFileSink::Append(const void *data, size_t len)
+{
+    size_t before;
+    {
+        wxMutexLocker lock(m_lock);
+        before = m_pending.size();
+        m_pending.append(static_cast<const char *>(data), len);
+    }
+
+    if (!m_writer)
+        Flush();
+    else if (before < WAKE_BYTES && before + len >= WAKE_BYTES)
+        m_wakeup.Post();
+}
+
+void BufferedFileSink::Flush()
+{
+    wxMutexLocker lock(m_fileLock);
+    WritePending();
+}
+
+void BufferedFileSink::WritePending()
+{
+    {
+        wxMutexLocker lock(m_lock);
+        m_batch.swap(m_pending);
+    }
+
+    if (m_batch.empty())
+        return;
+
+    if (m_file.IsOpened())
+    {
+        m_file.Write(m_batch.data(), m_batch.size());
+        m_file.Flush();
+    }
+
+    m_batch.clear();
+
+    // do not hold on to the memory of an unusually large batch
+    if (m_batch.capacity() > 1024 * 1024)
+        std::string().swap(m_batch);
+}
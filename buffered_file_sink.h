@@ -0,0 +1,89 @@
+/*
+ *  buffered_file_sink.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef BUFFERED_FILE_SINK_H_INCLUDED
+#define BUFFERED_FILE_SINK_H_INCLUDED
+
+#include <string>
+
+//
+// Appends to a file through an in-memory buffer that a background thread
+// writes out every FLUSH_INTERVAL_MS, or sooner once the buffer fills up.
+// Append never touches the file, so callers on the guiding path do not wait
+// for the disk. If the writer thread cannot be started, appends are written
+// through.
+//
+class BufferedFileSink
+{
+    class Writer;
+
+    enum
+    {
+        FLUSH_INTERVAL_MS = 1000,
+        WAKE_BYTES = 64 * 1024,     // wake the writer early once this much is pending
+    };
+
+    wxString m_fileName;
+    wxFFile m_file;
+    wxFileOffset m_openedLength;
+    wxMutex m_fileLock;     // serializes writes to m_file
+    wxMutex m_lock;         // protects m_pending
+    wxSemaphore m_wakeup;
+    std::string m_pending;
+    std::string m_batch;    // written by the holder of m_fileLock
+    Writer *m_writer;
+
+    void WritePending();    // caller must hold m_fileLock
+
+public:
+    BufferedFileSink();
+    ~BufferedFileSink();
+
+    BufferedFileSink(const BufferedFileSink&) = delete;
+    BufferedFileSink& operator=(const BufferedFileSink&) = delete;
+
+    // open for appending; returns true on error
+    bool Open(const wxString& fileName);
+    void Close();
+    bool IsOpen() const { return m_file.IsOpened(); }
+    const wxString& FileName() const { return m_fileName; }
+    // size of the file when it was opened
+    wxFileOffset OpenedLength() const { return m_openedLength; }
+
+    void Append(const void *data, size_t len);
+    // write out everything appended so far
+    void Flush();
+};
+
+#endif // BUFFERED_FILE_SINK_H_INCLUDED
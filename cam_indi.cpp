@@ -665,6 +665,7 @@ void CameraINDI::SetCCDdevice()
 bool CameraINDI::ReadFITS(usImage& img, bool takeSubframe, const wxRect& subframe)
 {
     int xsize, ysize;
+    FitsLock fitsLock;
     fitsfile *fptr;  // FITS file pointer
     int status = 0;  // CFITSIO status value MUST be initialized to zero!
     int hdutype, naxis;
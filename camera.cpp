@@ -796,6 +796,7 @@ void CameraConfigDialogPane::LayoutControls(GuideCamera *pCamera, BrainCtrlIdMap
     wxSizerFlags def_flags = wxSizerFlags(0).Border(wxALL, 10).Expand();
     pTopline->Add(GetSizerCtrl(CtrlMap, AD_szNoiseReduction));
     pTopline->Add(GetSizerCtrl(CtrlMap, AD_szTimeLapse), wxSizerFlags(0).Border(wxLEFT, 110).Expand());
+    pTopline->Add(GetSingleCtrl(CtrlMap, AD_cbPipelinedCapture), wxSizerFlags(0).Border(wxLEFT, 30).Align(wxALIGN_CENTER_VERTICAL));
     pGenGroup->Add(pTopline, def_flags);
     pGenGroup->Add(GetSizerCtrl(CtrlMap, AD_szAutoExposure), def_flags);
     pGenGroup->Layout();
@@ -1406,6 +1407,7 @@ void GuideCamera::SubtractDark(usImage& img)
     // DarkFrameLock to protect against the dark frame disappearing when the main
     // thread does "Load Darks" or "Clear Darks"
 
+    LatencyTimer timer(GuideLatency::DARKS);
     wxCriticalSectionLocker lck(DarkFrameLock);
 
     if (CurrentDefectMap)
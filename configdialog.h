@@ -65,6 +65,7 @@ enum BRAIN_CTRL_IDS
     AD_szSaturationOptions,
     AD_szCameraTimeout,
     AD_szTimeLapse,
+    AD_cbPipelinedCapture,
     AD_szPixelSize,
     AD_szGain,
     AD_szDelay,
@@ -42,6 +42,7 @@
  */
 
 #include <cstdint>
+#include <algorithm>
 
 #include "gaussian_process.h"
 #include "math_tools.h"
@@ -58,6 +59,29 @@ struct covariance_ordering
     Eigen::VectorXd const& covariance_;
 };
 
+namespace
+{
+    void remove_element(Eigen::VectorXd& v, int k)
+    {
+        int n = v.rows() - 1;
+        Eigen::VectorXd r(n);
+        r.head(k) = v.head(k);
+        r.tail(n - k) = v.tail(n - k);
+        v.swap(r);
+    }
+
+    void remove_row_col(Eigen::MatrixXd& m, int k)
+    {
+        int n = m.rows() - 1;
+        Eigen::MatrixXd r(n, n);
+        r.topLeftCorner(k, k) = m.topLeftCorner(k, k);
+        r.topRightCorner(k, n - k) = m.block(0, k + 1, k, n - k);
+        r.bottomLeftCorner(n - k, k) = m.block(k + 1, 0, n - k, k);
+        r.bottomRightCorner(n - k, n - k) = m.bottomRightCorner(n - k, n - k);
+        m.swap(r);
+    }
+}
+
 GP::GP() : covFunc_(nullptr), // initialize pointer to null
     covFuncProj_(nullptr), // initialize pointer to null
     data_loc_(Eigen::VectorXd()),
@@ -71,7 +95,11 @@ GP::GP() : covFunc_(nullptr), // initialize pointer to null
     feature_vectors_(Eigen::MatrixXd()),
     feature_matrix_(Eigen::MatrixXd()),
     chol_feature_matrix_(Eigen::LDLT<Eigen::MatrixXd>()),
-    beta_(Eigen::VectorXd())
+    beta_(Eigen::VectorXd()),
+    use_incremental_(false),
+    have_chol_factor_(false),
+    updates_since_infer_(0),
+    chol_factor_(Eigen::MatrixXd())
 { }
 
 GP::GP(const covariance_functions::CovFunc& covFunc) :
@@ -88,7 +116,11 @@ GP::GP(const covariance_functions::CovFunc& covFunc) :
     feature_vectors_(Eigen::MatrixXd()),
     feature_matrix_(Eigen::MatrixXd()),
     chol_feature_matrix_(Eigen::LDLT<Eigen::MatrixXd>()),
-    beta_(Eigen::VectorXd())
+    beta_(Eigen::VectorXd()),
+    use_incremental_(false),
+    have_chol_factor_(false),
+    updates_since_infer_(0),
+    chol_factor_(Eigen::MatrixXd())
 { }
 
 GP::GP(const double noise_variance,
@@ -106,7 +138,11 @@ GP::GP(const double noise_variance,
     feature_vectors_(Eigen::MatrixXd()),
     feature_matrix_(Eigen::MatrixXd()),
     chol_feature_matrix_(Eigen::LDLT<Eigen::MatrixXd>()),
-    beta_(Eigen::VectorXd())
+    beta_(Eigen::VectorXd()),
+    use_incremental_(false),
+    have_chol_factor_(false),
+    updates_since_infer_(0),
+    chol_factor_(Eigen::MatrixXd())
 { }
 
 GP::~GP()
@@ -129,7 +165,11 @@ GP::GP(const GP& that) :
     feature_vectors_(that.feature_vectors_),
     feature_matrix_(that.feature_matrix_),
     chol_feature_matrix_(that.chol_feature_matrix_),
-    beta_(that.beta_)
+    beta_(that.beta_),
+    use_incremental_(that.use_incremental_),
+    have_chol_factor_(that.have_chol_factor_),
+    updates_since_infer_(that.updates_since_infer_),
+    chol_factor_(that.chol_factor_)
 {
     covFunc_ = that.covFunc_->clone();
     covFuncProj_ = that.covFuncProj_->clone();
@@ -174,6 +214,10 @@ GP& GP::operator=(const GP& that)
         alpha_ = that.alpha_;
         chol_gram_matrix_ = that.chol_gram_matrix_;
         log_noise_sd_ = that.log_noise_sd_;
+        use_incremental_ = that.use_incremental_;
+        have_chol_factor_ = that.have_chol_factor_;
+        updates_since_infer_ = that.updates_since_infer_;
+        chol_factor_ = that.chol_factor_;
     }
     return *this;
 }
@@ -207,7 +251,7 @@ Eigen::VectorXd GP::drawSample(const Eigen::VectorXd& locations,
         mixed_covariance = covFunc_->evaluate(locations, data_loc_);
         Eigen::MatrixXd posterior_covariance;
         posterior_covariance = prior_covariance - mixed_covariance *
-                               (chol_gram_matrix_.solve(mixed_covariance.transpose()));
+                               (solveGram(mixed_covariance.transpose()));
         kernel_matrix = posterior_covariance + JITTER * Eigen::MatrixXd::Identity(
                             posterior_covariance.rows(), posterior_covariance.cols());
     }
@@ -240,11 +284,31 @@ void GP::infer()
         gram_matrix_ += data_var_.asDiagonal();
     }
 
-    // compute the Cholesky decomposition of the Gram matrix
-    chol_gram_matrix_ = gram_matrix_.ldlt();
+    have_chol_factor_ = false;
+    if (use_incremental_)
+    {
+        // the explicit factor L can be updated when data is added or removed
+        Eigen::LLT<Eigen::MatrixXd> chol_gram_matrix(gram_matrix_);
+        if (chol_gram_matrix.info() == Eigen::Success)
+        {
+            chol_factor_ = chol_gram_matrix.matrixL();
+            have_chol_factor_ = true;
+        }
+    }
+    if (!have_chol_factor_)
+    {
+        // compute the Cholesky decomposition of the Gram matrix
+        chol_gram_matrix_ = gram_matrix_.ldlt();
+    }
+    updates_since_infer_ = 0;
+
+    inferWeights();
+}
 
+void GP::inferWeights()
+{
     // pre-compute the alpha, which is the solution of the chol to the data
-    alpha_ = chol_gram_matrix_.solve(data_out_);
+    alpha_ = solveGram(data_out_);
 
     if (use_explicit_trend_)
     {
@@ -253,13 +317,25 @@ void GP::infer()
         feature_vectors_.row(0) = Eigen::MatrixXd::Ones(1,data_loc_.rows()); // instead of pow(0)
         feature_vectors_.row(1) = data_loc_.array(); // instead of pow(1)
 
-        feature_matrix_ = feature_vectors_ * chol_gram_matrix_.solve(feature_vectors_.transpose());
+        feature_matrix_ = feature_vectors_ * solveGram(feature_vectors_.transpose());
         chol_feature_matrix_ = feature_matrix_.ldlt();
 
         beta_ = chol_feature_matrix_.solve(feature_vectors_) * alpha_;
     }
 }
 
+Eigen::MatrixXd GP::solveGram(const Eigen::MatrixXd& b) const
+{
+    if (have_chol_factor_)
+    {
+        // K^{-1} b = L^{-T} (L^{-1} b)
+        Eigen::MatrixXd x = chol_factor_.triangularView<Eigen::Lower>().solve(b);
+        chol_factor_.triangularView<Eigen::Lower>().transpose().solveInPlace(x);
+        return x;
+    }
+    return chol_gram_matrix_.solve(b);
+}
+
 void GP::infer(const Eigen::VectorXd& data_loc,
                const Eigen::VectorXd& data_out,
                const Eigen::VectorXd& data_var /* = EigenVectorXd() */)
@@ -341,12 +417,256 @@ void GP::inferSD(const Eigen::VectorXd& data_loc,
     infer();
 }
 
+void GP::enableIncrementalInference()
+{
+    use_incremental_ = true;
+    if (data_loc_.rows() > 0)
+    {
+        infer(); // to get the explicit factor
+    }
+}
+
+void GP::disableIncrementalInference()
+{
+    use_incremental_ = false;
+    if (have_chol_factor_)
+    {
+        infer(); // back to the LDLT decomposition
+    }
+}
+
+void GP::appendPoint(double loc, double out, double var)
+{
+    int n = data_loc_.rows();
+    bool use_var = !math_tools::isNaN(var); // true means heteroscedastic noise
+    assert((n == 0 || use_var == (data_var_.rows() > 0)) && "Error: mixing homoscedastic and heteroscedastic noise!");
+
+    // refactorize from time to time to keep the rounding errors of the updates bounded
+    if (have_chol_factor_ && (n == 0 || ++updates_since_infer_ > n))
+    {
+        have_chol_factor_ = false;
+    }
+
+    if (have_chol_factor_)
+    {
+        Eigen::VectorXd new_loc(1);
+        new_loc << loc;
+
+        Eigen::VectorXd k = covFunc_->evaluate(data_loc_, new_loc);
+        double k_new = covFunc_->evaluate(new_loc, new_loc)(0, 0) +
+            (use_var ? var : std::exp(2 * log_noise_sd_) + JITTER);
+
+        // the new row of L is [l^T, d] with L*l = k and d^2 = k_new - l^T*l
+        Eigen::VectorXd l = chol_factor_.triangularView<Eigen::Lower>().solve(k);
+        double d2 = k_new - l.squaredNorm();
+
+        if (d2 > 0)
+        {
+            chol_factor_.conservativeResize(n + 1, n + 1);
+            chol_factor_.block(0, n, n, 1).setZero();
+            chol_factor_.block(n, 0, 1, n) = l.transpose();
+            chol_factor_(n, n) = std::sqrt(d2);
+
+            gram_matrix_.conservativeResize(n + 1, n + 1);
+            gram_matrix_.block(0, n, n, 1) = k;
+            gram_matrix_.block(n, 0, 1, n) = k.transpose();
+            gram_matrix_(n, n) = k_new;
+        }
+        else // numerically not positive definite, needs a full decomposition
+        {
+            have_chol_factor_ = false;
+        }
+    }
+
+    data_loc_.conservativeResize(n + 1);
+    data_loc_(n) = loc;
+    data_out_.conservativeResize(n + 1);
+    data_out_(n) = out;
+    if (use_var)
+    {
+        data_var_.conservativeResize(n + 1);
+        data_var_(n) = var;
+    }
+    else
+    {
+        data_var_ = Eigen::VectorXd();
+    }
+}
+
+void GP::removePoint(int index)
+{
+    int n = data_loc_.rows();
+    assert(index >= 0 && index < n);
+
+    if (have_chol_factor_ && ++updates_since_infer_ > n)
+    {
+        have_chol_factor_ = false;
+    }
+
+    if (have_chol_factor_)
+    {
+        // Removing row and column k from K leaves the leading block of L
+        // unchanged, while the trailing block L33 has to absorb the removed
+        // column: L33' * L33'^T = L33 * L33^T + l32 * l32^T (rank-1 update).
+        int m = n - index - 1;
+        Eigen::VectorXd x = chol_factor_.block(index + 1, index, m, 1);
+        for (int j = 0; j < m; ++j)
+        {
+            int c = index + 1 + j;
+            double l_jj = chol_factor_(c, c);
+            double r = std::sqrt(l_jj * l_jj + x(j) * x(j));
+            double cos = r / l_jj;
+            double sin = x(j) / l_jj;
+            chol_factor_(c, c) = r;
+
+            int rest = m - j - 1;
+            chol_factor_.block(c + 1, c, rest, 1) = (chol_factor_.block(c + 1, c, rest, 1) + sin * x.tail(rest)) / cos;
+            x.tail(rest) = cos * x.tail(rest) - sin * chol_factor_.block(c + 1, c, rest, 1);
+        }
+        remove_row_col(chol_factor_, index);
+        remove_row_col(gram_matrix_, index);
+    }
+
+    remove_element(data_loc_, index);
+    remove_element(data_out_, index);
+    if (data_var_.rows() > 0)
+    {
+        remove_element(data_var_, index);
+    }
+}
+
+void GP::appendData(double loc, double out, double var /* = NaN */)
+{
+    appendPoint(loc, out, var);
+    if (have_chol_factor_)
+    {
+        inferWeights();
+    }
+    else
+    {
+        infer();
+    }
+}
+
+void GP::removeData(int index)
+{
+    removePoint(index);
+    if (data_loc_.rows() == 0)
+    {
+        clearData();
+    }
+    else if (have_chol_factor_)
+    {
+        inferWeights();
+    }
+    else
+    {
+        infer();
+    }
+}
+
+void GP::updateSD(const Eigen::VectorXd& data_loc,
+                  const Eigen::VectorXd& data_out,
+                  const int n, const Eigen::VectorXd& data_var /* = EigenVectorXd() */,
+                  const double prediction_point /*= std::numeric_limits<double>::quiet_NaN()*/)
+{
+    bool use_var = data_var.rows() > 0; // true means heteroscedastic noise
+
+    if (!use_incremental_ || !have_chol_factor_ || use_var != (data_var_.rows() > 0))
+    {
+        inferSD(data_loc, data_out, n, data_var, prediction_point);
+        return;
+    }
+
+    Eigen::VectorXd prediction_loc(1);
+    if ( math_tools::isNaN(prediction_point) )
+    {
+        // if none given, use the last datapoint as prediction reference
+        prediction_loc = data_loc.tail(1);
+    }
+    else
+    {
+        prediction_loc << prediction_point;
+    }
+
+    // calculate covariance between data and prediction point for point selection
+    Eigen::VectorXd covariance = covFunc_->evaluate(data_loc, prediction_loc);
+
+    // select the n points with the highest covariance, the order doesn't matter
+    std::vector<int> index(covariance.size(), 0);
+    for (size_t i = 0 ; i != index.size() ; i++) {
+        index[i] = i;
+    }
+    int count = std::min<int>(n, data_loc.rows());
+    std::nth_element(index.begin(), index.begin() + count, index.end(),
+        covariance_ordering(covariance));
+    index.resize(count);
+
+    // sort the selection by location to find the points we already have
+    std::sort(index.begin(), index.end(),
+        [&data_loc](int a, int b) { return data_loc[a] < data_loc[b]; });
+    std::vector<bool> present(count, false);
+    std::vector<int> outdated;
+
+    for (int j = 0; j < data_loc_.rows(); ++j)
+    {
+        std::vector<int>::const_iterator it = std::lower_bound(index.begin(), index.end(), data_loc_[j],
+            [&data_loc](int a, double loc) { return data_loc[a] < loc; });
+        if (it != index.end() && data_loc[*it] == data_loc_[j] && data_out[*it] == data_out_[j]
+            && (!use_var || data_var[*it] == data_var_[j]))
+        {
+            present[it - index.begin()] = true;
+        }
+        else
+        {
+            outdated.push_back(j);
+        }
+    }
+
+    int changes = static_cast<int>(outdated.size()) + count - static_cast<int>(std::count(present.begin(), present.end(), true));
+    if (changes == 0)
+    {
+        return;
+    }
+    if (4 * changes > count) // too many changes, a new decomposition is cheaper
+    {
+        inferSD(data_loc, data_out, n, data_var, prediction_point);
+        return;
+    }
+
+    // remove from the back, so that the remaining indices stay valid
+    for (std::vector<int>::reverse_iterator it = outdated.rbegin(); it != outdated.rend(); ++it)
+    {
+        removePoint(*it);
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        if (!present[i])
+        {
+            appendPoint(data_loc[index[i]], data_out[index[i]],
+                use_var ? data_var[index[i]] : std::numeric_limits<double>::quiet_NaN());
+        }
+    }
+
+    if (have_chol_factor_)
+    {
+        inferWeights();
+    }
+    else
+    {
+        infer();
+    }
+}
+
 void GP::clearData()
 {
     gram_matrix_ = Eigen::MatrixXd();
     chol_gram_matrix_ = Eigen::LDLT<Eigen::MatrixXd>();
+    chol_factor_ = Eigen::MatrixXd();
+    have_chol_factor_ = false;
     data_loc_ = Eigen::VectorXd();
     data_out_ = Eigen::VectorXd();
+    data_var_ = Eigen::VectorXd();
 }
 
 Eigen::VectorXd GP::predict(const Eigen::VectorXd& locations, Eigen::VectorXd* variances /*=nullptr*/) const
@@ -434,7 +754,7 @@ Eigen::VectorXd GP::predict(const Eigen::MatrixXd& prior_cov, const Eigen::Matri
     Eigen::VectorXd m = mixed_cov * alpha_;
 
     // precompute K^{-1} * mixed_cov
-    Eigen::MatrixXd gamma = chol_gram_matrix_.solve(mixed_cov.transpose());
+    Eigen::MatrixXd gamma = solveGram(mixed_cov.transpose());
 
     Eigen::MatrixXd R;
 
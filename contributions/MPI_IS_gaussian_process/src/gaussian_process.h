@@ -51,6 +51,7 @@
 #include <utility>
 #include <cstdint>
 #include <cmath>
+#include <limits>
 #include "covariance_functions.h"
 
 // Constants
@@ -76,6 +77,29 @@ private:
     Eigen::MatrixXd feature_matrix_;
     Eigen::LDLT<Eigen::MatrixXd> chol_feature_matrix_;
     Eigen::VectorXd beta_;
+    bool use_incremental_;
+    bool have_chol_factor_;
+    int updates_since_infer_;
+    Eigen::MatrixXd chol_factor_; // lower triangular L with L*L^T = gram_matrix_
+
+    /*!
+     * Solves gram_matrix_ * x = b with whichever decomposition is current.
+     */
+    Eigen::MatrixXd solveGram(const Eigen::MatrixXd& b) const;
+
+    /*!
+     * Computes alpha_ and the explicit trend quantities from the current
+     * decomposition of the Gram matrix.
+     */
+    void inferWeights();
+
+    /*!
+     * Add or remove a single datapoint and update the Cholesky factor, if
+     * there is one. If the factor cannot be updated, only the data is changed
+     * and have_chol_factor_ is reset, so that infer() needs to be called.
+     */
+    void appendPoint(double loc, double out, double var);
+    void removePoint(int index);
 
 public:
     typedef std::pair<Eigen::VectorXd, Eigen::MatrixXd> VectorMatrixPair;
@@ -150,6 +174,48 @@ public:
                  const Eigen::VectorXd& data_var = Eigen::VectorXd(),
                  const double prediction_point = std::numeric_limits<double>::quiet_NaN());
 
+    /*!
+     * Enables incremental inference. The Gram matrix is then decomposed into
+     * an explicit Cholesky factor, which appendData() and removeData() update
+     * in O(n^2) instead of recomputing it in O(n^3).
+     */
+    void enableIncrementalInference();
+
+    /*!
+     * Disables incremental inference, the Gram matrix is refactorized with
+     * every change of the data.
+     */
+    void disableIncrementalInference();
+
+    /*!
+     * Adds a single datapoint with location \a loc, output \a out and noise
+     * variance \a var. If no variance is given, the noise is homoscedastic.
+     * With incremental inference, the Cholesky factor is extended by one row,
+     * otherwise infer() is called.
+     */
+    void appendData(double loc, double out,
+                    double var = std::numeric_limits<double>::quiet_NaN());
+
+    /*!
+     * Removes the datapoint at \a index. With incremental inference, the
+     * Cholesky factor is downdated with a rank-1 update of the trailing
+     * block, otherwise infer() is called.
+     */
+    void removeData(int index);
+
+    /*!
+     * Incremental variant of inferSD(). The subset of the n most important
+     * datapoints is selected as in inferSD(), but points that are already
+     * part of the current subset (identified by their location) are kept,
+     * so only the points that enter or leave the subset cause an update of
+     * the Cholesky factor.
+     */
+    void updateSD(const Eigen::VectorXd& data_loc,
+                  const Eigen::VectorXd& data_out,
+                  const int n,
+                  const Eigen::VectorXd& data_var = Eigen::VectorXd(),
+                  const double prediction_point = std::numeric_limits<double>::quiet_NaN());
+
     /*!
      * Sets the GP back to the prior:
      * Removes datapoints, empties the Gram matrix.
@@ -60,6 +60,8 @@
 
 #define HYSTERESIS 0.1 // for the hybrid mode
 
+#define PERIOD_UPDATE_TOLERANCE 1e-3 // relative period change that triggers a refactorization
+
 GaussianProcessGuider::GaussianProcessGuider(guide_parameters parameters) :
     start_time_(std::chrono::system_clock::now()),
     last_time_(std::chrono::system_clock::now()),
@@ -70,6 +72,8 @@ GaussianProcessGuider::GaussianProcessGuider(guide_parameters parameters) :
     dithering_active_(false),
     dither_offset_(0.0),
     circular_buffer_data_(CIRCULAR_BUFFER_SIZE),
+    period_length_estimate_(math_tools::NaN),
+    spectrum_period_length_(math_tools::NaN),
     covariance_function_(),
     output_covariance_function_(),
     gp_(covariance_function_),
@@ -80,6 +84,11 @@ GaussianProcessGuider::GaussianProcessGuider(guide_parameters parameters) :
     circular_buffer_data_[0].control = 0; // set first control to zero
     gp_.enableExplicitTrend(); // enable the explicit basis function for the linear drift
     gp_.enableOutputProjection(output_covariance_function_); // for prediction
+    if (parameters.incremental_inference_)
+    {
+        gp_.enableIncrementalInference();
+    }
+    ResetGrid();
 
     std::vector<double> hyperparameters(NumParameters);
     hyperparameters[SE0KLengthScale] = parameters.SE0KLengthScale_;
@@ -140,8 +149,32 @@ double GaussianProcessGuider::CalculateVariance(double SNR)
     return standard_deviation * standard_deviation;
 }
 
+// linear least squares regression for offset and drift to de-trend the data
+static Eigen::VectorXd detrend(const Eigen::VectorXd& timestamps, const Eigen::VectorXd& gear_error)
+{
+    Eigen::MatrixXd feature_matrix(2, timestamps.rows());
+    feature_matrix.row(0) = Eigen::MatrixXd::Ones(1, timestamps.rows()); // timestamps.pow(0)
+    feature_matrix.row(1) = timestamps.array(); // timestamps.pow(1)
+
+    // this is the inference for linear regression
+    Eigen::VectorXd weights = (feature_matrix*feature_matrix.transpose()
+    + 1e-3*Eigen::Matrix<double, 2, 2>::Identity()).ldlt().solve(feature_matrix*gear_error);
+
+    // calculate the linear regression for all datapoints
+    Eigen::VectorXd linear_fit = weights.transpose()*feature_matrix;
+
+    // subtract polynomial fit from the data points
+    return gear_error - linear_fit;
+}
+
 void GaussianProcessGuider::UpdateGP(double prediction_point /*= std::numeric_limits<double>::quiet_NaN()*/)
 {
+    if (parameters.incremental_inference_)
+    {
+        UpdateGPIncremental(prediction_point);
+        return;
+    }
+
 #if PRINT_TIMINGS_
     clock_t begin = std::clock(); // this is for timing the method in a simple way
 #endif
@@ -167,7 +200,6 @@ void GaussianProcessGuider::UpdateGP(double prediction_point /*= std::numeric_li
     }
 
     Eigen::VectorXd gear_error(N-1);
-    Eigen::VectorXd linear_fit(N-1);
 
     // calculate the accumulated gear error
     gear_error = sum_controls + measurements; // for each time step, add the residual error
@@ -190,27 +222,6 @@ void GaussianProcessGuider::UpdateGP(double prediction_point /*= std::numeric_li
     end = std::clock();
     double time_regularize = double(end - begin) / CLOCKS_PER_SEC;
     begin = std::clock();
-#endif
-
-    // linear least squares regression for offset and drift to de-trend the data
-    Eigen::MatrixXd feature_matrix(2, timestamps.rows());
-    feature_matrix.row(0) = Eigen::MatrixXd::Ones(1, timestamps.rows()); // timestamps.pow(0)
-    feature_matrix.row(1) = timestamps.array(); // timestamps.pow(1)
-
-    // this is the inference for linear regression
-    Eigen::VectorXd weights = (feature_matrix*feature_matrix.transpose()
-    + 1e-3*Eigen::Matrix<double, 2, 2>::Identity()).ldlt().solve(feature_matrix*gear_error);
-
-    // calculate the linear regression for all datapoints
-    linear_fit = weights.transpose()*feature_matrix;
-
-    // subtract polynomial fit from the data points
-    Eigen::VectorXd gear_error_detrend = gear_error - linear_fit;
-
-#if PRINT_TIMINGS_
-    end = std::clock();
-    double time_detrend = double(end - begin) / CLOCKS_PER_SEC;
-    begin = std::clock();
     double time_fft = 0; // need to initialize in case the FFT isn't calculated
 #endif
 
@@ -219,7 +230,7 @@ void GaussianProcessGuider::UpdateGP(double prediction_point /*= std::numeric_li
     if (GetBoolComputePeriod() && get_last_point().timestamp > parameters.min_periods_for_period_estimation_ * period_length)
     {
         // find periodicity parameter with FFT
-        period_length = EstimatePeriodLength(timestamps, gear_error_detrend);
+        period_length = UpdateSpectrum(timestamps, gear_error);
         UpdatePeriodLength(period_length);
 
 #if PRINT_TIMINGS_
@@ -239,12 +250,111 @@ void GaussianProcessGuider::UpdateGP(double prediction_point /*= std::numeric_li
     end = std::clock();
     double time_gp = double(end - begin) / CLOCKS_PER_SEC;
 
-    printf("timings: init: %f, regularize: %f, detrend: %f, fft: %f, gp: %f, total: %f\n",
-           time_init, time_regularize, time_detrend, time_fft, time_gp,
-           time_init + time_regularize + time_detrend + time_fft + time_gp);
+    printf("timings: init: %f, regularize: %f, fft: %f, gp: %f, total: %f\n",
+           time_init, time_regularize, time_fft, time_gp,
+           time_init + time_regularize + time_fft + time_gp);
 #endif
 }
 
+void GaussianProcessGuider::UpdateGPIncremental(double prediction_point)
+{
+    // regularize the points that were completed since the last update, the
+    // last point is still missing its measurement
+    size_t N = get_number_of_measurements();
+    for (size_t i = grid_.consumed; i < N-1; i++)
+    {
+        RegularizePoint(circular_buffer_data_[i]);
+    }
+    grid_.consumed = N-1;
+
+    if (grid_.timestamps.rows() == 0)
+    {
+        return; // no complete grid cell yet
+    }
+
+    // calculate period length if we have enough points already
+    double period_length = GetGPHyperparameters()[PKPeriodLength];
+    if (GetBoolComputePeriod() && get_last_point().timestamp > parameters.min_periods_for_period_estimation_ * period_length)
+    {
+        // find periodicity parameter with FFT
+        period_length = UpdateSpectrum(grid_.timestamps, grid_.gear_error);
+        UpdatePeriodLength(period_length);
+    }
+
+    // only the points that enter or leave the subset of data update the GP
+    gp_.updateSD(grid_.timestamps, grid_.gear_error, parameters.points_for_approximation_, grid_.variances, prediction_point);
+}
+
+void GaussianProcessGuider::ResetGrid()
+{
+    grid_.consumed = 0;
+    grid_.sum_control = 0.0;
+    grid_.last_cell_end = -GRID_INTERVAL;
+    grid_.last_timestamp = -GRID_INTERVAL;
+    grid_.last_gear_error = 0.0;
+    grid_.last_variance = 0.0;
+    grid_.gear_error_sum = 0.0;
+    grid_.variance_sum = 0.0;
+    grid_.timestamps = Eigen::VectorXd();
+    grid_.gear_error = Eigen::VectorXd();
+    grid_.variances = Eigen::VectorXd();
+}
+
+// this is the loop body of regularize_dataset(), applied to a single point
+void GaussianProcessGuider::RegularizePoint(const data_point& point)
+{
+    double grid_interval = GRID_INTERVAL;
+
+    grid_.sum_control += point.control; // sum over the control signals
+    double timestamp = point.timestamp;
+    double gear_error = grid_.sum_control + point.measurement;
+    double variance = point.variance;
+
+    if (timestamp < grid_.last_cell_end + grid_interval)
+    {
+        grid_.gear_error_sum += (timestamp - grid_.last_timestamp) * 0.5 * (grid_.last_gear_error + gear_error);
+        grid_.variance_sum += (timestamp - grid_.last_timestamp) * 0.5 * (grid_.last_variance + variance);
+        grid_.last_timestamp = timestamp;
+        return;
+    }
+
+    while (timestamp >= grid_.last_cell_end + grid_interval)
+    {
+        double inter_timestamp = grid_.last_cell_end + grid_interval;
+
+        double proportion = (inter_timestamp - grid_.last_timestamp) / (timestamp - grid_.last_timestamp);
+        double inter_gear_error = proportion*gear_error + (1-proportion)*grid_.last_gear_error;
+        double inter_variance = proportion*variance + (1-proportion)*grid_.last_variance;
+
+        grid_.gear_error_sum += (inter_timestamp - grid_.last_timestamp) * 0.5 * (grid_.last_gear_error + inter_gear_error);
+        grid_.variance_sum += (inter_timestamp - grid_.last_timestamp) * 0.5 * (grid_.last_variance + inter_variance);
+
+        // the oldest cell drops out of a full grid
+        int j = grid_.timestamps.rows();
+        if (j == REGULAR_BUFFER_SIZE)
+        {
+            grid_.timestamps = grid_.timestamps.tail(j - 1).eval();
+            grid_.gear_error = grid_.gear_error.tail(j - 1).eval();
+            grid_.variances = grid_.variances.tail(j - 1).eval();
+            --j;
+        }
+        grid_.timestamps.conservativeResize(j + 1);
+        grid_.gear_error.conservativeResize(j + 1);
+        grid_.variances.conservativeResize(j + 1);
+        grid_.timestamps(j) = grid_.last_cell_end + 0.5 * grid_interval;
+        grid_.gear_error(j) = grid_.gear_error_sum / grid_interval;
+        grid_.variances(j) = grid_.variance_sum / grid_interval;
+
+        grid_.last_timestamp = inter_timestamp;
+        grid_.last_gear_error = inter_gear_error;
+        grid_.last_variance = inter_variance;
+        grid_.last_cell_end = inter_timestamp;
+
+        grid_.gear_error_sum = 0.0;
+        grid_.variance_sum = 0.0;
+    }
+}
+
 double GaussianProcessGuider::PredictGearError(double prediction_location)
 {
     // in the first step of each sequence, use the current time stamp as last prediction end
@@ -409,6 +519,10 @@ void GaussianProcessGuider::reset()
 {
     circular_buffer_data_.clear();
     gp_.clearData();
+    ResetGrid();
+
+    spectrum_timestamps_ = Eigen::VectorXd();
+    spectrum_gear_error_ = Eigen::VectorXd();
 
     // We need to add a first data point because the measurements are always relative to the control.
     // For the first measurement, we therefore need to add a point with zero control.
@@ -469,6 +583,28 @@ bool GaussianProcessGuider::SetBoolComputePeriod(bool active) {
     return false;
 }
 
+bool GaussianProcessGuider::GetBoolIncrementalInference() const {
+    return parameters.incremental_inference_;
+}
+
+bool GaussianProcessGuider::SetBoolIncrementalInference(bool active) {
+    if (active == parameters.incremental_inference_)
+    {
+        return false;
+    }
+    parameters.incremental_inference_ = active;
+    if (active)
+    {
+        gp_.enableIncrementalInference();
+        ResetGrid(); // the next update regularizes the whole buffer
+    }
+    else
+    {
+        gp_.disableIncrementalInference();
+    }
+    return false;
+}
+
 std::vector<double> GaussianProcessGuider::GetGPHyperparameters() const
 {
     // since the GP class works in log space, we have to exp() the parameters first.
@@ -506,6 +642,7 @@ bool GaussianProcessGuider::SetGPHyperparameters(std::vector<double> const &hype
 
     // the GP works in log space, therefore we need to convert
     gp_.setHyperParameters(hyperparameters_full.array().log());
+    period_length_estimate_ = math_tools::NaN; // restart the smoothing from the new value
     return false;
 }
 
@@ -571,7 +708,7 @@ double GaussianProcessGuider::EstimatePeriodLength(const Eigen::VectorXd& time,
     Eigen::VectorXd windowed_data = data.array() * math_tools::hamming_window(data.rows()).array();
 
     // compute the spectrum
-    std::pair<Eigen::VectorXd, Eigen::VectorXd> result = math_tools::compute_spectrum(windowed_data, FFT_SIZE);
+    std::pair<Eigen::VectorXd, Eigen::VectorXd> result = math_tools::compute_spectrum(windowed_data, FFT_SIZE, fft_);
 
     Eigen::ArrayXd amplitudes = result.first;
     Eigen::ArrayXd frequencies = result.second;
@@ -647,6 +784,24 @@ double GaussianProcessGuider::EstimatePeriodLength(const Eigen::VectorXd& time,
     return period_length;
 }
 
+double GaussianProcessGuider::UpdateSpectrum(const Eigen::VectorXd& timestamps, const Eigen::VectorXd& gear_error)
+{
+    // Between two grid cells, the regularized data is unchanged and so is the
+    // spectrum. Comparing the data is cheap compared to the FFT.
+    bool changed = timestamps.rows() != spectrum_timestamps_.rows()
+        || timestamps != spectrum_timestamps_
+        || gear_error != spectrum_gear_error_;
+
+    if (changed)
+    {
+        spectrum_period_length_ = EstimatePeriodLength(timestamps, detrend(timestamps, gear_error));
+        spectrum_timestamps_ = timestamps;
+        spectrum_gear_error_ = gear_error;
+    }
+
+    return spectrum_period_length_;
+}
+
 void GaussianProcessGuider::UpdatePeriodLength(double period_length)
 {
     std::vector<double> hypers = GetGPHyperparameters();
@@ -660,6 +815,27 @@ void GaussianProcessGuider::UpdatePeriodLength(double period_length)
             period_length = hypers[PKPeriodLength]; // just use the old value instead
     }
 
+    if (parameters.incremental_inference_)
+    {
+        // Every change of the period length requires a new decomposition of
+        // the Gram matrix, so the smoothed estimate is only passed on once it
+        // has moved by a noticeable amount.
+        if (math_tools::isNaN(period_length_estimate_))
+        {
+            period_length_estimate_ = hypers[PKPeriodLength];
+        }
+        period_length_estimate_ = (1 - learning_rate_) * period_length_estimate_ + learning_rate_ * period_length;
+        if (std::abs(period_length_estimate_ - hypers[PKPeriodLength]) < PERIOD_UPDATE_TOLERANCE * hypers[PKPeriodLength])
+        {
+            return;
+        }
+        double estimate = period_length_estimate_;
+        hypers[PKPeriodLength] = estimate;
+        SetGPHyperparameters(hypers); // the setter function is needed to convert parameters
+        period_length_estimate_ = estimate; // keep smoothing from the unrounded value
+        return;
+    }
+
     // we just apply a simple learning rate to slow down parameter jumps
     hypers[PKPeriodLength] = (1 - learning_rate_) * hypers[PKPeriodLength] + learning_rate_ * period_length;
 
@@ -95,6 +95,7 @@ public:
         int points_for_approximation_;
 
         bool compute_period_;
+        bool incremental_inference_;
 
         double SE0KLengthScale_;
         double SE0KSignalVariance_;
@@ -112,6 +113,7 @@ public:
             min_periods_for_period_estimation_(0.0),
             points_for_approximation_(0),
             compute_period_(false),
+            incremental_inference_(false),
             SE0KLengthScale_(0.0),
             SE0KSignalVariance_(0.0),
             PKLengthScale_(0.0),
@@ -141,6 +143,41 @@ private:
 
     circular_buffer<data_point> circular_buffer_data_;
 
+    /**
+     * The regularized dataset, maintained point by point for incremental
+     * inference. Holds the state of the integration over the current cell.
+     */
+    struct regular_grid
+    {
+        size_t consumed; // number of raw data points already regularized
+        double sum_control;
+        double last_cell_end;
+        double last_timestamp;
+        double last_gear_error;
+        double last_variance;
+        double gear_error_sum;
+        double variance_sum;
+        Eigen::VectorXd timestamps;
+        Eigen::VectorXd gear_error;
+        Eigen::VectorXd variances;
+    };
+    regular_grid grid_;
+
+    /**
+     * Smoothed period length that has not been passed to the GP yet.
+     */
+    double period_length_estimate_;
+
+    /**
+     * The spectrum only depends on the regularized dataset, which changes
+     * only when the grid advances. The peak found in the spectrum of this
+     * data is reused until then.
+     */
+    Eigen::VectorXd spectrum_timestamps_;
+    Eigen::VectorXd spectrum_gear_error_;
+    double spectrum_period_length_;
+    Eigen::FFT<double> fft_; // keeps the FFT plan between the estimates
+
     covariance_functions::PeriodicSquareExponential2 covariance_function_; // for inference
     covariance_functions::PeriodicSquareExponential output_covariance_function_; // for prediction
     GP gp_;
@@ -187,12 +224,26 @@ private:
     double EstimatePeriodLength(const Eigen::VectorXd& time, const Eigen::VectorXd& data);
 
     /**
-     * Calculates the difference in gear error for the time between the last
-     * prediction point and the current prediction point, which lies one
-     * exposure length in the future.
+     * Detrends the regularized dataset and estimates its main period length,
+     * unless the dataset is the same as for the last estimate.
      */
-    double PredictGearError(double prediction_location);
+    double UpdateSpectrum(const Eigen::VectorXd& timestamps, const Eigen::VectorXd& gear_error);
 
+    /**
+     * Clears the incrementally regularized dataset.
+     */
+    void ResetGrid();
+
+    /**
+     * Adds a raw data point to the incrementally regularized dataset.
+     */
+    void RegularizePoint(const data_point& point);
+
+    /**
+     * Incremental version of UpdateGP(). Only the new data points are
+     * regularized and the GP is updated instead of being inferred again.
+     */
+    void UpdateGPIncremental(double prediction_point);
 
 
 public:
@@ -214,6 +265,9 @@ public:
     bool GetBoolComputePeriod() const;
     bool SetBoolComputePeriod(bool active);
 
+    bool GetBoolIncrementalInference() const;
+    bool SetBoolIncrementalInference(bool active);
+
     std::vector<double> GetGPHyperparameters() const;
     bool SetGPHyperparameters(const std::vector<double>& hyperparameters);
 
@@ -293,6 +347,11 @@ public:
 
     void add_one_point()
     {
+        // a full buffer drops the oldest point, which shifts all indices
+        if (circular_buffer_data_.size() == circular_buffer_data_.capacity() && grid_.consumed > 0)
+        {
+            --grid_.consumed;
+        }
         circular_buffer_data_.push_front(data_point());
     }
 
@@ -301,6 +360,13 @@ public:
      */
     void inject_data_point(double timestamp, double input, double SNR, double control);
 
+    /**
+     * Calculates the difference in gear error for the time between the last
+     * prediction point and the current prediction point, which lies one
+     * exposure length in the future.
+     */
+    double PredictGearError(double prediction_location);
+
     /**
      * Takes timestamps, measurements and SNRs and returns them regularized in a matrix.
      */
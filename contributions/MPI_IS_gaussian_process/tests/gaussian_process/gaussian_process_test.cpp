@@ -220,6 +220,93 @@ TEST_F(GPTest, infer_prediction_clear_test)
     EXPECT_NEAR(prediction(1), 0, 1e-6);
 }
 
+// Adding and removing points with the incremental Cholesky updates has to
+// give the same posterior as a full inference on the same data
+TEST_F(GPTest, incremental_inference_test)
+{
+    int N = 40;
+    Eigen::VectorXd locations = Eigen::VectorXd::LinSpaced(N, 0, 10);
+    Eigen::VectorXd outputs = (locations.array() * 1.3).sin() + 0.1 * locations.array();
+    Eigen::VectorXd variances = 0.01 + 0.1 * (locations.array() * 0.7).cos().abs();
+
+    GP gp_batch(covariance_function_);
+    GP gp_incremental(covariance_function_);
+    gp_batch.enableExplicitTrend();
+    gp_incremental.enableExplicitTrend();
+    gp_incremental.enableIncrementalInference();
+
+    for (int i = 0; i < 30; ++i)
+    {
+        gp_incremental.appendData(locations(i), outputs(i), variances(i));
+    }
+    // remove from the front, the middle and the back
+    gp_incremental.removeData(0);
+    gp_incremental.removeData(10);
+    gp_incremental.removeData(27);
+    for (int i = 30; i < N; ++i)
+    {
+        gp_incremental.appendData(locations(i), outputs(i), variances(i));
+    }
+
+    // the same data in the same order
+    std::vector<int> index;
+    for (int i = 1; i < N; ++i)
+    {
+        if (i != 11 && i != 29)
+        {
+            index.push_back(i);
+        }
+    }
+    Eigen::VectorXd data_loc(index.size()), data_out(index.size()), data_var(index.size());
+    for (size_t i = 0; i < index.size(); ++i)
+    {
+        data_loc(i) = locations(index[i]);
+        data_out(i) = outputs(index[i]);
+        data_var(i) = variances(index[i]);
+    }
+    gp_batch.infer(data_loc, data_out, data_var);
+
+    Eigen::VectorXd prediction_location = Eigen::VectorXd::LinSpaced(25, -1, 12);
+    Eigen::VectorXd batch_variances, incremental_variances;
+    Eigen::VectorXd batch_prediction = gp_batch.predict(prediction_location, &batch_variances);
+    Eigen::VectorXd incremental_prediction = gp_incremental.predict(prediction_location, &incremental_variances);
+
+    for (int i = 0; i < prediction_location.rows(); ++i)
+    {
+        EXPECT_NEAR(incremental_prediction(i), batch_prediction(i), 1e-6);
+        EXPECT_NEAR(incremental_variances(i), batch_variances(i), 1e-6);
+    }
+}
+
+// The incremental subset of data update has to select the same points as inferSD
+TEST_F(GPTest, incremental_subset_of_data_test)
+{
+    int N = 200;
+    Eigen::VectorXd locations = Eigen::VectorXd::LinSpaced(N, 0, 100);
+    Eigen::VectorXd outputs = (locations.array() * 0.4).sin();
+    Eigen::VectorXd variances = 0.05 * Eigen::VectorXd::Ones(N);
+
+    GP gp_batch(covariance_function_);
+    GP gp_incremental(covariance_function_);
+    gp_incremental.enableIncrementalInference();
+
+    Eigen::VectorXd prediction_location(1);
+    for (int m = 20; m <= N; m += 3)
+    {
+        double prediction_point = locations(m - 1) + 0.2;
+        gp_batch.inferSD(locations.head(m), outputs.head(m), 30, variances.head(m), prediction_point);
+        gp_incremental.updateSD(locations.head(m), outputs.head(m), 30, variances.head(m), prediction_point);
+
+        prediction_location << prediction_point;
+        Eigen::VectorXd batch_variance, incremental_variance;
+        double batch_prediction = gp_batch.predict(prediction_location, &batch_variance)(0);
+        double incremental_prediction = gp_incremental.predict(prediction_location, &incremental_variance)(0);
+
+        EXPECT_NEAR(incremental_prediction, batch_prediction, 1e-6);
+        EXPECT_NEAR(incremental_variance(0), batch_variance(0), 1e-6);
+    }
+}
+
 TEST_F(GPTest, squareDistanceTest)
 {
     Eigen::MatrixXd a(4, 3);
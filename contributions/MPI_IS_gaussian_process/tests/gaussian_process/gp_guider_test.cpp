@@ -64,11 +64,11 @@ public:
 
     static const bool   DefaultComputePeriod;
 
+    GaussianProcessGuider::guide_parameters parameters;
     GaussianProcessGuider* GPG;
 
     GPGTest(): GPG(0)
     {
-        GaussianProcessGuider::guide_parameters parameters;
         parameters.control_gain_ = DefaultControlGain;
         parameters.min_periods_for_inference_ = DefaultPeriodLengthsForInference;
         parameters.min_move_ = DefaultMinMove;
@@ -162,6 +162,40 @@ TEST_F(GPGTest, period_identification_test)
     GPG->save_gp_data();
 }
 
+// The period estimate is reused while the regularized data doesn't change.
+// Updating on every step has to give the same estimate as a single update.
+TEST_F(GPGTest, period_estimation_cache_test)
+{
+    GaussianProcessGuider GPG_single(parameters);
+    GPG_single.SetLearningRate(1.0);
+
+    double period_length = 300;
+    double max_time = 5*period_length;
+    int resolution = 750; // two seconds per step, several steps per grid cell
+    Eigen::VectorXd timestamps = Eigen::VectorXd::LinSpaced(resolution + 1, 0, max_time);
+    Eigen::VectorXd measurements = 50*(timestamps.array()*2*M_PI/period_length).sin();
+    Eigen::VectorXd SNRs = 100*Eigen::VectorXd::Ones(resolution + 1);
+
+    for (int i = 0; i < timestamps.size(); ++i)
+    {
+        GPG->inject_data_point(timestamps[i], measurements[i], SNRs[i], 0.0);
+        GPG_single.inject_data_point(timestamps[i], measurements[i], SNRs[i], 0.0);
+        if (i > 10)
+        {
+            // like result(), the pending point carries the current time
+            GPG->get_last_point().timestamp = timestamps[i];
+            GPG->UpdateGP(timestamps[i] + 1.0);
+        }
+    }
+    GPG->get_last_point().timestamp = max_time;
+    GPG_single.get_last_point().timestamp = max_time;
+    GPG->UpdateGP(max_time + 1.0);
+    GPG_single.UpdateGP(max_time + 1.0);
+
+    EXPECT_NEAR(GPG->GetGPHyperparameters()[PKPeriodLength], period_length, 1e0);
+    EXPECT_DOUBLE_EQ(GPG->GetGPHyperparameters()[PKPeriodLength], GPG_single.GetGPHyperparameters()[PKPeriodLength]);
+}
+
 TEST_F(GPGTest, min_move_test)
 {
     // disable hysteresis blending
@@ -582,6 +616,109 @@ TEST_F(GPGTest, real_data_test_nan_issue)
     GPG->save_gp_data();
 }
 
+// The incremental GP update has to give the same control signals as the full inference
+TEST_F(GPGTest, incremental_inference_test)
+{
+    GaussianProcessGuider::guide_parameters incremental_parameters = parameters;
+    incremental_parameters.incremental_inference_ = true;
+    GaussianProcessGuider GPGI(incremental_parameters);
+    GPGI.SetLearningRate(1.0);
+
+    // without period estimation, both variants work on identical data
+    GPG->SetBoolComputePeriod(false);
+    GPGI.SetBoolComputePeriod(false);
+
+    double time = 0.0;
+    double measurement = 0.0;
+    double SNR = 0.0;
+    double control = 0.0;
+
+    std::ifstream file("dataset01.csv");
+
+    int i = 0;
+    CSVRow row;
+    while(file >> row)
+    {
+        // ignore special lines: "INFO", "Frame", "DROP"
+        if (row[0][0] == 'I' || row[0][0] == 'F' || row[2][1] == 'D')
+        {
+            continue;
+        }
+        else
+        {
+            ++i;
+        }
+        time = std::stod(row[1]);
+        measurement = std::stod(row[5]);
+        control = std::stod(row[7]);
+        SNR = std::stod(row[16]);
+
+        GPG->inject_data_point(time, measurement, SNR, control);
+        GPGI.inject_data_point(time, measurement, SNR, control);
+
+        // update the GPs on every step, like during guiding
+        if (i > 10)
+        {
+            GPG->UpdateGP(time + 1.5);
+            GPGI.UpdateGP(time + 1.5);
+        }
+    }
+
+    EXPECT_GT(i, 0) << "dataset01.csv was empty or not present";
+
+    EXPECT_NEAR(GPGI.result(0.5, 25.0, 3.0, time), GPG->result(0.5, 25.0, 3.0, time), 1e-3);
+}
+
+TEST_F(GPGTest, incremental_prediction_test)
+{
+    GaussianProcessGuider::guide_parameters incremental_parameters = parameters;
+    incremental_parameters.incremental_inference_ = true;
+    GaussianProcessGuider GPGI(incremental_parameters);
+
+    // with period estimation, like during guiding, the predictions have to
+    // agree on every step, not only at the end
+    GPG->SetBoolComputePeriod(true);
+    GPGI.SetBoolComputePeriod(true);
+
+    std::ifstream file("dataset01.csv");
+
+    int i = 0;
+    int predictions = 0;
+    CSVRow row;
+    while(file >> row)
+    {
+        // ignore special lines: "INFO", "Frame", "DROP"
+        if (row[0][0] == 'I' || row[0][0] == 'F' || row[2][1] == 'D')
+        {
+            continue;
+        }
+        else
+        {
+            ++i;
+        }
+        double time = std::stod(row[1]);
+        double measurement = std::stod(row[5]);
+        double control = std::stod(row[7]);
+        double SNR = std::stod(row[16]);
+
+        GPG->inject_data_point(time, measurement, SNR, control);
+        GPGI.inject_data_point(time, measurement, SNR, control);
+
+        if (i > 10)
+        {
+            GPG->UpdateGP(time + 1.5);
+            GPGI.UpdateGP(time + 1.5);
+
+            // both predictions start at the injected time stamp
+            EXPECT_NEAR(GPGI.PredictGearError(time + 3.0), GPG->PredictGearError(time + 3.0), 1e-3) << "step " << i;
+            ++predictions;
+        }
+    }
+
+    EXPECT_GT(predictions, 0) << "dataset01.csv was empty or not present";
+    EXPECT_NEAR(GPGI.GetGPHyperparameters()[PKPeriodLength], GPG->GetGPHyperparameters()[PKPeriodLength], 1e-3);
+}
+
 int main(int argc, char** argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
@@ -173,6 +173,12 @@ namespace math_tools
     }
 
     std::pair<Eigen::VectorXd, Eigen::VectorXd> compute_spectrum(Eigen::VectorXd& data, int N)
+    {
+        Eigen::FFT<double> fft;
+        return compute_spectrum(data, N, fft);
+    }
+
+    std::pair<Eigen::VectorXd, Eigen::VectorXd> compute_spectrum(Eigen::VectorXd& data, int N, Eigen::FFT<double>& fft)
     {
 
         int N_data = data.rows();
@@ -186,8 +192,6 @@ namespace math_tools
         Eigen::VectorXd padded_data = Eigen::VectorXd::Zero(N);
         padded_data.head(N_data) = data;
 
-        Eigen::FFT<double> fft;
-
         // initialize the double vector from Eigen vector. This works by initializing
         // with two pointers: 1) the first element of the data, 2) the last element of the data
         std::vector<double> vec_data(padded_data.data(), padded_data.data() + padded_data.rows() * padded_data.cols());
@@ -146,6 +146,14 @@ namespace math_tools
      */
     std::pair< Eigen::VectorXd, Eigen::VectorXd > compute_spectrum(Eigen::VectorXd& data, int N = 0);
 
+    /*!
+     * Calculates the spectrum of a data vector, like compute_spectrum() above,
+     * with a given FFT object. The FFT object caches its plans, so reusing it
+     * for repeated transforms of the same size saves the setup of the
+     * twiddle factors.
+     */
+    std::pair< Eigen::VectorXd, Eigen::VectorXd > compute_spectrum(Eigen::VectorXd& data, int N, Eigen::FFT<double>& fft);
+
     /*!
      * Computes a Hamming window (used to reduce spectral leakage of subsequent DFT).
      */
@@ -0,0 +1,521 @@
+/*
+ *  dark_stacker.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "phd.h"
+#include "dark_stacker.h"
+
+#include <algorithm>
+#include <math.h>
+#include <sstream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define DARK_STACKER_SSE2 1
+# include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define DARK_STACKER_NEON 1
+# include <arm_neon.h>
+#endif
+
+enum { MAX_QUEUED_FRAMES = 2 };                         // captured frames waiting to be added
+static const size_t KeepInMemoryBytes = 512 * 1024 * 1024; // robust modes spill to disk above this
+static const size_t BandBytes = 64 * 1024 * 1024;       // read buffer for combining spilled frames
+static const size_t KeptBandBytes = 8 * 1024 * 1024;    // frames in memory combined between checks for cancellation
+
+struct Histogram
+{
+    unsigned long val[256];
+    unsigned int median;
+    double mean;
+
+    Histogram(const usImage& img)
+    {
+        memset(&val[0], 0, sizeof(val));
+        mean = 0.0;
+        for (unsigned int i = 0; i < img.NPixels; i++)
+        {
+            unsigned short v = img.ImageData[i];
+            mean += v;
+            v >>= (img.BitsPerPixel - 8);
+            if (v > 255)
+                v = 255;  // should never happen if BitsPerPixel is valid
+            ++val[v];
+        }
+        mean /= img.NPixels;
+        // median (approx)
+        unsigned long sum = 0;
+        int i;
+        for (i = 0; i < 256; i++)
+        {
+            sum += val[i];
+            if (sum > img.NPixels / 2)
+                break;
+        }
+        median = i << (img.BitsPerPixel - 8);
+    }
+
+    void Dump()
+    {
+        Debug.Write(wxString::Format("mean = %.f  median(approx) = %u\n", mean, median));
+        int i = 0;
+        for (int l = 0; l < 4; l++)
+        {
+            std::ostringstream os;
+            os << "histo[" << (l * 64) << ".." << ((l + 1) * 64 - 1) << "]";
+            for (int j = 0; j < 64; j++, i++)
+                os << ' ' << val[i];
+            os << "\n";
+            Debug.Write(os.str());
+        }
+    }
+};
+
+// acc[i] += src[i]
+static void AccumulateRow(unsigned int *acc, const unsigned short *src, int n)
+{
+    int i = 0;
+
+#if defined(DARK_STACKER_SSE2)
+    __m128i const zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(acc + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(acc + i + 4));
+        _mm_storeu_si128((__m128i *)(acc + i), _mm_add_epi32(a0, _mm_unpacklo_epi16(v, zero)));
+        _mm_storeu_si128((__m128i *)(acc + i + 4), _mm_add_epi32(a1, _mm_unpackhi_epi16(v, zero)));
+    }
+#elif defined(DARK_STACKER_NEON)
+    for (; i + 8 <= n; i += 8)
+    {
+        uint16x8_t v = vld1q_u16(src + i);
+        vst1q_u32(acc + i, vaddw_u16(vld1q_u32(acc + i), vget_low_u16(v)));
+        vst1q_u32(acc + i + 4, vaddw_u16(vld1q_u32(acc + i + 4), vget_high_u16(v)));
+    }
+#endif
+
+    for (; i < n; i++)
+        acc[i] += src[i];
+}
+
+// combine the n values of one pixel
+static unsigned short CombinePixel(DarkStacker::Mode mode, unsigned short *v, int n)
+{
+    int const mid = n / 2;
+    std::nth_element(v, v + mid, v + n);
+    double med = v[mid];
+    if (n % 2 == 0)
+        med = (med + *std::max_element(v, v + mid)) / 2.0;
+
+    if (mode == DarkStacker::STACK_MEDIAN)
+        return (unsigned short) (med + 0.5);
+
+    // sigma from the median absolute deviation, which outliers (hot pixels in
+    // a single frame, cosmic ray hits) do not inflate
+    unsigned short dev[256];
+    for (int i = 0; i < n; i++)
+        dev[i] = (unsigned short) std::min(fabs(v[i] - med) + 0.5, 65535.0);
+    std::nth_element(dev, dev + mid, dev + n);
+    double sigma = std::max(1.4826 * dev[mid], 1.0);
+    double const lim = 3.0 * sigma;
+
+    unsigned int sum = 0;
+    int cnt = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (fabs(v[i] - med) <= lim)
+        {
+            sum += v[i];
+            ++cnt;
+        }
+    }
+
+    return cnt ? (unsigned short) (sum / cnt) : (unsigned short) (med + 0.5);
+}
+
+class DarkStacker::Worker : public wxThread
+{
+    DarkStacker *m_stacker;
+
+public:
+    Worker(DarkStacker *stacker) : wxThread(wxTHREAD_JOINABLE), m_stacker(stacker) { }
+
+protected:
+    ExitCode Entry() override
+    {
+        DarkStacker *s = m_stacker;
+
+        for (;;)
+        {
+            usImage *frame = nullptr;
+            usImage *finish = nullptr;
+            {
+                wxMutexLocker lock(s->m_lock);
+                while (s->m_queue.empty() && !s->m_finishImage && !s->m_stop)
+                    s->m_cond.Wait();
+                if (s->m_stop)
+                    break;
+                if (!s->m_queue.empty())
+                    frame = s->m_queue.front();
+                else
+                    finish = s->m_finishImage;
+            }
+
+            if (frame)
+            {
+                s->ProcessFrame(frame);
+
+                wxMutexLocker lock(s->m_lock);
+                s->m_queue.pop_front();
+                s->m_cond.Broadcast();
+            }
+            else
+            {
+                s->Combine(finish);
+
+                wxMutexLocker lock(s->m_lock);
+                s->m_finishImage = nullptr;
+                s->m_done = true;
+                break;
+            }
+        }
+
+        return (ExitCode) 0;
+    }
+};
+
+DarkStacker::DarkStacker(Mode mode, int frameCount)
+    :
+    m_mode(mode),
+    m_frameCount(frameCount),
+    m_worker(nullptr),
+    m_cond(m_lock),
+    m_finishImage(nullptr),
+    m_done(false),
+    m_failed(false),
+    m_stop(false),
+    m_frames(0),
+    m_bitsPerPixel(0),
+    m_pedestal(0)
+{
+    // the sigma clip works on a fixed-size buffer per pixel
+    if (m_frameCount > 256)
+        m_mode = STACK_MEAN;
+}
+
+DarkStacker::~DarkStacker()
+{
+    if (m_worker)
+    {
+        {
+            wxMutexLocker lock(m_lock);
+            m_stop = true;
+            m_cond.Broadcast();
+        }
+        m_worker->Wait();
+        delete m_worker;
+    }
+
+    for (std::deque<usImage *>::iterator it = m_queue.begin(); it != m_queue.end(); ++it)
+        delete *it;
+    for (std::vector<usImage *>::iterator it = m_kept.begin(); it != m_kept.end(); ++it)
+        delete *it;
+
+    if (m_spill.IsOpened())
+        m_spill.Close();
+    if (!m_spillPath.IsEmpty())
+        wxRemoveFile(m_spillPath);
+}
+
+wxString DarkStacker::ModeName(Mode mode)
+{
+    switch (mode)
+    {
+    case STACK_SIGMA_CLIP: return _("Sigma-clipped average");
+    case STACK_MEDIAN: return _("Median");
+    default: return _("Average");
+    }
+}
+
+bool DarkStacker::Start()
+{
+    m_worker = new Worker(this);
+    if (m_worker->Create() != wxTHREAD_NO_ERROR || m_worker->Run() != wxTHREAD_NO_ERROR)
+    {
+        Debug.Write("DarkStacker: could not start worker thread\n");
+        delete m_worker;
+        m_worker = nullptr;
+        return true;
+    }
+    return false;
+}
+
+bool DarkStacker::CanAddFrame()
+{
+    wxMutexLocker lock(m_lock);
+    return m_queue.size() < MAX_QUEUED_FRAMES;
+}
+
+void DarkStacker::AddFrame(usImage *frame)
+{
+    wxMutexLocker lock(m_lock);
+    m_queue.push_back(frame);
+    m_cond.Broadcast();
+}
+
+void DarkStacker::Finish(usImage *dark)
+{
+    wxMutexLocker lock(m_lock);
+    m_finishImage = dark;
+    m_cond.Broadcast();
+}
+
+bool DarkStacker::IsDone()
+{
+    wxMutexLocker lock(m_lock);
+    return m_done;
+}
+
+bool DarkStacker::Failed()
+{
+    wxMutexLocker lock(m_lock);
+    return m_failed;
+}
+
+bool DarkStacker::Stopping()
+{
+    wxMutexLocker lock(m_lock);
+    return m_stop;
+}
+
+void DarkStacker::ProcessFrame(usImage *frame)
+{
+    if (Failed())
+    {
+        delete frame;
+        return;
+    }
+
+    frame->CalcStats();
+    Debug.Write(wxString::Format("dark frame stats: bpp %u min %u max %u filtmin %u filtmax %u\n",
+        frame->BitsPerPixel, frame->Min, frame->Max, frame->FiltMin, frame->FiltMax));
+    Histogram h(*frame);
+    h.Dump();
+
+    bool err = false;
+
+    if (m_frames == 0)
+        m_size = frame->Size;
+    else if (frame->Size != m_size)
+    {
+        Debug.Write(wxString::Format("DarkStacker: frame size %dx%d does not match %dx%d\n",
+            frame->Size.x, frame->Size.y, m_size.x, m_size.y));
+        err = true;
+    }
+
+    m_bitsPerPixel = frame->BitsPerPixel;
+    m_pedestal = frame->Pedestal;
+    m_startTime = frame->ImgStartTime;
+    m_subframe = frame->Subframe;
+
+    int const width = m_size.x;
+
+    if (err)
+    {
+        // the frame is discarded
+    }
+    else if (m_mode == STACK_MEAN)
+    {
+        if (m_sum.empty())
+            m_sum.assign(frame->NPixels, 0);
+
+        unsigned int *sum = &m_sum[0];
+        const unsigned short *src = frame->ImageData;
+        ThreadPool::Get()->ParallelRange(m_size.y, std::max(1, 65536 / std::max(width, 1)), [&](int y0, int y1) {
+            for (int y = y0; y < y1; y++)
+                AccumulateRow(sum + (size_t) y * width, src + (size_t) y * width, width);
+        });
+    }
+    else if ((size_t) frame->NPixels * sizeof(unsigned short) * m_frameCount <= KeepInMemoryBytes)
+    {
+        m_kept.push_back(frame);
+        frame = nullptr;
+    }
+    else
+    {
+        if (m_frames == 0)
+        {
+            m_spillPath = wxFileName::CreateTempFileName("phd2dark");
+            if (m_spillPath.IsEmpty() || !m_spill.Open(m_spillPath, wxFile::read_write))
+                Debug.Write("DarkStacker: could not create temporary file\n");
+            else
+                Debug.Write(wxString::Format("DarkStacker: spilling frames to %s\n", m_spillPath));
+        }
+
+        size_t const bytes = (size_t) frame->NPixels * sizeof(unsigned short);
+        err = !m_spill.IsOpened() || m_spill.Write(frame->ImageData, bytes) != bytes;
+    }
+
+    delete frame;
+
+    if (err)
+    {
+        wxMutexLocker lock(m_lock);
+        m_failed = true;
+    }
+    else
+        ++m_frames;
+}
+
+// point src[i] at rows [y0, y0 + rows) of frame i
+bool DarkStacker::ReadBand(int y0, int rows, std::vector<const unsigned short *> *src)
+{
+    size_t const width = m_size.x;
+
+    if (!m_kept.empty())
+    {
+        for (int i = 0; i < m_frames; i++)
+            (*src)[i] = m_kept[i]->ImageData + y0 * width;
+        return false;
+    }
+
+    size_t const bandPixels = rows * width;
+    m_band.resize(bandPixels * m_frames);
+
+    for (int i = 0; i < m_frames; i++)
+    {
+        wxFileOffset ofs = ((wxFileOffset) i * m_size.y + y0) * width * sizeof(unsigned short);
+        unsigned short *dst = &m_band[i * bandPixels];
+        if (m_spill.Seek(ofs) != ofs ||
+            m_spill.Read(dst, bandPixels * sizeof(unsigned short)) != (ssize_t) (bandPixels * sizeof(unsigned short)))
+        {
+            Debug.Write(wxString::Format("DarkStacker: error reading %s\n", m_spillPath));
+            return true;
+        }
+        (*src)[i] = dst;
+    }
+
+    return false;
+}
+
+void DarkStacker::CombineBand(unsigned short *dst, int rows, const std::vector<const unsigned short *>& src) const
+{
+    int const width = m_size.x;
+    int const n = m_frames;
+    Mode const mode = m_mode;
+
+    ThreadPool::Get()->ParallelRange(rows, std::max(1, 4096 / std::max(width, 1)), [&](int y0, int y1) {
+        unsigned short v[256];
+        for (int y = y0; y < y1; y++)
+        {
+            size_t const row = (size_t) y * width;
+            for (int x = 0; x < width; x++)
+            {
+                for (int i = 0; i < n; i++)
+                    v[i] = src[i][row + x];
+                dst[row + x] = CombinePixel(mode, v, n);
+            }
+        }
+    });
+}
+
+void DarkStacker::Combine(usImage *dark)
+{
+    if (Failed() || m_frames == 0)
+    {
+        wxMutexLocker lock(m_lock);
+        m_failed = true;
+        return;
+    }
+
+    wxStopWatch swatch;
+
+    if (dark->Init(m_size))
+    {
+        wxMutexLocker lock(m_lock);
+        m_failed = true;
+        return;
+    }
+
+    dark->BitsPerPixel = m_bitsPerPixel;
+    dark->Pedestal = m_pedestal;
+    dark->ImgStartTime = m_startTime;
+    dark->Subframe = m_subframe;
+
+    int const width = m_size.x;
+
+    if (m_mode == STACK_MEAN)
+    {
+        const unsigned int *sum = &m_sum[0];
+        unsigned short *dst = dark->ImageData;
+        unsigned int const n = m_frames;
+        for (unsigned int i = 0; i < dark->NPixels; i++)
+            dst[i] = (unsigned short) (sum[i] / n);
+        std::vector<unsigned int>().swap(m_sum);
+    }
+    else
+    {
+        // the combine can take a while, so it is done in bands and abandoned
+        // between bands if the stacker is being destroyed
+        size_t bandBytes = KeptBandBytes;
+        if (m_kept.empty())
+        {
+            m_spill.Flush();
+            bandBytes = BandBytes;
+        }
+        int const bandRows = (int) std::max((size_t) 1, bandBytes / ((size_t) width * sizeof(unsigned short) * m_frames));
+
+        std::vector<const unsigned short *> src(m_frames);
+        for (int y0 = 0; y0 < m_size.y; y0 += bandRows)
+        {
+            int const rows = std::min(bandRows, m_size.y - y0);
+            if (Stopping())
+            {
+                Debug.Write("DarkStacker: combine cancelled\n");
+                wxMutexLocker lock(m_lock);
+                m_failed = true;
+                return;
+            }
+            if (ReadBand(y0, rows, &src))
+            {
+                wxMutexLocker lock(m_lock);
+                m_failed = true;
+                return;
+            }
+            CombineBand(dark->ImageData + (size_t) y0 * width, rows, src);
+        }
+        std::vector<unsigned short>().swap(m_band);
+    }
+
+    Debug.Write(wxString::Format("DarkStacker: combined %d frames (%s) in %ld ms\n", m_frames, ModeName(m_mode), swatch.Time()));
+}
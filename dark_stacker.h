@@ -0,0 +1,114 @@
+/*
+ *  dark_stacker.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef DARK_STACKER_H_INCLUDED
+#define DARK_STACKER_H_INCLUDED
+
+#include <deque>
+#include <vector>
+
+//
+// Combines dark frames into a master dark on a background thread, so that
+// the next frame can be captured while the previous one is being added.
+//
+// MEAN accumulates the frames as they arrive. The robust modes need every
+// frame for each pixel: the frames are kept in memory when they fit in a
+// fixed budget and are otherwise spilled to a temporary file, and the
+// combine step reads them back a band of rows at a time.
+//
+class DarkStacker
+{
+public:
+    enum Mode
+    {
+        STACK_MEAN,
+        STACK_SIGMA_CLIP,   // mean of the values within 3 sigma of the median
+        STACK_MEDIAN,
+    };
+
+    DarkStacker(Mode mode, int frameCount);
+    ~DarkStacker();
+
+    static wxString ModeName(Mode mode);
+
+    bool Start();
+
+    // false while the maximum number of frames is waiting to be processed
+    bool CanAddFrame();
+    // queue a captured frame, taking ownership of it
+    void AddFrame(usImage *frame);
+    // combine the frames into dark once they have all been processed
+    void Finish(usImage *dark);
+    // true when Finish() has completed or the stacker has failed
+    bool IsDone();
+    // true if a frame could not be processed or combined
+    bool Failed();
+
+private:
+    class Worker;
+
+    bool Stopping();
+    void ProcessFrame(usImage *frame);
+    void Combine(usImage *dark);
+    bool ReadBand(int y0, int rows, std::vector<const unsigned short *> *src);
+    void CombineBand(unsigned short *dst, int rows, const std::vector<const unsigned short *>& src) const;
+
+    Mode m_mode;
+    int m_frameCount;
+
+    Worker *m_worker;
+    wxMutex m_lock;                     // protects the fields below
+    wxCondition m_cond;
+    std::deque<usImage *> m_queue;
+    usImage *m_finishImage;
+    bool m_done;
+    bool m_failed;
+    bool m_stop;
+
+    // used by the worker thread only
+    wxSize m_size;
+    int m_frames;
+    std::vector<unsigned int> m_sum;    // STACK_MEAN
+    std::vector<usImage *> m_kept;      // robust modes, frames held in memory
+    wxString m_spillPath;               // robust modes, frames spilled to disk
+    wxFile m_spill;
+    std::vector<unsigned short> m_band;
+    // metadata of the most recent frame, copied to the master dark
+    wxByte m_bitsPerPixel;
+    unsigned short m_pedestal;
+    wxDateTime m_startTime;
+    wxRect m_subframe;
+};
+
+#endif // DARK_STACKER_H_INCLUDED
@@ -35,10 +35,10 @@
 
 #include "phd.h"
 #include "darks_dialog.h"
+#include "dark_stacker.h"
 #include "wx/valnum.h"
 
 #include <algorithm>
-#include <sstream>
 
 static const int DefDarkCount = 5;
 static const int DefDMExpTime = 15;
@@ -180,8 +180,22 @@ DarksDialog::DarksDialog(wxWindow *parent, bool darkLib) :
         pvSizer->Add(pDMapGroup, wxSizerFlags().Border(wxALL, 10));
     }
 
-    // Controls for notes and status
+    // Frame stacking method
     wxBoxSizer *phSizer = new wxBoxSizer(wxHORIZONTAL);
+    wxStaticText *pStackLabel = new wxStaticText(this, wxID_ANY, _("Combine frames using: "), wxPoint(-1, -1), wxSize(-1, -1));
+    m_pStackMode = new wxChoice(this, wxID_ANY);
+    m_pStackMode->Append(DarkStacker::ModeName(DarkStacker::STACK_MEAN));
+    m_pStackMode->Append(DarkStacker::ModeName(DarkStacker::STACK_SIGMA_CLIP));
+    m_pStackMode->Append(DarkStacker::ModeName(DarkStacker::STACK_MEDIAN));
+    m_pStackMode->SetSelection(wxMin(wxMax(pConfig->Profile.GetInt("/camera/darks_stack_mode", DarkStacker::STACK_MEAN), 0), 2));
+    m_pStackMode->SetToolTip(_("How the dark frames are combined. Sigma-clipped average and median reject hot pixels and cosmic ray hits "
+        "that appear in only some of the frames, at the cost of more processing after the last frame."));
+    phSizer->Add(pStackLabel, wxSizerFlags().Border(wxALL, 5).Align(wxALIGN_CENTER_VERTICAL));
+    phSizer->Add(m_pStackMode, wxSizerFlags().Border(wxALL, 5));
+    pvSizer->Add(phSizer, wxSizerFlags().Border(wxALL, 5));
+
+    // Controls for notes and status
+    phSizer = new wxBoxSizer(wxHORIZONTAL);
     wxStaticText *pNoteLabel = new wxStaticText(this, wxID_ANY,  _("Notes: "), wxPoint(-1, -1), wxSize(-1, -1));
     wxSize sz(38 * StringWidth(this, "M"), -1);
     m_pNotes = new wxTextCtrl(this, wxID_ANY, _T(""), wxDefaultPosition, sz);
@@ -402,6 +416,7 @@ void DarksDialog::OnReset(wxCommandEvent& evt)
         m_pNumDefExposures->SetValue(DefDMCount);
         m_pNotes->SetValue("");
     }
+    m_pStackMode->SetSelection(DarkStacker::STACK_MEAN);
 }
 
 void DarksDialog::ShowStatus(const wxString msg, bool appending)
@@ -431,65 +446,19 @@ void DarksDialog::SaveProfileInfo()
         pConfig->Profile.SetInt("/camera/dmap_num_frames", m_pNumDefExposures->GetValue());
     }
     pConfig->Profile.SetString("/camera/darks_note", m_pNotes->GetValue());
+    pConfig->Profile.SetInt("/camera/darks_stack_mode", m_pStackMode->GetSelection());
 }
 
-struct Histogram
-{
-    unsigned long val[256];
-    unsigned int median;
-    double mean;
-
-    Histogram(const usImage& img)
-    {
-        memset(&val[0], 0, sizeof(val));
-        mean = 0.0;
-        for (unsigned int i = 0; i < img.NPixels; i++)
-        {
-            unsigned short v = img.ImageData[i];
-            mean += v;
-            v >>= (img.BitsPerPixel - 8);
-            if (v > 255)
-                v = 255;  // should never happen if BitsPerPixel is valid
-            ++val[v];
-        }
-        mean /= img.NPixels;
-        // median (approx)
-        unsigned long sum = 0;
-        int i;
-        for (i = 0; i < 256; i++)
-        {
-            sum += val[i];
-            if (sum > img.NPixels / 2)
-                break;
-        }
-        median = i << (img.BitsPerPixel - 8);
-    }
-
-    void Dump()
-    {
-        Debug.Write(wxString::Format("mean = %.f  median(approx) = %u\n", mean, median));
-        int i = 0;
-        for (int l = 0; l < 4; l++)
-        {
-            std::ostringstream os;
-            os << "histo[" << (l * 64) << ".." << ((l + 1) * 64 - 1) << "]";
-            for (int j = 0; j < 64; j++, i++)
-                os << ' ' << val[i];
-            os << "\n";
-            Debug.Write(os.str());
-        }
-    }
-};
-
 bool DarksDialog::CreateMasterDarkFrame(usImage& darkFrame, int expTime, int frameCount)
 {
     bool err = false;
 
     pCamera->InitCapture();
-    darkFrame.ImgExpDur = expTime;
-    darkFrame.ImgStackCnt = frameCount;
 
-    unsigned int *avgimg = 0;
+    // the frames are added to the stack on a background thread while the next frame is captured
+    DarkStacker stacker((DarkStacker::Mode) m_pStackMode->GetSelection(), frameCount);
+    if (stacker.Start())
+        return true;
 
     for (int j = 1; j <= frameCount; j++)
     {
@@ -498,51 +467,51 @@ bool DarksDialog::CreateMasterDarkFrame(usImage& darkFrame, int expTime, int fra
             break;
         ShowStatus(wxString::Format(_("Taking dark frame %d/%d"), j, frameCount), true);
 
+        usImage *frame = new usImage();
         Debug.Write(wxString::Format("Capture dark frame %d/%d exp=%d\n", j, frameCount, expTime));
-        err = GuideCamera::Capture(pCamera, expTime, darkFrame, CAPTURE_DARK);
+        err = GuideCamera::Capture(pCamera, expTime, *frame, CAPTURE_DARK);
         if (err)
         {
+            delete frame;
             ShowStatus(wxString::Format(_("%.1f s dark FAILED"), (double)expTime / 1000.0), true);
             pCamera->ShutterClosed = false;
             break;
         }
 
         m_pProgress->SetValue(m_pProgress->GetValue() + expTime);
-        wxYield();
-
-        darkFrame.CalcStats();
-        Debug.Write(wxString::Format("dark frame stats: bpp %u min %u max %u filtmin %u filtmax %u\n",
-            darkFrame.BitsPerPixel, darkFrame.Min, darkFrame.Max, darkFrame.FiltMin, darkFrame.FiltMax));
-        Histogram h(darkFrame);
-        h.Dump();
-        wxYield();
 
-        if (!avgimg)
+        while (!stacker.CanAddFrame())
         {
-            avgimg = new unsigned int[darkFrame.NPixels];
-            memset(avgimg, 0, darkFrame.NPixels * sizeof(*avgimg));
+            wxYield();
+            wxMilliSleep(10);
         }
-
-        unsigned int *iptr = avgimg;
-        const unsigned short *usptr = darkFrame.ImageData;
-        for (unsigned int i = 0; i < darkFrame.NPixels; i++)
-            *iptr++ += *usptr++;
+        stacker.AddFrame(frame);
     }
 
     if (!m_cancelling && !err)
     {
         ShowStatus(_("Dark frames complete"), true);
-        const unsigned int *iptr = avgimg;
-        unsigned short *usptr = darkFrame.ImageData;
-        for (unsigned int i = 0; i < darkFrame.NPixels; i++)
-            *usptr++ = (unsigned short)(*iptr++ / frameCount);
+
+        stacker.Finish(&darkFrame);
+        while (!stacker.IsDone() && !m_cancelling)
+        {
+            wxYield();
+            wxMilliSleep(20);
+        }
+
+        if (!m_cancelling && stacker.Failed())
+        {
+            ShowStatus(_("Dark frames could not be combined"), true);
+            err = true;
+        }
     }
 
+    darkFrame.ImgExpDur = expTime;
+    darkFrame.ImgStackCnt = frameCount;
+
     m_pProgress->SetValue(m_pProgress->GetValue() + expTime);
     wxYield();
 
-    delete[] avgimg;
-
     return err;
 }
 
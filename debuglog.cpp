@@ -37,20 +37,64 @@
 
 #include <wx/dir.h>
 
-#define ALWAYS_FLUSH_DEBUGLOG
+#include <algorithm>
+
 const int RetentionPeriod = 30;
 
+// the writer thread flushes queued lines at least this often
+const int WriterFlushIntervalMs = 100;
+
+class DebugLog::Writer : public wxThread
+{
+    DebugLog *m_log;
+    std::atomic<bool> m_stop;
+
+public:
+    Writer(DebugLog *log) : wxThread(wxTHREAD_JOINABLE), m_log(log), m_stop(false) { }
+
+    void Stop()
+    {
+        m_stop = true;
+        m_log->m_wakeup.Post();
+        Wait();
+    }
+
+protected:
+    ExitCode Entry() override
+    {
+        while (!m_stop)
+        {
+            m_log->m_wakeup.WaitTimeout(WriterFlushIntervalMs);
+
+            wxCriticalSectionLocker lock(m_log->m_criticalSection);
+            m_log->WriteQueued(nullptr);
+        }
+        return (ExitCode) 0;
+    }
+};
+
 DebugLog::DebugLog()
     :
     m_enabled(false),
-    m_lastWriteTime(wxDateTime::UNow())
+    m_lastWriteTime(wxDateTime::UNow().GetValue().GetValue()),
+    m_ring(new Slot[RING_SIZE]),
+    m_enqueuePos(0),
+    m_dequeuePos(0),
+    m_async(false),
+    m_writer(nullptr)
 {
+    for (size_t i = 0; i < RING_SIZE; i++)
+        m_ring[i].seq.store(i, std::memory_order_relaxed);
 }
 
 DebugLog::~DebugLog()
 {
-    wxFFile::Flush();
+    // the writer thread must have been stopped by StopWriter(); it cannot
+    // be joined safely during static destruction
+    m_async = false;
+    WriteQueued(nullptr);
     wxFFile::Close();
+    delete[] m_ring;
 }
 
 static bool ParseLogTimestamp(wxDateTime *p, const wxString& s)
@@ -110,7 +154,7 @@ void DebugLog::InitDebugLog(bool enable, bool forceOpen)
 
     if (m_enabled)
     {
-        wxFFile::Flush();
+        WriteQueued(nullptr);
         wxFFile::Close();
 
         m_enabled = false;
@@ -178,33 +222,146 @@ bool DebugLog::Flush()
     {
         wxCriticalSectionLocker lock(m_criticalSection);
 
+        WriteQueued(nullptr);
         ret = wxFFile::Flush();
     }
 
     return ret;
 }
 
+void DebugLog::StartWriter()
+{
+    if (m_writer)
+        return;
+
+    Writer *writer = new Writer(this);
+    if (writer->Create() != wxTHREAD_NO_ERROR || writer->Run() != wxTHREAD_NO_ERROR)
+    {
+        delete writer;
+        Write("Could not start the debug log writer thread, logging synchronously\n");
+        return;
+    }
+
+    m_writer = writer;
+    m_async = true;
+}
+
+void DebugLog::StopWriter()
+{
+    if (!m_writer)
+        return;
+
+    m_async = false;
+    m_writer->Stop();
+    delete m_writer;
+    m_writer = nullptr;
+
+    Flush();
+}
+
+// Called from the fatal exception (crash) handler: write out whatever is
+// still queued. The lock is not waited for since the crashing thread may
+// already hold it.
+void DebugLog::EmergencyFlush()
+{
+    m_async = false;
+
+    if (m_criticalSection.TryEnter())
+    {
+        WriteQueued(nullptr);
+        m_criticalSection.Leave();
+    }
+}
+
+// multi-producer enqueue (bounded MPMC queue by Dmitry Vyukov); returns
+// false if the ring is full
+bool DebugLog::Enqueue(std::string& line)
+{
+    Slot *slot;
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        slot = &m_ring[pos & (RING_SIZE - 1)];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        ptrdiff_t dif = (ptrdiff_t) seq - (ptrdiff_t) pos;
+
+        if (dif == 0)
+        {
+            if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (dif < 0)
+            return false;
+        else
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+    }
+
+    slot->data.swap(line);
+    slot->seq.store(pos + 1, std::memory_order_release);
+
+    // wake the writer early when half a ring's worth of lines has been queued
+    if ((pos & (RING_SIZE / 2 - 1)) == 0 && pos != 0)
+        m_wakeup.Post();
+
+    return true;
+}
+
+// drain the ring, append line (if any), and write everything with a single flush
+void DebugLog::WriteQueued(const std::string *line)
+{
+    m_batch.clear();
+
+    for (;;)
+    {
+        Slot& slot = m_ring[m_dequeuePos & (RING_SIZE - 1)];
+        if (slot.seq.load(std::memory_order_acquire) != m_dequeuePos + 1)
+            break;
+        m_batch += slot.data;
+        slot.data.clear();
+        slot.seq.store(m_dequeuePos + RING_SIZE, std::memory_order_release);
+        ++m_dequeuePos;
+    }
+
+    if (line)
+        m_batch += *line;
+
+    if (!m_batch.empty() && wxFFile::IsOpened())
+    {
+        wxFFile::Write(m_batch.data(), m_batch.size());
+        wxFFile::Flush();
+    }
+
+    // do not hold on to the memory of an unusually large batch
+    if (m_batch.capacity() > 1024 * 1024)
+        std::string().swap(m_batch);
+}
+
 wxString DebugLog::Write(const wxString& str)
 {
     if (m_enabled)
     {
-        wxCriticalSectionLocker lock(m_criticalSection);
-
         wxDateTime now = wxDateTime::UNow();
-        wxTimeSpan deltaTime = now - m_lastWriteTime;
-        m_lastWriteTime = now;
-        wxString outputLine = wxString::Format("%s %s %lu %s", now.Format("%H:%M:%S.%l"),
-                                                              deltaTime.Format("%S.%l"),
-                                                              (unsigned long) wxThread::GetCurrentId(),
-                                                              str);
-
-        wxFFile::Write(outputLine);
-#if defined(ALWAYS_FLUSH_DEBUGLOG)
-        wxFFile::Flush();
-#endif
+        long long nowMs = now.GetValue().GetValue();
+        long long deltaMs = std::max(nowMs - m_lastWriteTime.exchange(nowMs), 0LL);
+        wxString outputLine = wxString::Format("%s %02ld.%03ld %lu %s", now.Format("%H:%M:%S.%l"),
+                                                                        (long)(deltaMs / 1000), (long)(deltaMs % 1000),
+                                                                        (unsigned long) wxThread::GetCurrentId(),
+                                                                        str);
 #if defined(__WINDOWS__) && defined(_DEBUG)
         OutputDebugString(outputLine.c_str());
 #endif
+
+        wxScopedCharBuffer utf8 = outputLine.utf8_str();
+        std::string line(utf8.data(), utf8.length());
+
+        if (!m_async || !Enqueue(line))
+        {
+            // no writer thread, or the ring is full: write through, after
+            // anything still queued
+            wxCriticalSectionLocker lock(m_criticalSection);
+            WriteQueued(&line);
+        }
     }
 
     return str;
@@ -38,13 +38,44 @@
 
 #include "logger.h"
 
+#include <atomic>
+#include <string>
+
+//
+// Debug log lines are formatted by the calling thread and queued in a
+// bounded lock-free ring; a background writer thread drains the ring and
+// writes the lines to the file in batches with one flush per batch. Until
+// the writer is started (and after it is stopped) lines are written and
+// flushed synchronously as before.
+//
 class DebugLog : public wxFFile, public Logger
 {
+    class Writer;
+
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        std::string data;
+    };
+
+    enum { RING_SIZE = 4096 }; // must be a power of 2
+
     bool m_enabled;
-    wxCriticalSection m_criticalSection;
-    wxDateTime m_lastWriteTime;
+    wxCriticalSection m_criticalSection; // serializes file access and the ring consumer
+    std::atomic<long long> m_lastWriteTime;
     wxString m_path;
 
+    Slot *m_ring;
+    std::atomic<size_t> m_enqueuePos;
+    size_t m_dequeuePos;
+    std::string m_batch;
+    std::atomic<bool> m_async;
+    wxSemaphore m_wakeup;
+    Writer *m_writer;
+
+    bool Enqueue(std::string& line);
+    void WriteQueued(const std::string *line); // caller must hold m_criticalSection
+
 public:
     DebugLog();
     ~DebugLog();
@@ -59,6 +90,10 @@ public:
     wxString Write(const wxString& str);
     bool Flush();
 
+    void StartWriter();
+    void StopWriter();
+    void EmergencyFlush();
+
     bool ChangeDirLog(const wxString& newdir) override;
     void RemoveOldFiles();
 };
@@ -36,7 +36,12 @@
 
 #include <wx/sstream.h>
 #include <wx/sckstrm.h>
+#include <algorithm>
+#include <deque>
+#include <limits>
 #include <sstream>
+#include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
 
 EventServer EvtServer;
@@ -51,11 +56,26 @@ enum
     MSG_PROTOCOL_VERSION = 1,
 };
 
-static const wxString literal_null("null");
-static const wxString literal_true("true");
-static const wxString literal_false("false");
+static const char literal_null[] = "null";
+static const char literal_true[] = "true";
+static const char literal_false[] = "false";
 
-static wxString state_name(EXPOSED_STATE st)
+// host name reported in events, captured when the server starts
+static std::string s_hostName;
+
+// what to do when a client's output queue is full
+enum SlowClientPolicy
+{
+    SLOW_CLIENT_DROP_OLDEST, // discard the oldest queued events
+    SLOW_CLIENT_COALESCE,    // replace a queued event of the same kind (GuideStep, ...), else drop the oldest
+    SLOW_CLIENT_DISCONNECT,  // close the connection
+};
+
+static const int DefaultClientQueueLimitKB = 256;
+static size_t s_clientQueueLimit = DefaultClientQueueLimitKB * 1024;
+static SlowClientPolicy s_slowClientPolicy = SLOW_CLIENT_DROP_OLDEST;
+
+static const char *state_name(EXPOSED_STATE st)
 {
     switch (st)
     {
@@ -70,33 +90,108 @@ static wxString state_name(EXPOSED_STATE st)
     }
 }
 
-static wxString json_escape(const wxString& s)
+//
+// The JSON text is written directly as UTF-8 into a std::string, so a
+// message can be sent to the socket as-is without further conversion.
+//
+
+static void json_append_format(std::string& out, const char *fmt, ...)
 {
-    wxString t(s);
-    static const wxString BACKSLASH("\\");
-    static const wxString BACKSLASHBACKSLASH("\\\\");
-    static const wxString DQUOT("\"");
-    static const wxString BACKSLASHDQUOT("\\\"");
-    static const wxString CR("\r");
-    static const wxString BACKSLASHCR("\\r");
-    static const wxString LF("\n");
-    static const wxString BACKSLASHLF("\\n");
-    t.Replace(BACKSLASH, BACKSLASHBACKSLASH);
-    t.Replace(DQUOT, BACKSLASHDQUOT);
-    t.Replace(CR, BACKSLASHCR);
-    t.Replace(LF, BACKSLASHLF);
-    return t;
+    char buf[64];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if (n >= 0 && (size_t) n < sizeof(buf))
+    {
+        out.append(buf, n);
+        return;
+    }
+
+    // does not fit (only for huge values)
+    va_start(ap, fmt);
+    wxString s(wxString::FormatV(fmt, ap));
+    va_end(ap);
+    out += s.utf8_str();
+}
+
+static void json_append_string(std::string& out, const char *s, size_t len)
+{
+    const char *const end = s + len;
+
+    out += '"';
+    while (s < end)
+    {
+        const char *p = s;
+        while (p < end && *p != '\\' && *p != '"' && *p != '\r' && *p != '\n')
+            ++p;
+        out.append(s, p - s);
+        if (p == end)
+            break;
+        switch (*p) {
+        case '\\': out += "\\\\"; break;
+        case '"':  out += "\\\""; break;
+        case '\r': out += "\\r"; break;
+        case '\n': out += "\\n"; break;
+        }
+        s = p + 1;
+    }
+    out += '"';
+}
+
+static void json_append_string(std::string& out, const wxString& s)
+{
+    const wxScopedCharBuffer utf8(s.utf8_str());
+    json_append_string(out, utf8.data(), utf8.length());
 }
 
 template<char LDELIM, char RDELIM>
 struct JSeq
 {
-    wxString m_s;
+    // mutable so that a sequence passed by const reference can be closed when it is sent
+    mutable std::string m_s;
     bool m_first;
-    bool m_closed;
-    JSeq() : m_first(true), m_closed(false) { m_s << LDELIM; }
-    void close() { m_s << RDELIM; m_closed = true; }
-    wxString str() { if (!m_closed) close(); return m_s; }
+    mutable bool m_closed;
+    mutable bool m_terminated;
+    JSeq() : m_first(true), m_closed(false), m_terminated(false) { m_s += LDELIM; }
+    // build the sequence in the storage of buf, reusing its capacity
+    explicit JSeq(std::string& buf) : m_first(true), m_closed(false), m_terminated(false)
+    {
+        m_s.swap(buf);
+        m_s.clear();
+        m_s += LDELIM;
+    }
+    // hand the storage back for the next sequence
+    void release(std::string& buf) { buf.swap(m_s); }
+    // every append operator starts with sep(); str() and line() close the
+    // sequence in place, so nothing may be appended after them
+    void sep()
+    {
+        assert(!m_closed);
+        if (m_first) m_first = false; else m_s += ',';
+    }
+    const std::string& str() const
+    {
+        if (!m_closed)
+        {
+            m_s += RDELIM;
+            m_closed = true;
+        }
+        return m_s;
+    }
+    // the closed sequence followed by CRLF, ready to send; nothing may be added after this
+    const std::string& line() const
+    {
+        if (!m_terminated)
+        {
+            str();
+            m_s += "\r\n";
+            m_terminated = true;
+        }
+        return m_s;
+    }
 };
 
 typedef JSeq<'[', ']'> JAry;
@@ -104,94 +199,104 @@ typedef JSeq<'{', '}'> JObj;
 
 static JAry& operator<<(JAry& a, const wxString& str)
 {
-    if (a.m_first)
-        a.m_first = false;
-    else
-        a.m_s << ',';
-    a.m_s << str;
+    a.sep();
+    json_append_string(a.m_s, str);
     return a;
 }
 
 static JAry& operator<<(JAry& a, double d)
 {
-    return a << wxString::Format("%.2f", d);
+    a.sep();
+    json_append_format(a.m_s, "%.2f", d);
+    return a;
 }
 
 static JAry& operator<<(JAry& a, int i)
 {
-    return a << wxString::Format("%d", i);
+    a.sep();
+    json_append_format(a.m_s, "%d", i);
+    return a;
 }
 
-static wxString json_format(const json_value *j)
+static void json_format(std::string& out, const json_value *j)
 {
     if (!j)
-        return literal_null;
+    {
+        out += literal_null;
+        return;
+    }
 
     switch (j->type) {
     default:
-    case JSON_NULL: return literal_null;
+    case JSON_NULL:
+        out += literal_null;
+        break;
     case JSON_OBJECT: {
-        wxString ret("{");
+        out += '{';
         bool first = true;
         json_for_each (jj, j)
         {
             if (first)
                 first = false;
             else
-                ret << ",";
-            ret << '"' << jj->name << "\":" << json_format(jj);
+                out += ',';
+            out += '"';
+            out += jj->name;
+            out += "\":";
+            json_format(out, jj);
         }
-        ret << "}";
-        return ret;
+        out += '}';
+        break;
     }
     case JSON_ARRAY: {
-        wxString ret("[");
+        out += '[';
         bool first = true;
         json_for_each (jj, j)
         {
             if (first)
                 first = false;
             else
-                ret << ",";
-            ret << json_format(jj);
+                out += ',';
+            json_format(out, jj);
         }
-        ret << "]";
-        return ret;
+        out += ']';
+        break;
     }
-    case JSON_STRING: return '"' + json_escape(j->string_value) + '"';
-    case JSON_INT:    return wxString::Format("%d", j->int_value);
-    case JSON_FLOAT:  return wxString::Format("%g", (double) j->float_value);
-    case JSON_BOOL:   return j->int_value ? literal_true : literal_false;
+    case JSON_STRING: json_append_string(out, j->string_value, strlen(j->string_value)); break;
+    case JSON_INT:    json_append_format(out, "%d", j->int_value); break;
+    case JSON_FLOAT:  json_append_format(out, "%g", (double) j->float_value); break;
+    case JSON_BOOL:   out += j->int_value ? literal_true : literal_false; break;
     }
 }
 
 struct NULL_TYPE { } NULL_VALUE;
 
-// name-value pair
+// name-value pair, the value is held as JSON text
 struct NV
 {
-    wxString n;
-    wxString v;
-    NV(const wxString& n_, const wxString& v_) : n(n_), v('"' + json_escape(v_) + '"') { }
-    NV(const wxString& n_, const char *v_) : n(n_), v('"' + json_escape(v_) + '"') { }
-    NV(const wxString& n_, const wchar_t *v_) : n(n_), v('"' + json_escape(v_) + '"') { }
-    NV(const wxString& n_, int v_) : n(n_), v(wxString::Format("%d", v_)) { }
-    NV(const wxString& n_, double v_) : n(n_), v(wxString::Format("%g", v_)) { }
-    NV(const wxString& n_, double v_, int prec) : n(n_), v(wxString::Format("%.*f", prec, v_)) { }
-    NV(const wxString& n_, bool v_) : n(n_), v(v_ ? literal_true : literal_false) { }
+    const char *n;
+    std::string v;
+    NV(const char *n_, const wxString& v_) : n(n_) { json_append_string(v, v_); }
+    NV(const char *n_, const std::string& v_) : n(n_) { json_append_string(v, v_.data(), v_.size()); }
+    NV(const char *n_, const char *v_) : n(n_) { json_append_string(v, v_, strlen(v_)); }
+    NV(const char *n_, const wchar_t *v_) : n(n_) { json_append_string(v, wxString(v_)); }
+    NV(const char *n_, int v_) : n(n_) { json_append_format(v, "%d", v_); }
+    NV(const char *n_, double v_) : n(n_) { json_append_format(v, "%g", v_); }
+    NV(const char *n_, double v_, int prec) : n(n_) { json_append_format(v, "%.*f", prec, v_); }
+    NV(const char *n_, bool v_) : n(n_), v(v_ ? literal_true : literal_false) { }
     template<typename T>
-    NV(const wxString& n_, const std::vector<T>& vec);
-    NV(const wxString& n_, JAry& ary) : n(n_), v(ary.str()) { }
-    NV(const wxString& n_, JObj& obj) : n(n_), v(obj.str()) { }
-    NV(const wxString& n_, const json_value *v_) : n(n_), v(json_format(v_)) { }
-    NV(const wxString& n_, const PHD_Point& p) : n(n_) { JAry ary; ary << p.X << p.Y; v = ary.str(); }
-    NV(const wxString& n_, const wxPoint& p) : n(n_) { JAry ary; ary << p.x << p.y; v = ary.str(); }
-    NV(const wxString& n_, const wxSize& s) : n(n_) { JAry ary; ary << s.x << s.y; v = ary.str(); }
-    NV(const wxString& n_, const NULL_TYPE& nul) : n(n_), v(literal_null) { }
+    NV(const char *n_, const std::vector<T>& vec);
+    NV(const char *n_, const JAry& ary) : n(n_), v(ary.str()) { }
+    NV(const char *n_, const JObj& obj) : n(n_), v(obj.str()) { }
+    NV(const char *n_, const json_value *v_) : n(n_) { json_format(v, v_); }
+    NV(const char *n_, const PHD_Point& p) : n(n_) { json_append_format(v, "[%.2f,%.2f]", p.X, p.Y); }
+    NV(const char *n_, const wxPoint& p) : n(n_) { json_append_format(v, "[%d,%d]", p.x, p.y); }
+    NV(const char *n_, const wxSize& s) : n(n_) { json_append_format(v, "[%d,%d]", s.x, s.y); }
+    NV(const char *n_, const NULL_TYPE& nul) : n(n_), v(literal_null) { }
 };
 
 template<typename T>
-NV::NV(const wxString& n_, const std::vector<T>& vec)
+NV::NV(const char *n_, const std::vector<T>& vec)
     : n(n_)
 {
     std::ostringstream os;
@@ -208,11 +313,11 @@ NV::NV(const wxString& n_, const std::vector<T>& vec)
 
 static JObj& operator<<(JObj& j, const NV& nv)
 {
-    if (j.m_first)
-        j.m_first = false;
-    else
-        j.m_s << ',';
-    j.m_s << '"' << nv.n << "\":" << nv.v;
+    j.sep();
+    j.m_s += '"';
+    j.m_s += nv.n;
+    j.m_s += "\":";
+    j.m_s += nv.v;
     return j;
 }
 
@@ -226,19 +331,23 @@ static JObj& operator<<(JObj& j, const PHD_Point& pt)
     return j << NV("X", pt.X, 3) << NV("Y", pt.Y, 3);
 }
 
-static JAry& operator<<(JAry& a, JObj& j)
+static JAry& operator<<(JAry& a, const JObj& j)
 {
-    return a << j.str();
+    a.sep();
+    a.m_s += j.str();
+    return a;
 }
 
 struct Ev : public JObj
 {
-    Ev(const wxString& event)
+    const char *name;
+
+    Ev(const char *event) : name(event)
     {
         double const now = ::wxGetUTCTimeMillis().ToDouble() / 1000.0;
         *this << NV("Event", event)
             << NV("Timestamp", now, 3)
-            << NV("Host", wxGetHostName())
+            << NV("Host", s_hostName)
             << NV("Inst", wxGetApp().GetInstanceNumber());
     }
 };
@@ -348,14 +457,39 @@ struct ClientReadBuf
     void reset() { dest = &m_buf[0]; }
 };
 
+// a message waiting to be sent to a client
+struct OutMsg
+{
+    std::string data;
+    const char *ev;     // event name, or null for RPC responses and star images, which are never dropped
+    bool image;         // star image frame, not counted against the queue limit
+};
+
 struct ClientData
 {
     wxSocketClient *cli;
     int refcnt;
     ClientReadBuf rdbuf;
     wxMutex wrlock;
-
-    ClientData(wxSocketClient *cli_) : cli(cli_), refcnt(1) { }
+    std::string outbuf; // storage reused for the responses to this client
+
+    // output the socket has not accepted yet, protected by wrlock
+    std::deque<OutMsg> pending;
+    size_t pendingSent;  // bytes of pending.front() already written
+    size_t pendingBytes; // bytes still to be written
+    size_t queuedBytes;  // bytes counted against the queue limit: the pending messages
+                         // except the one being written and star image frames
+    unsigned int dropped; // events dropped since the queue was last empty
+    bool closing;        // disconnecting a slow client
+
+    // star image stream, see set_star_image_stream
+    bool imgStream;
+    bool imgStreamFull;  // send the whole subframe instead of a box around the star
+    int imgStreamSize;
+    std::string imgbuf;
+
+    ClientData(wxSocketClient *cli_) : cli(cli_), refcnt(1), pendingSent(0), pendingBytes(0), queuedBytes(0), dropped(0), closing(false),
+        imgStream(false), imgStreamFull(false), imgStreamSize(0) { }
     void AddRef() { ++refcnt; }
     void RemoveRef()
     {
@@ -375,9 +509,19 @@ struct ClientDataGuard
     ClientData *operator->() const { return cd; }
 };
 
+inline static ClientData *client_data(wxSocketClient *cli)
+{
+    return (ClientData *) cli->GetClientData();
+}
+
 inline static wxMutex *client_wrlock(wxSocketClient *cli)
 {
-    return &((ClientData *) cli->GetClientData())->wrlock;
+    return &client_data(cli)->wrlock;
+}
+
+inline static std::string& client_outbuf(wxSocketClient *cli)
+{
+    return ((ClientData *) cli->GetClientData())->outbuf;
 }
 
 static wxString SockErrStr(wxSocketError e)
@@ -397,40 +541,208 @@ static wxString SockErrStr(wxSocketError e)
     }
 }
 
-static void send_buf(wxSocketClient *client, const wxCharBuffer& buf)
+// high-rate events where a client that is behind only needs the latest one
+static bool coalescable(const char *ev)
+{
+    static const char *const names[] = { "GuideStep", "GuideLatency", "LoopingExposures", "Settling", "StarLost" };
+    for (unsigned int i = 0; i < WXSIZEOF(names); i++)
+        if (strcmp(ev, names[i]) == 0)
+            return true;
+    return false;
+}
+
+static void drop_pending(ClientData *cd, std::deque<OutMsg>::iterator it)
 {
-    wxMutexLocker lock(*client_wrlock(client));
-    client->Write(buf.data(), buf.length());
-    if (client->LastWriteCount() != buf.length())
+    cd->pendingBytes -= it->data.length();
+    cd->queuedBytes -= it->data.length();
+    cd->pending.erase(it);
+    if (cd->dropped++ == 0)
+        Debug.Write(wxString::Format("evsrv: cli %p is not keeping up, dropping events\n", cd->cli));
+}
+
+// apply the slow client policy to make room for len more bytes in a client's
+// output queue; returns false if the client is being disconnected
+static bool make_room(ClientData *cd, size_t len, const char *ev)
+{
+    if (cd->queuedBytes + len <= s_clientQueueLimit)
+        return true;
+
+    // a message that has been partly written cannot be dropped
+    size_t const first = cd->pendingSent > 0 ? 1 : 0;
+
+    if (s_slowClientPolicy == SLOW_CLIENT_COALESCE && ev && coalescable(ev))
     {
-        Debug.Write(wxString::Format("evsrv: cli %p short write %u/%u %s\n",
-            client, client->LastWriteCount(), (unsigned int) buf.length(),
-            SockErrStr(client->Error() ? client->LastError() : wxSOCKET_NOERROR)));
+        for (size_t i = cd->pending.size(); i > first; i--)
+        {
+            const char *qev = cd->pending[i - 1].ev;
+            if (qev && strcmp(qev, ev) == 0)
+            {
+                drop_pending(cd, cd->pending.begin() + (i - 1));
+                break;
+            }
+        }
+    }
+
+    if (s_slowClientPolicy != SLOW_CLIENT_DISCONNECT)
+    {
+        size_t i = first;
+        while (cd->queuedBytes + len > s_clientQueueLimit && i < cd->pending.size())
+        {
+            if (cd->pending[i].ev)
+                drop_pending(cd, cd->pending.begin() + i);
+            else
+                ++i;
+        }
+
+        // only responses left: the client is not reading at all
+        if (cd->queuedBytes + len <= s_clientQueueLimit)
+            return true;
+    }
+
+    Debug.Write(wxString::Format("evsrv: cli %p output queue full (%u bytes), disconnecting\n",
+        cd->cli, (unsigned int) cd->queuedBytes));
+
+    cd->closing = true;
+    cd->pending.clear();
+    cd->pendingSent = cd->pendingBytes = cd->queuedBytes = 0;
+
+    // the client set may be being iterated, so remove the client later; the
+    // reference keeps the socket from being destroyed in the meantime
+    cd->AddRef();
+    EvtServer.CallAfter([cd]() {
+        // the client may have gone away on its own and its socket been reused
+        if (client_data(cd->cli) == cd)
+            EvtServer.DisconnectClient(cd->cli);
+        cd->RemoveRef();
+    });
+
+    return false;
+}
+
+// Queue output for a client without blocking. ev is the event name for
+// events, which may be dropped or coalesced under the slow client policy.
+// Star image frames are only sent to a client with nothing pending and do
+// not count against the queue limit, a full frame can be larger than it.
+static void send_buf(wxSocketClient *client, const char *buf, size_t len, const char *ev = nullptr, bool image = false)
+{
+    ClientData *cd = client_data(client);
+    wxMutexLocker lock(cd->wrlock);
+
+    if (cd->closing)
+        return;
+
+    if (!cd->pending.empty())
+    {
+        // keep the output in order behind the data that is still waiting
+        if (!make_room(cd, len, ev))
+            return;
+        OutMsg msg;
+        msg.data.assign(buf, len);
+        msg.ev = ev;
+        msg.image = image;
+        cd->pending.push_back(std::move(msg));
+        cd->pendingBytes += len;
+        if (!image)
+            cd->queuedBytes += len;
+        return;
+    }
+
+    client->Write(buf, len);
+    size_t const n = client->LastWriteCount();
+    if (n != len)
+    {
+        if (client->Error() && client->LastError() != wxSOCKET_WOULDBLOCK)
+        {
+            Debug.Write(wxString::Format("evsrv: cli %p short write %u/%u %s\n",
+                client, (unsigned int) n, (unsigned int) len, SockErrStr(client->LastError())));
+        }
+        else
+        {
+            // the socket buffer is full, send the rest when the socket becomes writable
+            OutMsg msg;
+            msg.data.assign(buf, len);
+            msg.ev = ev;
+            msg.image = image;
+            cd->pending.push_back(std::move(msg));
+            cd->pendingSent = n;
+            cd->pendingBytes = len - n;
+            cd->queuedBytes = n == 0 && !image ? len : 0;
+        }
+    }
+}
+
+static void send_buf(wxSocketClient *client, const std::string& buf, const char *ev = nullptr)
+{
+    send_buf(client, buf.data(), buf.length(), ev);
+}
+
+static void send_image_buf(wxSocketClient *client, const std::string& buf)
+{
+    send_buf(client, buf.data(), buf.length(), nullptr, true);
+}
+
+static void send_pending(wxSocketClient *client)
+{
+    ClientData *cd = client_data(client);
+    wxMutexLocker lock(cd->wrlock);
+
+    while (!cd->pending.empty())
+    {
+        const OutMsg& msg = cd->pending.front();
+        const std::string& data = msg.data;
+        size_t const len = data.length() - cd->pendingSent;
+
+        client->Write(data.data() + cd->pendingSent, len);
+        size_t const n = client->LastWriteCount();
+
+        // once started, the message is no longer counted against the limit
+        if (cd->pendingSent == 0 && n > 0 && !msg.image)
+            cd->queuedBytes -= data.length();
+
+        cd->pendingSent += n;
+        cd->pendingBytes -= n;
+
+        if (n != len)
+            return; // wait for the next output event
+
+        cd->pending.pop_front();
+        cd->pendingSent = 0;
+    }
+
+    if (cd->dropped)
+    {
+        Debug.Write(wxString::Format("evsrv: cli %p caught up, %u events were dropped\n", client, cd->dropped));
+        cd->dropped = 0;
     }
 }
 
 static void do_notify1(wxSocketClient *client, const JAry& ary)
 {
-    send_buf(client, (JAry(ary).str() + "\r\n").ToUTF8());
+    send_buf(client, ary.line());
 }
 
 static void do_notify1(wxSocketClient *client, const JObj& j)
 {
-    send_buf(client, (JObj(j).str() + "\r\n").ToUTF8());
+    send_buf(client, j.line());
+}
+
+static void do_notify1(wxSocketClient *client, const Ev& ev)
+{
+    send_buf(client, ev.line(), ev.name);
 }
 
-static void do_notify(const EventServer::CliSockSet& cli, const JObj& jj)
+static void do_notify(const EventServer::CliSockSet& cli, const Ev& ev)
 {
-    wxCharBuffer buf = (JObj(jj).str() + "\r\n").ToUTF8();
+    const std::string& buf = ev.line();
 
     for (EventServer::CliSockSet::const_iterator it = cli.begin();
         it != cli.end(); ++it)
     {
-        send_buf(*it, buf);
+        send_buf(*it, buf, ev.name);
     }
 }
 
-inline static void simple_notify(const EventServer::CliSockSet& cli, const wxString& ev)
+inline static void simple_notify(const EventServer::CliSockSet& cli, const char *ev)
 {
     if (!cli.empty())
         do_notify(cli, Ev(ev));
@@ -534,7 +846,9 @@ static NV jrpc_id(const json_value *id)
 
 struct JRpcResponse : public JObj
 {
-    JRpcResponse() { *this << NV("jsonrpc", "2.0"); }
+    JRpcResponse() { init(); }
+    explicit JRpcResponse(std::string& buf) : JObj(buf) { init(); }
+    void init() { *this << NV("jsonrpc", "2.0"); }
 };
 
 static wxString parser_error(const JsonParser& parser)
@@ -1350,6 +1664,154 @@ static void capture_single_frame(JObj& response, const json_value *params)
     response << jrpc_result(0);
 }
 
+//
+// Star image stream
+//
+// A client that enables the stream with set_star_image_stream receives a
+// binary message after each frame is processed, interleaved with the usual
+// JSON lines. The message starts with a 32 byte header, all values little-endian:
+//
+//   offset  size  field
+//      0     4    magic "PHDI"
+//      4     2    header size (32)
+//      6     2    format version (1)
+//      8     4    frame number
+//     12     2    x of the image area in the frame
+//     14     2    y of the image area in the frame
+//     16     2    width of the image area
+//     18     2    height of the image area
+//     20     4    star x relative to the image area (float, NaN if there is no star)
+//     24     4    star y relative to the image area (float, NaN if there is no star)
+//     28     4    pixel data size in bytes (width * height * 2)
+//
+// followed by the pixels, unsigned 16 bit, row by row. A frame is skipped
+// for a client that has not yet read the previous one; the frame numbers
+// show the gaps.
+//
+
+enum
+{
+    STAR_IMAGE_HDR_SIZE = 32,
+    STAR_IMAGE_VERSION = 1,
+};
+
+inline static void put16(unsigned char *p, unsigned int v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+inline static void put32(unsigned char *p, unsigned int v)
+{
+    put16(p, v & 0xffff);
+    put16(p + 2, v >> 16);
+}
+
+inline static void putf(unsigned char *p, float f)
+{
+    unsigned int v;
+    memcpy(&v, &f, sizeof(v));
+    put32(p, v);
+}
+
+static void send_star_image(wxSocketClient *cli, ClientData *cd, const usImage *img, const PHD_Point& star)
+{
+    wxRect frame(img->Subframe.IsEmpty() ? wxRect(img->Size) : img->Subframe);
+    wxRect rect;
+
+    if (cd->imgStreamFull)
+        rect = frame;
+    else
+    {
+        if (!star.IsValid())
+            return;
+        int const halfw = (cd->imgStreamSize - 1) / 2;
+        rect = wxRect((int) rint(star.X) - halfw, (int) rint(star.Y) - halfw, 2 * halfw + 1, 2 * halfw + 1);
+        rect.Intersect(frame);
+    }
+
+    if (rect.IsEmpty())
+        return;
+
+    {
+        wxMutexLocker lock(cd->wrlock);
+        if (!cd->pending.empty())
+            return; // client is still reading the previous frame
+    }
+
+    size_t const rowbytes = rect.GetWidth() * sizeof(unsigned short);
+    size_t const pixbytes = rowbytes * rect.GetHeight();
+
+    std::string& buf = cd->imgbuf;
+    buf.resize(STAR_IMAGE_HDR_SIZE + pixbytes);
+    unsigned char *hdr = (unsigned char *) &buf[0];
+
+    float const nan = std::numeric_limits<float>::quiet_NaN();
+
+    memcpy(hdr, "PHDI", 4);
+    put16(hdr + 4, STAR_IMAGE_HDR_SIZE);
+    put16(hdr + 6, STAR_IMAGE_VERSION);
+    put32(hdr + 8, img->FrameNum);
+    put16(hdr + 12, rect.GetLeft());
+    put16(hdr + 14, rect.GetTop());
+    put16(hdr + 16, rect.GetWidth());
+    put16(hdr + 18, rect.GetHeight());
+    putf(hdr + 20, star.IsValid() ? (float) (star.X - rect.GetLeft()) : nan);
+    putf(hdr + 24, star.IsValid() ? (float) (star.Y - rect.GetTop()) : nan);
+    put32(hdr + 28, pixbytes);
+
+    // the pixels go out as they are in memory, which is little-endian on every platform we build for
+    unsigned char *dst = hdr + STAR_IMAGE_HDR_SIZE;
+    for (int y = rect.GetTop(); y <= rect.GetBottom(); y++, dst += rowbytes)
+        memcpy(dst, img->ImageData + y * img->Size.GetWidth() + rect.GetLeft(), rowbytes);
+
+    send_image_buf(cli, buf);
+}
+
+static void set_star_image_stream(wxSocketClient *cli, JObj& response, const json_value *params)
+{
+    Params p("enabled", "size", "full", params);
+
+    bool enable;
+    const json_value *val = p.param("enabled");
+    if (!val || !bool_param(val, &enable))
+    {
+        response << jrpc_error(JSONRPC_INVALID_PARAMS, "expected enabled boolean param");
+        return;
+    }
+
+    int size = 15;
+    val = p.param("size");
+    if (val)
+    {
+        if (val->type != JSON_INT || (size = val->int_value) < 15)
+        {
+            response << jrpc_error(JSONRPC_INVALID_PARAMS, "invalid image size param");
+            return;
+        }
+    }
+
+    bool full = false;
+    val = p.param("full");
+    if (val && !bool_param(val, &full))
+    {
+        response << jrpc_error(JSONRPC_INVALID_PARAMS, "expected full boolean param");
+        return;
+    }
+
+    ClientData *cd = client_data(cli);
+    cd->imgStream = enable;
+    cd->imgStreamFull = full;
+    cd->imgStreamSize = size;
+    if (!enable)
+        std::string().swap(cd->imgbuf);
+
+    Debug.Write(wxString::Format("evsrv: cli %p star image stream %s size %d full %d\n", cli,
+        enable ? "on" : "off", size, full));
+
+    response << jrpc_result(0);
+}
+
 static void get_use_subframes(JObj& response, const json_value *params)
 {
     response << jrpc_result(pCamera && pCamera->UseSubframes);
@@ -1364,13 +1826,14 @@ static void get_search_region(JObj& response, const json_value *params)
 struct B64Encode
 {
     static const char *const E;
-    std::ostringstream os;
+    std::string os;
     unsigned int t;
     size_t nread;
 
-    B64Encode()
+    B64Encode(size_t len)
         : t(0), nread(0)
     {
+        os.reserve((len + 2) / 3 * 4);
     }
     void append1(unsigned char ch)
     {
@@ -1378,10 +1841,10 @@ struct B64Encode
         t |= ch;
         if (++nread % 3 == 0)
         {
-            os << E[t >> 18]
-               << E[(t >> 12) & 0x3F]
-               << E[(t >> 6) & 0x3F]
-               << E[t & 0x3F];
+            os += E[t >> 18];
+            os += E[(t >> 12) & 0x3F];
+            os += E[(t >> 6) & 0x3F];
+            os += E[t & 0x3F];
             t = 0;
         }
     }
@@ -1392,23 +1855,22 @@ struct B64Encode
         while (src < end)
             append1(*src++);
     }
-    std::string finish()
+    const std::string& finish()
     {
         switch (nread % 3) {
         case 1:
-            os << E[t >> 2]
-               << E[(t & 0x3) << 4]
-               << "==";
+            os += E[t >> 2];
+            os += E[(t & 0x3) << 4];
+            os += "==";
             break;
         case 2:
-            os << E[t >> 10]
-                << E[(t >> 4) & 0x3F]
-                << E[(t & 0xf) << 2]
-                << '=';
+            os += E[t >> 10];
+            os += E[(t >> 4) & 0x3F];
+            os += E[(t & 0xf) << 2];
+            os += '=';
             break;
         }
-        os << std::ends;
-        return os.str();
+        return os;
     }
 };
 const char *const B64Encode::E = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
@@ -1449,7 +1911,7 @@ static void get_star_image(JObj& response, const json_value *params)
     else
         rect.Intersect(img->Subframe);
 
-    B64Encode enc;
+    B64Encode enc(rect.GetWidth() * rect.GetHeight() * sizeof(unsigned short));
     for (int y = rect.GetTop(); y <= rect.GetBottom(); y++)
     {
         const unsigned short *p = img->ImageData + y * img->Size.GetWidth() + rect.GetLeft();
@@ -1733,7 +2195,7 @@ static void get_algo_param_names(JObj& response, const json_value *params)
 
     JAry names;
     for (auto it = ary.begin(); it != ary.end(); ++it)
-        names << ('"' + json_escape(*it) + '"');
+        names << *it;
 
     response << jrpc_result(names);
 }
@@ -2057,6 +2519,54 @@ static void get_sensor_temperature(JObj& response, const json_value *params)
     response << jrpc_result(rslt);
 }
 
+// per-stage guide cycle latency: count, mean and max in milliseconds, and a
+// histogram where bucket i counts the durations in [2^i, 2^(i+1)) microseconds.
+// Also the frame buffer pool counters, which count from startup and are not reset.
+static void get_latency_stats(JObj& response, const json_value *params)
+{
+    Params p("reset", params);
+
+    bool reset = false;
+    const json_value *val = p.param("reset");
+    if (val && !bool_param(val, &reset))
+    {
+        response << jrpc_error(JSONRPC_INVALID_PARAMS, "expected reset boolean param");
+        return;
+    }
+
+    GuideLatency::Histogram hist[GuideLatency::NUM_STAGES];
+    GuideLatency::GetHistograms(hist, reset);
+
+    JObj rslt;
+
+    for (int i = 0; i < GuideLatency::NUM_STAGES; i++)
+    {
+        const GuideLatency::Histogram& h = hist[i];
+        std::vector<unsigned int> buckets(h.buckets, h.buckets + GuideLatency::NUM_BUCKETS);
+
+        JObj stage;
+        stage << NV("count", (int) h.count)
+              << NV("mean", h.count ? h.sum / 1000.0 / h.count : 0.0, 3)
+              << NV("max", h.max / 1000.0, 3)
+              << NV("histogram", buckets);
+
+        rslt << NV(GuideLatency::StageName((GuideLatency::Stage) i), stage);
+    }
+
+    FrameBufferPool::Stats pool;
+    FrameBufferPool::GetStats(&pool);
+
+    JObj buffers;
+    buffers << NV("hits", (int) pool.hits)
+            << NV("misses", (int) pool.misses)
+            << NV("idle", (int) pool.idle)
+            << NV("idleBytes", (double) pool.idleBytes, 0);
+
+    rslt << NV("FrameBuffers", buffers);
+
+    response << jrpc_result(rslt);
+}
+
 static void export_config_settings(JObj& response, const json_value *params)
 {
     wxString filename(MyFrame::GetDefaultFileDir() + PATHSEPSTR + "phd2_settings.txt");
@@ -2074,6 +2584,81 @@ static void export_config_settings(JObj& response, const json_value *params)
     response << jrpc_result(rslt);
 }
 
+struct JRpcMethod
+{
+    const char *name;
+    void (*fn)(JObj& response, const json_value *params);
+    // for methods that act on the requesting client
+    void (*clifn)(wxSocketClient *cli, JObj& response, const json_value *params);
+};
+
+// sorted by name for the binary search in find_method, keep it sorted when adding methods
+static const JRpcMethod s_methods[] = {
+    { "capture_single_frame", &capture_single_frame, },
+    { "clear_calibration", &clear_calibration, },
+    { "deselect_star", &deselect_star, },
+    { "dither", &dither, },
+    { "export_config_settings", &export_config_settings, },
+    { "find_star", &find_star, },
+    { "flip_calibration", &flip_calibration, },
+    { "get_algo_param", &get_algo_param, },
+    { "get_algo_param_names", &get_algo_param_names, },
+    { "get_app_state", &get_app_state, },
+    { "get_calibrated", &get_calibrated, },
+    { "get_calibration_data", &get_calibration_data, },
+    { "get_camera_binning", &get_camera_binning, },
+    { "get_camera_frame_size", &get_camera_frame_size, },
+    { "get_ccd_temperature", &get_sensor_temperature, },
+    { "get_connected", &get_connected, },
+    { "get_cooler_status", &get_cooler_status, },
+    { "get_current_equipment", &get_current_equipment, },
+    { "get_dec_guide_mode", &get_dec_guide_mode, },
+    { "get_exposure", &get_exposure, },
+    { "get_exposure_durations", &get_exposure_durations, },
+    { "get_guide_output_enabled", &get_guide_output_enabled, },
+    { "get_latency_stats", &get_latency_stats, },
+    { "get_lock_position", &get_lock_position, },
+    { "get_lock_shift_enabled", &get_lock_shift_enabled, },
+    { "get_lock_shift_params", &get_lock_shift_params, },
+    { "get_paused", &get_paused, },
+    { "get_pixel_scale", &get_pixel_scale, },
+    { "get_profile", &get_profile, },
+    { "get_profiles", &get_profiles, },
+    { "get_search_region", &get_search_region, },
+    { "get_settling", &get_settling, },
+    { "get_star_image", &get_star_image, },
+    { "get_use_subframes", &get_use_subframes, },
+    { "guide", &guide, },
+    { "guide_pulse", &guide_pulse, },
+    { "loop", &loop, },
+    { "save_image", &save_image, },
+    { "set_algo_param", &set_algo_param, },
+    { "set_connected", &set_connected, },
+    { "set_dec_guide_mode", &set_dec_guide_mode, },
+    { "set_exposure", &set_exposure, },
+    { "set_guide_output_enabled", &set_guide_output_enabled, },
+    { "set_lock_position", &set_lock_position, },
+    { "set_lock_shift_enabled", &set_lock_shift_enabled, },
+    { "set_lock_shift_params", &set_lock_shift_params, },
+    { "set_paused", &set_paused, },
+    { "set_profile", &set_profile, },
+    { "set_star_image_stream", nullptr, &set_star_image_stream, },
+    { "shutdown", &shutdown, },
+    { "stop_capture", &stop_capture, },
+};
+
+static bool method_name_less(const JRpcMethod& m, const char *name)
+{
+    return strcmp(m.name, name) < 0;
+}
+
+static const JRpcMethod *find_method(const char *name)
+{
+    const JRpcMethod *const end = s_methods + WXSIZEOF(s_methods);
+    const JRpcMethod *m = std::lower_bound(s_methods, end, name, method_name_less);
+    return m != end && strcmp(m->name, name) == 0 ? m : nullptr;
+}
+
 struct JRpcCall
 {
     wxSocketClient *cli;
@@ -2081,17 +2666,24 @@ struct JRpcCall
     const json_value *method;
     JRpcResponse response;
 
-    JRpcCall(wxSocketClient *cli_, const json_value *req_) : cli(cli_), req(req_), method(nullptr) { }
+    // the response is built in the client's output buffer and the buffer is
+    // handed back when the call is done, so its capacity is reused
+    JRpcCall(wxSocketClient *cli_, const json_value *req_)
+        : cli(cli_), req(req_), method(nullptr), response(client_outbuf(cli_)) { }
+    ~JRpcCall() { response.release(client_outbuf(cli)); }
 };
 
 static void dump_request(const JRpcCall& call)
 {
-    Debug.Write(wxString::Format("evsrv: cli %p request: %s\n", call.cli, json_format(call.req)));
+    std::string s;
+    json_format(s, call.req);
+    Debug.Write(wxString::Format("evsrv: cli %p request: %s\n", call.cli, wxString::FromUTF8(s.data(), s.length())));
 }
 
 static void dump_response(const JRpcCall& call)
 {
-    wxString s(const_cast<JRpcResponse&>(call.response).str());
+    const std::string *s = &call.response.str();
+    std::string trimmed;
 
     // trim output for huge responses
 
@@ -2100,11 +2692,16 @@ static void dump_response(const JRpcCall& call)
     if (call.method && strcmp(call.method->string_value, "get_star_image") == 0)
     {
         size_t p0, p1;
-        if ((p0 = s.find("\"pixels\":\"")) != wxString::npos && (p1 = s.find('"', p0 + 10)) != wxString::npos)
-            s.replace(p0 + 10, p1 - (p0 + 10), "...");
+        if ((p0 = s->find("\"pixels\":\"")) != std::string::npos && (p1 = s->find('"', p0 + 10)) != std::string::npos)
+        {
+            trimmed.assign(*s, 0, p0 + 10);
+            trimmed += "...";
+            trimmed.append(*s, p1, std::string::npos);
+            s = &trimmed;
+        }
     }
 
-    Debug.Write(wxString::Format("evsrv: cli %p response: %s\n", call.cli, s));
+    Debug.Write(wxString::Format("evsrv: cli %p response: %s\n", call.cli, wxString::FromUTF8(s->data(), s->length())));
 }
 
 static bool handle_request(JRpcCall& call)
@@ -2129,75 +2726,22 @@ static bool handle_request(JRpcCall& call)
         return true;
     }
 
-    static struct {
-        const char *name;
-        void (*fn)(JObj& response, const json_value *params);
-    } methods[] = {
-        { "clear_calibration", &clear_calibration, },
-        { "deselect_star", &deselect_star, },
-        { "get_exposure", &get_exposure, },
-        { "set_exposure", &set_exposure, },
-        { "get_exposure_durations", &get_exposure_durations, },
-        { "get_profiles", &get_profiles, },
-        { "get_profile", &get_profile, },
-        { "set_profile", &set_profile, },
-        { "get_connected", &get_connected, },
-        { "set_connected", &set_connected, },
-        { "get_calibrated", &get_calibrated, },
-        { "get_paused", &get_paused, },
-        { "set_paused", &set_paused, },
-        { "get_lock_position", &get_lock_position, },
-        { "set_lock_position", &set_lock_position, },
-        { "loop", &loop, },
-        { "stop_capture", &stop_capture, },
-        { "guide", &guide, },
-        { "dither", &dither, },
-        { "find_star", &find_star, },
-        { "get_pixel_scale", &get_pixel_scale, },
-        { "get_app_state", &get_app_state, },
-        { "flip_calibration", &flip_calibration, },
-        { "get_lock_shift_enabled", &get_lock_shift_enabled, },
-        { "set_lock_shift_enabled", &set_lock_shift_enabled, },
-        { "get_lock_shift_params", &get_lock_shift_params, },
-        { "set_lock_shift_params", &set_lock_shift_params, },
-        { "save_image", &save_image, },
-        { "get_star_image", &get_star_image, },
-        { "get_use_subframes", &get_use_subframes, },
-        { "get_search_region", &get_search_region, },
-        { "shutdown", &shutdown, },
-        { "get_camera_binning", &get_camera_binning, },
-        { "get_camera_frame_size", &get_camera_frame_size, },
-        { "get_current_equipment", &get_current_equipment, },
-        { "get_guide_output_enabled", &get_guide_output_enabled, },
-        { "set_guide_output_enabled", &set_guide_output_enabled, },
-        { "get_algo_param_names", &get_algo_param_names, },
-        { "get_algo_param", &get_algo_param, },
-        { "set_algo_param", &set_algo_param, },
-        { "get_dec_guide_mode", &get_dec_guide_mode, },
-        { "set_dec_guide_mode", &set_dec_guide_mode, },
-        { "get_settling", &get_settling, },
-        { "guide_pulse", &guide_pulse, },
-        { "get_calibration_data", &get_calibration_data, },
-        { "capture_single_frame", &capture_single_frame, },
-        { "get_cooler_status", &get_cooler_status, },
-        { "get_ccd_temperature", &get_sensor_temperature, },
-        { "export_config_settings", &export_config_settings, },
-    };
+    const JRpcMethod *method = find_method(call.method->string_value);
 
-    for (unsigned int i = 0; i < WXSIZEOF(methods); i++)
+    if (method)
     {
-        if (strcmp(call.method->string_value, methods[i].name) == 0)
+        if (method->fn)
+            (*method->fn)(call.response, params);
+        else
+            (*method->clifn)(call.cli, call.response, params);
+        if (id)
         {
-            (*methods[i].fn)(call.response, params);
-            if (id)
-            {
-                call.response << jrpc_id(id);
-                return true;
-            }
-            else
-            {
-                return false;
-            }
+            call.response << jrpc_id(id);
+            return true;
+        }
+        else
+        {
+            return false;
         }
     }
 
@@ -2342,13 +2886,25 @@ bool EventServer::EventServerStart(unsigned int instanceId)
         return true;
     }
 
+    for (unsigned int i = 1; i < WXSIZEOF(s_methods); i++)
+        assert(strcmp(s_methods[i - 1].name, s_methods[i].name) < 0);
+
+    s_hostName = wxGetHostName().utf8_str();
+
+    int limitKB = pConfig->Global.GetInt("/server/ClientQueueLimitKB", DefaultClientQueueLimitKB);
+    s_clientQueueLimit = (size_t) std::max(limitKB, 16) * 1024;
+    int policy = pConfig->Global.GetInt("/server/SlowClientPolicy", SLOW_CLIENT_DROP_OLDEST);
+    s_slowClientPolicy = policy >= SLOW_CLIENT_DROP_OLDEST && policy <= SLOW_CLIENT_DISCONNECT ?
+        (SlowClientPolicy) policy : SLOW_CLIENT_DROP_OLDEST;
+
     m_serverSocket->SetEventHandler(*this, EVENT_SERVER_ID);
     m_serverSocket->SetNotify(wxSOCKET_CONNECTION_FLAG);
     m_serverSocket->Notify(true);
 
     m_configEventDebouncer = new wxTimer();
 
-    Debug.Write(wxString::Format("event server started, listening on port %u\n", port));
+    Debug.Write(wxString::Format("event server started, listening on port %u, client queue limit %u KB, slow client policy %d\n",
+        port, (unsigned int) (s_clientQueueLimit / 1024), s_slowClientPolicy));
 
     return false;
 }
@@ -2389,7 +2945,7 @@ void EventServer::OnEventServerEvent(wxSocketEvent& event)
     Debug.Write(wxString::Format("evsrv: cli %p connect\n", client));
 
     client->SetEventHandler(*this, EVENT_SERVER_CLIENT_ID);
-    client->SetNotify(wxSOCKET_LOST_FLAG | wxSOCKET_INPUT_FLAG);
+    client->SetNotify(wxSOCKET_LOST_FLAG | wxSOCKET_INPUT_FLAG | wxSOCKET_OUTPUT_FLAG);
     client->SetFlags(wxSOCKET_NOWAIT);
     client->Notify(true);
     client->SetClientData(new ClientData(client));
@@ -2399,6 +2955,19 @@ void EventServer::OnEventServerEvent(wxSocketEvent& event)
     m_eventServerClients.insert(client);
 }
 
+void EventServer::DisconnectClient(wxSocketClient *cli)
+{
+    // the client may already have gone away
+    if (m_eventServerClients.erase(cli) != 1)
+        return;
+
+    Debug.Write(wxString::Format("evsrv: cli %p disconnected by server\n", cli));
+
+    cli->Notify(false);
+    cli->Close();
+    destroy_client(cli);
+}
+
 void EventServer::OnEventServerClientEvent(wxSocketEvent& event)
 {
     wxSocketClient *cli = static_cast<wxSocketClient *>(event.GetSocket());
@@ -2417,6 +2986,10 @@ void EventServer::OnEventServerClientEvent(wxSocketEvent& event)
     {
         handle_cli_input(cli, m_parser);
     }
+    else if (event.GetSocketEvent() == wxSOCKET_OUTPUT)
+    {
+        send_pending(cli);
+    }
     else
     {
         Debug.Write(wxString::Format("unexpected client socket event %d\n", event.GetSocketEvent()));
@@ -2495,6 +3068,37 @@ void EventServer::NotifyLoopingStopped()
     SIMPLE_NOTIFY("LoopingExposuresStopped");
 }
 
+void EventServer::NotifyLatency(const GuideLatency::Record& rec)
+{
+    if (m_eventServerClients.empty())
+        return;
+
+    Ev ev("GuideLatency");
+    ev << NV("Frame", rec.frame);
+
+    for (int i = 0; i < GuideLatency::NUM_STAGES; i++)
+    {
+        if (rec.usec[i] >= 0)
+            ev << NV(GuideLatency::StageName((GuideLatency::Stage) i), rec.usec[i] / 1000.0, 3);
+    }
+
+    do_notify(m_eventServerClients, ev);
+}
+
+void EventServer::NotifyStarImage(const usImage *img, const PHD_Point& star)
+{
+    if (m_eventServerClients.empty() || !img->ImageData)
+        return;
+
+    for (CliSockSet::const_iterator it = m_eventServerClients.begin();
+         it != m_eventServerClients.end(); ++it)
+    {
+        ClientData *cd = client_data(*it);
+        if (cd->imgStream)
+            send_star_image(*it, cd, img, star);
+    }
+}
+
 void EventServer::NotifyStarSelected(const PHD_Point& pt)
 {
     SIMPLE_NOTIFY_EV(ev_star_selected(pt));
@@ -2643,7 +3247,7 @@ void EventServer::NotifySettling(double distance, double time, double settleTime
 
     Ev ev(ev_settling(distance, time, settleTime, starLocked));
 
-    Debug.Write(wxString::Format("evsrv: %s\n", ev.str()));
+    Debug.Write(wxString::Format("evsrv: %s\n", wxString::FromUTF8(ev.str().c_str())));
 
     do_notify(m_eventServerClients, ev);
 }
@@ -2655,7 +3259,7 @@ void EventServer::NotifySettleDone(const wxString& errorMsg, int settleFrames, i
 
     Ev ev(ev_settle_done(errorMsg, settleFrames, droppedFrames));
 
-    Debug.Write(wxString::Format("evsrv: %s\n", ev.str()));
+    Debug.Write(wxString::Format("evsrv: %s\n", wxString::FromUTF8(ev.str().c_str())));
 
     do_notify(m_eventServerClients, ev);
 }
@@ -55,6 +55,7 @@ public:
 
     bool EventServerStart(unsigned int instanceId);
     void EventServerStop();
+    void DisconnectClient(wxSocketClient *cli);
 
     void NotifyStartCalibration(const Mount *mount);
     void NotifyCalibrationStep(const CalibrationStepInfo& info);
@@ -64,6 +65,8 @@ public:
     void NotifyLooping(unsigned int exposure);
     void NotifyLoopingStopped();
     void NotifyStarSelected(const PHD_Point& pos);
+    void NotifyStarImage(const usImage *img, const PHD_Point& star);
+    void NotifyLatency(const GuideLatency::Record& rec);
     void NotifyStarLost(const FrameDroppedInfo& info);
     void NotifyGuidingStarted();
     void NotifyGuidingStopped();
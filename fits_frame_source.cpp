@@ -0,0 +1,510 @@
+/*
+ *  fits_frame_source.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "phd.h"
+
+#include "fits_frame_source.h"
+
+#include <wx/dir.h>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define FRAME_SOURCE_SSE2 1
+# include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define FRAME_SOURCE_NEON 1
+# include <arm_neon.h>
+#endif
+
+enum
+{
+    FITS_BLOCK = 2880,
+    FITS_CARD = 80,
+};
+
+struct HduHeader
+{
+    bool image;                 // primary HDU or IMAGE extension
+    bool compressed;            // tile-compressed image stored in a binary table
+    int bitpix;
+    int naxis;
+    long long naxes[3];
+    long long elements;         // product of all the axes
+    long long pcount;
+    long long gcount;
+    double bzero;
+    double bscale;
+    long long znaxes[2];
+    size_t headerSize;
+};
+
+// parse the header starting at p; returns false if there is no END card
+static bool ParseHeader(const unsigned char *p, size_t avail, bool primary, HduHeader *h)
+{
+    h->image = primary;
+    h->compressed = false;
+    h->bitpix = 0;
+    h->naxis = 0;
+    h->naxes[0] = h->naxes[1] = h->naxes[2] = 1;
+    h->elements = 1;
+    h->pcount = 0;
+    h->gcount = 1;
+    h->bzero = 0.0;
+    h->bscale = 1.0;
+    h->znaxes[0] = h->znaxes[1] = 0;
+
+    for (size_t pos = 0; pos + FITS_CARD <= avail; pos += FITS_CARD)
+    {
+        const char *card = reinterpret_cast<const char *>(p + pos);
+
+        char key[9];
+        memcpy(key, card, 8);
+        key[8] = 0;
+        for (int i = 7; i >= 0 && key[i] == ' '; i--)
+            key[i] = 0;
+
+        if (strcmp(key, "END") == 0)
+        {
+            h->headerSize = (pos / FITS_BLOCK + 1) * FITS_BLOCK;
+            return h->headerSize <= avail;
+        }
+
+        if (card[8] != '=')
+            continue;
+
+        char val[FITS_CARD - 10 + 1];
+        memcpy(val, card + 10, FITS_CARD - 10);
+        val[FITS_CARD - 10] = 0;
+        const char *v = val;
+        while (*v == ' ')
+            ++v;
+
+        if (strcmp(key, "XTENSION") == 0)
+            h->image = strncmp(v, "'IMAGE", 6) == 0;
+        else if (strcmp(key, "BITPIX") == 0)
+            h->bitpix = atoi(v);
+        else if (strcmp(key, "NAXIS") == 0)
+            h->naxis = atoi(v);
+        else if (strncmp(key, "NAXIS", 5) == 0)
+        {
+            int axis = atoi(key + 5);
+            long long n = strtoll(v, nullptr, 10);
+            if (axis >= 1 && axis <= h->naxis)
+            {
+                h->elements *= n;
+                if (axis <= 3)
+                    h->naxes[axis - 1] = n;
+            }
+        }
+        else if (strcmp(key, "PCOUNT") == 0)
+            h->pcount = strtoll(v, nullptr, 10);
+        else if (strcmp(key, "GCOUNT") == 0)
+            h->gcount = strtoll(v, nullptr, 10);
+        else if (strcmp(key, "BZERO") == 0)
+            h->bzero = strtod(v, nullptr);
+        else if (strcmp(key, "BSCALE") == 0)
+            h->bscale = strtod(v, nullptr);
+        else if (strcmp(key, "ZIMAGE") == 0)
+            h->compressed = *v == 'T';
+        else if (strcmp(key, "ZNAXIS1") == 0)
+            h->znaxes[0] = strtoll(v, nullptr, 10);
+        else if (strcmp(key, "ZNAXIS2") == 0)
+            h->znaxes[1] = strtoll(v, nullptr, 10);
+    }
+
+    return false;
+}
+
+void FitsFrameSource::IndexFile(const unsigned char *data, size_t size, unsigned int file, std::vector<Frame> *frames)
+{
+    size_t pos = 0;
+    int hdu = 0;
+
+    while (pos + FITS_BLOCK <= size)
+    {
+        HduHeader h;
+        if (!ParseHeader(data + pos, size - pos, hdu == 0, &h))
+            break;
+        ++hdu;
+
+        size_t const dataStart = pos + h.headerSize;
+        int const bytes = abs(h.bitpix) / 8;
+        unsigned long long const dataSize = h.naxis == 0 ? 0 :
+            (unsigned long long) bytes * h.gcount * (h.pcount + h.elements);
+        if (dataSize > size - dataStart)
+            break; // truncated
+
+        if (h.image && (h.naxis == 2 || (h.naxis == 3 && h.naxes[2] >= 1)) && h.naxes[0] > 0 && h.naxes[1] > 0 &&
+            h.naxes[0] <= INT_MAX && h.naxes[1] <= INT_MAX && bytes > 0)
+        {
+            bool const mapped = (h.bitpix == 16 || h.bitpix == 8) && h.bscale == 1.0 && h.bzero == floor(h.bzero);
+            size_t const planeBytes = (size_t)(h.naxes[0] * h.naxes[1] * bytes);
+
+            for (long long plane = 0; plane < h.naxes[2]; plane++)
+            {
+                Frame f;
+                f.file = file;
+                f.hdu = hdu;
+                f.plane = (int) plane;
+                f.size = wxSize((int) h.naxes[0], (int) h.naxes[1]);
+                f.bitpix = h.bitpix;
+                f.bzero = (long) h.bzero;
+                f.offset = dataStart + (size_t) plane * planeBytes;
+                f.mapped = mapped;
+                frames->push_back(f);
+            }
+        }
+        else if (h.compressed && h.znaxes[0] > 0 && h.znaxes[1] > 0 && h.znaxes[0] <= INT_MAX && h.znaxes[1] <= INT_MAX)
+        {
+            Frame f;
+            f.file = file;
+            f.hdu = hdu;
+            f.plane = 0;
+            f.size = wxSize((int) h.znaxes[0], (int) h.znaxes[1]);
+            f.bitpix = 0;
+            f.bzero = 0;
+            f.offset = 0;
+            f.mapped = false;
+            frames->push_back(f);
+        }
+
+        pos = dataStart + (size_t)((dataSize + FITS_BLOCK - 1) / FITS_BLOCK * FITS_BLOCK);
+    }
+}
+
+// big-endian 16-bit pixels plus bzero
+static void ConvertRow16(const unsigned char *src, unsigned short *dst, int n, long bzero)
+{
+    int x = 0;
+
+    if (bzero == 32768)
+    {
+        // the usual encoding of unsigned data: swap the bytes and flip the sign bit
+#if defined(FRAME_SOURCE_SSE2)
+        const __m128i flip = _mm_set1_epi16((short) 0x8000);
+        for (; x + 8 <= n; x += 8)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * x));
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_xor_si128(v, flip));
+        }
+#elif defined(FRAME_SOURCE_NEON)
+        const uint16x8_t flip = vdupq_n_u16(0x8000);
+        for (; x + 8 <= n; x += 8)
+        {
+            uint16x8_t v = vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(src + 2 * x)));
+            vst1q_u16(dst + x, veorq_u16(v, flip));
+        }
+#endif
+        for (; x < n; x++)
+            dst[x] = (unsigned short)(((src[2 * x] << 8) | src[2 * x + 1]) ^ 0x8000);
+        return;
+    }
+
+    for (; x < n; x++)
+    {
+        long v = (short)((src[2 * x] << 8) | src[2 * x + 1]) + bzero;
+        dst[x] = (unsigned short)(v < 0 ? 0 : v > 65535 ? 65535 : v);
+    }
+}
+
+static void ConvertRow8(const unsigned char *src, unsigned short *dst, int n, long bzero)
+{
+    for (int x = 0; x < n; x++)
+    {
+        long v = src[x] + bzero;
+        dst[x] = (unsigned short)(v < 0 ? 0 : v > 65535 ? 65535 : v);
+    }
+}
+
+class FitsFrameSource::Prefetcher : public wxThread
+{
+    FitsFrameSource *m_src;
+
+public:
+    Prefetcher(FitsFrameSource *src) : wxThread(wxTHREAD_JOINABLE), m_src(src) { }
+
+protected:
+    ExitCode Entry() override
+    {
+        FitsFrameSource *s = m_src;
+
+        for (;;)
+        {
+            int idx;
+            {
+                wxMutexLocker lock(s->m_lock);
+                while (s->m_request < 0 && !s->m_stop)
+                    s->m_cond.Wait();
+                if (s->m_stop)
+                    break;
+                idx = s->m_request;
+                s->m_request = -1;
+                s->m_busy = idx;
+            }
+
+            // m_next belongs to this thread while m_busy is set
+            const Frame& frame = s->m_frames[idx];
+            bool err = s->m_next.Init(frame.size) || s->Decode(frame, s->m_next, wxRect(frame.size));
+
+            wxMutexLocker lock(s->m_lock);
+            s->m_busy = -1;
+            s->m_ready = err ? -1 : idx;
+            s->m_cond.Broadcast();
+        }
+
+        return nullptr;
+    }
+};
+
+FitsFrameSource::FitsFrameSource()
+    :
+    m_pos(0),
+    m_prefetcher(nullptr),
+    m_cond(m_lock),
+    m_request(-1),
+    m_busy(-1),
+    m_ready(-1),
+    m_stop(false)
+{
+}
+
+FitsFrameSource::~FitsFrameSource()
+{
+    Close();
+}
+
+bool FitsFrameSource::Open(const wxString& dir)
+{
+    Close();
+
+    if (!wxDirExists(dir))
+    {
+        Debug.Write(wxString::Format("FitsFrameSource: %s does not exist\n", dir));
+        return true;
+    }
+
+    // match the extensions here rather than with a wildcard, which on Windows
+    // would also match longer extensions
+    wxArrayString names;
+    wxDir::GetAllFiles(dir, &names, wxEmptyString, wxDIR_FILES);
+    names.Sort();
+
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        wxString ext = wxFileName(names[i]).GetExt().Lower();
+        if (ext != "fit" && ext != "fits" && ext != "fts" && ext != "fz")
+            continue;
+
+        std::unique_ptr<MappedFile> file(new MappedFile());
+        if (file->Open(names[i]))
+        {
+            Debug.Write(wxString::Format("FitsFrameSource: cannot map %s\n", names[i]));
+            continue;
+        }
+
+        size_t const prevCount = m_frames.size();
+        IndexFile(file->Data(), file->Size(), m_files.size(), &m_frames);
+        if (m_frames.size() == prevCount)
+        {
+            Debug.Write(wxString::Format("FitsFrameSource: no images in %s\n", names[i]));
+            continue;
+        }
+
+        m_paths.push_back(names[i]);
+        m_files.push_back(std::move(file));
+    }
+
+    Debug.Write(wxString::Format("FitsFrameSource: %u frames in %u files from %s\n",
+                                 (unsigned int) m_frames.size(), (unsigned int) m_files.size(), dir));
+
+    if (m_frames.empty())
+        return true;
+
+    m_stop = false;
+    m_request = 0;
+
+    m_prefetcher = new Prefetcher(this);
+    if (m_prefetcher->Create() != wxTHREAD_NO_ERROR || m_prefetcher->Run() != wxTHREAD_NO_ERROR)
+    {
+        // frames are decoded on demand instead
+        Debug.Write("FitsFrameSource: could not start prefetch thread\n");
+        delete m_prefetcher;
+        m_prefetcher = nullptr;
+        m_request = -1;
+    }
+
+    return false;
+}
+
+void FitsFrameSource::Close()
+{
+    if (m_prefetcher)
+    {
+        {
+            wxMutexLocker lock(m_lock);
+            m_stop = true;
+            m_cond.Broadcast();
+        }
+        m_prefetcher->Wait();
+        delete m_prefetcher;
+        m_prefetcher = nullptr;
+    }
+
+    m_frames.clear();
+    m_files.clear();
+    m_paths.clear();
+    m_pos = 0;
+    m_request = m_busy = m_ready = -1;
+}
+
+bool FitsFrameSource::DecodeFits(const Frame& frame, usImage& img) const
+{
+    FitsLock fitsLock;
+    fitsfile *fptr;
+    int status = 0;
+
+    if (PHD_fits_open_diskfile(&fptr, m_paths[frame.file], READONLY, &status))
+        return true;
+
+    int hdutype;
+    long fpixel[3] = { 1, 1, frame.plane + 1 };
+    fits_movabs_hdu(fptr, frame.hdu, &hdutype, &status);
+    fits_read_pix(fptr, TUSHORT, fpixel, img.NPixels, nullptr, img.ImageData, nullptr, &status);
+
+    PHD_fits_close_file(fptr);
+
+    return status != 0;
+}
+
+// decode the pixels of rect; img has the size of the frame
+bool FitsFrameSource::Decode(const Frame& frame, usImage& img, const wxRect& rect) const
+{
+    if (!frame.mapped)
+        return DecodeFits(frame, img);
+
+    const unsigned char *const base = m_files[frame.file]->Data() + frame.offset;
+    int const bytes = frame.bitpix / 8;
+
+    for (int y = rect.GetTop(); y <= rect.GetBottom(); y++)
+    {
+        const unsigned char *src = base + ((size_t) y * frame.size.x + rect.x) * bytes;
+        unsigned short *dst = &img.Pixel(rect.x, y);
+        if (bytes == 2)
+            ConvertRow16(src, dst, rect.width, frame.bzero);
+        else
+            ConvertRow8(src, dst, rect.width, frame.bzero);
+    }
+
+    return false;
+}
+
+bool FitsFrameSource::ReadNext(usImage& img, const wxRect& subframe)
+{
+    if (m_frames.empty())
+        return true;
+
+    unsigned int const idx = m_pos;
+    m_pos = (m_pos + 1) % m_frames.size();
+    const Frame& frame = m_frames[idx];
+
+    wxRect const full(frame.size);
+    wxRect rect(full);
+    if (!subframe.IsEmpty())
+        rect = subframe.Intersect(full);
+    bool const useSubframe = !rect.IsEmpty() && rect != full;
+    if (!useSubframe)
+        rect = full;
+
+    if (img.Init(frame.size))
+        return true;
+
+    bool prefetched;
+    {
+        wxMutexLocker lock(m_lock);
+        while (m_busy == (int) idx)
+            m_cond.Wait();
+        prefetched = m_ready == (int) idx;
+        // m_next belongs to this thread until the next request
+        m_request = -1;
+        m_ready = -1;
+    }
+
+    bool err = false;
+
+    if (!useSubframe)
+    {
+        if (prefetched)
+            img.SwapImageData(m_next);
+        else
+            err = Decode(frame, img, full);
+    }
+    else
+    {
+        img.Clear();
+
+        if (frame.mapped && !prefetched)
+            err = Decode(frame, img, rect);
+        else
+        {
+            if (!prefetched)
+                err = m_next.Init(frame.size) || Decode(frame, m_next, full);
+            if (!err)
+            {
+                for (int y = rect.GetTop(); y <= rect.GetBottom(); y++)
+                    memcpy(&img.Pixel(rect.x, y), &m_next.Pixel(rect.x, y), rect.width * sizeof(unsigned short));
+            }
+        }
+
+        img.Subframe = rect;
+    }
+
+    if (err)
+    {
+        Debug.Write(wxString::Format("FitsFrameSource: error reading frame %u of %s\n", idx, m_paths[frame.file]));
+        return true;
+    }
+
+    if (m_prefetcher)
+    {
+        wxMutexLocker lock(m_lock);
+        m_request = m_pos;
+        m_cond.Broadcast();
+    }
+
+    return false;
+}
@@ -0,0 +1,108 @@
+/*
+ *  fits_frame_source.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef FITS_FRAME_SOURCE_H_INCLUDED
+#define FITS_FRAME_SOURCE_H_INCLUDED
+
+#include "mapped_file.h"
+
+#include <memory>
+#include <vector>
+
+//
+// Serves the frames of a directory of FITS files in name order, for the
+// camera simulator's replay of recorded frames.
+//
+// Every image HDU of every file is a frame, and each plane of a data cube is
+// a frame, so a recorded session can be packed into a single file.
+// Uncompressed 8- and 16-bit images are memory-mapped and converted straight
+// into the usImage; anything else (tile-compressed, floating point, scaled)
+// is read through CFITSIO. FITS stores big-endian pixels, so one converting
+// copy is needed either way.
+//
+// While the caller processes a frame, a background thread decodes the next
+// one; a full-frame read then only hands over the decoded buffer.
+//
+class FitsFrameSource
+{
+public:
+    FitsFrameSource();
+    ~FitsFrameSource();
+
+    // index the FITS files in dir; returns true on error or if there are no frames
+    bool Open(const wxString& dir);
+    void Close();
+    bool IsOpen() const { return !m_frames.empty(); }
+    unsigned int FrameCount() const { return m_frames.size(); }
+
+    // read the next frame, starting over after the last one. With a
+    // non-empty subframe only that part is read and the rest is cleared.
+    // Returns true on error.
+    bool ReadNext(usImage& img, const wxRect& subframe);
+
+private:
+    struct Frame
+    {
+        unsigned int file;      // index into m_files
+        int hdu;                // 1-based, for CFITSIO
+        int plane;              // 0-based plane of a data cube
+        wxSize size;
+        int bitpix;
+        long bzero;
+        size_t offset;          // start of the pixels in the mapping
+        bool mapped;            // false to read through CFITSIO
+    };
+
+    class Prefetcher;
+
+    static void IndexFile(const unsigned char *data, size_t size, unsigned int file, std::vector<Frame> *frames);
+    bool Decode(const Frame& frame, usImage& img, const wxRect& rect) const;
+    bool DecodeFits(const Frame& frame, usImage& img) const;
+
+    std::vector<wxString> m_paths;
+    std::vector<std::unique_ptr<MappedFile>> m_files;
+    std::vector<Frame> m_frames;
+    unsigned int m_pos;
+
+    Prefetcher *m_prefetcher;
+    wxMutex m_lock;                 // protects the fields below
+    wxCondition m_cond;
+    int m_request;                  // frame the prefetcher should decode next, -1 if none
+    int m_busy;                     // frame the prefetcher is decoding, -1 if none
+    int m_ready;                    // frame held in m_next, -1 if none
+    bool m_stop;
+    usImage m_next;
+};
+
+#endif // FITS_FRAME_SOURCE_H_INCLUDED
@@ -104,6 +104,11 @@ FitsFname::FitsFname(const wxString& path, bool create, bool clobber)
 #endif // __WINDOWS__
 }
 
+wxMutex *PHD_fits_mutex()
+{
+    static wxMutex s_mutex(wxMUTEX_RECURSIVE);
+    return &s_mutex;
+}
 
 int PHD_fits_open_diskfile(fitsfile **fptr, const wxString& filename, int iomode, int *status)
 {
@@ -38,10 +38,27 @@
 
 #include "fitsio.h"
 
+#include <string>
+#include <vector>
+
 extern int PHD_fits_open_diskfile(fitsfile **fptr, const wxString& filename, int iomode, int *status);
 extern int PHD_fits_create_file(fitsfile **fptr, const wxString& filename, bool clobber, int *status);
 extern void PHD_fits_close_file(fitsfile *fptr);
 
+// The bundled CFITSIO is not built reentrant, and images are read and written
+// from worker threads as well as the main thread. Every sequence of fits_*
+// calls, from opening a file to closing it, must be made while holding a
+// FitsLock. The lock is recursive.
+extern wxMutex *PHD_fits_mutex();
+
+class FitsLock
+{
+    wxMutexLocker m_lock;
+
+public:
+    FitsLock() : m_lock(*PHD_fits_mutex()) { }
+};
+
 class FITSHdrWriter
 {
     fitsfile *fptr;
@@ -73,4 +90,69 @@ public:
     }
 };
 
+// Header keywords collected for writing later, possibly on another thread
+class FITSHdrList
+{
+    struct Key
+    {
+        std::string key;
+        int type;
+        union { float f; unsigned int u; int i; } val;
+        std::string str;
+        std::string comment;
+        bool hasComment;
+    };
+
+    std::vector<Key> m_keys;
+
+    Key& add(const char *key, int type, const char *comment) {
+        m_keys.push_back(Key());
+        Key& k = m_keys.back();
+        k.key = key;
+        k.type = type;
+        k.hasComment = comment != nullptr;
+        if (comment)
+            k.comment = comment;
+        return k;
+    }
+
+public:
+
+    void write(const char *key, float val, const char *comment) {
+        add(key, TFLOAT, comment).val.f = val;
+    }
+
+    void write(const char *key, unsigned int val, const char *comment) {
+        add(key, TUINT, comment).val.u = val;
+    }
+
+    void write(const char *key, int val, const char *comment) {
+        add(key, TINT, comment).val.i = val;
+    }
+
+    void write(const char *key, const char *val, const char *comment) {
+        add(key, TSTRING, comment).str = val;
+    }
+
+    void write(const char *key, const wxDateTime& t, const wxDateTime::TimeZone& z, const char *comment) {
+        wxString s = t.Format("%Y-%m-%dT%H:%M:%S", z) + wxString::Format(".%03d", t.GetMillisecond(z));
+        write(key, (const char *) s.c_str(), comment);
+    }
+
+    void Write(fitsfile *fptr, int *status) const {
+        FITSHdrWriter hdr(fptr, status);
+        for (std::vector<Key>::const_iterator it = m_keys.begin(); it != m_keys.end(); ++it)
+        {
+            const char *comment = it->hasComment ? it->comment.c_str() : nullptr;
+            switch (it->type)
+            {
+            case TFLOAT: hdr.write(it->key.c_str(), it->val.f, comment); break;
+            case TUINT: hdr.write(it->key.c_str(), it->val.u, comment); break;
+            case TINT: hdr.write(it->key.c_str(), it->val.i, comment); break;
+            default: hdr.write(it->key.c_str(), it->str.c_str(), comment); break;
+            }
+        }
+    }
+};
+
 #endif
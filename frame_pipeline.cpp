@@ -0,0 +1,188 @@
+/*
+ *  frame_pipeline.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "phd.h"
+
+FramePipeline::FramePipeline(MyFrame *frame)
+    :
+    wxThread(wxTHREAD_JOINABLE),
+    m_pFrame(frame),
+    m_stop(false),
+    m_haveSearch(false)
+{
+}
+
+FramePipeline::~FramePipeline()
+{
+    // frames the main thread did not get to
+    InputSlot *in;
+    while ((in = m_input.ReadSlot()) != nullptr)
+    {
+        delete in->image;
+        m_input.Release();
+    }
+
+    OutputSlot *out;
+    while ((out = m_output.ReadSlot()) != nullptr)
+    {
+        delete out->image;
+        m_output.Release();
+    }
+}
+
+FramePipeline *FramePipeline::Start(MyFrame *frame)
+{
+    FramePipeline *pipeline = new FramePipeline(frame);
+    if (pipeline->Create() != wxTHREAD_NO_ERROR || pipeline->Run() != wxTHREAD_NO_ERROR)
+    {
+        Debug.Write("FramePipeline: could not start the processing thread, frames are processed on the main thread\n");
+        delete pipeline;
+        return nullptr;
+    }
+    return pipeline;
+}
+
+void FramePipeline::Stop(FramePipeline *pipeline)
+{
+    if (!pipeline)
+        return;
+
+    pipeline->m_stop = true;
+    pipeline->m_wake.Post();
+    pipeline->Wait();
+    delete pipeline;
+}
+
+bool FramePipeline::Push(usImage *image, bool error)
+{
+    InputSlot *slot;
+    while ((slot = m_input.WriteSlot()) == nullptr)
+    {
+        // not expected, the ring holds more frames than can be in flight
+        if (m_stop)
+            return false;
+        wxMilliSleep(1);
+    }
+
+    if (m_stop)
+        return false;
+
+    slot->image = image;
+    slot->error = error;
+    m_input.Commit();
+    m_wake.Post();
+
+    return true;
+}
+
+void FramePipeline::SetStarSearch(const StarSearch *search)
+{
+    wxMutexLocker lck(m_searchLock);
+
+    m_haveSearch = search != nullptr;
+    if (search)
+        m_search = *search;
+}
+
+bool FramePipeline::Pop(usImage **image, bool *error, StarMeasurement *measurement)
+{
+    OutputSlot *slot = m_output.ReadSlot();
+    if (!slot)
+        return false;
+
+    *image = slot->image;
+    *error = slot->error;
+    std::swap(*measurement, slot->measurement);
+    slot->image = nullptr;
+    m_output.Release();
+
+    return true;
+}
+
+void FramePipeline::Process(const InputSlot& in)
+{
+    OutputSlot *out;
+    while ((out = m_output.WriteSlot()) == nullptr)
+    {
+        // not expected, the main thread takes each frame before the next exposure is scheduled
+        if (m_stop)
+        {
+            delete in.image;
+            return;
+        }
+        wxMilliSleep(1);
+    }
+
+    out->image = in.image;
+    out->error = in.error;
+    out->measurement.image = nullptr;
+
+    if (!in.error)
+    {
+        bool haveSearch;
+        {
+            wxMutexLocker lck(m_searchLock);
+            haveSearch = m_haveSearch;
+            if (haveSearch)
+                m_threadSearch = m_search;
+        }
+
+        if (haveSearch)
+            out->measurement.Measure(in.image, m_threadSearch);
+    }
+
+    m_output.Commit();
+
+    wxQueueEvent(m_pFrame, new wxThreadEvent(wxEVT_THREAD, MYFRAME_FRAME_PROCESSED));
+}
+
+wxThread::ExitCode FramePipeline::Entry()
+{
+    while (true)
+    {
+        m_wake.Wait();
+
+        if (m_stop)
+            break;
+
+        InputSlot *in;
+        while ((in = m_input.ReadSlot()) != nullptr)
+        {
+            InputSlot frame = *in;
+            m_input.Release();
+            Process(frame);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ *  frame_pipeline.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef FRAME_PIPELINE_H_INCLUDED
+#define FRAME_PIPELINE_H_INCLUDED
+
+#include <atomic>
+
+//
+// A fixed-size single-producer single-consumer ring. The slots are allocated
+// with the ring and reused. The producer fills the slot returned by
+// WriteSlot() and publishes it with Commit(); the consumer reads the slot
+// returned by ReadSlot() and hands it back with Release(). Neither side takes
+// a lock.
+//
+template<typename T, unsigned int N>
+class SpscRing
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "ring size must be a power of 2");
+
+    T m_slots[N];
+    std::atomic<unsigned int> m_head;   // next slot to read, advanced by the consumer
+    std::atomic<unsigned int> m_tail;   // next slot to write, advanced by the producer
+
+public:
+    SpscRing() : m_head(0), m_tail(0) { }
+
+    // null if the ring is full
+    T *WriteSlot()
+    {
+        unsigned int tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == N)
+            return nullptr;
+        return &m_slots[tail % N];
+    }
+
+    void Commit()
+    {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // null if the ring is empty
+    T *ReadSlot()
+    {
+        unsigned int head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return nullptr;
+        return &m_slots[head % N];
+    }
+
+    void Release()
+    {
+        m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+//
+// The processing stage between capture and the guide state machine. The worker
+// thread that completed an exposure pushes the frame into the input ring; the
+// processing thread measures the guide stars in it, using the StarSearch the
+// main thread published last, and passes the frame and the measurement to the
+// main thread through the output ring. The guider uses the measurement if its
+// stars have not changed since it was published and measures the frame itself
+// otherwise, so the result is the same as measuring on the main thread.
+//
+// Only one exposure is in progress at a time, so there is only one producer
+// at a time even though pipelined capture uses a second worker thread.
+//
+class FramePipeline : public wxThread
+{
+    struct InputSlot
+    {
+        usImage *image;
+        bool error;
+    };
+
+    struct OutputSlot
+    {
+        usImage *image;
+        bool error;
+        StarMeasurement measurement;
+    };
+
+    // at most two frames are in the pipeline: the one the main thread is
+    // handling and the pipelined exposure
+    enum { RING_SIZE = 4 };
+
+    MyFrame *m_pFrame;
+    SpscRing<InputSlot, RING_SIZE> m_input;     // worker thread -> processing thread
+    SpscRing<OutputSlot, RING_SIZE> m_output;   // processing thread -> main thread
+    wxSemaphore m_wake;
+    std::atomic<bool> m_stop;
+
+    wxMutex m_searchLock;                       // protects the fields below
+    StarSearch m_search;
+    bool m_haveSearch;
+
+    StarSearch m_threadSearch;                  // processing thread's copy of m_search
+
+public:
+    // null if the processing thread could not be started
+    static FramePipeline *Start(MyFrame *frame);
+    // stop the processing thread and delete the pipeline and any frames left in it
+    static void Stop(FramePipeline *pipeline);
+
+    // worker thread: queue a completed exposure, false if the pipeline is stopping
+    bool Push(usImage *image, bool error);
+
+    // main thread: the stars to measure in the following frames, null if there are none
+    void SetStarSearch(const StarSearch *search);
+    // main thread: the next processed frame. The measurement is swapped into
+    // *measurement so the slot gets back buffers to reuse.
+    bool Pop(usImage **image, bool *error, StarMeasurement *measurement);
+
+protected:
+    ExitCode Entry() override;
+
+private:
+    FramePipeline(MyFrame *frame);
+    ~FramePipeline();
+
+    void Process(const InputSlot& in);
+};
+
+#endif // FRAME_PIPELINE_H_INCLUDED
@@ -160,6 +160,8 @@ GearDialog::GearDialog(wxWindow *pParent) :
 
 GearDialog::~GearDialog()
 {
+    PointingCache::Stop();
+
     delete m_pCamera;
     delete m_pScope;
     if (m_pAuxScope != m_pScope)
@@ -699,7 +701,10 @@ void GearDialog::UpdateAuxScopeButtonState()
         m_pConnectAuxScopeButton->Enable(false);
 
         if (m_pAuxScope && m_pAuxScope != m_pScope)
+        {
+            PointingCache::Detach(m_pAuxScope);
             delete m_pAuxScope;
+        }
         m_pAuxScope = nullptr;
     }
     else
@@ -1111,12 +1116,11 @@ bool GearDialog::DoConnectCamera(bool autoReconnecting)
             {
                 int currProfileId = pConfig->GetCurrentProfileId();
                 wxString darkName = MyFrame::DarkLibFileName(currProfileId);
-                wxString bpmName = DefectMap::DefectMapFileName(currProfileId);
 
                 m_camChanged = true;
 
                 // Can't use standard checks because we don't want to consider sensor-size
-                if (wxFileExists(darkName) || wxFileExists(bpmName))
+                if (wxFileExists(darkName) || DefectMap::DefectMapFileExists(currProfileId))
                 {
                     Debug.Write("DoConnectCamera: displaying camera-change warning\n");
 
@@ -1282,6 +1286,8 @@ void GearDialog::UpdateGearPointers()
         m_pScope : m_pAuxScope;
 
     pRotator = m_pRotator;
+
+    PointingCache::SetSource(pPointingSource);
 }
 
 void GearDialog::OnChoiceScope(wxCommandEvent& event)
@@ -1290,6 +1296,7 @@ void GearDialog::OnChoiceScope(wxCommandEvent& event)
     {
         wxString choice = m_pScopes->GetStringSelection();
 
+        PointingCache::Detach(m_pScope);
         delete m_pScope;
         m_pScope = nullptr;
         UpdateGearPointers();
@@ -1327,7 +1334,10 @@ void GearDialog::OnChoiceAuxScope(wxCommandEvent& event)
         wxString choice = m_pAuxScopes->GetStringSelection();
 
         if (m_pAuxScope != m_pScope)
+        {
+            PointingCache::Detach(m_pAuxScope);
             delete m_pAuxScope;
+        }
         m_pAuxScope = nullptr;
         UpdateGearPointers();
 
@@ -1478,6 +1488,7 @@ void GearDialog::OnButtonDisconnectScope(wxCommandEvent& event)
             throw THROW_INFO("OnButtonDisconnectScope: called when not connected");
         }
 
+        PointingCache::Detach(m_pScope);
         m_pScope->Disconnect();
 
         pFrame->StatusMsg(_("Mount Disconnected"));
@@ -1512,6 +1523,7 @@ void GearDialog::OnButtonDisconnectAuxScope(wxCommandEvent& event)
             throw THROW_INFO("OnButtonDisconnectAuxScope: called when not connected");
         }
 
+        PointingCache::Detach(m_pAuxScope);
         m_pAuxScope->Disconnect();
         pFrame->StatusMsg(_("Aux Mount Disconnected"));
     }
@@ -2032,6 +2044,8 @@ void GearDialog::Shutdown(bool forced)
 {
     Debug.Write(wxString::Format("Shutdown: forced=%d\n", forced));
 
+    PointingCache::Stop();
+
     if (!forced && m_pScope && m_pScope->IsConnected())
     {
         Debug.AddLine("Shutdown: disconnect scope");
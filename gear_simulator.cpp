@@ -39,10 +39,10 @@
 #ifdef SIMULATOR
 
 #include "camera.h"
+#include "fits_frame_source.h"
 #include "gear_simulator.h"
 #include "image_math.h"
 
-#include <wx/dir.h>
 #include <wx/gdicmn.h>
 #include <wx/stopwatch.h>
 #include <wx/radiobut.h>
@@ -51,6 +51,9 @@
 #include <wx/txtstrm.h>
 #include <wx/tokenzr.h>
 
+#include <atomic>
+#include <random>
+
 #define SIMMODE 3   // 1=FITS, 2=BMP, 3=Generate
 // #define SIMDEBUG
 
@@ -85,6 +88,10 @@ struct SimCamParams
     static double comet_rate_y;
     static bool allow_async_st4;
     static unsigned int frame_download_ms;
+    static bool deterministic;
+    static unsigned int seed;
+    static bool virtual_clock;
+    static wxString replay_dir;
 };
 
 unsigned int SimCamParams::width = 752;          // simulated camera image width
@@ -113,6 +120,20 @@ double SimCamParams::comet_rate_x;
 double SimCamParams::comet_rate_y;
 bool SimCamParams::allow_async_st4 = true;
 unsigned int SimCamParams::frame_download_ms;    // frame download time, ms
+bool SimCamParams::deterministic = false;        // replayable run: seeded random numbers, synchronous ST4
+unsigned int SimCamParams::seed;                 // random seed for a deterministic run
+bool SimCamParams::virtual_clock = false;        // advance a simulated clock instead of sleeping
+wxString SimCamParams::replay_dir;               // replay the FITS frames in this directory instead of rendering
+
+// random numbers for noise and seeing. Unlike rand(), std::mt19937 produces
+// the same sequence on every platform, so a seeded run can be replayed anywhere.
+static std::mt19937 s_rng;
+
+// uniformly distributed in [0, n)
+inline static unsigned int sim_rand(unsigned int n)
+{
+    return s_rng() % n;
+}
 
 // Note: these are all in units appropriate for the UI
 #define NR_STARS_DEFAULT 20
@@ -181,6 +202,7 @@ static void load_sim_params()
     SimCamParams::comet_rate_y = pConfig->Profile.GetDouble("/SimCam/comet_rate_y", COMET_RATE_Y_DEFAULT);
 
     SimCamParams::frame_download_ms = pConfig->Profile.GetInt("/SimCam/frame_download_ms", 50);
+    SimCamParams::replay_dir = pConfig->Profile.GetString("/SimCam/replay_dir", wxEmptyString);
 }
 
 static void save_sim_params()
@@ -300,7 +322,8 @@ StepGuider::STEP_RESULT StepGuiderSimulator::Step(GUIDE_DIRECTION direction, int
 
     // parent class maintains x/y offsets, so nothing to do here. Just simulate a delay.
     enum { LATENCY_MS_PER_STEP = 5 };
-    wxMilliSleep(steps * LATENCY_MS_PER_STEP);
+    if (!SimCamParams::virtual_clock)
+        wxMilliSleep(steps * LATENCY_MS_PER_STEP);
     return STEP_OK;
 }
 
@@ -531,6 +554,8 @@ struct SimCamState
     BacklashVal dec_ofs;     // simulate backlash in DEC
     double cum_dec_drift;    // cumulative dec drift
     wxStopWatch timer;       // platform-independent timer
+    std::atomic<long> virtual_time; // simulated time when SimCamParams::virtual_clock is set, milliseconds;
+                                    // advanced by both the capture and the guide pulse threads
     long last_exposure_time; // last expoure time, milliseconds
     Cooler cooler;           // simulated cooler
     StictionSim stictionSim;
@@ -548,14 +573,12 @@ struct SimCamState
     void ReadDisplacements(double& cumX, double& cumY);
 #endif
 
-#if SIMMODE == 1
-    wxDir dir;
-    bool dirStarted;
+    FitsFrameSource frames;  // recorded frames, see SimCamParams::replay_dir
     bool ReadNextImage(usImage& img, const wxRect& subframe);
-#endif
 
     void Initialize();
     void FillImage(usImage& img, const wxRect& subframe, int exptime, int gain, int offset);
+    long Now() const { return SimCamParams::virtual_clock ? virtual_time : timer.Time(); }
 };
 
 void SimCamState::Initialize()
@@ -567,13 +590,13 @@ void SimCamState::Initialize()
     stars.resize(nr_stars);
     unsigned int const border = SimCamParams::border;
 
-    srand(2); // always generate the same stars
+    std::mt19937 star_rng(2); // always generate the same stars
     for (unsigned int i = 0; i < nr_stars; i++)
     {
         // generate stars in ra/dec coordinates
-        stars[i].pos.x = (double)(rand() % (width - 2 * border)) - 0.5 * width;
-        stars[i].pos.y = (double)(rand() % (height - 2 * border)) - 0.5 * height;
-        double r = (double) (rand() % 90) / 3.0; // 0..30
+        stars[i].pos.x = (double)(star_rng() % (width - 2 * border)) - 0.5 * width;
+        stars[i].pos.y = (double)(star_rng() % (height - 2 * border)) - 0.5 * height;
+        double r = (double) (star_rng() % 90) / 3.0; // 0..30
         stars[i].inten = 0.1 + (double) (r * r * r) / 9000.0;
 
         // force a couple stars to be close together. This is a useful test for Star::AutoFind
@@ -589,18 +612,20 @@ void SimCamState::Initialize()
     unsigned int const nr_hot = SimCamParams::nr_hot_pixels;
     hotpx.resize(nr_hot);
     for (unsigned int i = 0; i < nr_hot; i++) {
-        hotpx[i].x = rand() % width;
-        hotpx[i].y = rand() % height;
+        hotpx[i].x = star_rng() % width;
+        hotpx[i].y = star_rng() % height;
     }
-    srand(clock());
+    if (SimCamParams::deterministic)
+        s_rng.seed(SimCamParams::seed);
+    else
+        s_rng.seed((unsigned int) clock());
+    virtual_time = 0;
     ra_ofs = 0.;
     dec_ofs = BacklashVal(SimCamParams::dec_backlash);
     cum_dec_drift = 0.;
     last_exposure_time = 0;
 
-#if SIMMODE == 1
-    dirStarted = false;
-#endif
+    frames.Close();
 
 #ifdef SIM_FILE_DISPLACEMENTS
     pIStream = nullptr;
@@ -640,123 +665,32 @@ void SimCamState::Initialize()
 #endif
 }
 
-#if SIMMODE == 1
 bool SimCamState::ReadNextImage(usImage& img, const wxRect& subframe)
 {
-    wxString filename;
-
-    if (!dir.IsOpened())
+    if (!frames.IsOpen())
     {
-        dir.Open(wxFileName(Debug.GetLogDir(), "sim_images").GetFullPath());
-    }
-    if (dir.IsOpened())
-    {
-        if (!dirStarted)
-        {
-            dir.GetFirst(&filename, "*.fit", wxDIR_FILES);
-            dirStarted = true;
-        }
-        else
-        {
-            if (!dir.GetNext(&filename))
-                dir.GetFirst(&filename, "*.fit", wxDIR_FILES);
-        }
-    }
-    if (filename.IsEmpty())
-    {
-        return true;
-    }
+        wxString dir = SimCamParams::replay_dir;
+        if (dir.empty())
+            dir = wxFileName(Debug.GetLogDir(), "sim_images").GetFullPath();
 
-    Debug.Write("Sim file opened: " + filename + "\n");
-    fitsfile *fptr;  // FITS file pointer
-    int status = 0;  // CFITSIO status value MUST be initialized to zero!
-
-    if (PHD_fits_open_diskfile(&fptr, wxFileName(dir.GetName(), filename).GetFullPath(), READONLY, &status))
-        return true;
-
-    int hdutype;
-    if (fits_get_hdu_type(fptr, &hdutype, &status) || hdutype != IMAGE_HDU)
-    {
-        pFrame->Alert(_("FITS file is not of an image"));
-        PHD_fits_close_file(fptr);
-        return true;
-    }
-
-    int naxis;
-    fits_get_img_dim(fptr, &naxis, &status);
-
-    int nhdus;
-    fits_get_num_hdus(fptr, &nhdus, &status);
-    if ((nhdus != 1) || (naxis != 2)) {
-        pFrame->Alert(_("Unsupported type or read error loading FITS file"));
-        PHD_fits_close_file(fptr);
-        return true;
-    }
-
-    long fits_size[2];
-    fits_get_img_size(fptr, 2, fits_size, &status);
-
-    int xsize = (int) fits_size[0];
-    int ysize = (int) fits_size[1];
-
-    if (img.Init(xsize, ysize)) {
-        pFrame->Alert(_("Memory allocation error"));
-        PHD_fits_close_file(fptr);
-        return true;
+        if (frames.Open(dir))
+            return true;
     }
 
-    unsigned short *buf = new unsigned short[img.NPixels];
-    bool useSubframe = !subframe.IsEmpty();
-    wxRect frame;
-    if (useSubframe)
-        frame = subframe;
-    else
-        frame = wxRect(0, 0, xsize, ysize);
-
-    long inc[] = { 1, 1 };
-    long fpixel[] = { frame.GetLeft() + 1, frame.GetTop() + 1 };
-    long lpixel[] = { frame.GetRight() + 1, frame.GetBottom() + 1 };
-    if (fits_read_subset(fptr, TUSHORT, fpixel, lpixel, inc, nullptr, buf, nullptr, &status))
+    if (frames.ReadNext(img, subframe))
     {
         pFrame->Alert(_("Error reading data"));
-        PHD_fits_close_file(fptr);
         return true;
     }
 
-    if (useSubframe)
-    {
-        img.Subframe = subframe;
-
-        // Clear out the image
-        img.Clear();
-
-        int i = 0;
-        for (int y = 0; y < subframe.height; y++)
-        {
-            unsigned short *dst = img.ImageData + (y + subframe.y) * xsize + subframe.x;
-            for (int x = 0; x < subframe.width; x++, i++)
-                *dst++ = (unsigned short) buf[i];
-        }
-    }
-    else
-    {
-        for (unsigned int i = 0; i < img.NPixels; i++)
-            img.ImageData[i] = (unsigned short) buf[i];
-    }
-
-    delete[] buf;
-
-    PHD_fits_close_file(fptr);
-
     return false;
 }
-#endif // SIMMODE == 1
 
 // get a pair of normally-distributed independent random values - Box-Muller algorithm, sigma=1
 static void rand_normal(double r[2])
 {
-    double u = (double) rand() / RAND_MAX;
-    double v = (double) rand() / RAND_MAX;
+    double u = (s_rng() + 1.0) / 4294967296.0; // (0, 1]
+    double v = s_rng() / 4294967296.0;
     double const a = sqrt(-2.0 * log(u));
     double const p = 2 * M_PI * v;
     r[0] = a * cos(p);
@@ -903,7 +837,7 @@ static void render_clouds(usImage& img, const wxRect& subframe, int exptime, int
     {
         unsigned short *const end = p0 + subframe.GetWidth();
         for (unsigned short *p = p0; p < end; p++)
-            *p = (unsigned short) (SimCamParams::clouds_inten * ((double) gain / 10.0 * offset * exptime / 100.0 + ((rand() % (gain * 100)) / 30.0)));
+            *p = (unsigned short) (SimCamParams::clouds_inten * ((double) gain / 10.0 * offset * exptime / 100.0 + (sim_rand(gain * 100) / 30.0)));
     }
 }
 
@@ -1001,7 +935,7 @@ void SimCamState::FillImage(usImage& img, const wxRect& subframe, int exptime, i
 
 #else // SIM_FILE_DISPLACEMENTS
 
-    long const cur_time = timer.Time();
+    long const cur_time = Now();
     long const delta_time_ms = last_exposure_time - cur_time;
     last_exposure_time = cur_time;
 
@@ -1135,7 +1069,7 @@ void SimCamState::FillImage(usImage& img, const wxRect& subframe, int exptime, i
         {
             double star = stars[i].inten * exptime * gain;
             double dark = (double) gain / 10.0 * offset * exptime / 100.0;
-            double noise = (double)(rand() % (gain * 100));
+            double noise = (double) sim_rand(gain * 100);
             double inten = star + dark + noise;
 
             render_star(img, pCamera->Binning, subframe, cc[i], inten);
@@ -1152,7 +1086,7 @@ void SimCamState::FillImage(usImage& img, const wxRect& subframe, int exptime, i
             double inten = 3.0;
             double star = inten * exptime * gain;
             double dark = (double) gain / 10.0 * offset * exptime / 100.0;
-            double noise = (double)(rand() % (gain * 100));
+            double noise = (double) sim_rand(gain * 100);
             inten = star + dark + noise;
 
             render_comet(img, pCamera->Binning, subframe, wxRealPoint(cx, cy), inten);
@@ -1195,6 +1129,7 @@ public:
     bool     ST4PulseGuideScope(int direction, int duration) override;
     PierSide SideOfPier() const;
     void     FlipPierSide();
+    long     SimulatedTimeMs() const { return sim.Now(); }
 };
 
 CameraSimulator::CameraSimulator()
@@ -1309,7 +1244,7 @@ static void fill_noise(usImage& img, const wxRect& subframe, int exptime, int ga
     {
         unsigned short *const end = p0 + subframe.GetWidth();
         for (unsigned short *p = p0; p < end; p++)
-            *p = (unsigned short) (SimCamParams::noise_multiplier * ((double) gain / 10.0 * offset * exptime / 100.0 + (rand() % (gain * 100))));
+            *p = (unsigned short) (SimCamParams::noise_multiplier * ((double) gain / 10.0 * offset * exptime / 100.0 + sim_rand(gain * 100)));
     }
 }
 #endif // SIMMODE == 3
@@ -1321,7 +1256,11 @@ bool CameraSimulator::Capture(int duration, usImage& img, int options, const wxR
 
     // sleep before rendering the image so that any changes made in the middle of a long exposure (e.g. manual guide pulse) shows up in the image
 
-    if (duration > 5)
+    if (SimCamParams::virtual_clock)
+    {
+        sim.virtual_time += duration;
+    }
+    else if (duration > 5)
     {
         if (WorkerThread::MilliSleep(duration - 5, WorkerThread::INT_ANY))
             return true;
@@ -1333,50 +1272,63 @@ bool CameraSimulator::Capture(int duration, usImage& img, int options, const wxR
     }
 
 #if SIMMODE == 1
+    bool const replay = true;
+#else
+    bool const replay = !SimCamParams::replay_dir.empty();
+#endif
 
-    if (!UseSubframes)
-        subframe = wxRect();
-
-    if (sim.ReadNextImage(img, subframe))
-        return true;
-
-    FullSize = img.Size;
+    if (replay)
+    {
+        if (!UseSubframes)
+            subframe = wxRect();
 
-#else
+        if (sim.ReadNextImage(img, subframe))
+            return true;
 
-    int width = sim.width / Binning;
-    int height = sim.height / Binning;
-    FullSize = wxSize(width, height);
+        FullSize = img.Size;
+    }
+#if SIMMODE == 3
+    else
+    {
+        int width = sim.width / Binning;
+        int height = sim.height / Binning;
+        FullSize = wxSize(width, height);
 
-    bool usingSubframe = UseSubframes;
-    if (subframe.width <= 0 || subframe.height <= 0 || subframe.GetRight() >= width || subframe.GetBottom() >= height)
-        usingSubframe = false;
-    if (!usingSubframe)
-        subframe = wxRect(0, 0, FullSize.GetWidth(), FullSize.GetHeight());
+        bool usingSubframe = UseSubframes;
+        if (subframe.width <= 0 || subframe.height <= 0 || subframe.GetRight() >= width || subframe.GetBottom() >= height)
+            usingSubframe = false;
+        if (!usingSubframe)
+            subframe = wxRect(0, 0, FullSize.GetWidth(), FullSize.GetHeight());
 
-    int const exptime = duration;
-    int const gain = 30;
-    int const offset = 100;
+        int const exptime = duration;
+        int const gain = 30;
+        int const offset = 100;
 
-    if (img.Init(FullSize))
-    {
-        pFrame->Alert(_("Memory allocation error"));
-        return true;
-    }
+        if (img.Init(FullSize))
+        {
+            pFrame->Alert(_("Memory allocation error"));
+            return true;
+        }
 
-    if (usingSubframe)
-        img.Clear();
+        if (usingSubframe)
+            img.Clear();
 
-    fill_noise(img, subframe, exptime, gain, offset);
+        fill_noise(img, subframe, exptime, gain, offset);
 
-    sim.FillImage(img, subframe, exptime, gain, offset);
+        sim.FillImage(img, subframe, exptime, gain, offset);
 
-    if (usingSubframe)
-        img.Subframe = subframe;
+        if (usingSubframe)
+            img.Subframe = subframe;
 
-    if (options & CAPTURE_SUBTRACT_DARK) SubtractDark(img);
+        if (options & CAPTURE_SUBTRACT_DARK) SubtractDark(img);
+    }
+#endif // SIMMODE == 3
 
-#endif // SIMMODE == 1
+    if (SimCamParams::virtual_clock)
+    {
+        sim.virtual_time += SimCamParams::frame_download_ms;
+        return false;
+    }
 
     unsigned int tot_dur = duration + SimCamParams::frame_download_ms;
     long elapsed = watchdog.Time();
@@ -1431,7 +1383,10 @@ bool CameraSimulator::ST4PulseGuideScope(int direction, int duration)
     case SOUTH:   sim.dec_ofs.incr(-d); break;
     default: return true;
     }
-    WorkerThread::MilliSleep(duration, WorkerThread::INT_ANY);
+    if (SimCamParams::virtual_clock)
+        sim.virtual_time += duration;
+    else
+        WorkerThread::MilliSleep(duration, WorkerThread::INT_ANY);
     return false;
 }
 
@@ -1489,7 +1444,8 @@ PierSide CameraSimulator::SideOfPier() const
 
 bool CameraSimulator::ST4SynchronousOnly()
 {
-    return !SimCamParams::allow_async_st4;
+    // asynchronous pulses overlap the exposure and make a deterministic run depend on thread scheduling
+    return !SimCamParams::allow_async_st4 || SimCamParams::deterministic;
 }
 
 static PierSide OtherSide(PierSide side)
@@ -1509,6 +1465,7 @@ bool CameraSimulator::Capture(int duration, usImage& img, int options, const wxR
     int xsize, ysize;
     //  unsigned short *dataptr;
     //  int i;
+    FitsLock fitsLock;
     fitsfile *fptr;  // FITS file pointer
     int status = 0;  // CFITSIO status value MUST be initialized to zero!
     int hdutype, naxis;
@@ -1967,6 +1924,20 @@ void GearSimulator::FlipPierSide(GuideCamera *camera)
     }
 }
 
+void GearSimulator::SetDeterministic(unsigned int seed, bool virtualClock)
+{
+    SimCamParams::deterministic = true;
+    SimCamParams::seed = seed;
+    SimCamParams::virtual_clock = virtualClock;
+}
+
+long GearSimulator::SimulatedTimeMs(GuideCamera *camera)
+{
+    if (camera && camera->Name == _T("Simulator"))
+        return static_cast<CameraSimulator *>(camera)->SimulatedTimeMs();
+    return 0;
+}
+
 StepGuider *GearSimulator::MakeAOSimulator()
 {
     return new StepGuiderSimulator();
@@ -43,6 +43,11 @@ class GearSimulator
 public:
     static GuideCamera *MakeCamSimulator();
     static void FlipPierSide(GuideCamera *camera);
+    // seed the simulator's random numbers for a replayable run; with virtualClock the
+    // camera and mount do not sleep and a simulated clock advances instead
+    static void SetDeterministic(unsigned int seed, bool virtualClock);
+    // elapsed simulated time since the camera connected, milliseconds
+    static long SimulatedTimeMs(GuideCamera *camera);
     static StepGuider *MakeAOSimulator();
     static Rotator *MakeRotatorSimulator();
 };
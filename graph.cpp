@@ -1484,7 +1484,7 @@ void GraphLogClientWindow::OnPaint(wxPaintEvent& WXUNUSED(evt))
             // show polar alignment error
             if (m_mode == MODE_RADEC && sampling != 1.0 && pMount && pMount->IsDecDrifting())
             {
-                double declination = pPointingSource->GetDeclination();
+                double declination = PointingCache::Get().declination;
                 if (declination == UNKNOWN_DECLINATION) // assume declination 0
                     declination = 0.0;
 
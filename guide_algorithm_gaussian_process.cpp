@@ -72,6 +72,7 @@ static const double DefaultPredictionGain                  = 0.5; // amount of G
 static const double DefaultNoresetMaxPctPeriod = 40.; // max percent of worm period elapsed to skip resetting the model when guiding is stopped and resumed
 
 static const bool   DefaultComputePeriod                 = true;
+static const bool   DefaultIncrementalInference          = false;
 
 static void MakeBold(wxControl *ctrl)
 {
@@ -476,6 +477,10 @@ GuideAlgorithmGaussianProcess::GuideAlgorithmGaussianProcess(Mount *pMount, Guid
 
     bool compute_period = pConfig->Profile.GetBoolean(configPath + "/gp_compute_period", DefaultComputePeriod);
     SetBoolComputePeriod(compute_period);
+
+    bool incremental_inference = pConfig->Profile.GetBoolean(configPath + "/gp_incremental_inference", DefaultIncrementalInference);
+    SetBoolIncrementalInference(incremental_inference);
+
     m_expertDialog = NULL;
     block_updates_ = !(m_pMount->GetGuidingEnabled());
     guiding_ra_ = math_tools::NaN;
@@ -849,6 +854,13 @@ bool GuideAlgorithmGaussianProcess::SetBoolComputePeriod(bool active)
     return true;
 }
 
+bool GuideAlgorithmGaussianProcess::SetBoolIncrementalInference(bool active)
+{
+    GPG->SetBoolIncrementalInference(active);
+    pConfig->Profile.SetBoolean(GetConfigPath() + "/gp_incremental_inference", active);
+    return true;
+}
+
 double GuideAlgorithmGaussianProcess::GetControlGain() const
 {
     return GPG->GetControlGain();
@@ -889,6 +901,11 @@ bool GuideAlgorithmGaussianProcess::GetBoolComputePeriod() const
     return GPG->GetBoolComputePeriod();
 }
 
+bool GuideAlgorithmGaussianProcess::GetBoolIncrementalInference() const
+{
+    return GPG->GetBoolIncrementalInference();
+}
+
 bool GuideAlgorithmGaussianProcess::GetDarkTracking() const
 {
     return dark_tracking_mode_;
@@ -916,6 +933,7 @@ wxString GuideAlgorithmGaussianProcess::GetSettingsSummary() const
       "\tPeriod length periodic kernel = %.3f\n"
       "\tFFT called after = %.3f worm cycles\n"
       "\tAuto-adjust period length = %s\n"
+      "\tIncremental inference = %s\n"
     ;
 
     std::vector<double> hyperparameters = GetGPHyperparameters();
@@ -934,7 +952,8 @@ wxString GuideAlgorithmGaussianProcess::GetSettingsSummary() const
         hyperparameters[SE1KSignalVariance],
         hyperparameters[PKPeriodLength],
         GetPeriodLengthsPeriodEstimation(),
-        GetBoolComputePeriod() ? "On" : "Off");
+        GetBoolComputePeriod() ? "On" : "Off",
+        GetBoolIncrementalInference() ? "On" : "Off");
 }
 
 GUIDE_ALGORITHM GuideAlgorithmGaussianProcess::Algorithm() const
@@ -979,22 +998,13 @@ void GuideAlgorithmGaussianProcess::reset()
 
 static double CurrentRA()
 {
-    if (pPointingSource)
-    {
-        double ra, dec, st;
-        bool err = pPointingSource->GetCoordinates(&ra, &dec, &st);
-        if (!err)
-        {
-            return ra;
-        }
-    }
-
-    return math_tools::NaN;
+    PointingState state = PointingCache::Get();
+    return state.haveCoordinates ? state.ra : math_tools::NaN;
 }
 
 static PierSide CurrentPierSide()
 {
-    return pPointingSource ? pPointingSource->SideOfPier() : PIER_SIDE_UNKNOWN;
+    return PointingCache::Get().pierSide;
 }
 
 inline static wxString FormatRA(double ra)
@@ -144,6 +144,9 @@ protected:
     bool GetBoolComputePeriod() const;
     bool SetBoolComputePeriod(bool);
 
+    bool GetBoolIncrementalInference() const;
+    bool SetBoolIncrementalInference(bool);
+
     std::vector<double> GetGPHyperparameters() const;
     bool SetGPHyperparameters(const std::vector<double>& hyperparameters);
 
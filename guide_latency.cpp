@@ -0,0 +1,241 @@
+/*
+ *  guide_latency.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "phd.h"
+
+#include <chrono>
+
+struct OpenRecord
+{
+    GuideLatency::Record rec;
+    bool valid;
+    long long captureEnd;                   // -1 once the total is taken
+};
+
+static wxCriticalSection s_lock;            // protects everything below
+static OpenRecord s_capture;                // the frame being captured
+static OpenRecord s_proc;                   // the frame being processed
+static GuideLatency::Record s_ring[GuideLatency::RING_SIZE];
+static unsigned int s_ringNext;
+static unsigned int s_ringCount;
+static GuideLatency::Histogram s_hist[GuideLatency::NUM_STAGES];
+
+#ifdef __WINDOWS__
+static long long PerfFrequency()
+{
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    return f.QuadPart;
+}
+static const long long s_perfFreq = PerfFrequency();
+#endif
+
+const char *GuideLatency::StageName(Stage stage)
+{
+    switch (stage)
+    {
+        case CAPTURE:   return "Capture";
+        case DARKS:     return "Darks";
+        case FIND:      return "Find";
+        case ALGORITHM: return "Algorithm";
+        case PULSE:     return "Pulse";
+        case TOTAL:     return "Total";
+        default:        return "Unknown";
+    }
+}
+
+long long GuideLatency::Now()
+{
+#ifdef __WINDOWS__
+    // std::chrono::steady_clock is not steady in VS2013
+    LARGE_INTEGER c;
+    QueryPerformanceCounter(&c);
+    return c.QuadPart / s_perfFreq * 1000000 + c.QuadPart % s_perfFreq * 1000000 / s_perfFreq;
+#else
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static unsigned int Bucket(long long usec)
+{
+    unsigned int b = 0;
+    while (usec > 1 && b < GuideLatency::NUM_BUCKETS - 1)
+    {
+        usec >>= 1;
+        ++b;
+    }
+    return b;
+}
+
+static void Commit(const GuideLatency::Record& rec)
+{
+    for (int i = 0; i < GuideLatency::NUM_STAGES; i++)
+    {
+        long long const usec = rec.usec[i];
+        if (usec < 0)
+            continue;
+
+        GuideLatency::Histogram& h = s_hist[i];
+        ++h.count;
+        h.sum += usec;
+        if (usec > h.max)
+            h.max = usec;
+        ++h.buckets[Bucket(usec)];
+    }
+
+    s_ring[s_ringNext] = rec;
+    s_ringNext = (s_ringNext + 1) % GuideLatency::RING_SIZE;
+    if (s_ringCount < GuideLatency::RING_SIZE)
+        ++s_ringCount;
+}
+
+void GuideLatency::CaptureStarted()
+{
+    wxCriticalSectionLocker lck(s_lock);
+
+    // a capture that never reached the main thread (error or stop) is dropped
+    s_capture.rec.frame = 0;
+    for (int i = 0; i < NUM_STAGES; i++)
+        s_capture.rec.usec[i] = -1;
+    s_capture.valid = true;
+    s_capture.captureEnd = -1;
+}
+
+void GuideLatency::CaptureDone(long long startUsec)
+{
+    long long const now = Now();
+
+    wxCriticalSectionLocker lck(s_lock);
+
+    if (!s_capture.valid)
+        return;
+
+    // dark subtraction happens inside the camera's capture
+    long long const darks = s_capture.rec.usec[DARKS] > 0 ? s_capture.rec.usec[DARKS] : 0;
+    s_capture.rec.usec[CAPTURE] = wxMax(now - startUsec - darks, 0LL);
+    s_capture.captureEnd = now;
+}
+
+void GuideLatency::FrameReceived(int frame)
+{
+    wxCriticalSectionLocker lck(s_lock);
+
+    if (s_proc.valid)
+        Commit(s_proc.rec);
+
+    s_proc = s_capture;
+    s_proc.rec.frame = frame;
+    s_capture.valid = false;
+}
+
+void GuideLatency::Add(Stage stage, long long usec)
+{
+    wxCriticalSectionLocker lck(s_lock);
+
+    OpenRecord& r = stage == CAPTURE || stage == DARKS ? s_capture : s_proc;
+
+    if (!r.valid)
+        return;
+
+    if (r.rec.usec[stage] < 0)
+        r.rec.usec[stage] = usec;
+    else
+        r.rec.usec[stage] += usec;
+}
+
+void GuideLatency::PulseStarted()
+{
+    long long const now = Now();
+
+    wxCriticalSectionLocker lck(s_lock);
+
+    if (s_proc.valid && s_proc.captureEnd >= 0)
+    {
+        s_proc.rec.usec[TOTAL] = now - s_proc.captureEnd;
+        s_proc.captureEnd = -1;
+    }
+}
+
+bool GuideLatency::GetRecord(int frame, Record *rec)
+{
+    wxCriticalSectionLocker lck(s_lock);
+
+    if (s_proc.valid && s_proc.rec.frame == frame)
+    {
+        *rec = s_proc.rec;
+        return true;
+    }
+
+    for (unsigned int i = 1; i <= s_ringCount; i++)
+    {
+        const Record& r = s_ring[(s_ringNext + RING_SIZE - i) % RING_SIZE];
+        if (r.frame == frame)
+        {
+            *rec = r;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void GuideLatency::GetHistograms(Histogram hist[NUM_STAGES], bool reset)
+{
+    wxCriticalSectionLocker lck(s_lock);
+
+    memcpy(hist, s_hist, sizeof(s_hist));
+    if (reset)
+        memset(s_hist, 0, sizeof(s_hist));
+}
+
+bool GuideLatency::LogColumnsEnabled()
+{
+    return pConfig->Global.GetBoolean("/GuideLog/LatencyColumns", false);
+}
+
+wxString GuideLatency::LogColumns(int frame)
+{
+    Record rec;
+    bool const found = GetRecord(frame, &rec);
+
+    wxString s;
+    for (int i = 0; i < NUM_STAGES; i++)
+    {
+        if (i != 0)
+            s += ",";
+        if (found && rec.usec[i] >= 0)
+            s += wxString::Format("%.1f", rec.usec[i] / 1000.0);
+    }
+    return s;
+}
@@ -0,0 +1,121 @@
+/*
+ *  guide_latency.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef GUIDE_LATENCY_H_INCLUDED
+#define GUIDE_LATENCY_H_INCLUDED
+
+//
+// Timing of the stages of the guide cycle, from the start of the capture to
+// the end of the guide pulses for that frame.
+//
+// The stages run on different threads: capture and dark subtraction on a
+// worker thread, star finding on the frame processing thread (plus whatever
+// the main thread adds when it uses the measurement), moves on the worker
+// thread.
+// Capture and dark times go into the record of the frame being captured, and
+// the later stages into the record of the frame being processed. With
+// pipelined capture these are different frames. A frame's record is committed
+// when the next frame arrives. Committed records are kept in a fixed-size
+// ring, and each stage also has a histogram of its durations. All times are
+// in microseconds from a monotonic clock.
+//
+class GuideLatency
+{
+public:
+    enum Stage
+    {
+        CAPTURE,    // camera exposure and download, excluding dark subtraction
+        DARKS,      // dark subtraction or defect removal
+        FIND,       // star measurement
+        ALGORITHM,  // guide algorithms
+        PULSE,      // guide pulses or AO steps
+        TOTAL,      // end of capture to the start of the first guide pulse
+        NUM_STAGES
+    };
+
+    enum
+    {
+        NUM_BUCKETS = 28,   // bucket i counts durations in [2^i, 2^(i+1)) usec, bucket 0 also counts 0
+        RING_SIZE = 128,
+    };
+
+    struct Record
+    {
+        int frame;                      // 0 until the main thread has numbered the frame
+        long long usec[NUM_STAGES];     // -1 if the stage did not run
+    };
+
+    struct Histogram
+    {
+        unsigned int count;
+        long long sum;
+        long long max;
+        unsigned int buckets[NUM_BUCKETS];
+    };
+
+    static const char *StageName(Stage stage);
+
+    static long long Now();
+
+    // worker thread, around the camera capture
+    static void CaptureStarted();
+    static void CaptureDone(long long startUsec);
+
+    // main thread, when the frame arrives
+    static void FrameReceived(int frame);
+
+    static void Add(Stage stage, long long usec);
+    static void PulseStarted();
+
+    // the record for a frame, if it is still in the ring or is being processed
+    static bool GetRecord(int frame, Record *rec);
+    // copy the histograms, and optionally clear them
+    static void GetHistograms(Histogram hist[NUM_STAGES], bool reset);
+
+    // extra columns in the guide log, global setting /GuideLog/LatencyColumns
+    static bool LogColumnsEnabled();
+    // the stage times in milliseconds for a guide log row, in stage order
+    static wxString LogColumns(int frame);
+};
+
+// adds the time from construction to destruction to a stage of the current frame
+class LatencyTimer
+{
+    GuideLatency::Stage m_stage;
+    long long m_start;
+
+public:
+    LatencyTimer(GuideLatency::Stage stage) : m_stage(stage), m_start(GuideLatency::Now()) { }
+    ~LatencyTimer() { GuideLatency::Add(m_stage, GuideLatency::Now() - m_start); }
+};
+
+#endif // GUIDE_LATENCY_H_INCLUDED
@@ -0,0 +1,261 @@
+/*
+ *  guidelog_binary.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "guidelog_binary.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sstream>
+#include <vector>
+
+namespace GuideLogBinary
+{
+
+static const char MAGIC[8] = { 'P', 'H', 'D', '2', 'G', 'L', 'O', 'G' };
+
+static_assert(sizeof(FileHeader) == 16, "FileHeader layout");
+static_assert(sizeof(TextRecord) == 8, "TextRecord layout");
+static_assert(sizeof(StepRecord) == 64, "StepRecord layout");
+static_assert(sizeof(LatencyRecord) == 28, "LatencyRecord layout");
+
+std::string FileHeaderBytes(const std::string& writer)
+{
+    std::ostringstream os;
+    os << "PHD2 binary guide log version " << VERSION << ", written by " << writer << "\n"
+       << "text: type:u8 reserved:u8[3] bytes:u32 text:u8[bytes]\n"
+       << "step: type:u8 flags:u8 raDir:char decDir:char negZero:u16 reserved:u16 frame:i32 timeMs:i32 dx:i32/1000 dy:i32/1000 "
+          "raRaw:i32/1000 decRaw:i32/1000 raGuide:i32/1000 decGuide:i32/1000 raDuration:i32 decDuration:i32 "
+          "starMass:i32 snr:i32/100 errorCode:i32 statusBytes:u32\n"
+       << "drop: step status:u8[statusBytes]\n"
+       << "latency: type:u8 reserved:u8[3] usec:i32[" << LATENCY_STAGES << "]\n";
+    std::string schema = os.str();
+
+    FileHeader hdr;
+    memcpy(hdr.magic, MAGIC, sizeof(hdr.magic));
+    hdr.version = VERSION;
+    hdr.schemaBytes = (uint32_t) schema.size();
+
+    return std::string(reinterpret_cast<const char *>(&hdr), sizeof(hdr)) + schema;
+}
+
+void SetFixed(StepRecord *rec, FixedField field, int32_t *dst, double val, int decimals)
+{
+    // Take the digits from printf rather than rounding val * 10^decimals,
+    // which rounds some values differently (1.0005 prints as "1.000", 2.5
+    // as "2").
+    char buf[64];
+    int const len = snprintf(buf, sizeof(buf), "%.*f", decimals, val);
+
+    const char *p = buf;
+    bool const neg = *p == '-';
+    if (neg)
+        ++p;
+
+    int64_t v = 0;
+    bool overflow = len < 0 || len >= (int) sizeof(buf) || *p == 'i' || *p == 'I';
+    if (*p == 'n' || *p == 'N')
+        p = ""; // nan, stored as 0
+    for (; !overflow && *p; p++)
+    {
+        if (*p == '.')
+            continue;
+        v = v * 10 + (*p - '0');
+        if (v > 2147483647)
+            overflow = true;
+    }
+    if (overflow)
+        v = 2147483647;
+
+    *dst = (int32_t) (neg ? -v : v);
+
+    // the text log shows these as "-0.000"
+    if (v == 0 && neg)
+        rec->negZero |= 1 << field;
+}
+
+double GetFixed(const StepRecord& rec, FixedField field, int32_t src, double scale)
+{
+    if (src == 0 && (rec.negZero & (1 << field)))
+        return -0.0;
+    return src / scale;
+}
+
+// read the rest of a record whose type byte has already been read
+template<typename T>
+static bool ReadRecord(FILE *in, uint8_t type, T *rec)
+{
+    rec->type = type;
+    size_t const len = sizeof(T) - 1;
+    return fread(reinterpret_cast<char *>(rec) + 1, 1, len, in) == len;
+}
+
+static bool ReadText(FILE *in, size_t len, std::vector<char> *buf)
+{
+    buf->resize(len);
+    return len == 0 || fread(&(*buf)[0], 1, len, in) == len;
+}
+
+static void WriteLatency(FILE *out, const LatencyRecord& rec)
+{
+    for (int i = 0; i < LATENCY_STAGES; i++)
+    {
+        if (i != 0)
+            fputc(',', out);
+        if (rec.usec[i] >= 0)
+            fprintf(out, "%.1f", rec.usec[i] / 1000.0);
+    }
+}
+
+bool ConvertToText(FILE *in, FILE *out, std::string *error)
+{
+    FileHeader hdr;
+    if (fread(&hdr, 1, sizeof(hdr), in) != sizeof(hdr) || memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        *error = "not a PHD2 binary guide log";
+        return true;
+    }
+    if (hdr.version != VERSION)
+    {
+        std::ostringstream os;
+        os << "unsupported binary guide log version " << hdr.version;
+        *error = os.str();
+        return true;
+    }
+    if (fseek(in, hdr.schemaBytes, SEEK_CUR) != 0)
+    {
+        *error = "truncated file header";
+        return true;
+    }
+
+    std::vector<char> text;
+
+    for (;;)
+    {
+        int type = fgetc(in);
+        if (type == EOF)
+            break;
+
+        bool ok;
+
+        switch (type)
+        {
+        case REC_TEXT:
+        {
+            TextRecord rec;
+            ok = ReadRecord(in, REC_TEXT, &rec) && ReadText(in, rec.bytes, &text);
+            if (ok && !text.empty())
+                fwrite(&text[0], 1, text.size(), out);
+            break;
+        }
+
+        case REC_STEP:
+        case REC_DROP:
+        {
+            StepRecord rec;
+            ok = ReadRecord(in, (uint8_t) type, &rec) && ReadText(in, rec.statusBytes, &text);
+            if (!ok)
+                break;
+
+            // the same columns GuidingLog::GuideStep and GuidingLog::FrameDropped write
+            if (type == REC_STEP)
+            {
+                fprintf(out, "%d,%.3f,\"%s\",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,",
+                        rec.frame, GetFixed(rec, F_TIME, rec.timeMs, 1000.0),
+                        rec.flags & STEP_AO ? "AO" : "Mount",
+                        GetFixed(rec, F_DX, rec.dx, 1000.0), GetFixed(rec, F_DY, rec.dy, 1000.0),
+                        GetFixed(rec, F_RA_RAW, rec.raRaw, 1000.0), GetFixed(rec, F_DEC_RAW, rec.decRaw, 1000.0),
+                        GetFixed(rec, F_RA_GUIDE, rec.raGuide, 1000.0), GetFixed(rec, F_DEC_GUIDE, rec.decGuide, 1000.0));
+
+                if (rec.flags & STEP_AO)
+                    fprintf(out, ",,,,%d,%d,", rec.raDuration, rec.decDuration);
+                else
+                {
+                    char raDir[2] = { rec.raDir, 0 };
+                    char decDir[2] = { rec.decDir, 0 };
+                    fprintf(out, "%d,%s,%d,%s,,,", rec.raDuration, raDir, rec.decDuration, decDir);
+                }
+
+                fprintf(out, "%.f,%.2f,%d", GetFixed(rec, F_MASS, rec.starMass, 1.0), GetFixed(rec, F_SNR, rec.snr, 100.0), rec.errorCode);
+            }
+            else
+            {
+                fprintf(out, "%d,%.3f,\"DROP\",,,,,,,,,,,,,%.f,%.2f,%d,\"",
+                        rec.frame, GetFixed(rec, F_TIME, rec.timeMs, 1000.0), GetFixed(rec, F_MASS, rec.starMass, 1.0),
+                        GetFixed(rec, F_SNR, rec.snr, 100.0), rec.errorCode);
+                if (!text.empty())
+                    fwrite(&text[0], 1, text.size(), out);
+                fputc('"', out);
+            }
+
+            if (rec.flags & STEP_LATENCY)
+            {
+                LatencyRecord lat;
+                ok = fgetc(in) == REC_LATENCY && ReadRecord(in, REC_LATENCY, &lat);
+                if (!ok)
+                    break;
+                fputs(type == REC_STEP ? ",," : ",", out);
+                WriteLatency(out, lat);
+            }
+
+            fputc('\n', out);
+            break;
+        }
+
+        default:
+        {
+            std::ostringstream os;
+            os << "unknown record type " << type << " at offset " << ftell(in) - 1;
+            *error = os.str();
+            return true;
+        }
+        }
+
+        if (!ok)
+        {
+            *error = "truncated record at end of file";
+            return true;
+        }
+    }
+
+    if (ferror(in) || ferror(out))
+    {
+        *error = "I/O error";
+        return true;
+    }
+
+    return false;
+}
+
+} // namespace GuideLogBinary
@@ -0,0 +1,151 @@
+/*
+ *  guidelog_binary.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef GUIDELOG_BINARY_H_INCLUDED
+#define GUIDELOG_BINARY_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+//
+// Binary guide log format. The file is written alongside the text guide log
+// and holds the same information: the lines of the text log are stored as
+// text records, and guide steps and dropped frames as fixed-width records
+// with the values at the precision the text log prints them. Converting a
+// binary log gives back the text (CSV) guide log.
+//
+// All values are little-endian. This file does not depend on wxWidgets so
+// that it can be built into the converter tool.
+//
+// file layout:
+//   FileHeader
+//   schema text (FileHeader::schemaBytes, UTF-8): the record layouts and the
+//     version of PHD2 that wrote the file
+//   records, each starting with a one byte RecordType
+//
+namespace GuideLogBinary
+{
+    enum { VERSION = 1 };
+
+    enum RecordType
+    {
+        REC_TEXT = 1,       // TextRecord followed by TextRecord::bytes of UTF-8 text
+        REC_STEP = 2,       // StepRecord
+        REC_DROP = 3,       // StepRecord followed by StepRecord::statusBytes of status text
+        REC_LATENCY = 4,    // LatencyRecord, follows a step or drop with STEP_LATENCY set
+    };
+
+    enum StepFlags
+    {
+        STEP_AO = 1,        // raDuration/decDuration are signed AO steps
+        STEP_LATENCY = 2,   // a LatencyRecord follows
+    };
+
+    // the fixed-point fields of a StepRecord
+    enum FixedField
+    {
+        F_TIME,
+        F_DX,
+        F_DY,
+        F_RA_RAW,
+        F_DEC_RAW,
+        F_RA_GUIDE,
+        F_DEC_GUIDE,
+        F_MASS,
+        F_SNR,
+    };
+
+    enum { LATENCY_STAGES = 6 };
+
+    struct FileHeader
+    {
+        char magic[8];              // "PHD2GLOG"
+        uint32_t version;
+        uint32_t schemaBytes;
+    };
+
+    struct TextRecord
+    {
+        uint8_t type;
+        uint8_t reserved[3];
+        uint32_t bytes;
+    };
+
+    struct StepRecord
+    {
+        uint8_t type;
+        uint8_t flags;
+        char raDir;                 // direction letter, 0 for no pulse
+        char decDir;
+        uint16_t negZero;           // FixedField bits: negative values that round to zero
+        uint16_t reserved;
+        int32_t frame;
+        int32_t timeMs;             // time since guiding started
+        int32_t dx;                 // camera offset, 0.001 px
+        int32_t dy;
+        int32_t raRaw;              // mount offset, 0.001 px
+        int32_t decRaw;
+        int32_t raGuide;            // guide distance, 0.001 px
+        int32_t decGuide;
+        int32_t raDuration;         // ms, or AO steps
+        int32_t decDuration;
+        int32_t starMass;
+        int32_t snr;                // 0.01
+        int32_t errorCode;
+        uint32_t statusBytes;
+    };
+
+    struct LatencyRecord
+    {
+        uint8_t type;
+        uint8_t reserved[3];
+        int32_t usec[LATENCY_STAGES];  // -1 if the stage did not run
+    };
+
+    // the file header and schema for a new file
+    std::string FileHeaderBytes(const std::string& writer);
+
+    // store a StepRecord field in fixed point: the digits of val printed with
+    // the given number of decimals, as the text log prints it
+    void SetFixed(StepRecord *rec, FixedField field, int32_t *dst, double val, int decimals);
+    // the value of a fixed-point field
+    double GetFixed(const StepRecord& rec, FixedField field, int32_t src, double scale);
+
+    // convert a binary guide log to the text guide log format; returns true
+    // on error
+    bool ConvertToText(FILE *in, FILE *out, std::string *error);
+}
+
+#endif // GUIDELOG_BINARY_H_INCLUDED
@@ -100,10 +100,16 @@ inline void DeflectionLogger::Log(const PHD_Point&) { }
 static const int DefaultOverlayMode  = OVERLAY_NONE;
 static const bool DefaultScaleImage  = true;
 
+enum
+{
+    LOST_STAR_FLASH_TIMER_ID = 1,
+};
+
 BEGIN_EVENT_TABLE(Guider, wxWindow)
     EVT_PAINT(Guider::OnPaint)
     EVT_CLOSE(Guider::OnClose)
     EVT_ERASE_BACKGROUND(Guider::OnErase)
+    EVT_TIMER(LOST_STAR_FLASH_TIMER_ID, Guider::OnLostStarFlashTimer)
 END_EVENT_TABLE()
 
 static void SaveBookmarks(const std::vector<wxRealPoint>& vec)
@@ -170,6 +176,7 @@ Guider::Guider(wxWindow *parent, int xSize, int ySize) :
     m_measurementMode = false;
     m_searchRegion = 0;
     m_pCurrentImage = new usImage(); // so we always have one
+    m_lostStarFlashTimer.SetOwner(this, LOST_STAR_FLASH_TIMER_ID);
 
     SetOverlayMode(DefaultOverlayMode);
 
@@ -226,6 +233,11 @@ void Guider::LoadProfileSettings()
     }
 }
 
+bool Guider::GetStarSearch(StarSearch *search) const
+{
+    return false;
+}
+
 PauseType Guider::SetPaused(PauseType pause)
 {
     Debug.Write(wxString::Format("Guider::SetPaused(%d)\n", pause));
@@ -411,6 +423,12 @@ void Guider::OnErase(wxEraseEvent& evt)
     evt.Skip();
 }
 
+void Guider::OnLostStarFlashTimer(wxTimerEvent& evt)
+{
+    SetBackgroundColour(m_lostStarPrevColor);
+    Refresh();
+}
+
 void Guider::OnClose(wxCloseEvent& evt)
 {
     Destroy();
@@ -725,6 +743,21 @@ void Guider::UpdateImageDisplay(usImage *pImage)
     Update();
 }
 
+// Like UpdateImageDisplay, but does not wait for the repaint. The window is
+// repainted when the event loop is idle, after OnExposeComplete has returned,
+// so painting a large frame does not delay the guide pulses or the next
+// exposure. If frames arrive faster than they can be painted only the latest
+// is shown.
+void Guider::RefreshImageDisplay(usImage *pImage)
+{
+    Debug.Write(wxString::Format("RefreshImageDisplay: Size=(%d,%d) min=%d, max=%d, FiltMin=%d, FiltMax=%d, Gamma=%.3f\n",
+        pImage->Size.x, pImage->Size.y, pImage->Min, pImage->Max, pImage->FiltMin, pImage->FiltMax, pFrame->Stretch_gamma));
+
+    // the lost star flash repaints when it is done
+    if (!m_lostStarFlashTimer.IsRunning())
+        Refresh();
+}
+
 void Guider::SetDefectMapPreview(const DefectMap *defectMap)
 {
     m_defectMapPreview = defectMap;
@@ -1210,6 +1243,103 @@ void Guider::DisplayImage(usImage *img)
 
 /*************  A new image is ready ************************/
 
+// measure the stars on the thread pool when there are at least this many
+static const size_t MIN_STARS_FOR_PARALLEL = 4;
+
+// everything Star::Find takes from the star it starts from
+static bool SameStar(const Star& a, const Star& b)
+{
+    return a.IsValid() == b.IsValid() && a.X == b.X && a.Y == b.Y && a.Mass == b.Mass && a.SNR == b.SNR &&
+        a.HFD == b.HFD && a.PeakVal == b.PeakVal && a.GetError() == b.GetError();
+}
+
+bool StarSearch::operator==(const StarSearch& rhs) const
+{
+    if (searchRegion != rhs.searchRegion || mode != rhs.mode || minHFD != rhs.minHFD ||
+        saturation != rhs.saturation || stars.size() != rhs.stars.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < stars.size(); i++)
+        if (!SameStar(stars[i], rhs.stars[i]))
+            return false;
+
+    return true;
+}
+
+void StarMeasurement::Measure(const usImage *img, const StarSearch& starSearch)
+{
+    long long const start = GuideLatency::Now();
+
+    image = img;
+    search = starSearch;
+    stars = search.stars;
+    found.assign(stars.size(), 0);
+
+    auto measure = [this](unsigned int i) {
+        found[i] = stars[i].Find(image, search.searchRegion, search.mode, search.minHFD, search.saturation);
+    };
+
+    if (stars.size() >= MIN_STARS_FOR_PARALLEL)
+        ThreadPool::Get()->ParallelFor((unsigned int) stars.size(), measure);
+    else
+    {
+        for (unsigned int i = 0; i < stars.size(); i++)
+            measure(i);
+    }
+
+    usec = GuideLatency::Now() - start;
+}
+
+void Guider::MeasureStars(const usImage *pImage, const StarSearch& search, StarMeasurement *meas)
+{
+    if (m_frameMeasurement.image == pImage && m_frameMeasurement.search == search)
+    {
+        // copied so the slot's buffers go back to the pipeline with the next frame
+        *meas = m_frameMeasurement;
+        GuideLatency::Add(GuideLatency::FIND, meas->usec);
+    }
+    else
+    {
+        if (m_frameMeasurement.image == pImage)
+            Debug.Write("MeasureStars: star search changed since the frame was processed, measure again\n");
+        meas->Measure(pImage, search);
+    }
+
+    m_frameMeasurement.image = nullptr;
+}
+
+// With pipelined capture the next exposure starts before the guide pulses for
+// the current frame are sent, so the star moves during that exposure and the
+// measured centroid only reflects part of the correction. Add back the part not
+// yet seen, in proportion to how far into the exposure the pulses were.
+static void CompensatePipelinedOffset(const usImage *img, GuiderOffset *ofs)
+{
+    const GuidePulseInfo& pulse = pMount->LastGuidePulse();
+
+    if (!pulse.mountMove.IsValid() || !img->ImgStartTime.IsValid() || img->ImgExpDur <= 0)
+        return;
+
+    double const mid = (pulse.start.ToDouble() + pulse.end.ToDouble()) / 2.0;
+    double frac = (mid - img->ImgStartTime.GetValue().ToDouble()) / img->ImgExpDur;
+    if (frac <= 0.0)
+        return; // the correction was complete before the exposure started
+    if (frac > 1.0)
+        frac = 1.0;
+
+    PHD_Point cameraMove;
+    if (pMount->TransformMountCoordinatesToCameraCoordinates(pulse.mountMove, cameraMove, false))
+        return;
+
+    // the correction moves the star against the offset it corrected
+    ofs->cameraOfs.SetXY(ofs->cameraOfs.X - frac * cameraMove.X, ofs->cameraOfs.Y - frac * cameraMove.Y);
+    ofs->mountOfs.Invalidate(); // recomputed by the move
+
+    Debug.Write(wxString::Format("pipelined capture: frame %u pulse at %.2f of exposure, offset adjusted by (%.2f, %.2f)\n",
+        img->FrameNum, frac, -frac * cameraMove.X, -frac * cameraMove.Y));
+}
+
 void Guider::UpdateGuideState(usImage *pImage, bool bStopping)
 {
     wxString statusMessage;
@@ -1258,7 +1388,8 @@ void Guider::UpdateGuideState(usImage *pImage, bool bStopping)
             throw THROW_INFO("Stopped Guiding");
         }
 
-        assert(!pMount || !pMount->IsBusy());
+        // with pipelined capture the guide step for the previous frame can still be in progress
+        assert(!pMount || !pMount->IsBusy() || pFrame->GetPipelinedCapture());
 
         // shift lock position
         if (LockPosShiftEnabled() && IsGuiding())
@@ -1274,8 +1405,14 @@ void Guider::UpdateGuideState(usImage *pImage, bool bStopping)
 
         GuiderOffset ofs;
         FrameDroppedInfo info;
+        bool lost;
+
+        {
+            LatencyTimer timer(GuideLatency::FIND);
+            lost = UpdateCurrentPosition(pImage, &ofs, &info);    // true means error
+        }
 
-        if (UpdateCurrentPosition(pImage, &ofs, &info))           // true means error
+        if (lost)
         {
             info.frameNumber = pImage->FrameNum;
             info.time = pFrame->TimeSinceGuidingStarted();
@@ -1307,19 +1444,22 @@ void Guider::UpdateGuideState(usImage *pImage, bool bStopping)
                     GuideLog.FrameDropped(info);
                     EvtServer.NotifyStarLost(info);
                     GuidingAssistant::NotifyFrameDropped(info);
+                    SimBenchmark::NotifyFrameDropped(info);
                     pFrame->pGraphLog->AppendData(info);
 
                     // allow guide algorithms to attempt dead reckoning
                     static GuiderOffset ZERO_OFS;
                     pFrame->SchedulePrimaryMove(pMount, ZERO_OFS, MOVEOPTS_DEDUCED_MOVE);
 
-                    wxColor prevColor = GetBackgroundColour();
+                    // flash the background without blocking the guide cycle, the
+                    // timer restores it and repaints the image
+                    if (!m_lostStarFlashTimer.IsRunning())
+                        m_lostStarPrevColor = GetBackgroundColour();
                     SetBackgroundColour(wxColour(64,0,0));
                     ClearBackground();
                     if (pFrame->GetBeepForLostStar())
                         wxBell();
-                    wxMilliSleep(100);
-                    SetBackgroundColour(prevColor);
+                    m_lostStarFlashTimer.StartOnce(100);
                     break;
                 }
 
@@ -1476,9 +1616,16 @@ void Guider::UpdateGuideState(usImage *pImage, bool bStopping)
                 {
                     GuidingAssistant::NotifyBacklashStep(CurrentPosition());
                 }
+                else if (pFrame->GetPipelinedCapture() && pMount->IsBusy())
+                {
+                    // pipelined capture: the frame came in before the previous guide step finished
+                    Debug.Write(wxString::Format("pipelined capture: mount busy, no guide step for frame %u\n", pImage->FrameNum));
+                }
                 else
                 {
                     // ordinary guide step
+                    if (pFrame->GetPipelinedCapture())
+                        CompensatePipelinedOffset(pImage, &ofs);
                     s_deflectionLogger.Log(CurrentPosition());
                     pFrame->SchedulePrimaryMove(pMount, ofs, MOVEOPTS_GUIDE_STEP);
                 }
@@ -1509,7 +1656,9 @@ void Guider::UpdateGuideState(usImage *pImage, bool bStopping)
 
     pFrame->UpdateButtonsStatus();
 
-    UpdateImageDisplay(pImage);
+    EvtServer.NotifyStarImage(pImage, CurrentPosition());
+
+    RefreshImageDisplay(pImage);
 
     Debug.AddLine("UpdateGuideState exits: " + statusMessage);
 }
@@ -1605,7 +1754,7 @@ void Guider::UpdateLockPosShiftCameraCoords()
                 // account for scope declination
                 if (pPointingSource)
                 {
-                    double dec = pPointingSource->GetDeclination();
+                    double dec = PointingCache::Get().declination;
                     if (dec != UNKNOWN_DECLINATION)
                     {
                         radec_rates.X *= cos(dec);
@@ -104,6 +104,35 @@ struct LockPosShiftParams
     bool shiftIsMountCoords;
 };
 
+// The stars a guider measures in each frame and the parameters they are
+// measured with
+struct StarSearch
+{
+    std::vector<Star> stars;    // starting positions, the primary star first
+    int searchRegion;
+    Star::FindMode mode;
+    double minHFD;
+    unsigned short saturation;
+
+    StarSearch() : searchRegion(0), mode(Star::FIND_CENTROID), minHFD(0.0), saturation(0) { }
+    bool operator==(const StarSearch& rhs) const;
+};
+
+// The result of measuring the stars of a StarSearch in a frame. The frame
+// processing stage (FramePipeline) measures each frame with the search the
+// guider published last, off the main thread.
+struct StarMeasurement
+{
+    const usImage *image;       // null if the frame was not measured
+    StarSearch search;
+    std::vector<Star> stars;    // in the order of search.stars
+    std::vector<char> found;
+    long long usec;             // time taken to measure the stars
+
+    StarMeasurement() : image(nullptr), usec(0) { }
+    void Measure(const usImage *img, const StarSearch& starSearch);
+};
+
 class DefectMap;
 
 /*
@@ -166,6 +195,9 @@ class Guider : public wxWindow
     bool m_measurementMode;
     double m_minStarHFD;
     unsigned int m_autoSelDownsample;  // downsample factor for star auto-selection, 0=Auto
+    wxTimer m_lostStarFlashTimer;      // restores the background after the lost star flash
+    wxColour m_lostStarPrevColor;
+    StarMeasurement m_frameMeasurement; // made by the frame processing stage for the incoming frame
 
 protected:
     int m_searchRegion; // how far u/d/l/r do we do the initial search for a star
@@ -203,6 +235,9 @@ protected:
     bool PaintHelper(wxAutoBufferedPaintDCBase& dc, wxMemoryDC& memDC);
     void SetState(GUIDER_STATE newState);
     void UpdateCurrentDistance(double distance, double distanceRA);
+    // measure the stars of search in pImage, using the frame processing
+    // stage's measurement if it was made from the same search
+    void MeasureStars(const usImage *pImage, const StarSearch& search, StarMeasurement *meas);
 
     void ToggleBookmark(const wxRealPoint& pt);
 
@@ -217,7 +252,9 @@ public:
     bool IsGuiding() const;
     void OnClose(wxCloseEvent& evt);
     void OnErase(wxEraseEvent& evt);
+    void OnLostStarFlashTimer(wxTimerEvent& evt);
     void UpdateImageDisplay(usImage *pImage = nullptr);
+    void RefreshImageDisplay(usImage *pImage);
 
     bool MoveLockPosition(const PHD_Point& mountDelta);
     bool SetLockPosition(const PHD_Point& position);
@@ -245,6 +282,7 @@ public:
     void StartGuiding();
     void StopGuiding();
     void UpdateGuideState(usImage *pImage, bool bStopping=false);
+    StarMeasurement *FrameMeasurement();
     void DisplayImage(usImage *img);
 
     bool SetScaleImage(bool newScaleValue);
@@ -276,6 +314,8 @@ private:
     virtual void InvalidateLockPosition();
 public:
     virtual void LoadProfileSettings();
+    // the stars to measure in the next frame; false if no star is selected
+    virtual bool GetStarSearch(StarSearch *search) const;
 
     // pure virtual functions -- these MUST be overridden by a subclass
 public:
@@ -324,6 +364,11 @@ inline PauseType Guider::GetPauseType() const
     return m_paused;
 }
 
+inline StarMeasurement *Guider::FrameMeasurement()
+{
+    return &m_frameMeasurement;
+}
+
 inline OVERLAY_MODE Guider::GetOverlayMode() const
 {
     return m_overlayMode;
@@ -0,0 +1,464 @@
+/*
+ *  guider_multistar.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "phd.h"
+
+#include <algorithm>
+
+enum
+{
+    MIN_MAX_STARS = 2,
+    DEFAULT_MAX_STARS = 9,
+    MAX_MAX_STARS = 20,
+};
+
+// stop tracking a secondary star after this many consecutive frames without it
+static const unsigned int MAX_SECONDARY_MISSES = 10;
+// below this many stars there is not enough information to reject outliers, so
+// the primary star is used alone
+static const unsigned int MIN_STARS_FOR_AVERAGE = 3;
+
+GuiderMultiStar::GuiderMultiStar(wxWindow *parent)
+    : GuiderOneStar(parent),
+      m_primaryFound(false),
+      m_starsUsed(0),
+      m_multiStarEnabled(false),
+      m_maxStars(DEFAULT_MAX_STARS)
+{
+}
+
+GuiderMultiStar::~GuiderMultiStar()
+{
+}
+
+void GuiderMultiStar::LoadProfileSettings()
+{
+    GuiderOneStar::LoadProfileSettings();
+
+    bool enabled = pConfig->Profile.GetBoolean("/guider/multistar/Enabled", false);
+    SetMultiStarEnabled(enabled);
+
+    int maxStars = pConfig->Profile.GetInt("/guider/multistar/MaxStars", DEFAULT_MAX_STARS);
+    SetMaxStars(maxStars);
+}
+
+void GuiderMultiStar::SetMultiStarEnabled(bool enable)
+{
+    m_multiStarEnabled = enable;
+    pConfig->Profile.SetBoolean("/guider/multistar/Enabled", enable);
+
+    if (!enable)
+        ClearSecondaryStars();
+}
+
+bool GuiderMultiStar::SetMaxStars(int maxStars)
+{
+    bool bError = false;
+
+    try
+    {
+        if (maxStars < MIN_MAX_STARS)
+        {
+            throw ERROR_INFO("Invalid maxStars");
+        }
+
+        if (maxStars > MAX_MAX_STARS)
+        {
+            throw ERROR_INFO("Invalid maxStars");
+        }
+
+        m_maxStars = maxStars;
+    }
+    catch (const wxString& Msg)
+    {
+        POSSIBLY_UNUSED(Msg);
+        bError = true;
+        m_maxStars = DEFAULT_MAX_STARS;
+    }
+
+    pConfig->Profile.SetInt("/guider/multistar/MaxStars", m_maxStars);
+
+    if (m_secondaries.size() >= (size_t) m_maxStars)
+        m_secondaries.resize(m_maxStars - 1);
+
+    return bError;
+}
+
+void GuiderMultiStar::ClearSecondaryStars()
+{
+    m_secondaries.clear();
+    m_starsUsed = 0;
+}
+
+void GuiderMultiStar::InvalidateCurrentPosition(bool fullReset)
+{
+    ClearSecondaryStars();
+    GuiderOneStar::InvalidateCurrentPosition(fullReset);
+}
+
+bool GuiderMultiStar::SetCurrentPosition(const usImage *pImage, const PHD_Point& position)
+{
+    // a manually selected star is guided on by itself
+    ClearSecondaryStars();
+    return GuiderOneStar::SetCurrentPosition(pImage, position);
+}
+
+bool GuiderMultiStar::AutoFindStar(const usImage& image, int edgeAllowance, const wxRect& roi, Star *star)
+{
+    m_candidates.clear();
+
+    if (!m_multiStarEnabled)
+        return GuiderOneStar::AutoFindStar(image, edgeAllowance, roi, star);
+
+    return star->AutoFind(image, edgeAllowance, m_searchRegion, roi, m_candidates, m_maxStars);
+}
+
+bool GuiderMultiStar::AutoSelect(const wxRect& roi)
+{
+    ClearSecondaryStars();
+
+    bool error = GuiderOneStar::AutoSelect(roi);
+
+    if (!error && m_multiStarEnabled && m_candidates.size() > 1)
+    {
+        const usImage *image = CurrentImage();
+        double minSeparation = 2.0 * m_searchRegion + 1.0;
+
+        // the first candidate is the primary star
+        for (auto it = m_candidates.begin() + 1; it != m_candidates.end(); ++it)
+        {
+            SecondaryStar sec;
+            if (!sec.star.Find(image, m_searchRegion, ROUND(it->X), ROUND(it->Y), Star::FIND_CENTROID, GetMinStarHFD(),
+                               pCamera->GetSaturationADU()))
+            {
+                continue;
+            }
+
+            // search regions must not overlap or two entries could lock on to the same star
+            bool tooClose = sec.star.Distance(m_star) < minSeparation;
+            for (auto s = m_secondaries.begin(); !tooClose && s != m_secondaries.end(); ++s)
+                tooClose = sec.star.Distance(s->star) < minSeparation;
+            if (tooClose)
+            {
+                Debug.Write(wxString::Format("MultiStar: skip star at (%.1f, %.1f), too close to another star\n",
+                                             sec.star.X, sec.star.Y));
+                continue;
+            }
+
+            sec.refOffset = sec.star - m_star;
+            sec.misses = 0;
+            sec.found = true;
+            m_secondaries.push_back(sec);
+        }
+
+        Debug.Write(wxString::Format("MultiStar: selected primary star at (%.1f, %.1f) and %u secondary stars\n",
+                                     m_star.X, m_star.Y, (unsigned int) m_secondaries.size()));
+
+        UpdateImageDisplay();
+    }
+
+    m_candidates.clear();
+
+    return error;
+}
+
+// each secondary star starts from its last known position
+void GuiderMultiStar::AddSecondaryStars(StarSearch *search) const
+{
+    for (auto it = m_secondaries.begin(); it != m_secondaries.end(); ++it)
+        search->stars.push_back(it->star);
+}
+
+bool GuiderMultiStar::GetStarSearch(StarSearch *search) const
+{
+    if (!GuiderOneStar::GetStarSearch(search))
+        return false;
+
+    AddSecondaryStars(search);
+    return true;
+}
+
+bool GuiderMultiStar::FindGuideStar(const usImage *pImage, Star *newStar)
+{
+    if (m_secondaries.empty())
+    {
+        m_primaryFound = GuiderOneStar::FindGuideStar(pImage, newStar);
+        return m_primaryFound;
+    }
+
+    // index 0 is the primary star
+    StarSearch search;
+    InitStarSearch(*newStar, &search);
+    AddSecondaryStars(&search);
+
+    StarMeasurement meas;
+    MeasureStars(pImage, search, &meas);
+
+    *newStar = meas.stars[0];
+    m_primaryFound = meas.found[0] != 0;
+
+    for (size_t i = 0; i < m_secondaries.size(); i++)
+    {
+        SecondaryStar& sec = m_secondaries[i];
+        sec.found = meas.found[i + 1] != 0;
+        if (sec.found)
+        {
+            sec.star = meas.stars[i + 1];
+            sec.misses = 0;
+        }
+        else
+        {
+            sec.star.SetError(meas.stars[i + 1].GetError());
+            ++sec.misses;
+        }
+    }
+
+    size_t count = m_secondaries.size();
+    m_secondaries.erase(std::remove_if(m_secondaries.begin(), m_secondaries.end(),
+                                       [](const SecondaryStar& s) { return s.misses > MAX_SECONDARY_MISSES; }),
+                        m_secondaries.end());
+    if (m_secondaries.size() != count)
+    {
+        Debug.Write(wxString::Format("MultiStar: dropped %u lost secondary stars, %u remain\n",
+                                     (unsigned int) (count - m_secondaries.size()), (unsigned int) m_secondaries.size()));
+    }
+
+    return m_primaryFound;
+}
+
+static double Median(std::vector<double>& v)
+{
+    size_t n = v.size() / 2;
+    std::nth_element(v.begin(), v.begin() + n, v.end());
+    double m = v[n];
+    if (v.size() % 2 == 0)
+        m = 0.5 * (m + *std::max_element(v.begin(), v.begin() + n));
+    return m;
+}
+
+// Weight for averaging star offsets. Centroid noise has a seeing component
+// common to all stars and a shot-noise component that grows as the SNR drops,
+// so bright stars get equal weight and faint stars are de-weighted.
+inline static double StarWeight(const Star& star)
+{
+    static const double SNR_KNEE = 10.0;
+    double snr = std::max(star.SNR, 1.0);
+    return 1.0 / (1.0 + (SNR_KNEE / snr) * (SNR_KNEE / snr));
+}
+
+PHD_Point GuiderMultiStar::CameraOffset(const PHD_Point& lockPos)
+{
+    PHD_Point primaryOfs = GuiderOneStar::CameraOffset(lockPos);
+
+    m_starsUsed = 1;
+
+    if (m_secondaries.empty())
+        return primaryOfs;
+
+    struct Offset
+    {
+        PHD_Point ofs;
+        double weight;
+    };
+    std::vector<Offset> offsets;
+    offsets.reserve(m_secondaries.size() + 1);
+
+    Offset o;
+    o.ofs = primaryOfs;
+    o.weight = StarWeight(m_star);
+    offsets.push_back(o);
+
+    for (auto it = m_secondaries.begin(); it != m_secondaries.end(); ++it)
+    {
+        if (!it->found)
+            continue;
+        o.ofs = it->star - (lockPos + it->refOffset);
+        o.weight = StarWeight(it->star);
+        offsets.push_back(o);
+    }
+
+    if (offsets.size() < MIN_STARS_FOR_AVERAGE)
+        return primaryOfs;
+
+    // reject stars whose offsets are far from the median offset
+    std::vector<double> tmp(offsets.size());
+    for (size_t i = 0; i < offsets.size(); i++)
+        tmp[i] = offsets[i].ofs.X;
+    double medX = Median(tmp);
+    for (size_t i = 0; i < offsets.size(); i++)
+        tmp[i] = offsets[i].ofs.Y;
+    double medY = Median(tmp);
+
+    PHD_Point median(medX, medY);
+    std::vector<double> dist(offsets.size());
+    for (size_t i = 0; i < offsets.size(); i++)
+        dist[i] = offsets[i].ofs.Distance(median);
+    tmp = dist;
+    double mad = Median(tmp);
+
+    static const double MIN_REJECT_DISTANCE = 0.5; // pixels
+    double threshold = std::max(3.0 * mad, MIN_REJECT_DISTANCE);
+
+    double sumw = 0.0, sumx = 0.0, sumy = 0.0;
+    unsigned int used = 0;
+    for (size_t i = 0; i < offsets.size(); i++)
+    {
+        if (dist[i] > threshold)
+            continue;
+        sumw += offsets[i].weight;
+        sumx += offsets[i].weight * offsets[i].ofs.X;
+        sumy += offsets[i].weight * offsets[i].ofs.Y;
+        ++used;
+    }
+
+    if (used < MIN_STARS_FOR_AVERAGE || sumw <= 0.0)
+        return primaryOfs;
+
+    m_starsUsed = used;
+    PHD_Point ofs(sumx / sumw, sumy / sumw);
+
+    Debug.Write(wxString::Format("MultiStar: used %u of %u stars, offset (%.2f, %.2f) primary (%.2f, %.2f)\n",
+                                 used, (unsigned int) offsets.size(), ofs.X, ofs.Y, primaryOfs.X, primaryOfs.Y));
+
+    return ofs;
+}
+
+inline static wxRect SubframeRect(const PHD_Point& pos, int halfwidth)
+{
+    return wxRect(ROUND(pos.X) - halfwidth,
+                  ROUND(pos.Y) - halfwidth,
+                  2 * halfwidth + 1,
+                  2 * halfwidth + 1);
+}
+
+wxRect GuiderMultiStar::GetBoundingBox()
+{
+    wxRect box = GuiderOneStar::GetBoundingBox();
+
+    if (box.IsEmpty() || m_secondaries.empty())
+        return box;
+
+    // grow the subframe to take in the secondary stars
+    for (auto it = m_secondaries.begin(); it != m_secondaries.end(); ++it)
+        box.Union(SubframeRect(it->star, m_searchRegion));
+    box.Intersect(wxRect(pCamera->FullSize));
+
+    return box;
+}
+
+void GuiderMultiStar::PaintSecondaryStars(wxDC& dc)
+{
+    dc.SetBrush(*wxTRANSPARENT_BRUSH);
+
+    for (auto it = m_secondaries.begin(); it != m_secondaries.end(); ++it)
+    {
+        if (it->found)
+            dc.SetPen(wxPen(wxColour(0, 160, 255), 1, wxPENSTYLE_SOLID));
+        else
+            dc.SetPen(wxPen(wxColour(230, 130, 30), 1, wxPENSTYLE_DOT));
+
+        wxPoint p(ROUND(it->star.X * m_scaleFactor), ROUND(it->star.Y * m_scaleFactor));
+        dc.DrawCircle(p, ROUND(m_searchRegion * m_scaleFactor / 2.0));
+    }
+}
+
+wxString GuiderMultiStar::GetSettingsSummary() const
+{
+    wxString s = GuiderOneStar::GetSettingsSummary();
+
+    if (m_multiStarEnabled)
+        s += wxString::Format(_T("Multi-star guiding = enabled, max stars = %d\n"), m_maxStars);
+    else
+        s += _T("Multi-star guiding = disabled\n");
+
+    return s;
+}
+
+GuiderConfigDialogCtrlSet *GuiderMultiStar::GetConfigDialogCtrlSet(wxWindow *pParent, Guider *pGuider, AdvancedDialog *pAdvancedDialog, BrainCtrlIdMap& CtrlMap)
+{
+    return new GuiderMultiStarConfigDialogCtrlSet(pParent, pGuider, pAdvancedDialog, CtrlMap);
+}
+
+GuiderMultiStarConfigDialogCtrlSet::GuiderMultiStarConfigDialogCtrlSet(wxWindow *pParent, Guider *pGuider, AdvancedDialog *pAdvancedDialog, BrainCtrlIdMap& CtrlMap)
+    : GuiderOneStarConfigDialogCtrlSet(pParent, pGuider, pAdvancedDialog, CtrlMap)
+{
+    m_pGuiderMultiStar = static_cast<GuiderMultiStar *>(pGuider);
+
+    wxWindow *parent = GetParentWindow(AD_szStarTracking);
+
+    wxStaticBoxSizer *pMultiStar = new wxStaticBoxSizer(wxHORIZONTAL, parent, _("Multi-star Guiding"));
+    m_pEnableMultiStar = new wxCheckBox(parent, MULTI_STAR_ENABLE, _("Enable"));
+    m_pEnableMultiStar->SetToolTip(_("Check to guide on several stars at once. When enabled, auto-selection picks "
+        "additional stars and the guide offset is the average of the star offsets, which reduces the effect of seeing."));
+
+    parent->Bind(wxEVT_COMMAND_CHECKBOX_CLICKED, &GuiderMultiStarConfigDialogCtrlSet::OnMultiStarEnableChecked, this, MULTI_STAR_ENABLE);
+
+    int width = StringWidth(_T("000"));
+    m_pMaxStars = pFrame->MakeSpinCtrl(parent, wxID_ANY, _T(" "), wxDefaultPosition,
+        wxSize(width, -1), wxSP_ARROW_KEYS, MIN_MAX_STARS, MAX_MAX_STARS, DEFAULT_MAX_STARS, _T("MaxStars"));
+    wxSizer *pMaxStars = MakeLabeledControl(AD_szStarTracking, _("Max stars"), m_pMaxStars,
+        wxString::Format(_("Maximum number of stars used for multi-star guiding, including the primary star. Default = %d"),
+        (int) DEFAULT_MAX_STARS));
+
+    pMultiStar->Add(m_pEnableMultiStar, wxSizerFlags(0).Border(wxTOP, 3));
+    pMultiStar->Add(pMaxStars, wxSizerFlags(0).Border(wxLEFT, 40));
+
+    m_pTrackingParams->Add(pMultiStar, wxSizerFlags(0).Border(wxLEFT, 75));
+}
+
+GuiderMultiStarConfigDialogCtrlSet::~GuiderMultiStarConfigDialogCtrlSet()
+{
+}
+
+void GuiderMultiStarConfigDialogCtrlSet::LoadValues()
+{
+    GuiderOneStarConfigDialogCtrlSet::LoadValues();
+
+    bool enabled = m_pGuiderMultiStar->GetMultiStarEnabled();
+    m_pEnableMultiStar->SetValue(enabled);
+    m_pMaxStars->Enable(enabled);
+    m_pMaxStars->SetValue(m_pGuiderMultiStar->GetMaxStars());
+}
+
+void GuiderMultiStarConfigDialogCtrlSet::UnloadValues()
+{
+    m_pGuiderMultiStar->SetMultiStarEnabled(m_pEnableMultiStar->GetValue());
+    m_pGuiderMultiStar->SetMaxStars(m_pMaxStars->GetValue());
+
+    GuiderOneStarConfigDialogCtrlSet::UnloadValues();
+}
+
+void GuiderMultiStarConfigDialogCtrlSet::OnMultiStarEnableChecked(wxCommandEvent& event)
+{
+    m_pMaxStars->Enable(event.IsChecked());
+}
@@ -0,0 +1,123 @@
+/*
+ *  guider_multistar.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef GUIDER_MULTISTAR_H_INCLUDED
+#define GUIDER_MULTISTAR_H_INCLUDED
+
+class GuiderMultiStar;
+
+class GuiderMultiStarConfigDialogCtrlSet : public GuiderOneStarConfigDialogCtrlSet
+{
+public:
+    GuiderMultiStarConfigDialogCtrlSet(wxWindow *pParent, Guider *pGuider, AdvancedDialog *pAdvancedDialog, BrainCtrlIdMap& CtrlMap);
+    virtual ~GuiderMultiStarConfigDialogCtrlSet();
+
+    GuiderMultiStar *m_pGuiderMultiStar;
+    wxCheckBox *m_pEnableMultiStar;
+    wxSpinCtrl *m_pMaxStars;
+
+    virtual void LoadValues();
+    virtual void UnloadValues();
+    void OnMultiStarEnableChecked(wxCommandEvent& event);
+};
+
+//
+// Guides on the primary star selected by GuiderOneStar plus up to MaxStars - 1
+// secondary stars picked from the AutoFind candidates. The stars are measured
+// in parallel, stars whose offsets disagree with the consensus are rejected,
+// and the guide offset is the weighted average of the remaining offsets.
+// With multi-star guiding disabled, or when a star is selected manually, it
+// behaves exactly like GuiderOneStar.
+//
+class GuiderMultiStar : public GuiderOneStar
+{
+    struct SecondaryStar
+    {
+        Star star;              // most recent measurement
+        PHD_Point refOffset;    // position relative to the primary star at selection time
+        unsigned int misses;    // number of consecutive frames the star was not found
+        bool found;             // found in the current frame
+    };
+
+    std::vector<SecondaryStar> m_secondaries;
+    std::vector<Star> m_candidates;     // stars from the most recent AutoFind
+    bool m_primaryFound;                // primary star found in the current frame
+    unsigned int m_starsUsed;           // number of stars used for the most recent offset
+
+    // parameters
+    bool m_multiStarEnabled;
+    int m_maxStars;
+
+public:
+    GuiderMultiStar(wxWindow *parent);
+    virtual ~GuiderMultiStar();
+
+    bool GetMultiStarEnabled() const;
+    void SetMultiStarEnabled(bool enable);
+    int GetMaxStars() const;
+    bool SetMaxStars(int maxStars);
+
+    bool AutoSelect(const wxRect& roi) override;
+    wxRect GetBoundingBox() override;
+    wxString GetSettingsSummary() const override;
+
+    GuiderConfigDialogCtrlSet *GetConfigDialogCtrlSet(wxWindow *pParent, Guider *pGuider, AdvancedDialog *pAdvancedDialog, BrainCtrlIdMap& CtrlMap) override;
+
+    void LoadProfileSettings() override;
+    bool GetStarSearch(StarSearch *search) const override;
+
+protected:
+    void InvalidateCurrentPosition(bool fullReset = false) override;
+    bool SetCurrentPosition(const usImage *pImage, const PHD_Point& position) override;
+
+    bool AutoFindStar(const usImage& image, int edgeAllowance, const wxRect& roi, Star *star) override;
+    bool FindGuideStar(const usImage *pImage, Star *newStar) override;
+    PHD_Point CameraOffset(const PHD_Point& lockPos) override;
+    void PaintSecondaryStars(wxDC& dc) override;
+
+private:
+    void ClearSecondaryStars();
+    void AddSecondaryStars(StarSearch *search) const;
+};
+
+inline bool GuiderMultiStar::GetMultiStarEnabled() const
+{
+    return m_multiStarEnabled;
+}
+
+inline int GuiderMultiStar::GetMaxStars() const
+{
+    return m_maxStars;
+}
+
+#endif /* GUIDER_MULTISTAR_H_INCLUDED */
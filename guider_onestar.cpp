@@ -415,7 +415,7 @@ bool GuiderOneStar::AutoSelect(const wxRect& roi)
             edgeAllowance = wxMax(edgeAllowance, pSecondaryMount->CalibrationTotDistance());
 
         Star newStar;
-        if (!newStar.AutoFind(*image, edgeAllowance, m_searchRegion, roi))
+        if (!AutoFindStar(*image, edgeAllowance, roi, &newStar))
         {
             throw ERROR_INFO("Unable to AutoFind");
         }
@@ -562,6 +562,51 @@ int GuiderOneStar::StarError()
     return m_star.GetError();
 }
 
+bool GuiderOneStar::AutoFindStar(const usImage& image, int edgeAllowance, const wxRect& roi, Star *star)
+{
+    return star->AutoFind(image, edgeAllowance, m_searchRegion, roi);
+}
+
+void GuiderOneStar::InitStarSearch(const Star& primary, StarSearch *search) const
+{
+    search->stars.assign(1, primary);
+    search->searchRegion = m_searchRegion;
+    search->mode = pFrame->GetStarFindMode();
+    search->minHFD = GetMinStarHFD();
+    search->saturation = pCamera->GetSaturationADU();
+}
+
+bool GuiderOneStar::GetStarSearch(StarSearch *search) const
+{
+    // same test as UpdateCurrentPosition
+    if (!pCamera || (!m_star.IsValid() && m_star.X == 0.0 && m_star.Y == 0.0))
+        return false;
+
+    InitStarSearch(m_star, search);
+    return true;
+}
+
+bool GuiderOneStar::FindGuideStar(const usImage *pImage, Star *newStar)
+{
+    StarSearch search;
+    InitStarSearch(*newStar, &search);
+
+    StarMeasurement meas;
+    MeasureStars(pImage, search, &meas);
+
+    *newStar = meas.stars[0];
+    return meas.found[0] != 0;
+}
+
+PHD_Point GuiderOneStar::CameraOffset(const PHD_Point& lockPos)
+{
+    return m_star - lockPos;
+}
+
+void GuiderOneStar::PaintSecondaryStars(wxDC& dc)
+{
+}
+
 void GuiderOneStar::InvalidateCurrentPosition(bool fullReset)
 {
     m_star.Invalidate();
@@ -693,8 +738,7 @@ bool GuiderOneStar::UpdateCurrentPosition(const usImage *pImage, GuiderOffset *o
     {
         Star newStar(m_star);
 
-        if (!newStar.Find(pImage, m_searchRegion, pFrame->GetStarFindMode(), GetMinStarHFD(),
-                          pCamera->GetSaturationADU()))
+        if (!FindGuideStar(pImage, &newStar))
         {
             errorInfo->starError = newStar.GetError();
             errorInfo->starMass = 0.0;
@@ -778,7 +822,7 @@ bool GuiderOneStar::UpdateCurrentPosition(const usImage *pImage, GuiderOffset *o
 
         if (lockPos.IsValid())
         {
-            ofs->cameraOfs = m_star - lockPos;
+            ofs->cameraOfs = CameraOffset(lockPos);
             if (pMount && pMount->IsCalibrated())
                 pMount->TransformCameraCoordinatesToMountCoordinates(ofs->cameraOfs, ofs->mountOfs, true);
             double distanceRA = ofs->mountOfs.IsValid() ? fabs(ofs->mountOfs.X) : 0.;
@@ -937,6 +981,7 @@ void GuiderOneStar::OnPaint(wxPaintEvent& event)
             else
                 dc.SetPen(wxPen(wxColour(230,130,30), 1, wxPENSTYLE_DOT));
             DrawBox(dc, m_star, m_searchRegion, m_scaleFactor);
+            PaintSecondaryStars(dc);
         }
         else if (state == STATE_CALIBRATING_PRIMARY || state == STATE_CALIBRATING_SECONDARY)
         {
@@ -952,6 +997,7 @@ void GuiderOneStar::OnPaint(wxPaintEvent& event)
             else
                 dc.SetPen(wxPen(wxColour(230,130,30), 1, wxPENSTYLE_DOT));
             DrawBox(dc, m_star, m_searchRegion, m_scaleFactor);
+            PaintSecondaryStars(dc);
         }
     }
     catch (const wxString& Msg)
@@ -989,6 +1035,7 @@ void GuiderOneStar::SaveStarFITS()
         wxFileName::Mkdir(imgLogDirectory, wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL);
     wxString fname = imgLogDirectory + PATHSEPSTR + "PHD_GuideStar" + wxDateTime::Now().Format(_T("_%j_%H%M%S")) + ".fit";
 
+    FitsLock fitsLock;
     fitsfile *fptr;  // FITS file pointer
     int status = 0;  // CFITSIO status value MUST be initialized to zero!
 
@@ -1105,14 +1152,14 @@ GuiderOneStarConfigDialogCtrlSet::GuiderOneStarConfigDialogCtrlSet(wxWindow *pPa
     m_pBeepForLostStarCtrl = new wxCheckBox(GetParentWindow(AD_cbBeepForLostStar), wxID_ANY, _("Beep on lost star"));
     m_pBeepForLostStarCtrl->SetToolTip(_("Issue an audible alarm any time the guide star is lost"));
 
-    wxFlexGridSizer *pTrackingParams = new wxFlexGridSizer(3, 2, 8, 15);
-    pTrackingParams->Add(pSearchRegion, wxSizerFlags(0).Border(wxTOP, 12));
-    pTrackingParams->Add(pStarMass, wxSizerFlags(0).Border(wxLEFT, 75));
-    pTrackingParams->Add(pHFD, wxSizerFlags().Border(wxTOP, 3));
-    pTrackingParams->Add(dsamp, wxSizerFlags().Border(wxTOP, 3).Right());
-    pTrackingParams->Add(m_pBeepForLostStarCtrl, wxSizerFlags().Border(wxTOP, 3));
+    m_pTrackingParams = new wxFlexGridSizer(3, 2, 8, 15);
+    m_pTrackingParams->Add(pSearchRegion, wxSizerFlags(0).Border(wxTOP, 12));
+    m_pTrackingParams->Add(pStarMass, wxSizerFlags(0).Border(wxLEFT, 75));
+    m_pTrackingParams->Add(pHFD, wxSizerFlags().Border(wxTOP, 3));
+    m_pTrackingParams->Add(dsamp, wxSizerFlags().Border(wxTOP, 3).Right());
+    m_pTrackingParams->Add(m_pBeepForLostStarCtrl, wxSizerFlags().Border(wxTOP, 3));
 
-    AddGroup(CtrlMap, AD_szStarTracking, pTrackingParams);
+    AddGroup(CtrlMap, AD_szStarTracking, m_pTrackingParams);
 }
 
 GuiderOneStarConfigDialogCtrlSet::~GuiderOneStarConfigDialogCtrlSet()
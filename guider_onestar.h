@@ -57,6 +57,7 @@ public:
     wxSpinCtrlDouble *m_MinHFD;
     wxChoice *m_autoSelDownsample;
     wxCheckBox *m_pBeepForLostStarCtrl;
+    wxFlexGridSizer *m_pTrackingParams;
 
     virtual void LoadValues();
     virtual void UnloadValues();
@@ -65,8 +66,10 @@ public:
 
 class GuiderOneStar : public Guider
 {
-private:
+protected:
     Star m_star;
+
+private:
     MassChecker *m_massChecker;
 
     // parameters
@@ -121,12 +124,24 @@ public:
     GuiderConfigDialogCtrlSet *GetConfigDialogCtrlSet(wxWindow *pParent, Guider *pGuider, AdvancedDialog *pAdvancedDialog, BrainCtrlIdMap& CtrlMap) override;
 
     void LoadProfileSettings() override;
+    bool GetStarSearch(StarSearch *search) const override;
+
+protected:
+    void InvalidateCurrentPosition(bool fullReset = false) override;
+    bool SetCurrentPosition(const usImage *pImage, const PHD_Point& position) override;
+
+    // a search for the primary star alone
+    void InitStarSearch(const Star& primary, StarSearch *search) const;
+
+    // hooks for guiders that track more than one star
+    virtual bool AutoFindStar(const usImage& image, int edgeAllowance, const wxRect& roi, Star *star);
+    virtual bool FindGuideStar(const usImage *pImage, Star *newStar);
+    virtual PHD_Point CameraOffset(const PHD_Point& lockPos);
+    virtual void PaintSecondaryStars(wxDC& dc);
 
 private:
     bool IsValidLockPosition(const PHD_Point& pt) final;
-    void InvalidateCurrentPosition(bool fullReset = false) final;
     bool UpdateCurrentPosition(const usImage *pImage, GuiderOffset *ofs, FrameDroppedInfo *errorInfo) final;
-    bool SetCurrentPosition(const usImage *pImage, const PHD_Point& position) final;
 
     void OnLClick(wxMouseEvent& evt);
 
@@ -34,6 +34,7 @@
  */
 
 #include "phd.h"
+#include "guidelog_binary.h"
 
 #include <wx/wfstream.h>
 #include <wx/txtstrm.h>
@@ -42,11 +43,20 @@
 
 const int RetentionPeriod = 60;
 
+static_assert(GuideLatency::NUM_STAGES == GuideLogBinary::LATENCY_STAGES, "binary guide log latency columns");
+
+// the binary guide log is optional; it is not needed by the log viewer or uploader
+static bool BinaryLogEnabled()
+{
+    return pConfig->Global.GetBoolean("/GuideLog/BinaryLog", false);
+}
+
 GuidingLog::GuidingLog()
     :
     m_enabled(false),
     m_keepFile(false),
-    m_isGuiding(false)
+    m_isGuiding(false),
+    m_latencyColumns(false)
 {
 }
 
@@ -167,47 +177,54 @@ static wxString PointingInfo()
     return rslt;
 }
 
-static void GuidingHeader(wxFFile& file)
-// output guiding header to log file
+static wxString GuidingHeader(bool latencyColumns)
+// guiding header for the log file
 {
-    file.Write("Equipment Profile = " + pConfig->GetCurrentProfile() + "\n");
+    wxString s;
 
-    file.Write(pFrame->GetSettingsSummary());
-    file.Write(pFrame->pGuider->GetSettingsSummary());
+    s += "Equipment Profile = " + pConfig->GetCurrentProfile() + "\n";
+
+    s += pFrame->GetSettingsSummary();
+    s += pFrame->pGuider->GetSettingsSummary();
 
     if (pCamera)
     {
-        file.Write(pCamera->GetSettingsSummary());
-        file.Write("Exposure = " + pFrame->ExposureDurationSummary() + "\n");
+        s += pCamera->GetSettingsSummary();
+        s += "Exposure = " + pFrame->ExposureDurationSummary() + "\n";
     }
 
     if (pMount)
-        file.Write(pMount->GetSettingsSummary());
+        s += pMount->GetSettingsSummary();
 
     if (pSecondaryMount)
-        file.Write(pSecondaryMount->GetSettingsSummary());
+        s += pSecondaryMount->GetSettingsSummary();
 
-    file.Write(PointingInfo());
-    file.Write("\n");
+    s += PointingInfo();
+    s += "\n";
 
-    file.Write(wxString::Format("Lock position = %.3f, %.3f, Star position = %.3f, %.3f, HFD = %.2f px\n",
+    s += wxString::Format("Lock position = %.3f, %.3f, Star position = %.3f, %.3f, HFD = %.2f px\n",
         pFrame->pGuider->LockPosition().X,
         pFrame->pGuider->LockPosition().Y,
         pFrame->pGuider->CurrentPosition().X,
         pFrame->pGuider->CurrentPosition().Y,
-        pFrame->pGuider->HFD()));
+        pFrame->pGuider->HFD());
+
+    s += "Frame,Time,mount,dx,dy,RARawDistance,DECRawDistance,RAGuideDistance,DECGuideDistance,RADuration,RADirection,DECDuration,DECDirection,XStep,YStep,StarMass,SNR,ErrorCode";
+    if (latencyColumns)
+        s += ",ErrorDetails,CaptureMs,DarksMs,FindMs,AlgorithmMs,PulseMs,LatencyMs";
+    s += "\n";
 
-    file.Write("Frame,Time,mount,dx,dy,RARawDistance,DECRawDistance,RAGuideDistance,DECGuideDistance,RADuration,RADirection,DECDuration,DECDirection,XStep,YStep,StarMass,SNR,ErrorCode\n");
+    return s;
 }
 
-static void WriteSummaryInfo(wxFFile& file, const GuideLogSummaryInfo& summary)
+static wxString SummaryInfo(const GuideLogSummaryInfo& summary)
 {
     if (!summary.valid)
-        return;
+        return wxEmptyString;
 
-    file.Write(wxString::Format("Log Summary: calcnt:%u gcnt:%u gdur:%.f gacnt:%u\n",
-                                summary.cal_cnt, summary.guide_cnt, summary.guide_dur,
-                                summary.ga_cnt));
+    return wxString::Format("Log Summary: calcnt:%u gcnt:%u gdur:%.f gacnt:%u\n",
+                            summary.cal_cnt, summary.guide_cnt, summary.guide_dur,
+                            summary.ga_cnt);
 }
 
 void GuideLogSummaryInfo::LoadSummaryInfo(wxFFile& file)
@@ -279,7 +296,10 @@ void GuidingLog::EnableLogging()
 
         assert(m_file.IsOpened());
 
-        m_file.Write(_T("PHD2 version ") FULLVER _T(" [") PHD_OSNAME _T("]") _T(", Log version ") GUIDELOG_VERSION _T(". Log enabled at ") +
+        if (BinaryLogEnabled() && !m_binary.IsOpen())
+            OpenBinaryLog();
+
+        WriteText(_T("PHD2 version ") FULLVER _T(" [") PHD_OSNAME _T("]") _T(", Log version ") GUIDELOG_VERSION _T(". Log enabled at ") +
             logFileTime.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
 
         m_enabled = true;
@@ -289,7 +309,10 @@ void GuidingLog::EnableLogging()
 
         // dump guiding header if logging enabled during guide
         if (pFrame && pFrame->pGuider->IsGuiding())
-            GuidingHeader(m_file);
+        {
+            m_latencyColumns = GuideLatency::LogColumnsEnabled();
+            WriteText(GuidingHeader(m_latencyColumns));
+        }
 
         Flush();
     }
@@ -316,8 +339,8 @@ void GuidingLog::DisableLogging()
     {
         wxDateTime now = wxDateTime::Now();
 
-        m_file.Write("\n");
-        m_file.Write("Log disabled at " + now.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
+        WriteText("\n");
+        WriteText("Log disabled at " + now.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
         Flush();
     }
 
@@ -351,6 +374,7 @@ bool GuidingLog::ChangeDirLog(const wxString& newdir)
 void GuidingLog::RemoveOldFiles()
 {
     Logger::RemoveMatchingFiles("PHD2_GuideLog*.txt", RetentionPeriod);
+    Logger::RemoveMatchingFiles("PHD2_GuideLog*.bin", RetentionPeriod);
 }
 
 bool GuidingLog::Flush()
@@ -386,23 +410,89 @@ void GuidingLog::CloseGuideLog()
         {
             wxDateTime now = wxDateTime::Now();
 
-            m_file.Write("\n");
-            WriteSummaryInfo(m_file, m_summary);
-            m_file.Write("Log closed at " + now.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
+            WriteText("\n");
+            WriteText(SummaryInfo(m_summary));
+            WriteText("Log closed at " + now.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
             Flush();
         }
 
         m_file.Close();
     }
 
+    bool haveBinary = m_binary.IsOpen();
+    m_binary.Close();
+
     m_enabled = false;
 
     if (!m_keepFile)            // Delete the file if nothing useful was logged
     {
         wxRemove(m_fileName);
+        if (haveBinary)
+            wxRemove(m_binary.FileName());
     }
 }
 
+void GuidingLog::OpenBinaryLog()
+{
+    wxFileName fn(m_fileName);
+    fn.SetExt("bin");
+
+    if (m_binary.Open(fn.GetFullPath()))
+    {
+        Debug.Write(wxString::Format("Could not open binary guide log %s\n", fn.GetFullPath()));
+        return;
+    }
+
+    if (m_binary.OpenedLength() == 0)
+    {
+        wxString writer(_T("PHD2 ") FULLVER _T(" [") PHD_OSNAME _T("], log version ") GUIDELOG_VERSION);
+        std::string hdr = GuideLogBinary::FileHeaderBytes(std::string(writer.utf8_str()));
+        m_binary.Append(hdr.data(), hdr.size());
+    }
+}
+
+// write to the text log, and to the binary log as a text record
+void GuidingLog::WriteText(const wxString& str)
+{
+    m_file.Write(str);
+
+    if (m_binary.IsOpen() && !str.empty())
+    {
+        wxScopedCharBuffer utf8 = str.utf8_str();
+        GuideLogBinary::TextRecord rec = { GuideLogBinary::REC_TEXT };
+        rec.bytes = (wxUint32) utf8.length();
+        m_binary.Append(&rec, sizeof(rec));
+        m_binary.Append(utf8.data(), utf8.length());
+    }
+}
+
+static GuideLogBinary::StepRecord BinaryStepRecord(GuideLogBinary::RecordType type, int frame, double time,
+                                                   double starMass, double starSNR, int starError, bool latencyColumns)
+{
+    GuideLogBinary::StepRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.type = type;
+    rec.flags = latencyColumns ? GuideLogBinary::STEP_LATENCY : 0;
+    rec.frame = frame;
+    GuideLogBinary::SetFixed(&rec, GuideLogBinary::F_TIME, &rec.timeMs, time, 3);
+    GuideLogBinary::SetFixed(&rec, GuideLogBinary::F_MASS, &rec.starMass, starMass, 0);
+    GuideLogBinary::SetFixed(&rec, GuideLogBinary::F_SNR, &rec.snr, starSNR, 2);
+    rec.errorCode = starError;
+    return rec;
+}
+
+void GuidingLog::AppendBinaryLatency(int frame)
+{
+    GuideLatency::Record lat;
+    bool const found = GuideLatency::GetRecord(frame, &lat);
+
+    GuideLogBinary::LatencyRecord rec = { GuideLogBinary::REC_LATENCY };
+    for (int i = 0; i < GuideLatency::NUM_STAGES; i++)
+        rec.usec[i] = found && lat.usec[i] >= 0 ? (wxInt32) std::min(lat.usec[i], 0x7fffffffLL) : -1;
+
+    m_binary.Append(&rec, sizeof(rec));
+}
+
 void GuidingLog::StartCalibration(const Mount *pCalibrationMount)
 {
     m_isGuiding = true;
@@ -413,37 +503,37 @@ void GuidingLog::StartCalibration(const Mount *pCalibrationMount)
     assert(m_file.IsOpened());
     wxDateTime now = wxDateTime::Now();
 
-    m_file.Write("\n");
-    m_file.Write("Calibration Begins at " + now.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
-    m_file.Write("Equipment Profile = " + pConfig->GetCurrentProfile() + "\n");
+    WriteText("\n");
+    WriteText("Calibration Begins at " + now.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
+    WriteText("Equipment Profile = " + pConfig->GetCurrentProfile() + "\n");
 
-    m_file.Write(pFrame->GetSettingsSummary());
-    m_file.Write(pFrame->pGuider->GetSettingsSummary());
+    WriteText(pFrame->GetSettingsSummary());
+    WriteText(pFrame->pGuider->GetSettingsSummary());
 
     if (pCamera)
     {
-        m_file.Write(pCamera->GetSettingsSummary());
-        m_file.Write("Exposure = " + pFrame->ExposureDurationSummary() + "\n");
+        WriteText(pCamera->GetSettingsSummary());
+        WriteText("Exposure = " + pFrame->ExposureDurationSummary() + "\n");
     }
 
     assert(pCalibrationMount && pCalibrationMount->IsConnected());
 
-    m_file.Write("Mount = " + pCalibrationMount->Name());
+    WriteText("Mount = " + pCalibrationMount->Name());
     wxString calSettings = pCalibrationMount->CalibrationSettingsSummary();
     if (!calSettings.IsEmpty())
-        m_file.Write(", " + calSettings);
-    m_file.Write("\n");
+        WriteText(", " + calSettings);
+    WriteText("\n");
 
-    m_file.Write(PointingInfo());
-    m_file.Write("\n");
+    WriteText(PointingInfo());
+    WriteText("\n");
 
-    m_file.Write(wxString::Format("Lock position = %.3f, %.3f, Star position = %.3f, %.3f, HFD = %.2f px\n",
+    WriteText(wxString::Format("Lock position = %.3f, %.3f, Star position = %.3f, %.3f, HFD = %.2f px\n",
                 pFrame->pGuider->LockPosition().X,
                 pFrame->pGuider->LockPosition().Y,
                 pFrame->pGuider->CurrentPosition().X,
                 pFrame->pGuider->CurrentPosition().Y,
                 pFrame->pGuider->HFD()));
-    m_file.Write("Direction,Step,dx,dy,x,y,Dist\n");
+    WriteText("Direction,Step,dx,dy,x,y,Dist\n");
 
     Flush();
 
@@ -459,7 +549,7 @@ void GuidingLog::CalibrationFailed(const Mount *pCalibrationMount, const wxStrin
 
     assert(m_file.IsOpened());
 
-    m_file.Write(msg); m_file.Write("\n");
+    WriteText(msg); WriteText("\n");
     Flush();
 }
 
@@ -471,7 +561,7 @@ void GuidingLog::CalibrationStep(const CalibrationStepInfo& info)
     assert(m_file.IsOpened());
 
     // Direction,Step,dx,dy,x,y,Dist
-    m_file.Write(wxString::Format("%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+    WriteText(wxString::Format("%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n",
         info.direction,
         info.stepNumber,
         info.dx, info.dy,
@@ -488,7 +578,7 @@ void GuidingLog::CalibrationDirectComplete(const Mount *pCalibrationMount, const
 
     assert(m_file.IsOpened());
 
-    m_file.Write(wxString::Format("%s calibration complete. Angle = %.1f deg, Rate = %.3f px/sec, Parity = %s\n",
+    WriteText(wxString::Format("%s calibration complete. Angle = %.1f deg, Rate = %.3f px/sec, Parity = %s\n",
         direction, degrees(angle), rate * 1000.0, ParityStr(parity)));
 
     Flush();
@@ -505,7 +595,7 @@ void GuidingLog::CalibrationComplete(const Mount *pCalibrationMount)
 
     assert(m_file.IsOpened());
 
-    m_file.Write(wxString::Format("Calibration complete, mount = %s.\n", pCalibrationMount->Name()));
+    WriteText(wxString::Format("Calibration complete, mount = %s.\n", pCalibrationMount->Name()));
 
     Flush();
 }
@@ -519,11 +609,12 @@ void GuidingLog::GuidingStarted()
 
     assert(m_file.IsOpened());
 
-    m_file.Write("\n");
-    m_file.Write("Guiding Begins at " + pFrame->m_guidingStarted.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
+    WriteText("\n");
+    WriteText("Guiding Begins at " + pFrame->m_guidingStarted.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
 
     // add common guiding header
-    GuidingHeader(m_file);
+    m_latencyColumns = GuideLatency::LogColumnsEnabled();
+    WriteText(GuidingHeader(m_latencyColumns));
 
     Flush();
 
@@ -542,7 +633,7 @@ void GuidingLog::GuidingStopped()
     ++m_summary.guide_cnt;
     m_summary.guide_dur += pFrame->TimeSinceGuidingStarted();
 
-    m_file.Write("Guiding Ends at " + wxDateTime::Now().Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
+    WriteText("Guiding Ends at " + wxDateTime::Now().Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
     Flush();
 }
 
@@ -573,9 +664,46 @@ void GuidingLog::GuideStep(const GuideStepInfo& step)
             step.durationDec, step.durationDec > 0 ? step.mount->DirectionChar((GUIDE_DIRECTION)step.directionDec): ""));
     }
 
-    m_file.Write(wxString::Format("%.f,%.2f,%d\n",
+    m_file.Write(wxString::Format("%.f,%.2f,%d",
             step.starMass, step.starSNR, step.starError));
 
+    if (m_latencyColumns)
+        m_file.Write(",," + GuideLatency::LogColumns(step.frameNumber));
+
+    m_file.Write("\n");
+
+    if (m_binary.IsOpen())
+    {
+        GuideLogBinary::StepRecord rec = BinaryStepRecord(GuideLogBinary::REC_STEP, step.frameNumber, step.time,
+            step.starMass, step.starSNR, step.starError, m_latencyColumns);
+        GuideLogBinary::SetFixed(&rec, GuideLogBinary::F_DX, &rec.dx, step.cameraOffset.X, 3);
+        GuideLogBinary::SetFixed(&rec, GuideLogBinary::F_DY, &rec.dy, step.cameraOffset.Y, 3);
+        GuideLogBinary::SetFixed(&rec, GuideLogBinary::F_RA_RAW, &rec.raRaw, step.mountOffset.X, 3);
+        GuideLogBinary::SetFixed(&rec, GuideLogBinary::F_DEC_RAW, &rec.decRaw, step.mountOffset.Y, 3);
+        GuideLogBinary::SetFixed(&rec, GuideLogBinary::F_RA_GUIDE, &rec.raGuide, step.guideDistanceRA, 3);
+        GuideLogBinary::SetFixed(&rec, GuideLogBinary::F_DEC_GUIDE, &rec.decGuide, step.guideDistanceDec, 3);
+
+        if (step.mount->IsStepGuider())
+        {
+            rec.flags |= GuideLogBinary::STEP_AO;
+            rec.raDuration = step.directionRA == LEFT ? -step.durationRA : step.durationRA;
+            rec.decDuration = step.directionDec == DOWN ? -step.durationDec : step.durationDec;
+        }
+        else
+        {
+            rec.raDuration = step.durationRA;
+            rec.decDuration = step.durationDec;
+            if (step.durationRA > 0)
+                rec.raDir = step.mount->DirectionChar((GUIDE_DIRECTION) step.directionRA)[0];
+            if (step.durationDec > 0)
+                rec.decDir = step.mount->DirectionChar((GUIDE_DIRECTION) step.directionDec)[0];
+        }
+
+        m_binary.Append(&rec, sizeof(rec));
+        if (m_latencyColumns)
+            AppendBinaryLatency(step.frameNumber);
+    }
+
     Flush();
 }
 
@@ -586,9 +714,26 @@ void GuidingLog::FrameDropped(const FrameDroppedInfo& info)
 
     assert(m_file.IsOpened());
 
-    m_file.Write(wxString::Format("%d,%.3f,\"DROP\",,,,,,,,,,,,,%.f,%.2f,%d,\"%s\"\n",
+    m_file.Write(wxString::Format("%d,%.3f,\"DROP\",,,,,,,,,,,,,%.f,%.2f,%d,\"%s\"",
         info.frameNumber, info.time, info.starMass, info.starSNR, info.starError, info.status));
 
+    if (m_latencyColumns)
+        m_file.Write("," + GuideLatency::LogColumns(info.frameNumber));
+
+    m_file.Write("\n");
+
+    if (m_binary.IsOpen())
+    {
+        wxScopedCharBuffer status = info.status.utf8_str();
+        GuideLogBinary::StepRecord rec = BinaryStepRecord(GuideLogBinary::REC_DROP, info.frameNumber, info.time,
+            info.starMass, info.starSNR, info.starError, m_latencyColumns);
+        rec.statusBytes = (wxUint32) status.length();
+        m_binary.Append(&rec, sizeof(rec));
+        m_binary.Append(status.data(), status.length());
+        if (m_latencyColumns)
+            AppendBinaryLatency(info.frameNumber);
+    }
+
     Flush();
 }
 
@@ -600,7 +745,7 @@ void GuidingLog::CalibrationFrameDropped(const FrameDroppedInfo& info)
 
     assert(m_file.IsOpened());
 
-    m_file.Write(wxString::Format("INFO: STAR LOST during calibration, Mass= %.f, SNR= %.2f, Error= %d, Status=%s\n",
+    WriteText(wxString::Format("INFO: STAR LOST during calibration, Mass= %.f, SNR= %.2f, Error= %d, Status=%s\n",
         info.starMass, info.starSNR, info.starError, info.status));
 
     Flush();
@@ -611,7 +756,7 @@ void GuidingLog::NotifyGuidingDithered(Guider *guider, double dx, double dy)
     if (!m_enabled || !m_isGuiding)
         return;
 
-    m_file.Write(wxString::Format("INFO: DITHER by %.3f, %.3f, new lock pos = %.3f, %.3f\n",
+    WriteText(wxString::Format("INFO: DITHER by %.3f, %.3f, new lock pos = %.3f, %.3f\n",
         dx, dy, guider->LockPosition().X, guider->LockPosition().Y));
 
     Flush();
@@ -621,7 +766,7 @@ void GuidingLog::NotifySettlingStateChange(const wxString& msg)
 {
     if (!m_enabled)
         return;
-    m_file.Write(wxString::Format("INFO: SETTLING STATE CHANGE, %s\n", msg));
+    WriteText(wxString::Format("INFO: SETTLING STATE CHANGE, %s\n", msg));
     Flush();
 }
 
@@ -639,7 +784,7 @@ void GuidingLog::NotifyGAResult(const wxString& msg)
         return;
 
     // Client needs to handle end-of-line formatting
-    m_file.Write(wxString::Format("INFO: GA Result - %s", msg));
+    WriteText(wxString::Format("INFO: GA Result - %s", msg));
     Flush();
 }
 
@@ -648,7 +793,7 @@ void GuidingLog::NotifySetLockPosition(Guider *guider)
     if (!m_enabled || !m_isGuiding)
         return;
 
-    m_file.Write(wxString::Format("INFO: SET LOCK POSITION, new lock pos = %.3f, %.3f\n",
+    WriteText(wxString::Format("INFO: SET LOCK POSITION, new lock pos = %.3f, %.3f\n",
         guider->LockPosition().X, guider->LockPosition().Y));
 
     Flush();
@@ -673,7 +818,7 @@ void GuidingLog::NotifyLockShiftParams(const LockPosShiftParams& shiftParams, co
                                     cameraRate.IsValid() ? cameraRate.Y * 3600.0 : 0.0);
     }
 
-    m_file.Write(wxString::Format("INFO: LOCK SHIFT, enabled = %d %s\n", shiftParams.shiftEnabled, details));
+    WriteText(wxString::Format("INFO: LOCK SHIFT, enabled = %d %s\n", shiftParams.shiftEnabled, details));
     Flush();
 
     m_keepFile = true;
@@ -684,7 +829,7 @@ void GuidingLog::ServerCommand(Guider *guider, const wxString& cmd)
     if (!m_enabled || !m_isGuiding)
         return;
 
-    m_file.Write(wxString::Format("INFO: Server received %s\n", cmd));
+    WriteText(wxString::Format("INFO: Server received %s\n", cmd));
     Flush();
 
     m_keepFile = true;
@@ -695,7 +840,7 @@ void GuidingLog::NotifyManualGuide(const Mount *mount, int direction, int durati
     if (!m_enabled || !m_isGuiding)
         return;
 
-    m_file.Write(wxString::Format("INFO: Manual guide (%s) %s %d %s\n",
+    WriteText(wxString::Format("INFO: Manual guide (%s) %s %d %s\n",
                                   mount->IsStepGuider() ? "AO" : "Mount",
                                   mount->DirectionStr(static_cast<GUIDE_DIRECTION>(direction)), duration,
                                   mount->IsStepGuider() ? (duration != 1 ? "steps" : "step") : "ms"));
@@ -724,7 +869,7 @@ void GuidingLog::SetGuidingParam(const wxString& name, const wxString& val)
     if (!m_enabled || !m_isGuiding)
         return;
 
-    m_file.Write(wxString::Format("INFO: Guiding parameter change, %s = %s\n", name, val));
+    WriteText(wxString::Format("INFO: Guiding parameter change, %s = %s\n", name, val));
     Flush();
 
     m_keepFile = true;
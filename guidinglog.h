@@ -37,6 +37,7 @@
 #define GUIDINGLOG_INCLUDED
 
 #include "logger.h"
+#include "buffered_file_sink.h"
 
 class Mount;
 class Guider;
@@ -122,12 +123,17 @@ class GuidingLog : public Logger
     bool m_enabled;
     wxFFile m_file;
     wxString m_fileName;
+    BufferedFileSink m_binary;  // optional binary copy of the log, see guidelog_binary.h
     bool m_keepFile;
     bool m_isGuiding;
+    bool m_latencyColumns;
     GuideLogSummaryInfo m_summary;
 
     void EnableLogging();
     void DisableLogging();
+    void OpenBinaryLog();
+    void WriteText(const wxString& str);
+    void AppendBinaryLatency(int frame);
 
 public:
     GuidingLog();
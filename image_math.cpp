@@ -34,12 +34,22 @@
 
 #include "phd.h"
 #include "image_math.h"
+#include "mapped_file.h"
 
 #include <wx/wfstream.h>
 #include <wx/txtstrm.h>
 #include <wx/tokenzr.h>
 
 #include <algorithm>
+#include <climits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define IMAGE_MATH_SSE2 1
+# include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define IMAGE_MATH_NEON 1
+# include <arm_neon.h>
+#endif
 
 int dbl_sort_func (double *first, double *second)
 {
@@ -179,41 +189,84 @@ inline static void swap(unsigned short& a, unsigned short& b)
     b = t;
 }
 
-inline static unsigned short median9(const unsigned short l[9])
+// Element-wise min/max for the median9 sorting network. The SIMD versions
+// filter 8 adjacent pixels at once.
+struct ScalarOps
 {
-    unsigned short l0 = l[0], l1 = l[1], l2 = l[2], l3 = l[3], l4 = l[4];
-    unsigned short x;
-    x = l[5];
-    if (x < l0) swap(x, l0);
-    if (x < l1) swap(x, l1);
-    if (x < l2) swap(x, l2);
-    if (x < l3) swap(x, l3);
-    if (x < l4) swap(x, l4);
-    x = l[6];
-    if (x < l0) swap(x, l0);
-    if (x < l1) swap(x, l1);
-    if (x < l2) swap(x, l2);
-    if (x < l3) swap(x, l3);
-    if (x < l4) swap(x, l4);
-    x = l[7];
-    if (x < l0) swap(x, l0);
-    if (x < l1) swap(x, l1);
-    if (x < l2) swap(x, l2);
-    if (x < l3) swap(x, l3);
-    if (x < l4) swap(x, l4);
-    x = l[8];
-    if (x < l0) swap(x, l0);
-    if (x < l1) swap(x, l1);
-    if (x < l2) swap(x, l2);
-    if (x < l3) swap(x, l3);
-    if (x < l4) swap(x, l4);
+    typedef unsigned short V;
+    static V Min(V a, V b) { return a < b ? a : b; }
+    static V Max(V a, V b) { return a < b ? b : a; }
+};
 
-    if (l1 > l0) l0 = l1;
-    if (l2 > l0) l0 = l2;
-    if (l3 > l0) l0 = l3;
-    if (l4 > l0) l0 = l4;
+#ifdef IMAGE_MATH_SSE2
+// SSE2 only has signed 16-bit min/max, so values are kept biased by 0x8000
+struct SSE2Ops
+{
+    typedef __m128i V;
+    static V Min(V a, V b) { return _mm_min_epi16(a, b); }
+    static V Max(V a, V b) { return _mm_max_epi16(a, b); }
+    static V Load(const unsigned short *p) { return _mm_xor_si128(_mm_loadu_si128((const __m128i *) p), _mm_set1_epi16((short) 0x8000)); }
+    static void Store(unsigned short *p, V v) { _mm_storeu_si128((__m128i *) p, _mm_xor_si128(v, _mm_set1_epi16((short) 0x8000))); }
+};
+#endif
 
-    return l0;
+#ifdef IMAGE_MATH_NEON
+struct NEONOps
+{
+    typedef uint16x8_t V;
+    static V Min(V a, V b) { return vminq_u16(a, b); }
+    static V Max(V a, V b) { return vmaxq_u16(a, b); }
+    static V Load(const unsigned short *p) { return vld1q_u16(p); }
+    static void Store(unsigned short *p, V v) { vst1q_u16(p, v); }
+};
+#endif
+
+// branchless median of 9 values: a 19 compare-exchange sorting network
+// (Paeth, Graphics Gems) pruned to the exchanges that reach the median
+template<typename Ops>
+inline static typename Ops::V median9(typename Ops::V p0, typename Ops::V p1, typename Ops::V p2,
+                                      typename Ops::V p3, typename Ops::V p4, typename Ops::V p5,
+                                      typename Ops::V p6, typename Ops::V p7, typename Ops::V p8)
+{
+    typedef typename Ops::V V;
+#define SORT2(a, b) { V const t_ = Ops::Min(a, b); b = Ops::Max(a, b); a = t_; }
+    SORT2(p1, p2); SORT2(p4, p5); SORT2(p7, p8);
+    SORT2(p0, p1); SORT2(p3, p4); SORT2(p6, p7);
+    SORT2(p1, p2); SORT2(p4, p5); SORT2(p7, p8);
+    p3 = Ops::Max(p0, p3); p5 = Ops::Min(p5, p8); SORT2(p4, p7);
+    p6 = Ops::Max(p3, p6); p4 = Ops::Max(p1, p4); p2 = Ops::Min(p2, p5);
+    p4 = Ops::Min(p4, p7); SORT2(p4, p2); p4 = Ops::Max(p6, p4);
+    return Ops::Min(p4, p2);
+#undef SORT2
+}
+
+// 3x3 median of the n pixels centered on r1[1..n], with r0 and r2 the rows above and below
+static void Median3Interior(unsigned short *d, const unsigned short *r0, const unsigned short *r1,
+                            const unsigned short *r2, int n)
+{
+    int x = 0;
+
+#if defined(IMAGE_MATH_SSE2) || defined(IMAGE_MATH_NEON)
+# ifdef IMAGE_MATH_SSE2
+    typedef SSE2Ops Ops;
+# else
+    typedef NEONOps Ops;
+# endif
+    for (; x + 8 <= n; x += 8)
+    {
+        Ops::V m = median9<Ops>(Ops::Load(r0 + x), Ops::Load(r0 + x + 1), Ops::Load(r0 + x + 2),
+                                Ops::Load(r1 + x), Ops::Load(r1 + x + 1), Ops::Load(r1 + x + 2),
+                                Ops::Load(r2 + x), Ops::Load(r2 + x + 1), Ops::Load(r2 + x + 2));
+        Ops::Store(d + x, m);
+    }
+#endif
+
+    for (; x < n; x++)
+    {
+        d[x] = median9<ScalarOps>(r0[x], r0[x + 1], r0[x + 2],
+                                  r1[x], r1[x + 1], r1[x + 2],
+                                  r2[x], r2[x + 1], r2[x + 2]);
+    }
 }
 
 inline static unsigned short median8(const unsigned short l[8])
@@ -320,7 +373,11 @@ inline static unsigned short median3(const unsigned short l[3])
     return l0;
 }
 
-void Median3(unsigned short *dst, const unsigned short *src, const wxSize& size, const wxRect& rect)
+// 3x3 median over rows [y0, y1) of rect, passing the filtered pixels to the
+// sink in row-major order. The median at the edges of rect is taken over the
+// neighbors that lie inside rect.
+template<typename Sink>
+static void Median3Rows(Sink& sink, const unsigned short *src, const wxSize& size, const wxRect& rect, int y0, int y1)
 {
     int const W = size.GetWidth();
     int const RX = rect.GetX();
@@ -329,42 +386,46 @@ void Median3(unsigned short *dst, const unsigned short *src, const wxSize& size,
     int const RH = rect.GetHeight();
 
     unsigned short a[9];
-    unsigned short *d;
 
 #define IX(x_, y_) ((RY + (y_)) * W + RX + (x_))
 
-    // top row
-    d = &dst[IX(0, 0)];
+    for (int y = y0; y < y1; y++)
+    {
+        sink.Row(y);
+
+        // rows above and below, clipped to rect
+        int const ya = y > 0 ? y - 1 : y;
+        int const yb = y < RH - 1 ? y + 1 : y;
 
-    // top-left corner
-    a[0] = src[IX(0, 0)];
-    a[1] = src[IX(1, 0)];
-    a[2] = src[IX(0, 1)];
-    a[3] = src[IX(1, 1)];
-    *d++ = median4(a);
+        if (y == 0 || y == RH - 1)
+        {
+            // top or bottom row: 2x2 at the corners, 3x2 in between
 
-    // top row middle pixels
-    for (int x = 1; x <= RW - 2; x++)
-    {
-        a[0] = src[IX(x - 1, 0)];
-        a[1] = src[IX(x,     0)];
-        a[2] = src[IX(x + 1, 0)];
-        a[3] = src[IX(x - 1, 1)];
-        a[4] = src[IX(x,     1)];
-        a[5] = src[IX(x + 1, 1)];
-        *d++ = median6(a);
-    }
+            a[0] = src[IX(0, ya)];
+            a[1] = src[IX(1, ya)];
+            a[2] = src[IX(0, yb)];
+            a[3] = src[IX(1, yb)];
+            sink.Put(median4(a));
+
+            for (int x = 1; x <= RW - 2; x++)
+            {
+                a[0] = src[IX(x - 1, ya)];
+                a[1] = src[IX(x,     ya)];
+                a[2] = src[IX(x + 1, ya)];
+                a[3] = src[IX(x - 1, yb)];
+                a[4] = src[IX(x,     yb)];
+                a[5] = src[IX(x + 1, yb)];
+                sink.Put(median6(a));
+            }
 
-    // top-right corner
-    a[0] = src[IX(RW - 2, 0)];
-    a[1] = src[IX(RW - 1, 0)];
-    a[2] = src[IX(RW - 2, 1)];
-    a[3] = src[IX(RW - 1, 1)];
-    *d = median4(a);
+            a[0] = src[IX(RW - 2, ya)];
+            a[1] = src[IX(RW - 1, ya)];
+            a[2] = src[IX(RW - 2, yb)];
+            a[3] = src[IX(RW - 1, yb)];
+            sink.Put(median4(a));
 
-    for (int y = 1; y <= RH - 2; y++)
-    {
-        d = &dst[IX(0, y)];
+            continue;
+        }
 
         // leftmost pixel
         a[0] = src[IX(0, y - 1)];
@@ -373,20 +434,15 @@ void Median3(unsigned short *dst, const unsigned short *src, const wxSize& size,
         a[3] = src[IX(1, y    )];
         a[4] = src[IX(0, y + 1)];
         a[5] = src[IX(1, y + 1)];
-        *d++ = median6(a);
+        sink.Put(median6(a));
 
-        for (int x = 1; x <= RW - 2; x++)
+        for (int x = 1; x <= RW - 2; )
         {
-            a[0] = src[IX(x - 1, y - 1)];
-            a[1] = src[IX(x    , y - 1)];
-            a[2] = src[IX(x + 1, y - 1)];
-            a[3] = src[IX(x - 1, y    )];
-            a[4] = src[IX(x    , y    )];
-            a[5] = src[IX(x + 1, y    )];
-            a[6] = src[IX(x - 1, y + 1)];
-            a[7] = src[IX(x    , y + 1)];
-            a[8] = src[IX(x + 1, y + 1)];
-            *d++ = median9(a);
+            int n = std::min(RW - 1 - x, (int) Sink::CHUNK);
+            unsigned short *d = sink.Reserve(n);
+            Median3Interior(d, &src[IX(x - 1, y - 1)], &src[IX(x - 1, y)], &src[IX(x - 1, y + 1)], n);
+            sink.Commit(d, n);
+            x += n;
         }
 
         // rightmost pixel
@@ -396,39 +452,132 @@ void Median3(unsigned short *dst, const unsigned short *src, const wxSize& size,
         a[3] = src[IX(RW - 1, y    )];
         a[4] = src[IX(RW - 2, y + 1)];
         a[5] = src[IX(RW - 1, y + 1)];
-        *d++ = median6(a);
+        sink.Put(median6(a));
+    }
+
+#undef IX
+}
+
+// rows per band when splitting a filter across the thread pool; enough pixels
+// per band to make the hand-off worthwhile
+inline static int MinBandRows(int width)
+{
+    return std::max(2, 64 * 1024 / std::max(width, 1));
+}
+
+// Median3 output written to an image buffer
+struct Median3Writer
+{
+    enum { CHUNK = 1 << 30 };
+
+    unsigned short *m_dst;
+    unsigned short *m_d;
+    int m_width;
+    int m_rx;
+    int m_ry;
+
+    Median3Writer(unsigned short *dst, const wxSize& size, const wxRect& rect)
+        : m_dst(dst), m_d(dst), m_width(size.GetWidth()), m_rx(rect.GetX()), m_ry(rect.GetY()) { }
+    void Row(int y) { m_d = &m_dst[(m_ry + y) * m_width + m_rx]; }
+    void Put(unsigned short val) { *m_d++ = val; }
+    unsigned short *Reserve(int n) { unsigned short *d = m_d; m_d += n; return d; }
+    void Commit(const unsigned short *, int) { }
+};
+
+void Median3(unsigned short *dst, const unsigned short *src, const wxSize& size, const wxRect& rect)
+{
+    ThreadPool::Get()->ParallelRange(rect.GetHeight(), MinBandRows(rect.GetWidth()), [&](int y0, int y1) {
+        Median3Writer writer(dst, size, rect);
+        Median3Rows(writer, src, size, rect, y0, y1);
+    });
+}
+
+// Min/max of the raw pixels and of the Median3-filtered pixels. The raw row is
+// scanned when the filter starts on it, so the rows are only pulled into cache
+// once, and the filtered pixels go through a small fixed buffer instead of a
+// full-size image.
+struct Median3MinMaxSink
+{
+    enum { CHUNK = 512 };
+
+    const unsigned short *m_src;
+    int m_width;
+    int m_rx;
+    int m_ry;
+    int m_rw;
+    unsigned short m_min, m_max;
+    unsigned short m_filtMin, m_filtMax;
+    unsigned short m_buf[CHUNK];
+
+    Median3MinMaxSink(const unsigned short *src, const wxSize& size, const wxRect& rect)
+        : m_src(src), m_width(size.GetWidth()), m_rx(rect.GetX()), m_ry(rect.GetY()), m_rw(rect.GetWidth()),
+          m_min(65535), m_max(0), m_filtMin(65535), m_filtMax(0) { }
+
+    void Row(int y)
+    {
+        const unsigned short *p = &m_src[(m_ry + y) * m_width + m_rx];
+        unsigned short mn = m_min, mx = m_max;
+        for (int x = 0; x < m_rw; x++)
+        {
+            unsigned short const v = p[x];
+            if (v < mn) mn = v;
+            if (v > mx) mx = v;
+        }
+        m_min = mn;
+        m_max = mx;
     }
 
-    // bottom row
-    d = &dst[IX(0, RH - 1)];
+    void Put(unsigned short val)
+    {
+        if (val < m_filtMin) m_filtMin = val;
+        if (val > m_filtMax) m_filtMax = val;
+    }
 
-    // bottom-left corner
-    a[0] = src[IX(0, RH - 2)];
-    a[1] = src[IX(1, RH - 2)];
-    a[2] = src[IX(0, RH - 1)];
-    a[3] = src[IX(1, RH - 1)];
-    *d++ = median4(a);
+    unsigned short *Reserve(int) { return m_buf; }
 
-    // bottom row middle pixels
-    for (int x = 1; x <= RW - 2; x++)
+    void Commit(const unsigned short *d, int n)
     {
-        a[0] = src[IX(x - 1, RH - 2)];
-        a[1] = src[IX(x    , RH - 2)];
-        a[2] = src[IX(x + 1, RH - 2)];
-        a[3] = src[IX(x - 1, RH - 1)];
-        a[4] = src[IX(x    , RH - 1)];
-        a[5] = src[IX(x + 1, RH - 1)];
-        *d++ = median6(a);
+        unsigned short mn = m_filtMin, mx = m_filtMax;
+        for (int i = 0; i < n; i++)
+        {
+            if (d[i] < mn) mn = d[i];
+            if (d[i] > mx) mx = d[i];
+        }
+        m_filtMin = mn;
+        m_filtMax = mx;
     }
+};
 
-    // bottom-right corner
-    a[0] = src[IX(RW - 2, RH - 2)];
-    a[1] = src[IX(RW - 1, RH - 2)];
-    a[2] = src[IX(RW - 2, RH - 1)];
-    a[3] = src[IX(RW - 1, RH - 1)];
-    *d = median4(a);
+void Median3MinMax(const unsigned short *src, const wxSize& size, const wxRect& rect, int *min, int *max, int *filtMin, int *filtMax)
+{
+    *min = *filtMin = 65535;
+    *max = *filtMax = 0;
 
-#undef IX
+    bool const filter = rect.GetWidth() >= 2 && rect.GetHeight() >= 2;
+
+    wxCriticalSection lock;
+    ThreadPool::Get()->ParallelRange(rect.GetHeight(), MinBandRows(rect.GetWidth()), [&](int y0, int y1) {
+        Median3MinMaxSink sink(src, size, rect);
+
+        if (filter)
+        {
+            Median3Rows(sink, src, size, rect, y0, y1);
+        }
+        else
+        {
+            // too small to filter
+            for (int y = y0; y < y1; y++)
+                sink.Row(y);
+            sink.m_filtMin = sink.m_min;
+            sink.m_filtMax = sink.m_max;
+        }
+
+        wxCriticalSectionLocker lck(lock);
+        *min = std::min(*min, (int) sink.m_min);
+        *max = std::max(*max, (int) sink.m_max);
+        *filtMin = std::min(*filtMin, (int) sink.m_filtMin);
+        *filtMax = std::max(*filtMax, (int) sink.m_filtMax);
+    });
 }
 
 static unsigned short MedianBorderingPixels(const usImage& img, int x, int y)
@@ -572,6 +721,75 @@ bool SquarePixels(usImage& img, float xsize, float ysize)
     return false;
 }
 
+// max(dark - light, 0) over a row
+static unsigned short MaxDarkExcess(const unsigned short *pl, const unsigned short *pd, unsigned int n)
+{
+    unsigned int i = 0;
+    unsigned short m = 0;
+
+#if defined(IMAGE_MATH_SSE2)
+    __m128i vm = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i ex = _mm_subs_epu16(_mm_loadu_si128((const __m128i *)(pd + i)), _mm_loadu_si128((const __m128i *)(pl + i)));
+        vm = _mm_adds_epu16(_mm_subs_epu16(vm, ex), ex); // unsigned max
+    }
+    unsigned short lanes[8];
+    _mm_storeu_si128((__m128i *) lanes, vm);
+    for (int k = 0; k < 8; k++)
+        m = std::max(m, lanes[k]);
+#elif defined(IMAGE_MATH_NEON)
+    uint16x8_t vm = vdupq_n_u16(0);
+    for (; i + 8 <= n; i += 8)
+        vm = vmaxq_u16(vm, vqsubq_u16(vld1q_u16(pd + i), vld1q_u16(pl + i)));
+    unsigned short lanes[8];
+    vst1q_u16(lanes, vm);
+    for (int k = 0; k < 8; k++)
+        m = std::max(m, lanes[k]);
+#endif
+
+    for (; i < n; i++)
+        if (pd[i] > pl[i])
+            m = std::max(m, (unsigned short) (pd[i] - pl[i]));
+
+    return m;
+}
+
+// pl = clamp(pl - pd + offset, 0, 65535), where offset >= pd - pl for every pixel
+static void SubtractRow(unsigned short *pl, const unsigned short *pd, unsigned int n, unsigned short offset)
+{
+    unsigned int i = 0;
+
+    // with p = max(l - d, 0) and m = max(d - l, 0), one of which is zero,
+    // the result is (p + offset) - m with saturation
+#if defined(IMAGE_MATH_SSE2)
+    __m128i const vofs = _mm_set1_epi16((short) offset);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i l = _mm_loadu_si128((const __m128i *)(pl + i));
+        __m128i d = _mm_loadu_si128((const __m128i *)(pd + i));
+        __m128i r = _mm_subs_epu16(_mm_adds_epu16(_mm_subs_epu16(l, d), vofs), _mm_subs_epu16(d, l));
+        _mm_storeu_si128((__m128i *)(pl + i), r);
+    }
+#elif defined(IMAGE_MATH_NEON)
+    uint16x8_t const vofs = vdupq_n_u16(offset);
+    for (; i + 8 <= n; i += 8)
+    {
+        uint16x8_t l = vld1q_u16(pl + i);
+        uint16x8_t d = vld1q_u16(pd + i);
+        vst1q_u16(pl + i, vqsubq_u16(vqaddq_u16(vqsubq_u16(l, d), vofs), vqsubq_u16(d, l)));
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        int newval = (int) pl[i] - (int) pd[i] + offset;
+        if (newval < 0) newval = 0; // shouldn't hit this...
+        else if (newval > 65535) newval = 65535;
+        pl[i] = (unsigned short) newval;
+    }
+}
+
 bool Subtract(usImage& light, const usImage& dark)
 {
     if (!light.ImageData || !dark.ImageData)
@@ -594,47 +812,23 @@ bool Subtract(usImage& light, const usImage& dark)
         height = light.Size.GetHeight();
     }
 
-    int mindiff = 65535;
+    unsigned int const rowsize = light.Size.GetWidth();
+
+    // the largest amount by which the dark exceeds the light
+    unsigned short offset = 0;
 
     unsigned short *pl0 = &light.Pixel(left, top);
     const unsigned short *pd0 = &dark.Pixel(left, top);
-    for (unsigned int r = 0; r < height;
-         r++, pl0 += light.Size.GetWidth(), pd0 += light.Size.GetWidth())
-    {
-        unsigned short *const endl = pl0 + width;
-        unsigned short *pl;
-        const unsigned short *pd;
-        for (pl = pl0, pd = pd0; pl < endl; pl++, pd++)
-        {
-            int diff = (int) *pl - (int) *pd;
-            if (diff < mindiff)
-                mindiff = diff;
-        }
-    }
+    for (unsigned int r = 0; r < height; r++, pl0 += rowsize, pd0 += rowsize)
+        offset = std::max(offset, MaxDarkExcess(pl0, pd0, width));
 
-    int offset = 0;
-    if (mindiff < 0) // dark was lighter than light
-    {
-        offset = -mindiff;
-        light.Pedestal = (unsigned short) offset;
-    }
+    if (offset > 0) // dark was lighter than light
+        light.Pedestal = offset;
 
     pl0 = &light.Pixel(left, top);
     pd0 = &dark.Pixel(left, top);
-    for (unsigned int r = 0; r < height;
-         r++, pl0 += light.Size.GetWidth(), pd0 += light.Size.GetWidth())
-    {
-        unsigned short *const endl = pl0 + width;
-        unsigned short *pl;
-        const unsigned short *pd;
-        for (pl = pl0, pd = pd0; pl < endl; pl++, pd++)
-        {
-            int newval = (int) *pl - (int) *pd + offset;
-            if (newval < 0) newval = 0; // shouldn't hit this...
-            else if (newval > 65535) newval = 65535;
-            *pl = (unsigned short) newval;
-        }
-    }
+    for (unsigned int r = 0; r < height; r++, pl0 += rowsize, pd0 += rowsize)
+        SubtractRow(pl0, pd0, width, offset);
 
     return false;
 }
@@ -658,132 +852,181 @@ inline static unsigned short histo_median(unsigned short histo1[256], unsigned s
     return i;
 }
 
+// 2-level histogram of the pixels in a median filter window
+struct MedianHisto
+{
+    std::vector<unsigned short> histo1;
+    std::vector<unsigned short> histo2;
+    unsigned int n;
+
+    MedianHisto() : histo1(256), histo2(65536), n(0) { }
+
+    // add (delta = 1) or remove (delta = -1) the pixels in [x0,x1]x[y0,y1]
+    void Update(const usImage& src, int x0, int x1, int y0, int y1, int delta)
+    {
+        int const width = src.Size.GetWidth();
+        for (int j = y0; j <= y1; j++)
+        {
+            const unsigned short *p = &src.ImageData[j * width + x0];
+            for (int i = x0; i <= x1; i++, p++)
+            {
+                histo1[*p >> 8] += delta;
+                histo2[*p] += delta;
+            }
+        }
+        n += delta * (x1 - x0 + 1) * (y1 - y0 + 1);
+    }
+
+    unsigned short Median() { return histo_median(&histo1[0], &histo2[0], n); }
+};
+
 static void MedianFilter(usImage& dst, const usImage& src, int halfWidth)
 {
     dst.Init(src.Size);
-    unsigned short *d = &dst.ImageData[0];
 
     int const width = src.Size.GetWidth();
     int const height = src.Size.GetHeight();
 
-    for (int y = 0; y < height; y++)
-    {
-        int top = std::max(0, y - halfWidth);
-        int bot = std::min(y + halfWidth, height - 1);
-        int left = 0;
-        int right = halfWidth;
+    // Each band of rows is scanned in a serpentine (left to right, down, right
+    // to left, down, ...) so the histogram is built once per band and then only
+    // updated with the columns or rows entering and leaving the window.
+    ThreadPool::Get()->ParallelRange(height, std::max(halfWidth, 1), [&](int y0, int y1) {
+        MedianHisto h;
 
-        // TODO: we initialize the histogram at the start of each row, but we could make this faster
-        // if we scan left to right, move down, scan right to left, move down so we never need to
-        // reinitialize the histogram
+        int top = std::max(0, y0 - halfWidth);
+        int bot = std::min(y0 + halfWidth, height - 1);
+        int left = 0;
+        int right = std::min(halfWidth, width - 1);
 
-        // initialize 2-level histogram
-        unsigned short histo1[256];
-        unsigned short histo2[65536];
-        memset(&histo1[0], 0, sizeof(histo1));
-        memset(&histo2[0], 0, sizeof(histo2));
+        h.Update(src, left, right, top, bot, 1);
 
-        for (int j = top; j <= bot; j++)
+        for (int y = y0; y < y1; y++)
         {
-            const unsigned short *p = &src.Pixel(left, j);
-            for (int i = left; i <= right; i++, p++)
+            if (y > y0)
             {
-                ++histo1[*p >> 8];
-                ++histo2[*p];
+                // move the window down one row
+                if (y - halfWidth - 1 >= 0)
+                    h.Update(src, left, right, y - halfWidth - 1, y - halfWidth - 1, -1);
+                if (y + halfWidth <= height - 1)
+                    h.Update(src, left, right, y + halfWidth, y + halfWidth, 1);
+                top = std::max(0, y - halfWidth);
+                bot = std::min(y + halfWidth, height - 1);
             }
-        }
-        unsigned int n = (right - left + 1) * (bot - top + 1);
 
-        // read off first value for this row
-        *d++ = histo_median(histo1, histo2, n);
+            unsigned short *d = &dst.ImageData[y * width];
+            bool const ltr = ((y - y0) & 1) == 0;
+            int i = ltr ? 0 : width - 1;
 
-        // loop across remaining columns for this row
-        for (int i = 1; i < width; i++)
-        {
-            left = std::max(0, i - halfWidth);
-            right = std::min(i + halfWidth, width - 1);
+            d[i] = h.Median();
 
-            // remove leftmost column
-            if (left > 0)
+            for (int k = 1; k < width; k++)
             {
-                const unsigned short *p = &src.Pixel(left - 1, top);
-                for (int j = top; j <= bot; j++, p += width)
+                if (ltr)
                 {
-                    --histo1[*p >> 8];
-                    --histo2[*p];
+                    ++i;
+                    // remove leftmost column, add new column on right
+                    if (i - halfWidth - 1 >= 0)
+                        h.Update(src, i - halfWidth - 1, i - halfWidth - 1, top, bot, -1);
+                    if (i + halfWidth <= width - 1)
+                        h.Update(src, i + halfWidth, i + halfWidth, top, bot, 1);
                 }
-                n -= (bot - top + 1);
-            }
-
-            // add new column on right
-            if (i + halfWidth <= width - 1)
-            {
-                const unsigned short *p = &src.Pixel(right, top);
-                for (int j = top; j <= bot; j++, p += width)
+                else
                 {
-                    ++histo1[*p >> 8];
-                    ++histo2[*p];
+                    --i;
+                    // remove rightmost column, add new column on left
+                    if (i + halfWidth + 1 <= width - 1)
+                        h.Update(src, i + halfWidth + 1, i + halfWidth + 1, top, bot, -1);
+                    if (i - halfWidth >= 0)
+                        h.Update(src, i - halfWidth, i - halfWidth, top, bot, 1);
                 }
-                n += (bot - top + 1);
+
+                d[i] = h.Median();
             }
 
-            *d++ = histo_median(histo1, histo2, n);
+            left = std::max(0, i - halfWidth);
+            right = std::min(i + halfWidth, width - 1);
         }
-    }
+    });
 }
 
-struct ImageStatsWork
+enum { NUM_LEVELS = 65536 };
+
+// Bands of rows for the parallel scans of a dark frame. Each band keeps its
+// own histograms, so the number of bands is limited to bound the memory used.
+static unsigned int RowBands(int height)
 {
-    ImageStats stats;
-    usImage temp;
-};
+    unsigned int n = std::min(ThreadPool::Get()->Concurrency() * 2, 16U);
+    return std::max(1U, std::min(n, (unsigned int) height));
+}
 
-static void GetImageStats(ImageStatsWork& w, const usImage& img, const wxRect& win)
+inline static int BandTop(int height, unsigned int band, unsigned int nbands)
 {
-    w.temp.Init(img.Size);
+    return (int) ((long long) height * band / nbands);
+}
 
-    // Determine the mean and standard deviation
-    double a = 0.0;
-    double q = 0.0;
-    double k = 1.0;
-    double km1 = 0.0;
+// smallest level whose cumulative count exceeds rank
+static unsigned short HistoSelect(const unsigned int *histo, unsigned int rank)
+{
+    unsigned int cum = 0;
+    for (int v = 0; v < NUM_LEVELS; v++)
+    {
+        cum += histo[v];
+        if (cum > rank)
+            return (unsigned short) v;
+    }
+    return NUM_LEVELS - 1;
+}
 
-    const unsigned short *p0 = &img.Pixel(win.GetLeft(), win.GetTop());
-    unsigned short *dst = &w.temp.ImageData[0];
-    for (int y = 0; y < win.GetHeight(); y++)
+static void GetImageStats(ImageStats *stats, const usImage& img)
+{
+    int const width = img.Size.GetWidth();
+    int const height = img.Size.GetHeight();
+    unsigned int const npix = (unsigned int) width * height;
+    unsigned int const nbands = RowBands(height);
+
+    // histogram of the pixel values, built in parallel over bands of rows
+    std::vector<unsigned int> bandHisto(nbands * NUM_LEVELS);
+    ThreadPool::Get()->ParallelFor(nbands, [&](unsigned int band) {
+        unsigned int *h = &bandHisto[band * NUM_LEVELS];
+        const unsigned short *p = img.ImageData + BandTop(height, band, nbands) * width;
+        const unsigned short *end = img.ImageData + BandTop(height, band + 1, nbands) * width;
+        for (; p < end; p++)
+            ++h[*p];
+    });
+
+    std::vector<unsigned int> histo(bandHisto.begin(), bandHisto.begin() + NUM_LEVELS);
+    for (unsigned int band = 1; band < nbands; band++)
     {
-        const unsigned short *end = p0 + win.GetWidth();
-        for (const unsigned short *p = p0; p < end; p++)
-        {
-            *dst++ = *p;
-            double const x = (double) *p;
-            double const a0 = a;
-            a += (x - a) / k;
-            q += (x - a0) * (x - a);
-            km1 = k;
-            k += 1.0;
-        }
-        p0 += img.Size.GetWidth();
+        const unsigned int *h = &bandHisto[band * NUM_LEVELS];
+        for (int v = 0; v < NUM_LEVELS; v++)
+            histo[v] += h[v];
+    }
+
+    // mean and standard deviation in two passes over the histogram
+    double sum = 0.0;
+    for (int v = 0; v < NUM_LEVELS; v++)
+        sum += (double) v * histo[v];
+    double const mean = sum / npix;
+    double q = 0.0;
+    for (int v = 0; v < NUM_LEVELS; v++)
+    {
+        double const d = v - mean;
+        q += d * d * histo[v];
     }
 
-    w.stats.mean = a;
-    w.stats.stdev = sqrt(q / km1);
+    stats->mean = mean;
+    stats->stdev = sqrt(q / npix);
 
-    int winPixels = win.GetWidth() * win.GetHeight();
-    unsigned short *tmp = &w.temp.ImageData[0];
-    std::nth_element(tmp, tmp + winPixels / 2, tmp + winPixels);
+    stats->median = HistoSelect(&histo[0], npix / 2);
 
-    w.stats.median = tmp[winPixels / 2];
+    // the absolute deviations from the median are histogrammed by folding
+    // the value histogram around the median
+    int const median = stats->median;
+    std::vector<unsigned int> dev(NUM_LEVELS, 0);
+    for (int v = 0; v < NUM_LEVELS; v++)
+        dev[std::abs(v - median)] += histo[v];
 
-    // replace each pixel with the absolute deviation from the median
-    unsigned short *p = tmp;
-    for (int i = 0; i < winPixels; i++)
-    {
-        unsigned short ad = (unsigned short) std::abs((int) *p - (int) w.stats.median);
-        *p++ = ad;
-    }
-    std::nth_element(tmp, tmp + winPixels / 2, tmp + winPixels);
-    w.stats.mad = tmp[winPixels / 2];
+    stats->mad = HistoSelect(&dev[0], npix / 2);
 }
 
 void DefectMapDarks::BuildFilteredDark()
@@ -827,30 +1070,40 @@ void DefectMapDarks::LoadDarks()
     filteredDark.Load(DefectMapFilterPath());
 }
 
-struct BadPx
+// Candidate defects in ascending order of magnitude, the difference between
+// the master dark and the median filtered dark. The pixels of magnitude v are
+// px[start[v] .. start[v + 1]), so selecting the defects above a threshold is
+// a lookup rather than a search. Like the std::set ordered by magnitude that
+// this replaces, the list holds only the first pixel (in row-major order) of
+// each magnitude; the aggressiveness sliders are tuned to those counts.
+struct BadPxList
 {
-    unsigned short x;
-    unsigned short y;
-    int v;
+    std::vector<unsigned int> px;       // pixel offsets, y * width + x
+    std::vector<unsigned int> start;    // NUM_LEVELS + 1 entries
 
-    BadPx();
-    BadPx(int x_, int y_, int v_) : x(x_), y(y_), v(v_) { }
-    bool operator<(const BadPx& rhs) const { return v < rhs.v; }
-};
+    void Clear()
+    {
+        std::vector<unsigned int>().swap(px);
+        start.assign(NUM_LEVELS + 1, 0);
+    }
 
-typedef std::set<BadPx> BadPxSet;
+    // the first level at or above thresh
+    static int Level(int thresh) { return std::max(0, std::min(thresh, (int) NUM_LEVELS)); }
+    unsigned int CountFrom(int level) const { return (unsigned int) px.size() - start[level]; }
+};
 
 struct DefectMapBuilderImpl
 {
     DefectMapDarks *darks;
-    ImageStatsWork w;
+    ImageStats stats;
     wxArrayString mapInfo;
     int aggrCold;
     int aggrHot;
-    BadPxSet coldPx;
-    BadPxSet hotPx;
-    BadPxSet::const_iterator coldPxThresh;
-    BadPxSet::const_iterator hotPxThresh;
+    int width;
+    BadPxList coldPx;
+    BadPxList hotPx;
+    int coldLevel;
+    int hotLevel;
     unsigned int coldPxSelected;
     unsigned int hotPxSelected;
     bool threshValid;
@@ -860,8 +1113,12 @@ struct DefectMapBuilderImpl
         darks(0),
         aggrCold(100),
         aggrHot(100),
+        width(0),
         threshValid(false)
-    { }
+    {
+        coldPx.Clear();
+        hotPx.Clear();
+    }
 };
 
 DefectMapBuilder::DefectMapBuilder()
@@ -880,16 +1137,102 @@ inline static double AggrToSigma(int val)
     return exp2(3.0 - (6.0 / 100.0) * (double)val);
 }
 
+static const unsigned int NO_SLOT = ~0U;
+
+// turn the per-band candidate counts into output positions: for each
+// magnitude, the first band with a candidate gets the one slot and the other
+// bands get NO_SLOT. Then size the list.
+static void AssignSlots(BadPxList *list, std::vector<unsigned int>& cnt, unsigned int nbands)
+{
+    unsigned int pos = 0;
+    for (int v = 0; v < NUM_LEVELS; v++)
+    {
+        list->start[v] = pos;
+        for (unsigned int band = 0; band < nbands; band++)
+        {
+            unsigned int& c = cnt[band * NUM_LEVELS + v];
+            if (c && list->start[v] == pos)
+                c = pos++;
+            else
+                c = NO_SLOT;
+        }
+    }
+    list->start[NUM_LEVELS] = pos;
+    list->px.resize(pos);
+}
+
+// Find the pixels that differ from the median filtered dark by more than
+// thresh. Each band of rows is scanned twice in parallel: once to count the
+// candidates at each magnitude and once to store the first of each magnitude
+// in its final place, which amounts to a counting sort by magnitude into a
+// single allocation.
+static void LoadCandidates(DefectMapBuilderImpl *impl, const usImage& dark, const usImage& medianFilt, int thresh)
+{
+    int const width = dark.Size.GetWidth();
+    int const height = dark.Size.GetHeight();
+    unsigned int const nbands = RowBands(height);
+
+    impl->width = width;
+    impl->coldPx.Clear();
+    impl->hotPx.Clear();
+
+    std::vector<unsigned int> coldCnt(nbands * NUM_LEVELS, 0);
+    std::vector<unsigned int> hotCnt(nbands * NUM_LEVELS, 0);
+
+    auto scan = [&](unsigned int band, bool store) {
+        unsigned int *cc = &coldCnt[band * NUM_LEVELS];
+        unsigned int *hc = &hotCnt[band * NUM_LEVELS];
+        unsigned int *cold = impl->coldPx.px.empty() ? nullptr : &impl->coldPx.px[0];
+        unsigned int *hot = impl->hotPx.px.empty() ? nullptr : &impl->hotPx.px[0];
+
+        for (int y = BandTop(height, band, nbands); y < BandTop(height, band + 1, nbands); y++)
+        {
+            const unsigned short *d = dark.ImageData + y * width;
+            const unsigned short *f = medianFilt.ImageData + y * width;
+            for (int x = 0; x < width; x++)
+            {
+                int v = (int) d[x] - (int) f[x];
+                if (v > thresh)
+                {
+                    if (!store)
+                        ++hc[v];
+                    else if (hc[v] != NO_SLOT)
+                    {
+                        hot[hc[v]] = y * width + x;
+                        hc[v] = NO_SLOT;
+                    }
+                }
+                else if (-v > thresh)
+                {
+                    if (!store)
+                        ++cc[-v];
+                    else if (cc[-v] != NO_SLOT)
+                    {
+                        cold[cc[-v]] = y * width + x;
+                        cc[-v] = NO_SLOT;
+                    }
+                }
+            }
+        }
+    };
+
+    ThreadPool::Get()->ParallelFor(nbands, [&](unsigned int band) { scan(band, false); });
+
+    AssignSlots(&impl->coldPx, coldCnt, nbands);
+    AssignSlots(&impl->hotPx, hotCnt, nbands);
+
+    ThreadPool::Get()->ParallelFor(nbands, [&](unsigned int band) { scan(band, true); });
+}
+
 void DefectMapBuilder::Init(DefectMapDarks& darks)
 {
     m_impl->darks = &darks;
 
     Debug.AddLine("DefectMapBuilder: Init");
 
-    ::GetImageStats(m_impl->w, darks.masterDark,
-        wxRect(0, 0, darks.masterDark.Size.GetWidth(), darks.masterDark.Size.GetHeight()));
+    ::GetImageStats(&m_impl->stats, darks.masterDark);
 
-    const ImageStats& stats = m_impl->w.stats;
+    const ImageStats& stats = m_impl->stats;
 
     Debug.Write(wxString::Format("DefectMapBuilder: Dark N = %u Mean = %.f Median = %d Standard Deviation = %.f MAD=%d\n",
                                  darks.masterDark.NPixels, stats.mean, stats.median, stats.stdev, stats.mad));
@@ -900,36 +1243,15 @@ void DefectMapBuilder::Init(DefectMapDarks& darks)
 
     Debug.Write(wxString::Format("DefectMapBuilder: load potential defects thresh = %d\n", thresh));
 
-    usImage& dark = m_impl->darks->masterDark;
-    usImage& medianFilt = m_impl->darks->filteredDark;
-
-    m_impl->coldPx.clear();
-    m_impl->hotPx.clear();
-
-    for (int y = 0; y < dark.Size.GetHeight(); y++)
-    {
-        for (int x = 0; x < dark.Size.GetWidth(); x++)
-        {
-            int filt = (int) medianFilt.Pixel(x, y);
-            int val = (int) dark.Pixel(x, y);
-            int v = val - filt;
-            if (v > thresh)
-            {
-                m_impl->hotPx.insert(BadPx(x, y, v));
-            }
-            else if (-v > thresh)
-            {
-                m_impl->coldPx.insert(BadPx(x, y, -v));
-            }
-        }
-    }
+    LoadCandidates(m_impl, m_impl->darks->masterDark, m_impl->darks->filteredDark, thresh);
+    m_impl->threshValid = false;
 
-    Debug.Write(wxString::Format("DefectMapBuilder: Loaded %d cold %d hot\n", m_impl->coldPx.size(), m_impl->hotPx.size()));
+    Debug.Write(wxString::Format("DefectMapBuilder: Loaded %d cold %d hot\n", m_impl->coldPx.px.size(), m_impl->hotPx.px.size()));
 }
 
 const ImageStats& DefectMapBuilder::GetImageStats() const
 {
-    return m_impl->w.stats;
+    return m_impl->stats;
 }
 
 void DefectMapBuilder::SetAggressiveness(int aggrCold, int aggrHot)
@@ -947,17 +1269,17 @@ static void FindThresh(DefectMapBuilderImpl *impl)
     double multCold = AggrToSigma(impl->aggrCold);
     double multHot = AggrToSigma(impl->aggrHot);
 
-    int coldThresh = (int) (multCold * impl->w.stats.stdev);
-    int hotThresh = (int) (multHot * impl->w.stats.stdev);
+    int coldThresh = (int) (multCold * impl->stats.stdev);
+    int hotThresh = (int) (multHot * impl->stats.stdev);
 
     Debug.Write(wxString::Format("DefectMap: find thresholds aggr:(%d,%d) sigma:(%.1f,%.1f) px:(%+d,%+d)\n",
                                  impl->aggrCold, impl->aggrHot, multCold, multHot, -coldThresh, hotThresh));
 
-    impl->coldPxThresh = impl->coldPx.lower_bound(BadPx(0, 0, coldThresh));
-    impl->hotPxThresh = impl->hotPx.lower_bound(BadPx(0, 0, hotThresh));
+    impl->coldLevel = BadPxList::Level(coldThresh);
+    impl->hotLevel = BadPxList::Level(hotThresh);
 
-    impl->coldPxSelected = std::distance(impl->coldPxThresh, impl->coldPx.end());
-    impl->hotPxSelected = std::distance(impl->hotPxThresh, impl->hotPx.end());
+    impl->coldPxSelected = impl->coldPx.CountFrom(impl->coldLevel);
+    impl->hotPxSelected = impl->hotPx.CountFrom(impl->hotLevel);
 
     Debug.Write(wxString::Format("DefectMap: find thresholds found (%d,%d)\n", impl->coldPxSelected, impl->hotPxSelected));
 
@@ -976,17 +1298,22 @@ int DefectMapBuilder::GetHotPixelCnt() const
     return m_impl->hotPxSelected;
 }
 
-inline static unsigned int emit_defects(DefectMap& defectMap, BadPxSet::const_iterator p0, BadPxSet::const_iterator p1, double stdev, int sign, bool verbose)
+inline static unsigned int emit_defects(DefectMap& defectMap, const BadPxList& list, int level, int width, double stdev, int sign, bool verbose)
 {
     unsigned int cnt = 0;
-    for (BadPxSet::const_iterator it = p0; it != p1; ++it, ++cnt)
+    for (int v = level; v < NUM_LEVELS; v++)
     {
-        if (verbose)
+        for (unsigned int i = list.start[v]; i < list.start[v + 1]; i++, ++cnt)
         {
-            int v = sign * it->v;
-            Debug.Write(wxString::Format("DefectMap: defect @ (%d, %d) val = %d (%+.1f sigma)\n", it->x, it->y, v, stdev > 0.1 ? (double)v / stdev : 0.0));
+            int const x = list.px[i] % width;
+            int const y = list.px[i] / width;
+            if (verbose)
+            {
+                int val = sign * v;
+                Debug.Write(wxString::Format("DefectMap: defect @ (%d, %d) val = %d (%+.1f sigma)\n", x, y, val, stdev > 0.1 ? (double)val / stdev : 0.0));
+            }
+            defectMap.push_back(wxPoint(x, y));
         }
-        defectMap.push_back(wxPoint(it->x, it->y));
     }
     return cnt;
 }
@@ -997,7 +1324,7 @@ void DefectMapBuilder::BuildDefectMap(DefectMap& defectMap, bool verbose) const
 
     double multCold = AggrToSigma(m_impl->aggrCold);
     double multHot = AggrToSigma(m_impl->aggrHot);
-    const ImageStats& stats = m_impl->w.stats;
+    const ImageStats& stats = m_impl->stats;
 
     info.Clear();
     info.push_back(wxString::Format("Generated: %s", wxDateTime::UNow().FormatISOCombined(' ')));
@@ -1024,8 +1351,10 @@ void DefectMapBuilder::BuildDefectMap(DefectMap& defectMap, bool verbose) const
     FindThresh(m_impl);
 
     defectMap.clear();
-    unsigned int nr_cold = emit_defects(defectMap, m_impl->coldPxThresh, m_impl->coldPx.end(), stats.stdev, -1, verbose);
-    unsigned int nr_hot = emit_defects(defectMap, m_impl->hotPxThresh, m_impl->hotPx.end(), stats.stdev, +1, verbose);
+    defectMap.InvalidateIndex();
+    defectMap.reserve(m_impl->coldPxSelected + m_impl->hotPxSelected);
+    unsigned int nr_cold = emit_defects(defectMap, m_impl->coldPx, m_impl->coldLevel, m_impl->width, stats.stdev, -1, verbose);
+    unsigned int nr_hot = emit_defects(defectMap, m_impl->hotPx, m_impl->hotLevel, m_impl->width, stats.stdev, +1, verbose);
 
     if (verbose) Debug.Write(wxString::Format("New defect map created, count=%d (cold=%d, hot=%d)\n", defectMap.size(), nr_cold, nr_hot));
 }
@@ -1041,44 +1370,99 @@ bool RemoveDefects(usImage& light, const DefectMap& defectMap)
     if (!light.ImageData)
         return true;
 
+    if (!defectMap.IndexValid())
+        defectMap.BuildIndex();
+
+    // only the rows and columns of the subframe are visited
+    wxRect rect(light.Size);
     if (!light.Subframe.IsEmpty())
+        rect.Intersect(light.Subframe);
+
+    int const xsize = light.Size.GetWidth();
+    int const ysize = light.Size.GetHeight();
+    int const bottom = std::min(rect.GetBottom(), defectMap.IndexRows() - 1);
+
+    // Step over each defect and replace the light value
+    // with the median of the surrounding pixels
+    for (int y = rect.GetTop(); y <= bottom; y++)
     {
-        // Step over each defect and replace the light value
-        // with the median of the surrounding pixels
-        for (DefectMap::const_iterator it = defectMap.begin(); it != defectMap.end(); ++it)
-        {
-            const wxPoint& pt = *it;
-            // Check to see if we are within the subframe before correcting the defect
-            if (light.Subframe.Contains(pt))
-            {
-                light.Pixel(pt.x, pt.y) = MedianBorderingPixels(light, pt.x, pt.y);
-            }
-        }
-    }
-    else
-    {
-        // Step over each defect and replace the light value
-        // with the median of the surrounding pixels
-        for (DefectMap::const_iterator it = defectMap.begin(); it != defectMap.end(); ++it)
-        {
-            int const x = it->x;
-            int const y = it->y;
+        const int *end = defectMap.RowEnd(y);
+        const int *p = std::lower_bound(defectMap.RowBegin(y), end, rect.GetLeft());
+        unsigned short *row = light.ImageData + y * xsize;
+        bool const interiorRow = y > 0 && y < ysize - 1;
 
-            if (x >= 0 && x < light.Size.GetWidth() && y >= 0 && y < light.Size.GetHeight())
+        for (; p < end && *p <= rect.GetRight(); ++p)
+        {
+            int const x = *p;
+            if (interiorRow && x > 0 && x < xsize - 1)
             {
-                light.Pixel(x, y) = MedianBorderingPixels(light, x, y);
+                unsigned short array[8];
+                array[0] = row[x - 1 - xsize];
+                array[1] = row[x - xsize];
+                array[2] = row[x + 1 - xsize];
+                array[3] = row[x - 1];
+                array[4] = row[x + 1];
+                array[5] = row[x - 1 + xsize];
+                array[6] = row[x + xsize];
+                array[7] = row[x + 1 + xsize];
+                row[x] = median8(array);
             }
+            else
+                row[x] = MedianBorderingPixels(light, x, y);
         }
     }
 
     return false;
 }
 
-wxString DefectMap::DefectMapFileName(int profileId)
+//
+// Binary defect map file. All fields are 32-bit little-endian integers, so
+// the file can be moved between machines.
+//
+//   DefectMapFileHeader, DEFECT_MAP_HEADER_SIZE bytes
+//   info text, UTF-8 lines separated by '\n', zero padded to a multiple of 4 bytes
+//   rowCount x { y, number of runs in the row }, in ascending y
+//   runCount x { x, run length }, in ascending x within each row
+//   { x, y } records appended by AddDefect, in no particular order
+//
+// Older versions saved the map as text, one "x y" line per defect. A text
+// map is converted to the binary format the first time it is loaded.
+//
+struct DefectMapFileHeader
+{
+    char magic[8];
+    wxUint32 version;
+    wxUint32 infoBytes;
+    wxUint32 rowCount;
+    wxUint32 runCount;
+    wxUint32 defectCount;   // number of defects in the runs
+    wxUint32 reserved;
+};
+
+static const char DEFECT_MAP_MAGIC[8] = { 'P', 'H', 'D', '2', 'D', 'M', 'A', 'P' };
+enum { DEFECT_MAP_VERSION = 1 };
+enum { DEFECT_MAP_HEADER_SIZE = 8 + 6 * 4 };
+
+static wxString DefectMapPath(int profileId, const char *ext)
 {
     int inst = wxGetApp().GetInstanceNumber();
     return MyFrame::GetDarksDir() + PATHSEPSTR +
-        wxString::Format("PHD2_defect_map%s_%d.txt", inst > 1 ? wxString::Format("_%d", inst) : "", profileId);
+        wxString::Format("PHD2_defect_map%s_%d.%s", inst > 1 ? wxString::Format("_%d", inst) : "", profileId, ext);
+}
+
+wxString DefectMap::DefectMapFileName(int profileId)
+{
+    return DefectMapPath(profileId, "dat");
+}
+
+wxString DefectMap::LegacyFileName(int profileId)
+{
+    return DefectMapPath(profileId, "txt");
+}
+
+bool DefectMap::DefectMapFileExists(int profileId)
+{
+    return wxFileExists(DefectMapFileName(profileId)) || wxFileExists(LegacyFileName(profileId));
 }
 
 bool DefectMap::ImportFromProfile(int srcId, int destId)
@@ -1089,6 +1473,12 @@ bool DefectMap::ImportFromProfile(int srcId, int destId)
 
     sourceName = DefectMapFileName(srcId);
     destName = DefectMapFileName(destId);
+    if (!wxFileExists(sourceName))
+    {
+        // not converted yet
+        sourceName = LegacyFileName(srcId);
+        destName = LegacyFileName(destId);
+    }
     rslt = wxCopyFile(sourceName, destName, true);
     if (rslt != 1)
     {
@@ -1118,7 +1508,7 @@ bool DefectMap::DefectMapExists(int profileId, bool showAlert)
 {
     bool bOk = false;
 
-    if (wxFileExists(DefectMapFileName(profileId)))
+    if (DefectMapFileExists(profileId))
     {
         wxString fName = DefectMapMasterPath(profileId);
         const wxSize& sensorSize = pCamera->DarkFrameSize();
@@ -1129,6 +1519,7 @@ bool DefectMap::DefectMapExists(int profileId, bool showAlert)
         }
         else
         {
+            FitsLock fitsLock;
             fitsfile *fptr;
             int status = 0;  // CFITSIO status value MUST be initialized to zero!
 
@@ -1156,113 +1547,364 @@ bool DefectMap::DefectMapExists(int profileId, bool showAlert)
     return bOk;
 }
 
+static void PutWord(std::vector<unsigned char> *buf, wxUint32 val)
+{
+    buf->push_back(val & 0xff);
+    buf->push_back((val >> 8) & 0xff);
+    buf->push_back((val >> 16) & 0xff);
+    buf->push_back((val >> 24) & 0xff);
+}
+
+inline static wxUint32 GetWord(const unsigned char *p)
+{
+    return (wxUint32) p[0] | ((wxUint32) p[1] << 8) | ((wxUint32) p[2] << 16) | ((wxUint32) p[3] << 24);
+}
+
+static void PutHeader(std::vector<unsigned char> *buf, const DefectMapFileHeader& hdr)
+{
+    buf->insert(buf->end(), hdr.magic, hdr.magic + sizeof(hdr.magic));
+    PutWord(buf, hdr.version);
+    PutWord(buf, hdr.infoBytes);
+    PutWord(buf, hdr.rowCount);
+    PutWord(buf, hdr.runCount);
+    PutWord(buf, hdr.defectCount);
+    PutWord(buf, hdr.reserved);
+}
+
+static void GetHeader(DefectMapFileHeader *hdr, const unsigned char *p)
+{
+    memcpy(hdr->magic, p, sizeof(hdr->magic));
+    p += sizeof(hdr->magic);
+    hdr->version = GetWord(p);
+    hdr->infoBytes = GetWord(p + 4);
+    hdr->rowCount = GetWord(p + 8);
+    hdr->runCount = GetWord(p + 12);
+    hdr->defectCount = GetWord(p + 16);
+    hdr->reserved = GetWord(p + 20);
+}
+
 void DefectMap::Save(const wxArrayString& info) const
 {
     wxString filename = DefectMapFileName(m_profileId);
-    wxFileOutputStream oStream(filename);
-    wxTextOutputStream outText(oStream);
 
-    if (oStream.GetLastError() != wxSTREAM_NO_ERROR)
+    if (!IndexValid())
+        BuildIndex();
+
+    std::string text;
+    for (wxArrayString::const_iterator it = info.begin(); it != info.end(); ++it)
     {
-        Debug.AddLine(wxString::Format("Failed to save defect map to %s", filename));
-        return;
+        text += it->ToStdString();
+        text += '\n';
     }
+    text.resize((text.size() + 3) & ~3, '\0');
 
-    outText << "# PHD2 Defect Map v1\n";
-
-    for (wxArrayString::const_iterator it = info.begin(); it != info.end(); ++it)
+    // encode each row as runs of adjacent columns
+    std::vector<unsigned char> rows;
+    std::vector<unsigned char> runs;
+    wxUint32 rowCount = 0, runCount = 0;
+    for (int y = 0; y < IndexRows(); y++)
     {
-        outText << "# " << *it << "\n";
+        const int *p = RowBegin(y), *end = RowEnd(y);
+        if (p == end)
+            continue;
+
+        wxUint32 rowRuns = 0;
+        while (p < end)
+        {
+            const int *q = p + 1;
+            while (q < end && *q == q[-1] + 1)
+                ++q;
+            PutWord(&runs, (wxUint32) *p);
+            PutWord(&runs, (wxUint32) (q - p));
+            ++rowRuns;
+            p = q;
+        }
+
+        PutWord(&rows, (wxUint32) y);
+        PutWord(&rows, rowRuns);
+        ++rowCount;
+        runCount += rowRuns;
     }
-    outText << "# Defect count: " << ((unsigned int) size()) << "\n";
 
-    for (const_iterator it = begin(); it != end(); ++it)
+    DefectMapFileHeader hdr;
+    memcpy(hdr.magic, DEFECT_MAP_MAGIC, sizeof(hdr.magic));
+    hdr.version = DEFECT_MAP_VERSION;
+    hdr.infoBytes = (wxUint32) text.size();
+    hdr.rowCount = rowCount;
+    hdr.runCount = runCount;
+    hdr.defectCount = (wxUint32) m_rowX.size();
+    hdr.reserved = 0;
+
+    std::vector<unsigned char> head;
+    PutHeader(&head, hdr);
+
+    // write a new file and replace the old one, so an interrupted save
+    // leaves the previous map in place
+    wxString tmpname = filename + ".tmp";
+    wxFile file;
+    bool ok = file.Create(tmpname, true) &&
+        file.Write(head.data(), head.size()) == head.size() &&
+        file.Write(text.data(), text.size()) == text.size() &&
+        file.Write(rows.data(), rows.size()) == rows.size() &&
+        file.Write(runs.data(), runs.size()) == runs.size() &&
+        file.Close();
+
+    if (!ok || !wxRenameFile(tmpname, filename, true))
     {
-        outText << it->x << " " << it->y << "\n";
+        Debug.AddLine(wxString::Format("Failed to save defect map to %s", filename));
+        wxRemoveFile(tmpname);
+        return;
     }
 
-    oStream.Close();
-    Debug.AddLine(wxString::Format("Saved defect map to %s", filename));
+    Debug.AddLine(wxString::Format("Saved defect map to %s (%u defects in %u runs)", filename, hdr.defectCount, runCount));
 }
 
 DefectMap::DefectMap()
-    : m_profileId(pConfig->GetCurrentProfileId())
+    : m_profileId(pConfig->GetCurrentProfileId()), m_indexedSize(0)
 {
 }
 
 DefectMap::DefectMap(int profileId)
-    : m_profileId(profileId)
+    : m_profileId(profileId), m_indexedSize(0)
+{
+}
+
+void DefectMap::BuildIndex() const
+{
+    // sort by row, then column, in the same order as the map builder emits defects
+    std::vector<wxPoint> pts;
+    pts.reserve(size());
+    int maxy = -1;
+    for (const_iterator it = begin(); it != end(); ++it)
+    {
+        if (it->x < 0 || it->y < 0)
+            continue;
+        pts.push_back(*it);
+        maxy = std::max(maxy, it->y);
+    }
+    std::sort(pts.begin(), pts.end(), [](const wxPoint& a, const wxPoint& b) {
+        return a.y < b.y || (a.y == b.y && a.x < b.x);
+    });
+    pts.erase(std::unique(pts.begin(), pts.end()), pts.end());
+
+    m_rowStart.assign(maxy + 2, 0);
+    m_rowX.resize(pts.size());
+    for (size_t i = 0; i < pts.size(); i++)
+    {
+        m_rowX[i] = pts[i].x;
+        ++m_rowStart[pts[i].y + 1];
+    }
+    for (int y = 0; y <= maxy; y++)
+        m_rowStart[y + 1] += m_rowStart[y];
+
+    m_indexedSize = size();
+}
+
+void DefectMap::InvalidateIndex()
 {
+    m_rowStart.clear();
+    m_rowX.clear();
+    m_indexedSize = 0;
 }
 
 bool DefectMap::FindDefect(const wxPoint& pt) const
 {
-    return std::find(begin(), end(), pt) != end();
+    if (pt.x < 0 || pt.y < 0)
+        return std::find(begin(), end(), pt) != end(); // not in the index
+
+    if (!IndexValid())
+        BuildIndex();
+
+    return pt.y < IndexRows() && std::binary_search(RowBegin(pt.y), RowEnd(pt.y), pt.x);
+}
+
+// add pt to an up-to-date index without rebuilding it
+void DefectMap::IndexDefect(const wxPoint& pt)
+{
+    if (pt.x < 0 || pt.y < 0)
+        return;
+
+    if (pt.y >= IndexRows())
+        m_rowStart.resize(pt.y + 2, m_rowStart.back());
+
+    std::vector<int>::iterator rowEnd = m_rowX.begin() + m_rowStart[pt.y + 1];
+    std::vector<int>::iterator pos = std::lower_bound(m_rowX.begin() + m_rowStart[pt.y], rowEnd, pt.x);
+    if (pos != rowEnd && *pos == pt.x)
+        return; // already in the map
+
+    m_rowX.insert(pos, pt.x);
+    for (size_t y = pt.y + 1; y < m_rowStart.size(); y++)
+        ++m_rowStart[y];
 }
 
 void DefectMap::AddDefect(const wxPoint& pt)
 {
     // first add the point
+    bool const indexed = IndexValid();
     push_back(pt);
+    if (indexed)
+    {
+        IndexDefect(pt);
+        m_indexedSize = size();
+    }
+    else
+        InvalidateIndex();
 
     wxString filename = DefectMapFileName(m_profileId);
+    if (!wxFileExists(filename))
+    {
+        Save(wxArrayString());
+        return;
+    }
+
+    // append the point to the file instead of rewriting the whole map
+    std::vector<unsigned char> rec;
+    PutWord(&rec, (wxUint32) pt.x);
+    PutWord(&rec, (wxUint32) pt.y);
     wxFile file(filename, wxFile::write_append);
-    wxFileOutputStream oStream(file);
-    wxTextOutputStream outText(oStream);
 
-    if (oStream.GetLastError() != wxSTREAM_NO_ERROR)
+    if (!file.IsOpened() || file.Write(rec.data(), rec.size()) != rec.size())
     {
         Debug.AddLine(wxString::Format("Failed to save defect map to %s", filename));
         return;
     }
 
-    outText << pt.x << " " << pt.y << "\n";
-
-    oStream.Close();
     Debug.AddLine(wxString::Format("Saved defect map to %s", filename));
 }
 
-DefectMap *DefectMap::LoadDefectMap(int profileId)
+// returns true on error
+bool DefectMap::LoadBinary(const wxString& filename)
 {
-    wxString filename = DefectMapFileName(profileId);
-    Debug.AddLine(wxString::Format("Loading defect map file %s", filename));
+    MappedFile map;
+    if (map.Open(filename))
+        return true;
 
-    if (!wxFileExists(filename))
+    const unsigned char *p = map.Data();
+    size_t const fileSize = map.Size();
+
+    DefectMapFileHeader hdr;
+    if (fileSize < DEFECT_MAP_HEADER_SIZE)
+        return true;
+    GetHeader(&hdr, p);
+
+    if (memcmp(hdr.magic, DEFECT_MAP_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != DEFECT_MAP_VERSION)
     {
-        Debug.AddLine(wxString::Format("Defect map file not found: %s", filename));
-        return 0;
+        Debug.AddLine(wxString::Format("DefectMap: %s is not a defect map file, or was written by a newer version", filename));
+        return true;
     }
 
-    wxFileInputStream iStream(filename);
-    wxTextInputStream inText(iStream);
+    size_t const rowsOffset = DEFECT_MAP_HEADER_SIZE + (size_t) hdr.infoBytes;
+    size_t const runsOffset = rowsOffset + 8 * (size_t) hdr.rowCount;
+    size_t const appendOffset = runsOffset + 8 * (size_t) hdr.runCount;
+    if (hdr.infoBytes % 4 != 0 || appendOffset > fileSize)
+    {
+        Debug.AddLine(wxString::Format("DefectMap: %s is truncated", filename));
+        return true;
+    }
+
+    const unsigned char *rows = p + rowsOffset;
+    const unsigned char *runs = p + runsOffset;
 
-    // Re-initialize the defect map and parse the defect map file
-    if (iStream.GetLastError() != wxSTREAM_NO_ERROR)
+    // the runs are already in row order, so they expand directly into the index
+    clear();
+    reserve(hdr.defectCount);
+    m_rowX.clear();
+    m_rowX.reserve(hdr.defectCount);
+    m_rowStart.assign(1, 0);
+
+    const unsigned char *run = runs;
+    const unsigned char *const runsEnd = runs + 8 * (size_t) hdr.runCount;
+    for (wxUint32 i = 0; i < hdr.rowCount; i++)
     {
-        Debug.AddLine(wxString::Format("Unexpected eof on defect map file %s", filename));
-        return 0;
+        int const y = (int) GetWord(rows + 8 * i);
+        wxUint32 const rowRuns = GetWord(rows + 8 * i + 4);
+        if (y < 0 || y < IndexRows() || (size_t) (runsEnd - run) < 8 * (size_t) rowRuns)
+        {
+            Debug.AddLine(wxString::Format("DefectMap: %s is corrupt", filename));
+            return true;
+        }
+
+        m_rowStart.resize(y + 2, (unsigned int) m_rowX.size());
+        int nextX = 0;
+        for (wxUint32 r = 0; r < rowRuns; r++, run += 8)
+        {
+            int const x0 = (int) GetWord(run);
+            wxUint32 const len = GetWord(run + 4);
+            if (x0 < nextX || len == 0 || len > (wxUint32) (INT_MAX - x0))
+            {
+                Debug.AddLine(wxString::Format("DefectMap: %s is corrupt", filename));
+                return true;
+            }
+            nextX = x0 + (int) len + 1;
+            for (wxUint32 n = 0; n < len; n++)
+            {
+                m_rowX.push_back(x0 + (int) n);
+                push_back(wxPoint(x0 + (int) n, y));
+            }
+        }
+        m_rowStart[y + 1] = (unsigned int) m_rowX.size();
     }
+    m_indexedSize = size();
 
-    DefectMap *defectMap = new DefectMap(profileId);
+    // points added one at a time since the file was last saved; a partial
+    // record from an interrupted write is ignored
+    size_t const appended = (fileSize - appendOffset) / 8;
+    const unsigned char *rec = p + appendOffset;
+    for (size_t i = 0; i < appended; i++)
+    {
+        wxPoint pt((wxInt32) GetWord(rec + 8 * i), (wxInt32) GetWord(rec + 8 * i + 4));
+        push_back(pt);
+        IndexDefect(pt);
+        m_indexedSize = size();
+    }
+
+    return false;
+}
+
+// read a map saved by an older version. Returns true on error
+bool DefectMap::LoadText(const wxString& filename, wxArrayString *info)
+{
+    wxFile file(filename);
+    if (!file.IsOpened())
+        return true;
+
+    wxFileOffset len = file.Length();
+    std::string buf(len > 0 ? (size_t) len : 0, '\0');
+    if (len > 0 && file.Read(&buf[0], buf.size()) != (ssize_t) buf.size())
+        return true;
+
+    clear();
+    InvalidateIndex();
 
     int linenum = 0;
-    while (!inText.GetInputStream().Eof())
+    size_t pos = 0;
+    while (pos < buf.size())
     {
-        wxString line = inText.ReadLine();
+        size_t eol = buf.find('\n', pos);
+        if (eol == std::string::npos)
+            eol = buf.size();
+        std::string line(buf, pos, eol - pos);
+        pos = eol + 1;
         ++linenum;
-        line.Trim(false); // trim leading whitespace
-        if (line.IsEmpty())
+
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos)
             continue;
-        if (line.StartsWith("#"))
+        if (line[start] == '#')
+        {
+            wxString comment = wxString(line.c_str() + start + 1).Trim(false).Trim();
+            if (!comment.StartsWith("PHD2 Defect Map") && !comment.StartsWith("Defect count"))
+                info->push_back(comment);
             continue;
+        }
 
-        wxStringTokenizer tok(line);
-        wxString s1 = tok.GetNextToken();
-        wxString s2 = tok.GetNextToken();
-        long x, y;
-        if (s1.ToLong(&x) && s2.ToLong(&y))
+        const char *s = line.c_str() + start;
+        char *e1, *e2;
+        long x = strtol(s, &e1, 10);
+        long y = strtol(e1, &e2, 10);
+        if (e1 != s && e2 != e1)
         {
-            defectMap->push_back(wxPoint(x, y));
+            push_back(wxPoint(x, y));
         }
         else
         {
@@ -1270,6 +1912,40 @@ DefectMap *DefectMap::LoadDefectMap(int profileId)
         }
     }
 
+    return false;
+}
+
+DefectMap *DefectMap::LoadDefectMap(int profileId)
+{
+    DefectMap *defectMap = new DefectMap(profileId);
+
+    wxString filename = DefectMapFileName(profileId);
+    Debug.AddLine(wxString::Format("Loading defect map file %s", filename));
+
+    bool err = true;
+    if (wxFileExists(filename))
+    {
+        err = defectMap->LoadBinary(filename);
+    }
+
+    wxString legacy = LegacyFileName(profileId);
+    if (err && wxFileExists(legacy))
+    {
+        Debug.AddLine(wxString::Format("Converting defect map file %s", legacy));
+
+        wxArrayString info;
+        err = defectMap->LoadText(legacy, &info);
+        if (!err)
+            defectMap->Save(info);
+    }
+
+    if (err)
+    {
+        Debug.AddLine(wxString::Format("Defect map file not found or unreadable: %s", filename));
+        delete defectMap;
+        return 0;
+    }
+
     Debug.AddLine(wxString::Format("Loaded %d defects", defectMap->size()));
     return defectMap;
 }
@@ -1282,6 +1958,14 @@ void DefectMap::DeleteDefectMap(int profileId)
         Debug.AddLine("Removing defect map file: " + filename);
         wxRemoveFile(filename);
     }
+
+    // also remove an unconverted map from an older version, or it would be loaded instead
+    filename = LegacyFileName(profileId);
+    if (wxFileExists(filename))
+    {
+        Debug.AddLine("Removing defect map file: " + filename);
+        wxRemoveFile(filename);
+    }
 }
 
 
@@ -39,23 +39,48 @@
 class DefectMap : public std::vector<wxPoint>
 {
     int m_profileId;
+
+    // Defect columns grouped by row, so that RemoveDefects only visits the
+    // rows of the subframe. Rebuilt on first use after the map changes;
+    // callers serialize access with the camera's DarkFrameLock.
+    mutable std::vector<unsigned int> m_rowStart; // defects in row y are m_rowX[m_rowStart[y] .. m_rowStart[y+1])
+    mutable std::vector<int> m_rowX;              // sorted within each row
+    mutable size_t m_indexedSize;
+
     DefectMap(int profileId);
+    static wxString LegacyFileName(int profileId);
+    bool LoadBinary(const wxString& filename);
+    bool LoadText(const wxString& filename, wxArrayString *info);
+    void IndexDefect(const wxPoint& pt);
 public:
     static void DeleteDefectMap(int profileId);
     static bool DefectMapExists(int profileId, bool showAlert);
+    static bool DefectMapFileExists(int profileId);
     static DefectMap *LoadDefectMap(int profileId);
     static wxString DefectMapFileName(int profileId);
     static bool ImportFromProfile(int sourceId, int destId);
     DefectMap();
     void Save(const wxArrayString& mapInfo) const;
+    // binary search of the row index
     bool FindDefect(const wxPoint& pt) const;
+    // updates the index in place and appends the point to the saved map
     void AddDefect(const wxPoint& pt);
 
+    // the row index for RemoveDefects and FindDefect; IndexRows() is one more than the largest defect row
+    void BuildIndex() const;
+    // must be called after changing the points other than with AddDefect
+    void InvalidateIndex();
+    int IndexRows() const { return m_rowStart.empty() ? 0 : (int) m_rowStart.size() - 1; }
+    const int *RowBegin(int y) const { return m_rowX.data() + m_rowStart[y]; }
+    const int *RowEnd(int y) const { return m_rowX.data() + m_rowStart[y + 1]; }
+    bool IndexValid() const { return m_indexedSize == size() && !m_rowStart.empty(); }
+
 };
 
 extern bool QuickLRecon(usImage& img);
 extern void Median3(unsigned short *dst, const unsigned short *src, const wxSize& size, const wxRect& rect);
 extern bool Median3(usImage& img);
+extern void Median3MinMax(const unsigned short *src, const wxSize& size, const wxRect& rect, int *min, int *max, int *filtMin, int *filtMax);
 extern bool SquarePixels(usImage& img, float xsize, float ysize);
 extern int dbl_sort_func(double *first, double *second);
 extern bool Subtract(usImage& light, const usImage& dark);
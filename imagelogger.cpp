@@ -35,11 +35,87 @@
 #include "phd.h"
 #include "imagelogger.h"
 
+#include <deque>
+#include <memory>
+
 enum { SAVE_IMAGES = 2 }; // number of images to log preceding and following the trigger image
+enum { MAX_QUEUED_IMAGES = 16 }; // images waiting to be written before further images are discarded
+
+typedef std::shared_ptr<const usImage> ImagePtr;
+
+struct ImageLogJob
+{
+    ImagePtr img;
+    wxString path;
+    FITSHdrList hdr;
+    bool compress;
+};
+
+// Writes logged images to disk so that the guide loop does not wait for the
+// file I/O. The FITS header is collected by the caller on the main thread.
+class ImageLogWriter : public wxThread
+{
+    wxMutex m_lock;
+    wxCondition m_cond;
+    std::deque<ImageLogJob *> m_queue;
+    bool m_stop;
+
+public:
+    ImageLogWriter() : wxThread(wxTHREAD_JOINABLE), m_cond(m_lock), m_stop(false) { }
+
+    bool Enqueue(ImageLogJob *job)
+    {
+        wxMutexLocker lock(m_lock);
+        if (m_queue.size() >= MAX_QUEUED_IMAGES)
+            return false;
+        m_queue.push_back(job);
+        m_cond.Signal();
+        return true;
+    }
+
+    // write any queued images and stop the thread
+    void Stop()
+    {
+        {
+            wxMutexLocker lock(m_lock);
+            m_stop = true;
+            m_cond.Signal();
+        }
+        Wait();
+    }
+
+protected:
+    ExitCode Entry() override
+    {
+        for (;;)
+        {
+            ImageLogJob *job;
+            {
+                wxMutexLocker lock(m_lock);
+                while (m_queue.empty() && !m_stop)
+                    m_cond.Wait();
+                if (m_queue.empty())
+                    break;
+                job = m_queue.front();
+                m_queue.pop_front();
+            }
+
+            wxStopWatch swatch;
+            bool err = job->img->Save(job->path, job->hdr, job->compress);
+            Debug.Write(wxString::Format("ImgLogger: %s %s in %ld ms\n", err ? "error writing" : "wrote",
+                wxFileName(job->path).GetFullName(), swatch.Time()));
+
+            delete job;
+        }
+
+        return (ExitCode) 0;
+    }
+};
 
 struct IL
 {
-    usImage *saved_image[SAVE_IMAGES];
+    ImagePtr saved_image[SAVE_IMAGES]; // shared with the writer thread while queued for writing
+    ImageLogWriter *writer;
 
     int imagesToLog;
     int eventNumber;
@@ -50,8 +126,7 @@ struct IL
 
     void Init()
     {
-        for (int i = 0; i < SAVE_IMAGES; i++)
-            saved_image[i] = 0;
+        writer = nullptr;
 
         imagesToLog = 0;
         eventNumber = 1;
@@ -62,23 +137,41 @@ struct IL
         settings.logFramesDropped = false;
         settings.logAutoSelectFrames = false;
         settings.logNextNFrames = false;
+        settings.compressFrames = false;
     }
 
     void Destroy()
     {
+        if (writer)
+        {
+            writer->Stop();
+            delete writer;
+            writer = nullptr;
+        }
+
         for (int i = 0; i < SAVE_IMAGES; i++)
-            delete saved_image[i];
+            saved_image[i].reset();
     }
 
     void SaveImage(usImage *img)
     {
-        delete saved_image[0];
         for (int i = 1; i < SAVE_IMAGES; i++)
             saved_image[i - 1] = saved_image[i];
-        saved_image[SAVE_IMAGES - 1] = img;
+        saved_image[SAVE_IMAGES - 1].reset(img);
     }
 
-    void LogImage(const usImage *img, const wxString& filename)
+    // The current image stays in use by the guider, so the writer gets a copy
+    // of its pixels. The copy uses a pooled frame buffer.
+    static ImagePtr CopyPixels(const usImage *img)
+    {
+        std::shared_ptr<usImage> copy = std::make_shared<usImage>();
+        if (copy->CopyFrom(*img))
+            return ImagePtr();
+        return copy;
+    }
+
+    // queue img to be written; pixels is either img itself or a copy of it
+    void QueueImage(const usImage *img, const ImagePtr& pixels, const wxString& filename)
     {
         wxString dir = Debug.GetLogDir();
         if (dir != debugLogDir)
@@ -94,24 +187,72 @@ struct IL
             }
         }
 
-        img->Save(wxFileName(subdir, filename).GetFullPath());
+        if (!pixels)
+        {
+            Debug.Write(wxString::Format("ImgLogger: could not copy frame %u, not logged\n", img->FrameNum));
+            return;
+        }
+
+        ImageLogJob *job = new ImageLogJob();
+        job->img = pixels;
+        job->path = wxFileName(subdir, filename).GetFullPath();
+        job->compress = settings.compressFrames;
+        if (job->compress)
+            job->path += ".fz"; // RICE tile-compressed, as produced by fpack
+        img->GetFitsHeader(&job->hdr);
+
+        if (!writer)
+        {
+            writer = new ImageLogWriter();
+            if (writer->Create() != wxTHREAD_NO_ERROR || writer->Run() != wxTHREAD_NO_ERROR)
+            {
+                Debug.Write("ImgLogger: could not start writer thread\n");
+                delete writer;
+                writer = nullptr;
+
+                job->img->Save(job->path, job->hdr, job->compress);
+                delete job;
+                return;
+            }
+        }
+
+        if (!writer->Enqueue(job))
+        {
+            Debug.Write(wxString::Format("ImgLogger: writer is behind, frame %u not logged\n", img->FrameNum));
+            delete job;
+        }
     }
 
-    void LogImage(const usImage *img)
+    void LogImage(const usImage *img, const wxString& filename)
     {
-        Debug.Write(wxString::Format("ImgLogger: LogImage event %u frame %u\n", eventNumber, img->FrameNum));
+        QueueImage(img, CopyPixels(img), filename);
+    }
 
+    wxString EventFilename(const usImage *img) const
+    {
         wxString t = img->ImgStartTime.Format(_T("%Y-%m-%d_%H%M%S"), wxDateTime::Local);
-        wxString filename = wxString::Format("event%03d_%05d_%s_%s.fit", eventNumber, img->FrameNum, t, trigger);
+        return wxString::Format("event%03d_%05d_%s_%s.fit", eventNumber, img->FrameNum, t, trigger);
+    }
 
-        LogImage(img, filename);
+    void LogImage(const usImage *img)
+    {
+        Debug.Write(wxString::Format("ImgLogger: LogImage event %u frame %u\n", eventNumber, img->FrameNum));
+
+        LogImage(img, EventFilename(img));
     }
 
     void LogSavedImages()
     {
+        // the saved images are no longer changed, so the writer can share them
         for (int i = 0; i < SAVE_IMAGES; i++)
+        {
             if (saved_image[i])
-                LogImage(saved_image[i]);
+            {
+                const usImage *img = saved_image[i].get();
+                Debug.Write(wxString::Format("ImgLogger: LogImage event %u frame %u\n", eventNumber, img->FrameNum));
+                QueueImage(img, saved_image[i], EventFilename(img));
+            }
+        }
     }
 
     void BeginLogging(const usImage *img, const wxString& trigger_)
@@ -158,12 +299,12 @@ void ImageLogger::GetSettings(ImageLoggerSettings *settings)
 
 void ImageLogger::ApplySettings(const ImageLoggerSettings& settings)
 {
-    Debug.Write(wxString::Format("ImgLogger: Settings LogEnabled=%d Log Rel=%d, %.2f Log Px=%d, %.2f LogFrameDrop=%d LogAutoSel=%d NextN=%d\n",
+    Debug.Write(wxString::Format("ImgLogger: Settings LogEnabled=%d Log Rel=%d, %.2f Log Px=%d, %.2f LogFrameDrop=%d LogAutoSel=%d NextN=%d Compress=%d\n",
         settings.loggingEnabled,
         settings.logFramesOverThreshRel, settings.logFramesOverThreshRel ? settings.guideErrorThreshRel : 0.,
         settings.logFramesOverThreshPx, settings.logFramesOverThreshPx ? settings.guideErrorThreshPx : 0.,
         settings.logFramesDropped, settings.logAutoSelectFrames,
-        settings.logNextNFrames ? settings.logNextNFramesCount : 0));
+        settings.logNextNFrames ? settings.logNextNFramesCount : 0, settings.compressFrames));
 
     s_il.settings = settings;
     if (settings.loggingEnabled && settings.logNextNFrames && s_il.imagesToLog < settings.logNextNFramesCount)
@@ -43,13 +43,15 @@ struct ImageLoggerSettings
     bool logFramesDropped;
     bool logAutoSelectFrames;
     bool logNextNFrames;
+    bool compressFrames; // save RICE-compressed frames (.fit.fz) instead of .fit
     double guideErrorThreshRel; // relative error theshold
     double guideErrorThreshPx; // pixel error theshold
     unsigned int logNextNFramesCount;
 
     ImageLoggerSettings() :
         loggingEnabled(false), logFramesOverThreshRel(false), logFramesOverThreshPx(false),
-        logFramesDropped(false), logAutoSelectFrames(false), logNextNFrames(false)
+        logFramesDropped(false), logAutoSelectFrames(false), logNextNFrames(false),
+        compressFrames(false)
     { }
 };
 
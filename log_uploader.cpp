@@ -34,8 +34,10 @@
 
 #include "log_uploader.h"
 #include "phd.h"
+#include "mapped_file.h"
 
 #include <algorithm>
+#include <atomic>
 #include <curl/curl.h>
 #include <fstream>
 #include <sstream>
@@ -56,6 +58,11 @@
 # define strncasecmp strnicmp
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define LOG_SCANNER_SSE2 1
+# include <emmintrin.h>
+#endif
+
 struct WindowUpdateLocker
 {
     wxWindow *m_win;
@@ -107,31 +114,90 @@ enum
     MIN_ROWS = 16,
 };
 
-// state machine to allow scanning logs during idle event processing
+// scans the guide logs that do not have an embedded summary, one file per
+// worker thread, and fills in the grid during idle event processing
 //
+struct ScanJob
+{
+    int idx;            // session index
+    wxString name;
+    wxString path;
+    long long size;
+    long long mtime;
+};
+
+struct ScanResult
+{
+    size_t job;         // index into LogScanner::m_jobs
+    GuideLogSummaryInfo summary;
+};
+
+// summaries of previously scanned logs, keyed by file name; an entry is only
+// used when the file size and modification time still match
+struct IndexEntry
+{
+    long long size;
+    long long mtime;
+    GuideLogSummaryInfo summary;
+};
+typedef std::map<wxString, IndexEntry> SummaryIndex;
+
+// a guide log scanned a chunk at a time
+struct GuideLogScan
+{
+    MappedFile map;
+    const char *pos;
+    wxDateTime guidingStarts;
+    GuideLogSummaryInfo summary;
+
+    GuideLogScan() : pos(nullptr) { }
+    bool Open(const wxString& path);
+    bool Scan(size_t bytes);
+};
+
+class LogScanThread;
+
 struct LogScanner
 {
     wxGrid *m_grid;
-    std::deque<int> m_q;  // indexes remaining to be checked
-    std::ifstream m_ifs;
-    wxDateTime m_guiding_starts;
+    std::vector<ScanJob> m_jobs;
+    std::vector<LogScanThread *> m_threads;
+    size_t m_pending;           // jobs whose results have not been applied yet
+    SummaryIndex m_index;
+    bool m_indexDirty;
+    std::atomic<bool> m_stop;
+    GuideLogScan m_idleScan;    // scan on the main thread if no thread could be started
+    size_t m_idleJob;
+    bool m_idleScanning;
+
+    wxMutex m_lock;             // protects the fields below
+    size_t m_next;              // next job to be claimed by a worker
+    std::vector<ScanResult> m_results;
+
+    LogScanner();
+    ~LogScanner();
     void Init(wxGrid *grid);
-    void FindNextRow();
-    bool DoWork(unsigned int millis);
+    bool DoWork();
+
+    // worker thread interface
+    bool NextJob(size_t *job);
+    void AddResult(const ScanResult& result);
+
+private:
+    void StoreResult(const ScanResult& result);
+    void Stop();
 };
 
-void LogScanner::Init(wxGrid *grid)
+class LogScanThread : public wxThread
 {
-    m_grid = grid;
-    // load work queue in sorted order
-    for (auto idx : s_session_idx)
-    {
-        if (s_session[idx].summary_loaded != ST_LOADED)
-            m_q.push_back(idx);
-    }
-    m_guiding_starts = wxInvalidDateTime;
-    FindNextRow();
-}
+    LogScanner *m_scanner;
+
+public:
+    LogScanThread(LogScanner *scanner) : wxThread(wxTHREAD_JOINABLE), m_scanner(scanner) { }
+
+protected:
+    ExitCode Entry() override;
+};
 
 static wxString DebugLogName(const Session& session)
 {
@@ -202,115 +268,455 @@ static void FillActivity(wxGrid *grid, int row, const Session& session, bool res
     }
 }
 
-void LogScanner::FindNextRow()
+static wxString SummaryIndexPath()
 {
-    while (!m_q.empty())
+    return wxFileName(Debug.GetLogDir(), "PHD2_GuideLogSummaries.idx").GetFullPath();
+}
+
+static void LoadSummaryIndex(SummaryIndex *index)
+{
+    index->clear();
+
+    std::ifstream ifs(SummaryIndexPath().fn_str());
+    std::string line;
+    while (std::getline(ifs, line))
     {
-        auto idx = m_q.front();
-        Session& session = s_session[idx];
+        char name[128];
+        IndexEntry e;
+        if (sscanf(line.c_str(), "%127s %lld %lld %u %u %lf %u", name, &e.size, &e.mtime,
+                   &e.summary.cal_cnt, &e.summary.guide_cnt, &e.summary.guide_dur, &e.summary.ga_cnt) != 7)
+        {
+            continue; // header or damaged line
+        }
+        e.summary.valid = true;
+        (*index)[name] = e;
+    }
+}
+
+static void SaveSummaryIndex(const SummaryIndex& index)
+{
+    wxString filename = SummaryIndexPath();
+    wxString tmpname = filename + ".tmp";
 
-        assert(session.has_guide);
-        assert(session.summary_loaded != ST_LOADED);
+    wxFFile file;
+    bool ok = file.Open(tmpname, "w");
+    if (ok)
+    {
+        ok = file.Write("# PHD2 guide log summaries: name size mtime calcnt gcnt gdur gacnt\n");
+        for (auto it = index.begin(); ok && it != index.end(); ++it)
+        {
+            const IndexEntry& e = it->second;
+            ok = file.Write(wxString::Format("%s %lld %lld %u %u %.f %u\n", it->first, e.size, e.mtime,
+                                             e.summary.cal_cnt, e.summary.guide_cnt, e.summary.guide_dur, e.summary.ga_cnt));
+        }
+        ok = file.Close() && ok;
+    }
 
-        int row = s_grid_row[idx];
+    if (!ok || !wxRenameFile(tmpname, filename, true))
+    {
+        Debug.Write(wxString::Format("Log uploader: could not save %s\n", filename));
+        wxRemoveFile(tmpname);
+    }
+}
 
-        wxFileName fn(Debug.GetLogDir(), GuideLogName(session));
-        m_ifs.open(fn.GetFullPath().fn_str());
-        if (!m_ifs)
+#define GUIDING_BEGINS "Guiding Begins at "
+#define GUIDING_ENDS "Guiding Ends at "
+#define CALIBRATION_ENDS "Calibration complete"
+#define GA_COMPLETE "INFO: GA Result - Dec Drift Rate="
+
+// every marker starts with one of these characters; most guide log lines are
+// CSV guide steps starting with a digit, so few lines need a closer look
+inline static bool IsMarkerLead(char c)
+{
+    return c == 'G' || c == 'C' || c == 'I';
+}
+
+// find the next line in [p, limit) that starts with a marker lead character;
+// returns a pointer to the start of the line, or nullptr if there is none
+static const char *FindMarkerLine(const char *p, const char *limit, const char *end)
+{
+#if defined(LOG_SCANNER_SSE2)
+    __m128i const nl = _mm_set1_epi8('\n');
+    __m128i const g = _mm_set1_epi8('G');
+    __m128i const c = _mm_set1_epi8('C');
+    __m128i const i = _mm_set1_epi8('I');
+
+    // a newline at p[k] followed by a lead character at p[k + 1]
+    for (; p + 16 <= limit && p + 17 <= end; p += 16)
+    {
+        __m128i cur = _mm_loadu_si128((const __m128i *) p);
+        __m128i next = _mm_loadu_si128((const __m128i *) (p + 1));
+        __m128i lead = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(next, g), _mm_cmpeq_epi8(next, c)), _mm_cmpeq_epi8(next, i));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(cur, nl), lead));
+        if (mask)
         {
-            // should never get here since we have already scanned the list once
-            session.summary_loaded = ST_LOADED;
-            FillActivity(m_grid, row, session, true);
-            m_q.pop_front();
-            continue;
+            int k = 0;
+            while (!(mask & 1))
+            {
+                mask >>= 1;
+                ++k;
+            }
+            return p + k + 1;
         }
+    }
+#endif
 
-        session.summary_loaded = ST_LOADING;
-        FillActivity(m_grid, row, session, true);
+    while (p < limit && (p = static_cast<const char *>(memchr(p, '\n', limit - p))) != nullptr)
+    {
+        if (p + 1 < end && IsMarkerLead(p[1]))
+            return p + 1;
+        ++p;
+    }
 
-        return;
+    return nullptr;
+}
+
+inline static bool StartsWith(const char *line, size_t len, const char *pfx, size_t pfxlen)
+{
+    return len >= pfxlen && memcmp(line, pfx, pfxlen) == 0;
+}
+
+#define LINE_STARTS_WITH(pfx) StartsWith(line, len, pfx, sizeof(pfx) - 1)
+
+static void ScanLine(const char *line, const char *end, wxDateTime *guidingStarts, GuideLogSummaryInfo *summary)
+{
+    const char *eol = static_cast<const char *>(memchr(line, '\n', end - line));
+    size_t len = (eol ? eol : end) - line;
+    if (len > 0 && line[len - 1] == '\r')
+        --len;
+
+    if (LINE_STARTS_WITH(GUIDING_BEGINS))
+    {
+        std::string datestr(line + sizeof(GUIDING_BEGINS) - 1, line + len);
+        guidingStarts->ParseISOCombined(datestr, ' ');
     }
+    else if (LINE_STARTS_WITH(GUIDING_ENDS))
+    {
+        if (guidingStarts->IsValid())
+        {
+            std::string datestr(line + sizeof(GUIDING_ENDS) - 1, line + len);
+            wxDateTime end;
+            end.ParseISOCombined(datestr, ' ');
+            if (end.IsValid() && end.IsLaterThan(*guidingStarts))
+            {
+                wxTimeSpan dt = end - *guidingStarts;
+                ++summary->guide_cnt;
+                summary->guide_dur += dt.GetSeconds().GetValue();
+            }
+            *guidingStarts = wxInvalidDateTime;
+        }
+    }
+    else if (LINE_STARTS_WITH(CALIBRATION_ENDS))
+        ++summary->cal_cnt;
+    else if (LINE_STARTS_WITH(GA_COMPLETE))
+        ++summary->ga_cnt;
 }
 
-static std::string GUIDING_BEGINS("Guiding Begins at ");
-static std::string GUIDING_ENDS("Guiding Ends at ");
-static std::string CALIBRATION_ENDS("Calibration complete");
-static std::string GA_COMPLETE("INFO: GA Result - Dec Drift Rate=");
+// returns true on error
+bool GuideLogScan::Open(const wxString& path)
+{
+    summary.Clear();
+    guidingStarts = wxInvalidDateTime;
+
+    if (map.Open(path))
+        return true; // should never get here since we have already scanned the list once
+
+    pos = reinterpret_cast<const char *>(map.Data());
+    const char *const end = pos + map.Size();
+
+    if (IsMarkerLead(pos[0]))
+        ScanLine(pos, end, &guidingStarts, &summary);
+
+    return false;
+}
 
-inline static bool StartsWith(const std::string& s, const std::string& pfx)
+// scan up to the next bytes of the log; returns true when the whole log has
+// been scanned
+bool GuideLogScan::Scan(size_t bytes)
 {
-    return s.length() >= pfx.length() &&
-        s.compare(0, pfx.length(), pfx) == 0;
+    const char *const end = reinterpret_cast<const char *>(map.Data()) + map.Size();
+
+    const char *limit = (size_t) (end - pos) > bytes ? pos + bytes : end;
+    const char *line;
+    while ((line = FindMarkerLine(pos, limit, end)) != nullptr)
+    {
+        ScanLine(line, end, &guidingStarts, &summary);
+        pos = line;
+    }
+    pos = limit;
+
+    if (pos < end)
+        return false;
+
+    summary.valid = true;
+    map.Close();
+    return true;
 }
 
-bool LogScanner::DoWork(unsigned int millis)
+// returns false if the scan was interrupted by stop
+static bool ScanGuideLog(const wxString& path, GuideLogSummaryInfo *summary, const std::atomic<bool>& stop)
 {
-    int n = 0;
-    wxStopWatch swatch;
+    GuideLogScan scan;
+    if (scan.Open(path))
+    {
+        summary->Clear();
+        return true;
+    }
 
-    while (!m_q.empty())
+    // check for stop between chunks so closing the dialog does not wait for a big log
+    enum { CHUNK_SIZE = 4 * 1024 * 1024 };
+
+    do
+    {
+        if (stop)
+            return false;
+    } while (!scan.Scan(CHUNK_SIZE));
+
+    *summary = scan.summary;
+    return true;
+}
+
+wxThread::ExitCode LogScanThread::Entry()
+{
+    size_t job;
+    while (m_scanner->NextJob(&job))
+    {
+        ScanResult result;
+        result.job = job;
+        if (!ScanGuideLog(m_scanner->m_jobs[job].path, &result.summary, m_scanner->m_stop))
+            break;
+        m_scanner->AddResult(result);
+        wxWakeUpIdle();
+    }
+    return 0;
+}
+
+LogScanner::LogScanner()
+    :
+    m_grid(nullptr),
+    m_pending(0),
+    m_indexDirty(false),
+    m_stop(false),
+    m_idleJob(0),
+    m_idleScanning(false),
+    m_next(0)
+{
+}
+
+LogScanner::~LogScanner()
+{
+    Stop();
+}
+
+void LogScanner::Init(wxGrid *grid)
+{
+    m_grid = grid;
+
+    SummaryIndex prev;
+    LoadSummaryIndex(&prev);
+
+    // queue the logs that need scanning in sorted order, and keep only the index
+    // entries for logs that are still there
+    for (auto idx : s_session_idx)
     {
-        auto idx = m_q.front();
         Session& session = s_session[idx];
+        if (session.summary_loaded == ST_LOADED)
+            continue;
+
+        ScanJob job;
+        job.idx = idx;
+        job.name = GuideLogName(session);
+        job.path = wxFileName(Debug.GetLogDir(), job.name).GetFullPath();
 
-        std::string line;
-        while (true)
+        wxStructStat st;
+        if (::wxStat(job.path, &st) != 0)
         {
-            if (++n % 1000 == 0)
-            {
-                if (swatch.Time() > millis)
-                    return true;
-            }
+            session.summary_loaded = ST_LOADED;
+            FillActivity(m_grid, s_grid_row[idx], session, false);
+            continue;
+        }
+        job.size = st.st_size;
+        job.mtime = st.st_mtime;
 
-            if (!std::getline(m_ifs, line))
-                break;
+        auto it = prev.find(job.name);
+        if (it != prev.end() && it->second.size == job.size && it->second.mtime == job.mtime)
+        {
+            session.summary = it->second.summary;
+            session.summary_loaded = ST_LOADED;
+            m_index[job.name] = it->second;
+        }
+        else
+        {
+            session.summary_loaded = ST_LOADING;
+            m_jobs.push_back(job);
+        }
 
-            if (StartsWith(line, GUIDING_BEGINS))
+        FillActivity(m_grid, s_grid_row[idx], session, false);
+    }
+
+    m_indexDirty = m_index.size() != prev.size();
+    m_pending = m_jobs.size();
+
+    if (!m_jobs.empty())
+    {
+        // one file per thread at a time; the scan is mostly I/O bound, so a
+        // couple of threads is enough and leaves the other cores to guiding
+        enum { MAX_SCAN_THREADS = 2 };
+        size_t nthreads = std::min(m_jobs.size(), (size_t) MAX_SCAN_THREADS);
+        for (size_t i = 0; i < nthreads; i++)
+        {
+            LogScanThread *thread = new LogScanThread(this);
+            if (thread->Create() != wxTHREAD_NO_ERROR)
             {
-                std::string datestr = line.substr(GUIDING_BEGINS.length());
-                m_guiding_starts.ParseISOCombined(datestr, ' ');
-                continue;
+                Debug.Write("Log uploader: could not create scan thread\n");
+                delete thread;
+                break;
             }
-
-            if (StartsWith(line, GUIDING_ENDS) && m_guiding_starts.IsValid())
+            thread->SetPriority(wxPRIORITY_MIN);
+            if (thread->Run() != wxTHREAD_NO_ERROR)
             {
-                std::string datestr = line.substr(GUIDING_ENDS.length());
-                wxDateTime end;
-                end.ParseISOCombined(datestr, ' ');
-                if (end.IsValid() && end.IsLaterThan(m_guiding_starts))
-                {
-                    wxTimeSpan dt = end - m_guiding_starts;
-                    ++session.summary.guide_cnt;
-                    session.summary.guide_dur += dt.GetSeconds().GetValue();
-                }
-                m_guiding_starts = wxInvalidDateTime;
-                continue;
+                Debug.Write("Log uploader: could not start scan thread\n");
+                delete thread;
+                break;
             }
+            m_threads.push_back(thread);
+        }
+
+        Debug.Write(wxString::Format("Log uploader: scanning %u guide logs on %u threads, %u from index\n",
+                                     (unsigned int) m_jobs.size(), (unsigned int) m_threads.size(), (unsigned int) m_index.size()));
+    }
+    else if (m_indexDirty)
+    {
+        SaveSummaryIndex(m_index);
+        m_indexDirty = false;
+    }
+
+    m_grid->AutoSizeColumn(COL_GUIDE);
+    m_grid->AutoSizeColumn(COL_CAL);
+    m_grid->AutoSizeColumn(COL_GA);
+}
 
-            if (StartsWith(line, CALIBRATION_ENDS))
+bool LogScanner::NextJob(size_t *job)
+{
+    wxMutexLocker lck(m_lock);
+    if (m_stop || m_next >= m_jobs.size())
+        return false;
+    *job = m_next++;
+    return true;
+}
+
+void LogScanner::AddResult(const ScanResult& result)
+{
+    wxMutexLocker lck(m_lock);
+    m_results.push_back(result);
+}
+
+void LogScanner::StoreResult(const ScanResult& result)
+{
+    if (!result.summary.valid)
+        return;
+
+    // the key is the size and mtime from before the scan, so a log that grew
+    // while it was being scanned is scanned again next time
+    const ScanJob& job = m_jobs[result.job];
+    IndexEntry& e = m_index[job.name];
+    e.size = job.size;
+    e.mtime = job.mtime;
+    e.summary = result.summary;
+    m_indexDirty = true;
+}
+
+// apply the results of the completed scans to the grid; returns true if
+// there is more work to do right away
+bool LogScanner::DoWork()
+{
+    if (m_threads.empty() && m_pending)
+    {
+        // could not start any worker threads, scan for up to 100 ms per idle event
+        enum { IDLE_CHUNK_SIZE = 256 * 1024 };
+        wxStopWatch swatch;
+        while (swatch.Time() < 100)
+        {
+            if (!m_idleScanning)
             {
-                ++session.summary.cal_cnt;
-                continue;
+                if (!NextJob(&m_idleJob))
+                    break;
+                m_idleScanning = !m_idleScan.Open(m_jobs[m_idleJob].path);
+                if (!m_idleScanning)
+                {
+                    ScanResult result;
+                    result.job = m_idleJob;
+                    result.summary.Clear();
+                    AddResult(result);
+                    continue;
+                }
             }
 
-            if (StartsWith(line, GA_COMPLETE))
+            if (m_idleScan.Scan(IDLE_CHUNK_SIZE))
             {
-                ++session.summary.ga_cnt;
-                continue;
+                ScanResult result;
+                result.job = m_idleJob;
+                result.summary = m_idleScan.summary;
+                AddResult(result);
+                m_idleScanning = false;
             }
         }
+    }
+
+    std::vector<ScanResult> results;
+    {
+        wxMutexLocker lck(m_lock);
+        results.swap(m_results);
+    }
+
+    if (results.empty())
+        return m_threads.empty() && m_pending > 0;
 
-        session.summary.valid = true;
+    for (const ScanResult& result : results)
+    {
+        int idx = m_jobs[result.job].idx;
+        Session& session = s_session[idx];
+        session.summary = result.summary;
         session.summary_loaded = ST_LOADED;
+        FillActivity(m_grid, s_grid_row[idx], session, false);
+        StoreResult(result);
+    }
+
+    m_grid->AutoSizeColumn(COL_GUIDE);
+    m_grid->AutoSizeColumn(COL_CAL);
+    m_grid->AutoSizeColumn(COL_GA);
 
-        FillActivity(m_grid, s_grid_row[idx], session, true);
+    m_pending -= results.size();
+    if (m_pending == 0)
+    {
+        Stop();
+        return false;
+    }
+
+    return m_threads.empty();
+}
+
+void LogScanner::Stop()
+{
+    m_stop = true;
 
-        m_ifs.close();
-        m_q.pop_front();
-        FindNextRow();
+    for (LogScanThread *thread : m_threads)
+    {
+        thread->Wait(wxTHREAD_WAIT_BLOCK); // the workers never wait on the main thread
+        delete thread;
     }
+    m_threads.clear();
 
-    return false;
+    // keep what was scanned before the dialog was closed
+    for (const ScanResult& result : m_results)
+        StoreResult(result);
+    m_results.clear();
+
+    if (m_indexDirty)
+    {
+        SaveSummaryIndex(m_index);
+        m_indexDirty = false;
+    }
 }
 
 class LogUploadDialog : public wxDialog
@@ -573,7 +979,7 @@ static void LoadGrid(wxGrid *grid)
 
 void LogUploadDialog::OnIdle(wxIdleEvent& event)
 {
-    bool more = m_scanner.DoWork(100);
+    bool more = m_scanner.DoWork();
     event.RequestMore(more);
 }
 
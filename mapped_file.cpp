@@ -0,0 +1,156 @@
+/*
+ *  mapped_file.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "phd.h"
+
+#include "mapped_file.h"
+
+#ifndef __WINDOWS__
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+    :
+#ifdef __WINDOWS__
+    m_file(INVALID_HANDLE_VALUE),
+    m_mapping(nullptr),
+#else
+    m_fd(-1),
+#endif
+    m_data(nullptr),
+    m_size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef __WINDOWS__
+
+bool MappedFile::Open(const wxString& filename)
+{
+    Close();
+
+    m_file = ::CreateFileW(filename.wc_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return true;
+
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(m_file, &size) || size.QuadPart == 0 || (unsigned long long) size.QuadPart > (size_t) -1)
+    {
+        Close();
+        return true;
+    }
+
+    m_mapping = ::CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping)
+    {
+        Close();
+        return true;
+    }
+
+    m_data = static_cast<const unsigned char *>(::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data)
+    {
+        Close();
+        return true;
+    }
+
+    m_size = (size_t) size.QuadPart;
+    return false;
+}
+
+void MappedFile::Close()
+{
+    if (m_data)
+        ::UnmapViewOfFile(m_data);
+    if (m_mapping)
+        ::CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        ::CloseHandle(m_file);
+
+    m_data = nullptr;
+    m_mapping = nullptr;
+    m_file = INVALID_HANDLE_VALUE;
+    m_size = 0;
+}
+
+#else // __WINDOWS__
+
+bool MappedFile::Open(const wxString& filename)
+{
+    Close();
+
+    m_fd = ::open(filename.fn_str(), O_RDONLY);
+    if (m_fd < 0)
+        return true;
+
+    struct stat st;
+    if (::fstat(m_fd, &st) != 0 || st.st_size <= 0 || (unsigned long long) st.st_size > (size_t) -1)
+    {
+        Close();
+        return true;
+    }
+
+    void *p = ::mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (p == MAP_FAILED)
+    {
+        Close();
+        return true;
+    }
+
+    m_data = static_cast<const unsigned char *>(p);
+    m_size = (size_t) st.st_size;
+    return false;
+}
+
+void MappedFile::Close()
+{
+    if (m_data)
+        ::munmap(const_cast<unsigned char *>(m_data), m_size);
+    if (m_fd >= 0)
+        ::close(m_fd);
+
+    m_data = nullptr;
+    m_fd = -1;
+    m_size = 0;
+}
+
+#endif // __WINDOWS__
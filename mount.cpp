@@ -933,6 +933,7 @@ void Mount::LogGuideStepInfo()
         pFrame->pGraphLog->AppendData(m_lastStep);
         pFrame->pTarget->AppendData(m_lastStep);
         GuidingAssistant::NotifyGuideStep(m_lastStep);
+        SimBenchmark::NotifyGuideStep(m_lastStep);
     }
 
     m_lastStep.frameNumber = -1; // invalidate
@@ -948,8 +949,11 @@ Mount::MOVE_RESULT Mount::MoveOffset(GuiderOffset *ofs, unsigned int moveOptions
 
         if (moveOptions & MOVEOPT_ALGO_DEDUCE)
         {
-            xDistance = m_pXGuideAlgorithm ? m_pXGuideAlgorithm->deduceResult() : 0.0;
-            yDistance = m_pYGuideAlgorithm ? m_pYGuideAlgorithm->deduceResult() : 0.0;
+            {
+                LatencyTimer timer(GuideLatency::ALGORITHM);
+                xDistance = m_pXGuideAlgorithm ? m_pXGuideAlgorithm->deduceResult() : 0.0;
+                yDistance = m_pYGuideAlgorithm ? m_pYGuideAlgorithm->deduceResult() : 0.0;
+            }
             if (xDistance == 0.0 && yDistance == 0.0)
                 return result;
             ofs->mountOfs.SetXY(xDistance, yDistance);
@@ -982,6 +986,8 @@ Mount::MOVE_RESULT Mount::MoveOffset(GuiderOffset *ofs, unsigned int moveOptions
             if (moveOptions & MOVEOPT_ALGO_RESULT)
             {
                 // Feed the raw distances to the guide algorithms
+                LatencyTimer timer(GuideLatency::ALGORITHM);
+
                 if (m_pXGuideAlgorithm)
                 {
                     xDistance = m_pXGuideAlgorithm->result(xDistance);
@@ -998,6 +1004,13 @@ Mount::MOVE_RESULT Mount::MoveOffset(GuiderOffset *ofs, unsigned int moveOptions
         GUIDE_DIRECTION xDirection = xDistance > 0.0 ? LEFT : RIGHT;
         GUIDE_DIRECTION yDirection = yDistance > 0.0 ? DOWN : UP;
 
+        // only guide steps and deduced moves count toward the latency of the frame
+        bool const timed = (moveOptions & MOVEOPT_GRAPH) != 0;
+        if (timed)
+            GuideLatency::PulseStarted();
+        long long const pulseStart = GuideLatency::Now();
+        wxLongLong const pulseStartMs = wxGetUTCTimeMillis();
+
         int requestedXAmount = ROUND(fabs(xDistance / m_xRate));
         MoveResultInfo xMoveResult;
         result = MoveAxis(xDirection, requestedXAmount, moveOptions, &xMoveResult);
@@ -1013,6 +1026,21 @@ Mount::MOVE_RESULT Mount::MoveOffset(GuiderOffset *ofs, unsigned int moveOptions
             result = MoveAxis(yDirection, requestedYAmount, moveOptions, &yMoveResult);
         }
 
+        if (timed)
+        {
+            GuideLatency::Add(GuideLatency::PULSE, GuideLatency::Now() - pulseStart);
+
+            // the part of the correction actually sent: moves can be clipped by
+            // the max duration or the dec guide mode, and backlash compensation
+            // does not move the star
+            double const xMoved = wxMin(fabs(xDistance), xMoveResult.amountMoved * m_xRate);
+            double const yMoved = wxMin(fabs(yDistance), yMoveResult.amountMoved * m_cal.yRate);
+
+            m_lastPulse.start = pulseStartMs;
+            m_lastPulse.end = wxGetUTCTimeMillis();
+            m_lastPulse.mountMove.SetXY(xDistance > 0.0 ? xMoved : -xMoved, yDistance > 0.0 ? yMoved : -yMoved);
+        }
+
         // Record the info about the guide step. The info will be picked up back in the main UI thread.
         // We don't want to do anything with the info here in the worker thread since UI operations are
         // not allowed outside the main UI thread.
@@ -1217,8 +1245,11 @@ bool Mount::DecCompensationEnabled() const
  */
 void Mount::AdjustCalibrationForScopePointing()
 {
-    double newDeclination = pPointingSource->GetDeclination();
-    PierSide newPierSide = pPointingSource->SideOfPier();
+    // read the mount now rather than using the last snapshot, the mount may
+    // have just slewed or flipped
+    PointingState pointing = PointingCache::Refresh();
+    double newDeclination = pointing.declination;
+    PierSide newPierSide = pointing.pierSide;
     double newRotatorAngle = Rotator::RotatorPosition();
     unsigned short binning = pCamera->Binning;
 
@@ -1227,16 +1258,15 @@ void Mount::AdjustCalibrationForScopePointing()
         RotAngleStr(newRotatorAngle), binning));
 
     // See if the user has changed mount guide speeds after the last calibration.  If so, raise an alert that can't be avoided
-    if (pPointingSource->CanReportPosition())
+    if (pointing.haveGuideRates)
     {
         CalibrationDetails calDetails;
         LoadCalibrationDetails(&calDetails);
 
         if (calDetails.raGuideSpeed > 0 && calDetails.decGuideSpeed > 0)
         {
-            double currRASpeed;
-            double currDecSpeed;
-            pPointingSource->GetGuideRates(&currRASpeed, &currDecSpeed);
+            double currRASpeed = pointing.raGuideRate;
+            double currDecSpeed = pointing.decGuideRate;
             if (fabs(1.0 - currRASpeed / calDetails.raGuideSpeed) > 0.05 || fabs(1.0 - currDecSpeed / calDetails.decGuideSpeed) > 0.05)
             {
                 pFrame->Alert(_("Mount guide speeds are different from those used in last calibration.  Do a new calibration or reset mount guide speed settings to previous values. "));
@@ -1411,6 +1441,13 @@ bool Mount::IsStepGuider() const
     return false;
 }
 
+// true if guide pulses are sent through the camera driver, so the camera
+// cannot be exposing on another thread while the mount is being guided
+bool Mount::UsesCameraGuidePort() const
+{
+    return false;
+}
+
 wxPoint Mount::GetAoPos() const
 {
     return wxPoint();
@@ -150,6 +150,14 @@ struct MoveResultInfo
     MoveResultInfo() : amountMoved(0), limited(false) { }
 };
 
+// timing of the pulses of the last guide step, for pipelined capture
+struct GuidePulseInfo
+{
+    wxLongLong start;       // UTC milliseconds, same clock as usImage::ImgStartTime
+    wxLongLong end;
+    PHD_Point mountMove;    // correction applied, mount coordinates; invalid if none
+};
+
 class MountConfigDialogCtrlSet : public ConfigDialogCtrlSet
 {
     Mount* m_pMount;
@@ -183,6 +191,7 @@ protected:
     wxString m_Name;
     BacklashComp *m_backlashComp;
     GuideStepInfo m_lastStep;
+    GuidePulseInfo m_lastPulse;
 
     // Things related to the Advanced Config Dialog
 public:
@@ -278,6 +287,8 @@ public:
                                                       PHD_Point& cameraVectorEndpoint, bool logged = true);
 
     void LogGuideStepInfo();
+    // only valid while the mount is not busy
+    const GuidePulseInfo& LastGuidePulse() const { return m_lastPulse; }
 
     GraphControlPane *GetXGuideAlgorithmControlPane(wxWindow *pParent);
     GraphControlPane *GetYGuideAlgorithmControlPane(wxWindow *pParent);
@@ -345,6 +356,7 @@ public:
 
     virtual const wxString& Name() const;
     virtual bool IsStepGuider() const;
+    virtual bool UsesCameraGuidePort() const;
     virtual wxPoint GetAoPos() const;
     virtual wxPoint GetAoMaxPos() const;
     virtual const char *DirectionStr(GUIDE_DIRECTION d) const;
@@ -159,6 +159,7 @@ wxBEGIN_EVENT_TABLE(MyFrame, wxFrame)
     EVT_CLOSE(MyFrame::OnClose)
     EVT_THREAD(MYFRAME_WORKER_THREAD_EXPOSE_COMPLETE, MyFrame::OnExposeComplete)
     EVT_THREAD(MYFRAME_WORKER_THREAD_MOVE_COMPLETE, MyFrame::OnMoveComplete)
+    EVT_THREAD(MYFRAME_FRAME_PROCESSED, MyFrame::OnFrameProcessed)
 
     EVT_COMMAND(wxID_ANY, REQUEST_EXPOSURE_EVENT, MyFrame::OnRequestExposure)
     EVT_COMMAND(wxID_ANY, WXMESSAGEBOX_PROXY_EVENT, MyFrame::OnMessageBoxProxy)
@@ -220,6 +221,9 @@ MyFrame::MyFrame()
     StartWorkerThread(m_pPrimaryWorkerThread);
     m_pSecondaryWorkerThread = nullptr;
     StartWorkerThread(m_pSecondaryWorkerThread);
+    m_pCaptureWorkerThread = nullptr;
+    StartWorkerThread(m_pCaptureWorkerThread);
+    m_pFramePipeline = FramePipeline::Start(this);
 
     m_statusbarTimer.SetOwner(this, STATUSBAR_TIMER_EVENT);
 
@@ -266,7 +270,7 @@ MyFrame::MyFrame()
 
     sizer->Add(m_infoBar, wxSizerFlags().Expand());
 
-    pGuider = new GuiderOneStar(guiderWin);
+    pGuider = new GuiderMultiStar(guiderWin);
     sizer->Add(pGuider, wxSizerFlags().Proportion(1).Expand());
 
     guiderWin->SetSizer(sizer);
@@ -798,6 +802,7 @@ static void LoadImageLoggerSettings()
     settings.logAutoSelectFrames = pConfig->Profile.GetBoolean("/ImageLogger/LogAutoSelectFrames", false);
     settings.logNextNFrames = false;
     settings.logNextNFramesCount = 1;
+    settings.compressFrames = pConfig->Profile.GetBoolean("/ImageLogger/Compress", false);
     settings.guideErrorThreshRel = pConfig->Profile.GetDouble("/ImageLogger/ErrorThreshRel", 4.0);
     settings.guideErrorThreshPx = pConfig->Profile.GetDouble("/ImageLogger/ErrorThreshPx", 4.0);
 
@@ -811,6 +816,7 @@ static void SaveImageLoggerSettings(const ImageLoggerSettings& settings)
     pConfig->Profile.SetBoolean("/ImageLogger/LogFramesOverThreshPx", settings.logFramesOverThreshPx);
     pConfig->Profile.SetBoolean("/ImageLogger/LogFramesDropped", settings.logFramesDropped);
     pConfig->Profile.SetBoolean("/ImageLogger/LogAutoSelectFrames", settings.logAutoSelectFrames);
+    pConfig->Profile.SetBoolean("/ImageLogger/Compress", settings.compressFrames);
     pConfig->Profile.SetDouble("/ImageLogger/ErrorThreshRel", settings.guideErrorThreshRel);
     pConfig->Profile.SetDouble("/ImageLogger/ErrorThreshPx", settings.guideErrorThreshPx);
 }
@@ -838,6 +844,8 @@ void MyFrame::LoadProfileSettings()
     int timeLapse = pConfig->Profile.GetInt("/frame/timeLapse", DefaultTimelapse);
     SetTimeLapse(timeLapse);
 
+    SetPipelinedCapture(pConfig->Profile.GetBoolean("/frame/pipelinedCapture", false));
+
     // Don't re-save the setting here with a call to SetAutoLoadCalibration().  An un-initialized registry key (-1) will
     // be populated after the 1st calibration
     int autoLoad = pConfig->Profile.GetInt("/AutoLoadCalibration", -1);
@@ -1643,27 +1651,47 @@ void MyFrame::OnStatusBarTimerEvent(wxTimerEvent& evt)
         m_statusbar->StatusMsg(wxEmptyString);
 }
 
-void MyFrame::ScheduleExposure()
+// A pipelined exposure is started before the current frame has been
+// processed. It runs on its own worker thread so that the guide pulses for the
+// current frame, which are queued on the primary worker thread, are not held up
+// behind it.
+void MyFrame::ScheduleExposure(bool pipelined)
 {
     int exposureDuration = RequestedExposureDuration();
     int exposureOptions = GetRawImageMode() ? CAPTURE_BPM_REVIEW : CAPTURE_LIGHT;
     const wxRect& subframe =
         m_singleExposure.enabled ? m_singleExposure.subframe : pGuider->GetBoundingBox();
 
-    Debug.Write(wxString::Format("ScheduleExposure(%d,%x,%d) exposurePending=%d\n",
-        exposureDuration, exposureOptions, !subframe.IsEmpty(), m_exposurePending));
+    Debug.Write(wxString::Format("ScheduleExposure(%d,%x,%d) exposurePending=%d pipelined=%d\n",
+        exposureDuration, exposureOptions, !subframe.IsEmpty(), m_exposurePending, pipelined));
 
     assert(wxThread::IsMain()); // m_exposurePending only updated in main thread
     assert(!m_exposurePending);
 
     m_exposurePending = true;
 
+    PublishStarSearch();
+
     usImage *img = new usImage();
 
     wxCriticalSectionLocker lock(m_CSpWorkerThread);
 
-    if (m_pPrimaryWorkerThread) // can be null when app is shutting down (unlikely but possible)
-        m_pPrimaryWorkerThread->EnqueueWorkerThreadExposeRequest(img, exposureDuration, exposureOptions, subframe);
+    WorkerThread *thr = pipelined ? m_pCaptureWorkerThread : m_pPrimaryWorkerThread;
+
+    if (thr) // can be null when app is shutting down (unlikely but possible)
+        thr->EnqueueWorkerThreadExposeRequest(img, exposureDuration, exposureOptions, subframe);
+}
+
+// The frame processing stage measures each frame with the guider's stars as
+// of the last call. A frame measured with stars that have changed since is
+// measured again by the guider.
+void MyFrame::PublishStarSearch()
+{
+    if (!m_pFramePipeline)
+        return;
+
+    StarSearch search;
+    m_pFramePipeline->SetStarSearch(pGuider->GetStarSearch(&search) ? &search : nullptr);
 }
 
 void MyFrame::SchedulePrimaryMove(Mount *mount, const GuiderOffset& ofs, unsigned int moveOptions)
@@ -1831,6 +1859,8 @@ bool MyFrame::StopCapturing()
         if (m_exposurePending)
         {
             m_pPrimaryWorkerThread->RequestStop();
+            if (m_pCaptureWorkerThread)
+                m_pCaptureWorkerThread->RequestStop();
             finished = false;
         }
         else
@@ -2098,6 +2128,12 @@ void MyFrame::OnClose(wxCloseEvent& event)
     bool killed = StopWorkerThread(m_pPrimaryWorkerThread);
     if (StopWorkerThread(m_pSecondaryWorkerThread))
         killed = true;
+    if (StopWorkerThread(m_pCaptureWorkerThread))
+        killed = true;
+
+    // no more frames can come in now that the worker threads are stopped
+    FramePipeline::Stop(m_pFramePipeline);
+    m_pFramePipeline = nullptr;
 
     // disconnect all gear
     pGearDialog->Shutdown(killed);
@@ -2281,6 +2317,7 @@ static bool save_multi_darks(const ExposureImgMap& darks, const wxString& fname,
 
     try
     {
+        FitsLock fitsLock;
         fitsfile *fptr;  // FITS file pointer
         int status = 0;  // CFITSIO status value MUST be initialized to zero!
 
@@ -2333,6 +2370,7 @@ static bool save_multi_darks(const ExposureImgMap& darks, const wxString& fname,
 static bool load_multi_darks(GuideCamera *camera, const wxString& fname)
 {
     bool bError = false;
+    FitsLock fitsLock;
     fitsfile *fptr = 0;
     int status = 0;  // CFITSIO status value MUST be initialized to zero!
     long last_frame_size [] = { -1L, -1L };
@@ -2469,6 +2507,7 @@ bool MyFrame::DarkLibExists(int profileId, bool showAlert)
         }
         else
         {
+            FitsLock fitsLock;
             fitsfile *fptr;
             int status = 0;  // CFITSIO status value MUST be initialized to zero!
 
@@ -2642,6 +2681,14 @@ bool MyFrame::SetTimeLapse(int timeLapse)
     return bError;
 }
 
+void MyFrame::SetPipelinedCapture(bool enable)
+{
+    m_pipelinedCapture = enable;
+    m_pipelineBlockedLogged = false;
+    pConfig->Profile.SetBoolean("/frame/pipelinedCapture", enable);
+    Debug.Write(wxString::Format("Pipelined capture set to %s\n", enable ? "true" : "false"));
+}
+
 bool MyFrame::SetFocalLength(int focalLength)
 {
     bool bError = false;
@@ -2960,6 +3007,12 @@ MyFrameConfigDialogCtrlSet::MyFrameConfigDialogCtrlSet(MyFrame *pFrame, Advanced
     AddLabeledCtrl(CtrlMap, AD_szTimeLapse, _("Time Lapse (ms)"), m_pTimeLapse,
         _("How long should PHD wait between guide frames? Default = 0ms, useful when using very short exposures (e.g., using a video camera) but wanting to send guide commands less frequently"));
 
+    m_pPipelinedCapture = new wxCheckBox(GetParentWindow(AD_cbPipelinedCapture), wxID_ANY, _("Pipelined capture"));
+    AddCtrl(CtrlMap, AD_cbPipelinedCapture, m_pPipelinedCapture,
+        _("While guiding, start the next exposure as soon as the previous frame is downloaded instead of after the guide pulses. "
+          "Increases the frame rate with short exposures. Only used with cameras that capture in the background, "
+          "and only when the camera can expose while the mount is being guided."));
+
     parent = GetParentWindow(AD_szFocalLength);
     // Put a validator on this field to be sure that only digits are entered - avoids problem where
     // user face-plant on keyboard results in a focal length of zero
@@ -3012,7 +3065,7 @@ MyFrameConfigDialogCtrlSet::MyFrameConfigDialogCtrlSet(MyFrame *pFrame, Advanced
     parent = GetParentWindow(AD_szImageLoggingOptions);
     m_EnableImageLogging->Bind(wxEVT_COMMAND_CHECKBOX_CLICKED, &MyFrameConfigDialogCtrlSet::OnImageLogEnableChecked, this);
     m_LoggingOptions = new wxStaticBoxSizer(wxVERTICAL, parent, _("Save Guider Images"));
-    wxFlexGridSizer *pOptionsGrid = new wxFlexGridSizer(3, 2, 0, PAD);
+    wxFlexGridSizer *pOptionsGrid = new wxFlexGridSizer(4, 2, 0, PAD);
 
     m_LogDroppedFrames = new wxCheckBox(parent, wxID_ANY, _("For all lost-star frames"));
     m_LogDroppedFrames->SetToolTip(_("Save guider image whenever a lost-star event occurs"));
@@ -3048,11 +3101,17 @@ MyFrameConfigDialogCtrlSet::MyFrameConfigDialogCtrlSet(MyFrame *pFrame, Advanced
     pHzN->Add(m_LogNextNFrames, wxSizerFlags().Border(wxALL, PAD).Align(wxALIGN_CENTER_VERTICAL));
     pHzN->Add(m_LogNextNFramesCount, wxSizerFlags().Border(wxALL, PAD).Align(wxALIGN_CENTER_VERTICAL));
 
+    m_LogCompressFrames = new wxCheckBox(parent, wxID_ANY, _("Compress saved images"));
+    m_LogCompressFrames->SetToolTip(_("Save the guider images RICE-compressed (.fit.fz), like the fpack utility. "
+        "Compressed images are smaller but not all applications can open them"));
+
     pOptionsGrid->Add(m_LogDroppedFrames, wxSizerFlags().Border(wxALL, PAD));
     pOptionsGrid->Add(m_LogAutoSelectFrames, wxSizerFlags().Border(wxALL, PAD));
     pOptionsGrid->Add(pHzRel);
     pOptionsGrid->Add(pHzN);
     pOptionsGrid->Add(pHzAbs);
+    pOptionsGrid->Add(0, 0);
+    pOptionsGrid->Add(m_LogCompressFrames, wxSizerFlags().Border(wxALL, PAD));
     m_LoggingOptions->Add(pOptionsGrid);
 
     AddGroup(CtrlMap, AD_szImageLoggingOptions, m_LoggingOptions);
@@ -3128,6 +3187,7 @@ void MyFrameConfigDialogCtrlSet::LoadValues()
     m_ditherRaOnly->SetValue(m_pFrame->GetDitherRaOnly());
     m_ditherScaleFactor->SetValue(m_pFrame->GetDitherScaleFactor());
     m_pTimeLapse->SetValue(m_pFrame->GetTimeLapse());
+    m_pPipelinedCapture->SetValue(m_pFrame->GetPipelinedCapture());
     SetFocalLength(m_pFrame->GetFocalLength());
     m_pFocalLength->Enable(!pFrame->CaptureActive);
 
@@ -3176,6 +3236,7 @@ void MyFrameConfigDialogCtrlSet::LoadValues()
     m_LogAbsErrorThresh->SetValue(imlSettings.guideErrorThreshPx);
     m_LogNextNFrames->SetValue(imlSettings.logNextNFrames);
     m_LogNextNFramesCount->SetValue(imlSettings.logNextNFramesCount);
+    m_LogCompressFrames->SetValue(imlSettings.compressFrames);
 
     UpdaterSettings updSettings;
     PHD2Updater::GetSettings(&updSettings);
@@ -3212,6 +3273,7 @@ void MyFrameConfigDialogCtrlSet::UnloadValues()
         m_pFrame->SetDitherRaOnly(m_ditherRaOnly->GetValue());
         m_pFrame->SetDitherScaleFactor(m_ditherScaleFactor->GetValue());
         m_pFrame->SetTimeLapse(m_pTimeLapse->GetValue());
+        m_pFrame->SetPipelinedCapture(m_pPipelinedCapture->GetValue());
         int oldFL = m_pFrame->GetFocalLength();
         int newFL = GetFocalLength();               // From UI control
         if (oldFL != newFL)
@@ -3264,6 +3326,7 @@ void MyFrameConfigDialogCtrlSet::UnloadValues()
             imlSettings.guideErrorThreshPx = m_LogAbsErrorThresh->GetValue();
             imlSettings.logNextNFrames = m_LogNextNFrames->GetValue();
             imlSettings.logNextNFramesCount = m_LogNextNFramesCount->GetValue();
+            imlSettings.compressFrames = m_LogCompressFrames->GetValue();
         }
 
         ImageLogger::ApplySettings(imlSettings);
@@ -3313,6 +3376,7 @@ void MyFrameConfigDialogCtrlSet::OnImageLogEnableChecked(wxCommandEvent& event)
     m_LogAutoSelectFrames->Enable(setIt);
     m_LogNextNFrames->Enable(setIt);
     m_LogNextNFramesCount->Enable(setIt);
+    m_LogCompressFrames->Enable(setIt);
 }
 
 void MyFrame::PlaceWindowOnScreen(wxWindow *win, int x, int y)
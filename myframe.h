@@ -38,6 +38,7 @@
 #define MYFRAME_H_INCLUDED
 
 class WorkerThread;
+class FramePipeline;
 class MyFrame;
 class RefineDefMap;
 struct alert_params;
@@ -47,6 +48,7 @@ enum E_MYFRAME_WORKER_THREAD_MESSAGES
 {
     MYFRAME_WORKER_THREAD_EXPOSE_COMPLETE = wxID_HIGHEST+1,
     MYFRAME_WORKER_THREAD_MOVE_COMPLETE,
+    MYFRAME_FRAME_PROCESSED,
 };
 
 wxDECLARE_EVENT(REQUEST_EXPOSURE_EVENT, wxCommandEvent);
@@ -122,6 +124,7 @@ class MyFrameConfigDialogCtrlSet : public ConfigDialogCtrlSet
     wxCheckBox *m_ditherRaOnly;
     wxChoice *m_pNoiseReduction;
     wxSpinCtrl *m_pTimeLapse;
+    wxCheckBox *m_pPipelinedCapture;
     wxTextCtrl *m_pFocalLength;
     wxChoice *m_pLanguage;
     int m_oldLanguageChoice;
@@ -137,6 +140,7 @@ class MyFrameConfigDialogCtrlSet : public ConfigDialogCtrlSet
     wxSpinCtrlDouble *m_LogRelErrorThresh;
     wxSpinCtrlDouble *m_LogAbsErrorThresh;
     wxSpinCtrl *m_LogNextNFramesCount;
+    wxCheckBox *m_LogCompressFrames;
     wxCheckBox *m_pAutoLoadCalibration;
     wxComboBox *m_autoExpDurationMin;
     wxComboBox *m_autoExpDurationMax;
@@ -166,6 +170,9 @@ protected:
     bool SetTimeLapse(int timeLapse);
     int GetTimeLapse() const;
 
+    void SetPipelinedCapture(bool enable);
+    bool GetPipelinedCapture() const;
+
     bool SetFocalLength(int focalLength);
 
     friend class MyFrameConfigDialogPane;
@@ -181,6 +188,8 @@ private:
     DitherSpiral m_ditherSpiral;
     bool m_serverMode;
     int  m_timeLapse;       // Delay between frames (useful for vid cameras)
+    bool m_pipelinedCapture; // start the next exposure while the current frame is processed
+    bool m_pipelineBlockedLogged;
     int  m_focalLength;
     bool m_beepForLostStar;
     double m_sampling;
@@ -328,6 +337,7 @@ public:
 
     void OnExposeComplete(wxThreadEvent& evt);
     void OnExposeComplete(usImage *image, bool err);
+    void OnFrameProcessed(wxThreadEvent& evt);
     void OnMoveComplete(wxThreadEvent& evt);
 
     void LoadProfileSettings();
@@ -385,7 +395,8 @@ public:
     void OnRequestExposure(wxCommandEvent& evt);
     void OnRequestMountMove(wxCommandEvent& evt);
 
-    void ScheduleExposure();
+    void ScheduleExposure(bool pipelined = false);
+    void PublishStarSearch();
 
     void SchedulePrimaryMove(Mount *mount, const GuiderOffset& ofs, unsigned int moveOptions);
     void ScheduleSecondaryMove(Mount *mount, const GuiderOffset& ofs, unsigned int moveOptions);
@@ -459,6 +470,8 @@ private:
     wxCriticalSection m_CSpWorkerThread;
     WorkerThread *m_pPrimaryWorkerThread;
     WorkerThread *m_pSecondaryWorkerThread;
+    WorkerThread *m_pCaptureWorkerThread;   // pipelined exposures
+    FramePipeline *m_pFramePipeline;        // star measurement between capture and the guider
 
     wxSocketServer *SocketServer;
     wxTimer m_statusbarTimer;
@@ -657,6 +670,7 @@ enum {
     EEGG_STICKY_LOCK,
     EEGG_FLIPCAL,
     STAR_MASS_ENABLE,
+    MULTI_STAR_ENABLE,
     MENU_BOOKMARKS_SHOW,
     MENU_BOOKMARKS_SET_AT_LOCK,
     MENU_BOOKMARKS_SET_AT_STAR,
@@ -748,6 +762,11 @@ inline int MyFrame::GetTimeLapse() const
     return m_timeLapse;
 }
 
+inline bool MyFrame::GetPipelinedCapture() const
+{
+    return m_pipelinedCapture;
+}
+
 inline int MyFrame::GetFocalLength() const
 {
     return m_focalLength;
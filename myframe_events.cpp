@@ -490,6 +490,11 @@ void MyFrame::OnExposeComplete(usImage *pNewFrame, bool err)
 
         pNewFrame->FrameNum = ++m_frameCounter;
 
+        GuideLatency::FrameReceived(pNewFrame->FrameNum);
+        GuideLatency::Record latency;
+        if (GuideLatency::GetRecord(pNewFrame->FrameNum - 1, &latency))
+            EvtServer.NotifyLatency(latency);
+
         if (m_rawImageMode && !m_rawImageModeWarningDone)
         {
             WarnRawImageMode();
@@ -502,23 +507,52 @@ void MyFrame::OnExposeComplete(usImage *pNewFrame, bool err)
             CheckDarkFrameGeometry();
         }
 
+        // with pipelined capture the next exposure starts now, while this frame
+        // is processed and its guide pulses are sent. Not when the pulses go
+        // through the camera: the driver would be called from two threads.
+        if (m_pipelinedCapture && m_continueCapturing && !m_singleExposure.enabled &&
+            pCamera->HasNonGuiCapture() && pGuider->IsGuiding() && !pGuider->IsPaused())
+        {
+            if ((pMount && pMount->UsesCameraGuidePort()) ||
+                (pSecondaryMount && pSecondaryMount->UsesCameraGuidePort()))
+            {
+                if (!m_pipelineBlockedLogged)
+                {
+                    Debug.Write("Pipelined capture: mount guides through the camera, using serial capture\n");
+                    m_pipelineBlockedLogged = true;
+                }
+            }
+            else
+            {
+                ScheduleExposure(true);
+            }
+        }
+
         pGuider->UpdateGuideState(pNewFrame, !m_continueCapturing);
         pNewFrame = NULL; // the guider owns it now
 
-        PhdController::UpdateControllerState();
+        // a pipelined exposure is already running, let it be measured with the updated stars
+        PublishStarSearch();
 
-        Debug.Write(wxString::Format("OnExposeComplete: CaptureActive=%d m_continueCapturing=%d\n",
-            CaptureActive, m_continueCapturing));
+        PhdController::UpdateControllerState();
 
-        CaptureActive = m_continueCapturing;
+        Debug.Write(wxString::Format("OnExposeComplete: CaptureActive=%d m_continueCapturing=%d exposurePending=%d\n",
+            CaptureActive, m_continueCapturing, m_exposurePending));
 
-        if (CaptureActive)
-        {
-            ScheduleExposure();
-        }
-        else
+        // a pipelined exposure may still be in progress; a stop requested while
+        // processing this frame is completed when that exposure comes back
+        if (!m_exposurePending)
         {
-            FinishStop();
+            CaptureActive = m_continueCapturing;
+
+            if (CaptureActive)
+            {
+                ScheduleExposure();
+            }
+            else
+            {
+                FinishStop();
+            }
         }
     }
     catch (const wxString& Msg)
@@ -535,6 +569,21 @@ void MyFrame::OnExposeComplete(wxThreadEvent& event)
     OnExposeComplete(image, err);
 }
 
+void MyFrame::OnFrameProcessed(wxThreadEvent& event)
+{
+    usImage *image;
+    bool err;
+
+    // the pipeline is gone if the event arrives while the app is closing
+    if (!m_pFramePipeline || !m_pFramePipeline->Pop(&image, &err, pGuider->FrameMeasurement()))
+        return;
+
+    OnExposeComplete(image, err);
+
+    // not used if the frame did not get to the guider
+    pGuider->FrameMeasurement()->image = nullptr;
+}
+
 void MyFrame::OnMoveComplete(wxThreadEvent& event_)
 {
     try
@@ -65,10 +65,12 @@ int YWinSize = 512;
 
 static const wxCmdLineEntryDesc cmdLineDesc[] =
 {
+    { wxCMD_LINE_OPTION, "b", "benchmark", "run a simulator benchmark scenario file and exit", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
     { wxCMD_LINE_OPTION, "i", "instanceNumber", "sets the PHD2 instance number (default = 1)", wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL},
     { wxCMD_LINE_OPTION, "l", "load", "load settings from file and exit", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
     { wxCMD_LINE_SWITCH, "R", "Reset", "Reset all PHD2 settings to default values" },
     { wxCMD_LINE_OPTION, "s", "save", "save settings to file and exit", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, nullptr, "seed", "random seed for the benchmark, overrides the scenario", wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
     { wxCMD_LINE_NONE }
 };
 
@@ -80,6 +82,8 @@ enum ConfigOp
 };
 static ConfigOp s_configOp = CONFIG_OP_NONE;
 static wxString s_configPath;
+static wxString s_benchmarkScenario;
+static long s_benchmarkSeed = -1;
 
 wxIMPLEMENT_APP(PhdApp);
 
@@ -572,6 +576,12 @@ bool PhdApp::OnInit()
 
     m_logFileTime = DebugLog::GetLogFileTime();
     OpenLogs(false /* not for rollover */);
+    Debug.StartWriter();
+
+#if wxUSE_ON_FATAL_EXCEPTION
+    // flush queued debug log lines if we crash
+    wxHandleFatalExceptions();
+#endif
 
     logger.Close(); // writes any deferrred error messages to the debug log
 
@@ -624,6 +634,19 @@ bool PhdApp::OnInit()
 
     pConfig->InitializeProfile();
 
+    if (!s_benchmarkScenario.empty())
+    {
+        wxString err;
+        if (SimBenchmark::Init(s_benchmarkScenario, s_benchmarkSeed, &err))
+        {
+            Debug.Write(wxString::Format("Benchmark scenario error: %s\n", err));
+            wxFprintf(stderr, "Benchmark scenario error: %s\n", err);
+            Debug.StopWriter();
+            ::exit(1);
+            return false;
+        }
+    }
+
     PhdController::OnAppInit();
 
     ImageLogger::Init();
@@ -633,6 +656,13 @@ bool PhdApp::OnInit()
 
     pFrame = new MyFrame();
 
+    if (SimBenchmark::IsActive())
+    {
+        // unattended run, the main window stays hidden
+        pFrame->CallAfter([]() { SimBenchmark::Start(); });
+        return true;
+    }
+
     pFrame->Show(true);
 
     if (pConfig->IsNewInstance() || (pConfig->NumProfiles() == 1 && pFrame->pGearDialog->IsEmptyProfile()))
@@ -645,6 +675,11 @@ bool PhdApp::OnInit()
     return true;
 }
 
+void PhdApp::OnFatalException()
+{
+    Debug.EmergencyFlush();
+}
+
 int PhdApp::OnExit()
 {
     assert(!pMount);
@@ -652,6 +687,8 @@ int PhdApp::OnExit()
     assert(!pCamera);
 
     ImageLogger::Destroy();
+    ThreadPool::Destroy();
+    FrameBufferPool::Destroy();
 
     PhdController::OnAppExit();
 
@@ -660,6 +697,8 @@ int PhdApp::OnExit()
 
     curl_global_cleanup();
 
+    Debug.StopWriter();
+
     delete m_instanceChecker;
     m_instanceChecker = nullptr;
 
@@ -685,6 +724,9 @@ bool PhdApp::OnCmdLineParsed(wxCmdLineParser& parser)
 
     m_resetConfig = parser.Found("R");
 
+    parser.Found("b", &s_benchmarkScenario);
+    parser.Found("seed", &s_benchmarkSeed);
+
     return bReturn;
 }
 
@@ -45,6 +45,7 @@
 #endif
 
 #include <wx/wx.h>
+#include <wx/atomic.h>
 #include <wx/aui/aui.h>
 #include <wx/bitmap.h>
 #include <wx/bmpbuttn.h>
@@ -174,6 +175,7 @@ WX_DEFINE_ARRAY_DOUBLE(double, ArrayOfDbl);
 #include "camera.h"
 #include "mount.h"
 #include "scopes.h"
+#include "pointing_cache.h"
 #include "stepguiders.h"
 #include "rotators.h"
 #include "image_math.h"
@@ -183,9 +185,13 @@ WX_DEFINE_ARRAY_DOUBLE(double, ArrayOfDbl);
 #include "myframe.h"
 #include "debuglog.h"
 #include "worker_thread.h"
+#include "frame_pipeline.h"
+#include "thread_pool.h"
+#include "guide_latency.h"
 #include "event_server.h"
 #include "confirm_dialog.h"
 #include "phdcontrol.h"
+#include "sim_benchmark.h"
 #include "runinbg.h"
 #include "fitsiowrap.h"
 #include "imagelogger.h"
@@ -228,6 +234,7 @@ public:
     PhdApp();
     bool OnInit();
     int OnExit();
+    void OnFatalException() override;
     void OnInitCmdLine(wxCmdLineParser& parser);
     bool OnCmdLineParsed(wxCmdLineParser & parser);
     void TerminateApp();
@@ -256,6 +256,8 @@ static void do_notify(void)
 
     if (pMount)
         pMount->NotifyGuidingDitherSettleDone(ctrl.succeeded);
+
+    SimBenchmark::NotifySettleDone(ctrl.succeeded ? wxString() : ctrl.errorMsg);
 }
 
 static bool start_capturing(void)
@@ -0,0 +1,259 @@
+/*
+ *  pointing_cache.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "phd.h"
+
+#include <algorithm>
+#include <atomic>
+
+//
+// The snapshot is published with a sequence lock. The writer makes the
+// sequence number odd, copies the state and makes it even again. A reader
+// retries if the number was odd or changed while it copied the state.
+// The poller and Refresh() can both publish, so writers take s_writeLock;
+// it is never held during mount I/O.
+//
+static std::atomic<unsigned int> s_seq(0);
+static PointingState s_state;
+static wxMutex s_writeLock;
+
+static std::atomic<int> s_pollInterval(PointingCache::DEFAULT_POLL_INTERVAL);
+
+class PointingPoller : public wxThread
+{
+    Scope *m_scope;
+    wxMutex m_lock;
+    wxCondition m_cond;
+    bool m_stop;
+
+public:
+    PointingPoller(Scope *scope);
+    Scope *Source() const { return m_scope; }
+    void Wake();
+    void RequestStop();
+
+protected:
+    ExitCode Entry() override;
+};
+
+static PointingPoller *s_poller;
+
+PointingState::PointingState()
+    :
+    haveCoordinates(false),
+    ra(0.0),
+    dec(0.0),
+    lst(0.0),
+    declination(UNKNOWN_DECLINATION),
+    pierSide(PIER_SIDE_UNKNOWN),
+    haveGuideRates(false),
+    raGuideRate(0.0),
+    decGuideRate(0.0),
+    timestamp(0)
+{
+}
+
+long long PointingState::Age() const
+{
+    if (!timestamp)
+        return -1;
+    return wxGetUTCTimeMillis().GetValue() - timestamp;
+}
+
+static PointingState ReadMount(Scope *scope)
+{
+    PointingState state;
+
+    if (!scope->GetCoordinates(&state.ra, &state.dec, &state.lst))
+        state.haveCoordinates = true;
+    state.declination = scope->GetDeclination();
+    state.pierSide = scope->SideOfPier();
+    if (!scope->GetGuideRates(&state.raGuideRate, &state.decGuideRate))
+        state.haveGuideRates = true;
+    state.timestamp = wxGetUTCTimeMillis().GetValue();
+
+    return state;
+}
+
+static void Publish(const PointingState& state)
+{
+    wxMutexLocker lck(s_writeLock);
+
+    unsigned int seq = s_seq.load(std::memory_order_relaxed);
+    s_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s_state = state;
+    s_seq.store(seq + 2, std::memory_order_release);
+}
+
+PointingPoller::PointingPoller(Scope *scope)
+    :
+    wxThread(wxTHREAD_JOINABLE),
+    m_scope(scope),
+    m_cond(m_lock),
+    m_stop(false)
+{
+}
+
+void PointingPoller::Wake()
+{
+    wxMutexLocker lck(m_lock);
+    m_cond.Signal();
+}
+
+void PointingPoller::RequestStop()
+{
+    wxMutexLocker lck(m_lock);
+    m_stop = true;
+    m_cond.Signal();
+}
+
+wxThread::ExitCode PointingPoller::Entry()
+{
+#if defined(__WINDOWS__)
+    HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    Debug.Write(wxString::Format("pointing poller CoInitializeEx returns %x\n", hr));
+#endif
+
+    while (true)
+    {
+        Publish(ReadMount(m_scope));
+
+        wxMutexLocker lck(m_lock);
+        if (!m_stop)
+            m_cond.WaitTimeout(s_pollInterval.load());
+        if (m_stop)
+            break;
+    }
+
+#if defined(__WINDOWS__)
+    CoUninitialize();
+#endif
+
+    return 0;
+}
+
+void PointingCache::SetSource(Scope *scope)
+{
+    if (scope && (!scope->IsConnected() || !scope->CanReportPosition()))
+        scope = nullptr;
+
+    if (s_poller && s_poller->Source() == scope)
+        return;
+
+    Stop();
+
+    if (!scope)
+        return;
+
+    s_pollInterval = std::max((int) MIN_POLL_INTERVAL, GetPollInterval());
+
+    PointingPoller *poller = new PointingPoller(scope);
+    if (poller->Create() != wxTHREAD_NO_ERROR || poller->Run() != wxTHREAD_NO_ERROR)
+    {
+        Debug.Write("PointingCache: could not start the polling thread, mount position is not available\n");
+        delete poller;
+        return;
+    }
+
+    s_poller = poller;
+    Debug.Write(wxString::Format("PointingCache: polling %s every %d ms\n", scope->Name(), s_pollInterval.load()));
+}
+
+void PointingCache::Stop()
+{
+    if (s_poller)
+    {
+        Debug.Write(wxString::Format("PointingCache: stop polling %s\n", s_poller->Source()->Name()));
+        s_poller->RequestStop();
+        s_poller->Wait();
+        delete s_poller;
+        s_poller = nullptr;
+    }
+
+    Publish(PointingState());
+}
+
+void PointingCache::Detach(Scope *scope)
+{
+    if (scope && s_poller && s_poller->Source() == scope)
+        Stop();
+}
+
+PointingState PointingCache::Get()
+{
+    while (true)
+    {
+        unsigned int seq = s_seq.load(std::memory_order_acquire);
+        if ((seq & 1) == 0)
+        {
+            PointingState state = s_state;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s_seq.load(std::memory_order_relaxed) == seq)
+                return state;
+        }
+        wxThread::Yield();
+    }
+}
+
+PointingState PointingCache::Refresh()
+{
+    // without a poller (the source cannot report its position, or the thread
+    // did not start) read the pointing source directly; it may still know its
+    // declination or pier side
+    Scope *scope = s_poller ? s_poller->Source() : pPointingSource;
+    if (!scope)
+        return Get();
+
+    PointingState state = ReadMount(scope);
+    Publish(state);
+    return state;
+}
+
+int PointingCache::GetPollInterval()
+{
+    return pConfig->Profile.GetInt("/scope/PointingPollInterval", DEFAULT_POLL_INTERVAL);
+}
+
+void PointingCache::SetPollInterval(int ms)
+{
+    if (ms < MIN_POLL_INTERVAL)
+        ms = MIN_POLL_INTERVAL;
+
+    pConfig->Profile.SetInt("/scope/PointingPollInterval", ms);
+    s_pollInterval = ms;
+
+    if (s_poller)
+        s_poller->Wake();
+}
@@ -0,0 +1,100 @@
+/*
+ *  pointing_cache.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef POINTING_CACHE_H_INCLUDED
+#define POINTING_CACHE_H_INCLUDED
+
+class Scope;
+
+//
+// Mount position for code that must not wait for the mount.
+//
+// Reading the position from an ASCOM, INDI or serial mount is a round trip
+// to the driver. PointingCache polls the pointing source on its own thread
+// and publishes the results as a snapshot. Readers copy the snapshot without
+// taking a lock, so a repaint or a guide step never waits for mount I/O.
+//
+// The polling interval is the profile setting /scope/PointingPollInterval,
+// in milliseconds. Refresh() reads the mount on the calling thread, for
+// callers that need current values, such as calibration adjustment.
+// SetSource(), Stop() and Refresh() are called from the main thread only;
+// Get() can be called from any thread.
+//
+struct PointingState
+{
+    bool haveCoordinates;       // ra, dec and lst are valid
+    double ra;                  // hours
+    double dec;                 // degrees
+    double lst;                 // local sidereal time, hours
+    double declination;         // radians, or UNKNOWN_DECLINATION, see Scope::GetDeclination()
+    PierSide pierSide;
+    bool haveGuideRates;        // raGuideRate and decGuideRate are valid
+    double raGuideRate;         // degrees/sec
+    double decGuideRate;
+    long long timestamp;        // wxGetUTCTimeMillis() when the mount was read, 0 if never read
+
+    PointingState();
+    // milliseconds since the mount was read, -1 if it was never read
+    long long Age() const;
+};
+
+class PointingCache
+{
+public:
+    enum
+    {
+        DEFAULT_POLL_INTERVAL = 2000,   // milliseconds
+        MIN_POLL_INTERVAL = 250,
+    };
+
+    // poll scope in the background. A null scope, or one that is not
+    // connected or cannot report its position, stops the polling.
+    static void SetSource(Scope *scope);
+    // stop polling and clear the snapshot
+    static void Stop();
+    // stop polling scope if it is the source; call this before a scope is
+    // disconnected or deleted
+    static void Detach(Scope *scope);
+
+    // the most recent snapshot; never blocks
+    static PointingState Get();
+    // read the mount now and publish the result; blocks on the driver. Reads
+    // pPointingSource when it is not being polled
+    static PointingState Refresh();
+
+    static int GetPollInterval();
+    static void SetPollInterval(int ms);
+};
+
+#endif // POINTING_CACHE_H_INCLUDED
@@ -212,3 +212,8 @@ bool ScopeOnboardST4::SynchronousOnly(void)
 
     return syncOnly;
 }
+
+bool ScopeOnboardST4::UsesCameraGuidePort(void) const
+{
+    return m_pOnboardHost && m_pOnboardHost == static_cast<OnboardST4 *>(pCamera);
+}
@@ -0,0 +1,421 @@
+/*
+ *  sim_benchmark.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "phd.h"
+
+#include "gear_simulator.h"
+#include "guiding_stats.h"
+
+#include <memory>
+#include <vector>
+
+static const wxString BENCHMARK_PROFILE = _T("Simulator benchmark");
+
+enum BenchState
+{
+    BENCH_IDLE,
+    BENCH_SETTLING,     // PhdController is calibrating or settling
+    BENCH_MEASURING,
+    BENCH_DONE,
+};
+
+struct Scenario
+{
+    wxString filename;
+    unsigned int seed;
+    int frames;
+    int settleFrames;
+    int exposureMs;
+    bool calibrate;
+    bool realtime;
+    wxString profile;
+    wxString results;
+    std::vector<std::pair<wxString, wxString>> settings;   // profile keys and values
+};
+
+struct Benchmark
+{
+    Scenario scn;
+    BenchState state;
+    int prevProfileId;
+    int steps;
+    int dropped;
+    DescriptiveStats ra;
+    DescriptiveStats dec;
+    double peakRa;
+    double peakDec;
+    wxStopWatch wall;
+    long simStart;
+    long wallMs;
+    long simMs;
+    GuideLatency::Histogram hist[GuideLatency::NUM_STAGES];
+};
+
+static Benchmark *s_bench;
+
+static wxString RelativeTo(const wxString& path, const wxString& scenarioFile)
+{
+    wxFileName fn(path);
+    if (fn.IsRelative())
+        fn.MakeAbsolute(wxFileName(scenarioFile).GetPath());
+    return fn.GetFullPath();
+}
+
+static bool LoadScenario(const wxString& filename, Scenario *scn, wxString *error)
+{
+    scn->filename = filename;
+    scn->seed = 1;
+    scn->frames = 500;
+    scn->settleFrames = 10;
+    scn->exposureMs = 1000;
+    scn->calibrate = true;
+    scn->realtime = false;
+
+    wxFileName results(filename);
+    results.SetName(results.GetName() + _T("_results"));
+    results.SetExt(_T("txt"));
+    scn->results = results.GetFullPath();
+
+    wxTextFile file;
+    if (!wxFileExists(filename) || !file.Open(filename))
+    {
+        *error = wxString::Format("cannot open %s", filename);
+        return true;
+    }
+
+    for (size_t i = 0; i < file.GetLineCount(); i++)
+    {
+        wxString line = file[i].BeforeFirst('#').Trim(true).Trim(false);
+        if (line.empty())
+            continue;
+
+        wxString key = line.BeforeFirst('=').Trim(true);
+        wxString val = line.AfterFirst('=').Trim(false);
+
+        if (key.empty() || !line.Contains("="))
+        {
+            *error = wxString::Format("%s line %u: expected key = value", filename, (unsigned int)(i + 1));
+            return true;
+        }
+
+        long lval = 0;
+        bool isNum = val.ToLong(&lval);
+
+        if (key.StartsWith("/"))
+            scn->settings.push_back(std::make_pair(key, val));
+        else if (key == "seed" && isNum && lval >= 0)
+            scn->seed = (unsigned int) lval;
+        else if (key == "frames" && isNum && lval > 0)
+            scn->frames = (int) lval;
+        else if (key == "settle_frames" && isNum && lval >= 0)
+            scn->settleFrames = (int) lval;
+        else if (key == "exposure_ms" && isNum && lval > 0)
+            scn->exposureMs = (int) lval;
+        else if (key == "calibrate" && isNum)
+            scn->calibrate = lval != 0;
+        else if (key == "realtime" && isNum)
+            scn->realtime = lval != 0;
+        else if (key == "profile" && !val.empty())
+            scn->profile = RelativeTo(val, filename);
+        else if (key == "results" && !val.empty())
+            scn->results = RelativeTo(val, filename);
+        else
+        {
+            *error = wxString::Format("%s line %u: invalid setting %s", filename, (unsigned int)(i + 1), line);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// switch away from a profile that is about to be replaced
+static void LeaveProfile(const wxString& name)
+{
+    if (pConfig->GetCurrentProfile().CmpNoCase(name) != 0)
+        return;
+
+    wxArrayString names = pConfig->ProfileNames();
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        if (names[i].CmpNoCase(name) != 0)
+        {
+            pConfig->SetCurrentProfile(names[i]);
+            return;
+        }
+    }
+
+    pConfig->SetCurrentProfile(wxGetTranslation(PhdConfig::DefaultProfileName));
+}
+
+static void ApplySetting(const wxString& key, const wxString& val)
+{
+    long lval;
+    double dval;
+
+    Debug.Write(wxString::Format("SimBenchmark: set %s = %s\n", key, val));
+
+    if (val.ToLong(&lval))
+        pConfig->Profile.SetInt(key, (int) lval);
+    else if (val.ToCDouble(&dval))
+        pConfig->Profile.SetDouble(key, dval);
+    else
+        pConfig->Profile.SetString(key, val);
+}
+
+bool SimBenchmark::Init(const wxString& scenarioFile, long seed, wxString *error)
+{
+    std::unique_ptr<Benchmark> bench(new Benchmark());
+    Scenario& scn = bench->scn;
+
+    wxFileName fn(scenarioFile);
+    fn.MakeAbsolute();
+
+    if (LoadScenario(fn.GetFullPath(), &scn, error))
+        return true;
+
+    if (seed >= 0)
+        scn.seed = (unsigned int) seed;
+
+    Debug.Write(wxString::Format("SimBenchmark: scenario %s seed %u frames %d\n", scn.filename, scn.seed, scn.frames));
+
+    // each run starts from a fresh copy of its profile so that nothing
+    // carries over from an earlier run
+    wxString profileName = scn.profile.empty() ? BENCHMARK_PROFILE : wxFileName(scn.profile).GetName();
+    LeaveProfile(profileName);
+    bench->prevProfileId = pConfig->GetCurrentProfileId();
+
+    if (!scn.profile.empty())
+    {
+        if (pConfig->ReadProfile(scn.profile))
+        {
+            *error = wxString::Format("cannot load profile %s", scn.profile);
+            return true;
+        }
+    }
+    else
+    {
+        pConfig->DeleteProfile(profileName);
+        if (pConfig->SetCurrentProfile(profileName))
+        {
+            *error = wxString::Format("cannot create profile %s", profileName);
+            return true;
+        }
+        pConfig->Profile.SetString("/camera/LastMenuChoice", _T("Simulator"));
+        pConfig->Profile.SetString("/scope/LastMenuChoice", _T("On-camera"));
+    }
+
+    pConfig->Profile.SetInt("/ExposureDurationMs", scn.exposureMs);
+    for (size_t i = 0; i < scn.settings.size(); i++)
+        ApplySetting(scn.settings[i].first, scn.settings[i].second);
+
+    bench->state = BENCH_IDLE;
+    s_bench = bench.release();
+
+    return false;
+}
+
+bool SimBenchmark::IsActive()
+{
+    return s_bench != nullptr;
+}
+
+static void Shutdown()
+{
+    pFrame->StopCapturing();
+
+    // the next interactive session opens the profile that was current before the benchmark
+    pConfig->Global.SetInt("/currentProfile", s_bench->prevProfileId);
+
+    wxGetApp().TerminateApp();
+}
+
+static double Rms(DescriptiveStats& stats)
+{
+    return stats.GetCount() > 1 ? stats.GetSigma() : 0.0;
+}
+
+static void WriteResults(Benchmark& b, const wxString& status)
+{
+    double const raRms = Rms(b.ra);
+    double const decRms = Rms(b.dec);
+
+    wxString line = wxString::Format("%s\t%u\t%s\t%d\t%d\t%.3f\t%.4f\t%.4f\t%.4f\t%.4f\t%.4f\t%.3f\t%.3f",
+        wxFileName(b.scn.filename).GetName(), b.scn.seed, status, b.steps, b.dropped,
+        pFrame->GetCameraPixelScale(), raRms, decRms, hypot(raRms, decRms),
+        b.peakRa, b.peakDec, b.wallMs / 1000.0, b.simMs / 1000.0);
+
+    wxString header = "scenario\tseed\tstatus\tframes\tdropped\tpixel_scale\tra_rms_px\tdec_rms_px\ttotal_rms_px\t"
+        "ra_peak_px\tdec_peak_px\twall_sec\tsim_sec";
+
+    for (int i = 0; i < GuideLatency::NUM_STAGES; i++)
+    {
+        const GuideLatency::Histogram& h = b.hist[i];
+        wxString name = wxString(GuideLatency::StageName((GuideLatency::Stage) i)).Lower();
+        header += wxString::Format("\t%s_mean_ms\t%s_max_ms", name, name);
+        line += wxString::Format("\t%.3f\t%.3f", h.count ? h.sum / 1000.0 / h.count : 0.0, h.max / 1000.0);
+    }
+
+    Debug.Write(wxString::Format("SimBenchmark: %s\nSimBenchmark: %s\n", header, line));
+
+    bool writeHeader = !wxFileExists(b.scn.results) || wxFileName::GetSize(b.scn.results) == 0;
+
+    wxFFile file(b.scn.results, "a");
+    if (!file.IsOpened())
+    {
+        Debug.Write(wxString::Format("SimBenchmark: cannot open results file %s\n", b.scn.results));
+        return;
+    }
+
+    if (writeHeader)
+        file.Write(header + "\n");
+    file.Write(line + "\n");
+}
+
+static void Complete(const wxString& status)
+{
+    Benchmark& b = *s_bench;
+
+    if (b.state == BENCH_MEASURING)
+    {
+        b.wallMs = b.wall.Time();
+        b.simMs = GearSimulator::SimulatedTimeMs(pCamera) - b.simStart;
+        GuideLatency::GetHistograms(b.hist, false);
+    }
+
+    b.state = BENCH_DONE;
+
+    Debug.Write(wxString::Format("SimBenchmark: complete, status %s\n", status));
+    WriteResults(b, status);
+
+    // shut down from the event loop rather than from inside the guide step notification
+    wxGetApp().CallAfter([]() { Shutdown(); });
+}
+
+void SimBenchmark::Start()
+{
+    Benchmark& b = *s_bench;
+
+    b.steps = b.dropped = 0;
+    b.peakRa = b.peakDec = 0.0;
+    b.wallMs = b.simMs = 0;
+    b.simStart = 0;
+    memset(b.hist, 0, sizeof(b.hist));
+
+    GearSimulator::SetDeterministic(b.scn.seed, !b.scn.realtime);
+
+    // a pipelined exposure overlaps the guide pulses, so the simulated time
+    // and the results would depend on thread scheduling. The benchmark runs
+    // in its own copy of the profile, so the setting is not restored.
+    pFrame->SetPipelinedCapture(false);
+
+    wxString err;
+    if (pFrame->pGearDialog->ConnectAll(&err))
+    {
+        Complete("error: " + err);
+        return;
+    }
+    if (!pCamera || !pCamera->Connected || pCamera->Name != _T("Simulator"))
+    {
+        Complete("error: the profile does not use the camera simulator");
+        return;
+    }
+
+    // settle on a frame count only, as PhdController::Dither(pixels, frames) does
+    SettleParams settle;
+    settle.tolerancePx = 99.;
+    settle.settleTimeSec = 9999;
+    settle.timeoutSec = 9999;
+    settle.frames = b.scn.settleFrames;
+
+    b.state = BENCH_SETTLING;
+
+    if (!PhdController::Guide(b.scn.calibrate, settle, wxRect(), &err))
+        Complete("error: " + err);
+}
+
+void SimBenchmark::NotifySettleDone(const wxString& errorMsg)
+{
+    if (!s_bench || s_bench->state != BENCH_SETTLING)
+        return;
+
+    if (!errorMsg.empty())
+    {
+        Complete("error: " + errorMsg);
+        return;
+    }
+
+    Benchmark& b = *s_bench;
+
+    Debug.Write("SimBenchmark: settled, measuring\n");
+
+    b.ra.ClearAll();
+    b.dec.ClearAll();
+    GuideLatency::GetHistograms(b.hist, true);
+    b.simStart = GearSimulator::SimulatedTimeMs(pCamera);
+    b.wall.Start();
+    b.state = BENCH_MEASURING;
+}
+
+static void CheckDone()
+{
+    if (s_bench->steps + s_bench->dropped >= s_bench->scn.frames)
+        Complete("ok");
+}
+
+void SimBenchmark::NotifyGuideStep(const GuideStepInfo& info)
+{
+    if (!s_bench || s_bench->state != BENCH_MEASURING)
+        return;
+
+    Benchmark& b = *s_bench;
+
+    b.ra.AddValue(info.mountOffset.X);
+    b.dec.AddValue(info.mountOffset.Y);
+    b.peakRa = wxMax(b.peakRa, fabs(info.mountOffset.X));
+    b.peakDec = wxMax(b.peakDec, fabs(info.mountOffset.Y));
+    ++b.steps;
+
+    CheckDone();
+}
+
+void SimBenchmark::NotifyFrameDropped(const FrameDroppedInfo& info)
+{
+    if (!s_bench || s_bench->state != BENCH_MEASURING)
+        return;
+
+    ++s_bench->dropped;
+
+    CheckDone();
+}
@@ -0,0 +1,85 @@
+/*
+ *  sim_benchmark.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef SIM_BENCHMARK_H_INCLUDED
+#define SIM_BENCHMARK_H_INCLUDED
+
+//
+// Unattended benchmark runs against the camera simulator.
+//
+// A scenario file selects the gear and guiding settings, the seeing and the
+// length of the run. PHD2 starts without showing the main window, connects
+// the simulator, calibrates and guides through PhdController, and after the
+// requested number of guide frames appends one line with the guiding RMS and
+// the per-stage timings from GuideLatency to a results file, then exits.
+//
+// The simulator's random numbers are seeded from the scenario so that a run
+// can be replayed. Unless the scenario asks for real time, exposures and
+// guide pulses advance a simulated clock and take no real time.
+//
+// Scenario files have one "key = value" per line; # starts a comment.
+//
+//   seed = 1              simulator random seed (--seed overrides it)
+//   frames = 500          guide frames to measure
+//   settle_frames = 10    guide frames to skip before measuring
+//   exposure_ms = 1000    exposure duration
+//   calibrate = 1         calibrate even if the profile has a calibration
+//   realtime = 0          sleep the real exposure and pulse durations
+//   profile = file.phd    start from a saved profile instead of a new one
+//   results = file.txt    results file (default <scenario>_results.txt)
+//   /SimCam/seeing_scale = 2.5
+//   /SimCam/replay_dir = dir   replay recorded FITS frames instead of rendering
+//
+// Keys starting with / are profile settings, for example /SimCam/... for the
+// simulator or /scope/GuideAlgorithm/... for the guide algorithms. Write a
+// decimal point in floating-point values. The scenario is applied to a
+// profile of its own, so run each benchmark in a separate instance (-i) to
+// leave the usual profiles alone; instances can run in parallel.
+//
+class SimBenchmark
+{
+public:
+    // called from OnInit before the main frame is created; selects the
+    // scenario's profile. Returns true on error.
+    static bool Init(const wxString& scenarioFile, long seed, wxString *error);
+    static bool IsActive();
+    // called from OnInit once the main frame exists
+    static void Start();
+
+    static void NotifyGuideStep(const GuideStepInfo& info);
+    static void NotifyFrameDropped(const FrameDroppedInfo& info);
+    static void NotifySettleDone(const wxString& errorMsg);
+};
+
+#endif // SIM_BENCHMARK_H_INCLUDED
@@ -36,9 +36,12 @@
  */
 
 #include "phd.h"
+#include "star_kernel.h"
+
 #include <algorithm>
 
 Star::Star(void)
+    : PeakVal(0)
 {
     Invalidate();
     // Star is a bit quirky in that we use X and Y after the star is Invalidate()ed.
@@ -135,6 +138,43 @@ static double hfr(std::vector<R2M>& vec, double cx, double cy, double mass)
     return hfr;
 }
 
+// pixels over threshold within the aperture, in row-major order, for the HFR calculation
+static void CollectAperture(std::vector<R2M> *vec, const unsigned short *imgdata, int rowsize, int peak_x, int peak_y, int A,
+                            int minx, int miny, int maxx, int maxy, unsigned short thresh, double mean_bg)
+{
+    int const A2 = A * A;
+
+    int start_x = wxMax(peak_x - A, minx);
+    int end_x = wxMin(peak_x + A, maxx);
+    int start_y = wxMax(peak_y - A, miny);
+    int end_y = wxMin(peak_y + A, maxy);
+
+    const unsigned short *row = imgdata + rowsize * start_y;
+    for (int y = start_y; y <= end_y; y++, row += rowsize)
+    {
+        int dy = y - peak_y;
+        int dy2 = dy * dy;
+        if (dy2 > A2)
+            continue;
+
+        for (int x = start_x; x <= end_x; x++)
+        {
+            int dx = x - peak_x;
+
+            // exclude points outside aperture
+            if (dx * dx + dy2 > A2)
+                continue;
+
+            // exclude points below threshold
+            unsigned short val = row[x];
+            if (val < thresh)
+                continue;
+
+            vec->push_back(R2M(x, y, (double) val - mean_bg));
+        }
+    }
+}
+
 bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, FindMode mode, double minHFD, unsigned short maxADU)
 {
     FindResult Result = STAR_OK;
@@ -176,6 +216,8 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
         const unsigned short *imgdata = pImg->ImageData;
         int rowsize = pImg->Size.GetWidth();
 
+        StarKernel::Bounds const bounds = { minx, miny, maxx, maxy };
+
         int peak_x = 0, peak_y = 0;
         unsigned int peak_val = 0;
         unsigned short max3[3] = { 0, 0, 0 };
@@ -204,37 +246,13 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
             // find the peak value within the search region using a smoothing function
             // also check for saturation
 
-            for (int y = start_y + 1; y <= end_y - 1; y++)
-            {
-                for (int x = start_x + 1; x <= end_x - 1; x++)
-                {
-                    unsigned short p = imgdata[y * rowsize + x];
-                    unsigned int val =
-                        4 * (unsigned int) p +
-                        imgdata[(y - 1) * rowsize + (x - 1)] +
-                        imgdata[(y - 1) * rowsize + (x + 1)] +
-                        imgdata[(y + 1) * rowsize + (x - 1)] +
-                        imgdata[(y + 1) * rowsize + (x + 1)] +
-                        2 * imgdata[(y - 1) * rowsize + (x + 0)] +
-                        2 * imgdata[(y + 0) * rowsize + (x - 1)] +
-                        2 * imgdata[(y + 0) * rowsize + (x + 1)] +
-                        2 * imgdata[(y + 1) * rowsize + (x + 0)];
+            StarKernel::PeakResult pk;
+            StarKernel::SmoothedPeak(imgdata, rowsize, start_x, start_y, end_x, end_y, &pk);
 
-                    if (val > peak_val)
-                    {
-                        peak_val = val;
-                        peak_x = x;
-                        peak_y = y;
-                    }
-
-                    if (p > max3[0])
-                        std::swap(p, max3[0]);
-                    if (p > max3[1])
-                        std::swap(p, max3[1]);
-                    if (p > max3[2])
-                        std::swap(p, max3[2]);
-                }
-            }
+            peak_x = pk.x;
+            peak_y = pk.y;
+            peak_val = pk.val;
+            std::copy(pk.max3, pk.max3 + 3, max3);
 
             PeakVal = max3[0];   // raw peak val
             peak_val /= 16; // smoothed peak value
@@ -246,67 +264,19 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
         int const A2 = A * A;
         int const B2 = B * B;
 
-        // center window around peak value
-        start_x = wxMax(peak_x - B, minx);
-        end_x = wxMin(peak_x + B, maxx);
-        start_y = wxMax(peak_y - B, miny);
-        end_y = wxMin(peak_y + B, maxy);
-
         // find the mean and stdev of the background
 
-        unsigned int nbg;
-        double mean_bg = 0., prev_mean_bg;
-        double sigma2_bg;
-        double sigma_bg;
-
-        for (int iter = 0; iter < 9; iter++)
-        {
-            double sum = 0.0;
-            double a = 0.0;
-            double q = 0.0;
-            nbg = 0;
-
-            const unsigned short *row = imgdata + rowsize * start_y;
-            for (int y = start_y; y <= end_y; y++, row += rowsize)
-            {
-                int dy = y - peak_y;
-                int dy2 = dy * dy;
-                for (int x = start_x; x <= end_x; x++)
-                {
-                    int dx = x - peak_x;
-                    int r2 = dx * dx + dy2;
+        StarKernel::Background bg;
+        StarKernel::AnnulusBackground(imgdata, rowsize, peak_x, peak_y, A2, B2, bounds, &bg);
 
-                    // exclude points not in annulus
-                    if (r2 <= A2 || r2 > B2)
-                        continue;
+        unsigned int nbg = bg.n;
+        double mean_bg = bg.mean;
+        double sigma2_bg = bg.sigma2;
+        double sigma_bg = bg.sigma;
 
-                    double const val = (double) row[x];
-
-                    if (iter > 0 && (val < mean_bg - 2.0 * sigma_bg || val > mean_bg + 2.0 * sigma_bg))
-                        continue;
-
-                    sum += val;
-                    ++nbg;
-                    double const k = (double) nbg;
-                    double const a0 = a;
-                    a += (val - a) / k;
-                    q += (val - a0) * (val - a);
-                }
-            }
-
-            if (nbg < 10) // only possible after the first iteration
-            {
-                Debug.Write(wxString::Format("Star::Find: too few background points! nbg=%u mean=%.1f sigma=%.1f\n", nbg, mean_bg, sigma_bg));
-                break;
-            }
-
-            prev_mean_bg = mean_bg;
-            mean_bg = sum / (double) nbg;
-            sigma2_bg = q / (double) (nbg - 1);
-            sigma_bg = sqrt(sigma2_bg);
-
-            if (iter > 0 && fabs(mean_bg - prev_mean_bg) < 0.5)
-                break;
+        if (!bg.ok)
+        {
+            Debug.Write(wxString::Format("Star::Find: too few background points! nbg=%u mean=%.1f sigma=%.1f\n", nbg, mean_bg, sigma_bg));
         }
 
         unsigned short thresh;
@@ -316,8 +286,6 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
         double mass = 0.0;
         unsigned int n;
 
-        std::vector<R2M> hfrvec;
-
         if (mode == FIND_PEAK)
         {
             mass = peak_val;
@@ -330,44 +298,13 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
 
             // find pixels over threshold within aperture; compute mass and centroid
 
-            start_x = wxMax(peak_x - A, minx);
-            end_x = wxMin(peak_x + A, maxx);
-            start_y = wxMax(peak_y - A, miny);
-            end_y = wxMin(peak_y + A, maxy);
-
-            n = 0;
-
-            const unsigned short *row = imgdata + rowsize * start_y;
-            for (int y = start_y; y <= end_y; y++, row += rowsize)
-            {
-                int dy = y - peak_y;
-                int dy2 = dy * dy;
-                if (dy2 > A2)
-                    continue;
-
-                for (int x = start_x; x <= end_x; x++)
-                {
-                    int dx = x - peak_x;
-
-                    // exclude points outside aperture
-                    if (dx * dx + dy2 > A2)
-                        continue;
-
-                    // exclude points below threshold
-                    unsigned short val = row[x];
-                    if (val < thresh)
-                        continue;
+            StarKernel::Moments m;
+            StarKernel::ApertureMoments(imgdata, rowsize, peak_x, peak_y, A2, bounds, thresh, &m);
 
-                    double const d = (double) val - mean_bg;
-
-                    cx += dx * d;
-                    cy += dy * d;
-                    mass += d;
-                    ++n;
-
-                    hfrvec.push_back(R2M(x, y, d));
-                }
-            }
+            n = m.n;
+            mass = (double) m.sum - mean_bg * (double) n;
+            cx = (double) m.sumdxv - mean_bg * (double) m.sumdx;
+            cy = (double) m.sumdyv - mean_bg * (double) m.sumdy;
         }
 
         Mass = mass;
@@ -404,6 +341,10 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
         newX = peak_x + cx / mass;
         newY = peak_y + cy / mass;
 
+        std::vector<R2M> hfrvec;
+        if (mode != FIND_PEAK)
+            CollectAperture(&hfrvec, imgdata, rowsize, peak_x, peak_y, A, minx, miny, maxx, maxy, thresh, mean_bg);
+
         HFD = 2.0 * hfr(hfrvec, newX, newY, mass);
 
         if (HFD < minHFD && mode != FIND_PEAK)
@@ -560,17 +501,13 @@ static void SaveImage(const FloatImg& img, const char *name)
 #endif // SAVE_AUTOFIND_IMG
 }
 
-static void psf_conv(FloatImg& dst, const FloatImg& src)
+// convolve rows [y0, y1) of src with the PSF
+static void psf_conv_rows(FloatImg& dst, const FloatImg& src, int y0, int y1)
 {
-    dst.Init(src.Size);
-
     //                       A      B1     B2    C1     C2    C3     D1     D2     D3
     const double PSF[] = { 0.906, 0.584, 0.365, .117, .049, -0.05, -.064, -.074, -.094 };
 
     int const width = src.Size.GetWidth();
-    int const height = src.Size.GetHeight();
-
-    memset(dst.px, 0, src.NPixels * sizeof(float));
 
     /* PSF Grid is:
     D3 D3 D3 D3 D3 D3 D3 D3 D3
@@ -591,7 +528,7 @@ static void psf_conv(FloatImg& dst, const FloatImg& src)
 
     int psf_size = 4;
 
-    for (int y = psf_size; y < height - psf_size; y++)
+    for (int y = y0; y < y1; y++)
     {
         for (int x = psf_size; x < width - psf_size; x++)
         {
@@ -643,6 +580,23 @@ static void psf_conv(FloatImg& dst, const FloatImg& src)
     }
 }
 
+static void psf_conv(FloatImg& dst, const FloatImg& src)
+{
+    dst.Init(src.Size);
+
+    int const width = src.Size.GetWidth();
+    int const height = src.Size.GetHeight();
+
+    memset(dst.px, 0, src.NPixels * sizeof(float));
+
+    // the PSF is 9x9, leave a 4 pixel border; rows are independent so they
+    // are split across the thread pool
+    enum { PSF_SIZE = 4 };
+    ThreadPool::Get()->ParallelRange(height - 2 * PSF_SIZE, std::max(8, 16384 / std::max(width, 1)), [&](int y0, int y1) {
+        psf_conv_rows(dst, src, PSF_SIZE + y0, PSF_SIZE + y1);
+    });
+}
+
 static void Downsample(FloatImg& dst, const FloatImg& src, int downsample)
 {
     int width = src.Size.GetWidth();
@@ -697,6 +651,15 @@ static void RemoveItems(std::set<Peak>& stars, const std::set<int>& to_erase)
 
 bool Star::AutoFind(const usImage& image, int extraEdgeAllowance, int searchRegion, const wxRect& roi)
 {
+    std::vector<Star> foundStars;
+    return AutoFind(image, extraEdgeAllowance, searchRegion, roi, foundStars, 1);
+}
+
+bool Star::AutoFind(const usImage& image, int extraEdgeAllowance, int searchRegion, const wxRect& roi,
+                    std::vector<Star>& foundStars, int maxStars)
+{
+    foundStars.clear();
+
     if (!image.Subframe.IsEmpty())
     {
         Debug.AddLine("AutoFind called on subframe, returning error");
@@ -1027,6 +990,23 @@ bool Star::AutoFind(const usImage& image, int extraEdgeAllowance, int searchRegi
                 // star accepted
                 SetXY(it->x, it->y);
                 Debug.Write(wxString::Format("AutoFind returns star at [%d, %d] %.1f Mass %.f SNR %.1f\n", it->x, it->y, it->val, tmp.Mass, tmp.SNR));
+                foundStars.push_back(tmp);
+
+                // additional stars, brightest first, must meet the pass 1 criteria
+                for (std::set<Peak>::reverse_iterator it2 = stars.rbegin();
+                     it2 != stars.rend() && foundStars.size() < (size_t) maxStars; ++it2)
+                {
+                    if (it2 == it)
+                        continue;
+                    Star star;
+                    star.Find(&image, searchRegion, it2->x, it2->y, FIND_CENTROID, pFrame->pGuider->GetMinStarHFD(), pCamera->GetSaturationADU());
+                    if (star.WasFound() && star.GetError() != STAR_SATURATED && star.PeakVal <= sat_thresh && star.SNR >= 6.0)
+                    {
+                        Debug.Write(wxString::Format("AutoFind: additional star at [%d, %d] %.1f Mass %.f SNR %.1f\n", it2->x, it2->y, it2->val, star.Mass, star.SNR));
+                        foundStars.push_back(star);
+                    }
+                }
+
                 return true;
             }
         }
@@ -77,6 +77,9 @@ public:
     bool Find(const usImage *pImg, int searchRegion, FindMode mode, double min_hfd, unsigned short saturation);
     bool Find(const usImage *pImg, int searchRegion, int X, int Y, FindMode mode, double min_hfd, unsigned short saturation);
     bool AutoFind(const usImage& image, int edgeAllowance, int searchRegion, const wxRect& roi);
+    // as above, also returning up to maxStars stars suitable for guiding, the selected star first
+    bool AutoFind(const usImage& image, int edgeAllowance, int searchRegion, const wxRect& roi,
+                  std::vector<Star>& foundStars, int maxStars);
 
     bool WasFound(FindResult result);
     bool WasFound(void);
@@ -0,0 +1,920 @@
+/*
+ *  star_kernel.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "star_kernel.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define STAR_KERNEL_SSE2 1
+# include <emmintrin.h>
+# if defined(__GNUC__) || defined(__clang__)
+#  if (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#   define STAR_KERNEL_AVX2 1
+#   define AVX2_TARGET __attribute__((target("avx2")))
+#   include <immintrin.h>
+#  endif
+# elif defined(_MSC_VER)
+#  define STAR_KERNEL_AVX2 1
+#  define AVX2_TARGET
+#  include <immintrin.h>
+#  include <intrin.h>
+# endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define STAR_KERNEL_NEON 1
+# include <arm_neon.h>
+#endif
+
+namespace StarKernel
+{
+
+// accumulated sums over one contiguous run of pixels, index i relative to the start of the run
+struct SpanSums
+{
+    unsigned int n;
+    unsigned long long s;       // sum of val
+    unsigned long long s2;      // sum of val^2
+    unsigned long long si;      // sum of i
+    unsigned long long siv;     // sum of i * val
+
+    SpanSums() : n(0), s(0), s2(0), si(0), siv(0) { }
+};
+
+typedef void (*SmoothedPeakFn)(const unsigned short *img, int rowsize, int x0, int y0, int x1, int y1, PeakResult *res);
+typedef void (*SpanFn)(const unsigned short *p, int len, unsigned short lo, unsigned short hi, SpanSums *acc);
+
+// merge a value into a descending top-3 list, keeping duplicates
+static inline void Insert3(unsigned short max3[3], unsigned short p)
+{
+    if (p > max3[0])
+        std::swap(p, max3[0]);
+    if (p > max3[1])
+        std::swap(p, max3[1]);
+    if (p > max3[2])
+        std::swap(p, max3[2]);
+}
+
+static inline void InitPeak(PeakResult *res)
+{
+    res->x = res->y = 0;
+    res->val = 0;
+    res->max3[0] = res->max3[1] = res->max3[2] = 0;
+}
+
+// record the first occurrence of the row maximum if it beats the current peak
+static inline void UpdatePeakFromRow(const unsigned int *h, int n, unsigned int rowmax, int x, int y, PeakResult *res)
+{
+    if (rowmax <= res->val)
+        return;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (h[i] == rowmax)
+        {
+            res->val = rowmax;
+            res->x = x + i;
+            res->y = y;
+            return;
+        }
+    }
+}
+
+static inline void SpanTail(const unsigned short *p, int i, int len, unsigned short lo, unsigned short hi, SpanSums *acc)
+{
+    for (; i < len; i++)
+    {
+        unsigned int val = p[i];
+        if (val < lo || val > hi)
+            continue;
+        ++acc->n;
+        acc->s += val;
+        acc->s2 += (unsigned long long) val * val;
+        acc->si += i;
+        acc->siv += (unsigned long long) i * val;
+    }
+}
+
+//
+// scalar implementation
+//
+
+static void SmoothedPeakScalar(const unsigned short *imgdata, int rowsize, int x0, int y0, int x1, int y1, PeakResult *res)
+{
+    InitPeak(res);
+
+    for (int y = y0 + 1; y <= y1 - 1; y++)
+    {
+        for (int x = x0 + 1; x <= x1 - 1; x++)
+        {
+            unsigned short p = imgdata[y * rowsize + x];
+            unsigned int val =
+                4 * (unsigned int) p +
+                imgdata[(y - 1) * rowsize + (x - 1)] +
+                imgdata[(y - 1) * rowsize + (x + 1)] +
+                imgdata[(y + 1) * rowsize + (x - 1)] +
+                imgdata[(y + 1) * rowsize + (x + 1)] +
+                2 * imgdata[(y - 1) * rowsize + (x + 0)] +
+                2 * imgdata[(y + 0) * rowsize + (x - 1)] +
+                2 * imgdata[(y + 0) * rowsize + (x + 1)] +
+                2 * imgdata[(y + 1) * rowsize + (x + 0)];
+
+            if (val > res->val)
+            {
+                res->val = val;
+                res->x = x;
+                res->y = y;
+            }
+
+            Insert3(res->max3, p);
+        }
+    }
+}
+
+static void SpanScalar(const unsigned short *p, int len, unsigned short lo, unsigned short hi, SpanSums *acc)
+{
+    SpanTail(p, 0, len, lo, hi, acc);
+}
+
+//
+// SSE2 implementation
+//
+
+#ifdef STAR_KERNEL_SSE2
+
+static inline __m128i Max32(__m128i a, __m128i b)
+{
+    // values are < 2^31 so a signed compare is safe
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+static unsigned int HMax32(__m128i v)
+{
+    unsigned int a[4];
+    _mm_storeu_si128((__m128i *) a, v);
+    return std::max(std::max(a[0], a[1]), std::max(a[2], a[3]));
+}
+
+static void MergeTop3(PeakResult *res, const __m128i v[3], bool biased)
+{
+    unsigned short a[3][8];
+    for (int k = 0; k < 3; k++)
+        _mm_storeu_si128((__m128i *) a[k], v[k]);
+    for (int k = 0; k < 3; k++)
+        for (int i = 0; i < 8; i++)
+            Insert3(res->max3, biased ? (unsigned short)(a[k][i] ^ 0x8000) : a[k][i]);
+}
+
+static void SmoothedPeakSSE2(const unsigned short *imgdata, int rowsize, int x0, int y0, int x1, int y1, PeakResult *res)
+{
+    InitPeak(res);
+
+    int const w = x1 - x0 + 1;
+    int const nout = w - 2;
+    if (nout <= 0 || y1 - y0 < 2)
+        return;
+
+    std::vector<unsigned int> vbuf(w + 4);
+    std::vector<unsigned int> hbuf(nout + 4);
+    unsigned int *V = &vbuf[0];
+    unsigned int *H = &hbuf[0];
+
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const bias = _mm_set1_epi16((short) 0x8000);
+
+    // per-lane top-3 of the raw values, kept in the biased (signed) domain
+    __m128i top[3];
+    top[0] = top[1] = top[2] = _mm_set1_epi16((short) 0x8000);
+
+    for (int y = y0 + 1; y <= y1 - 1; y++)
+    {
+        const unsigned short *r0 = imgdata + (y - 1) * rowsize + x0;
+        const unsigned short *r1 = r0 + rowsize;
+        const unsigned short *r2 = r1 + rowsize;
+
+        // vertical pass: V = top + 2 * mid + bottom
+        int c = 0;
+        for (; c + 8 <= w; c += 8)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(r0 + c));
+            __m128i b = _mm_loadu_si128((const __m128i *)(r1 + c));
+            __m128i d = _mm_loadu_si128((const __m128i *)(r2 + c));
+            __m128i lo = _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(a, zero), _mm_unpacklo_epi16(d, zero)),
+                                       _mm_slli_epi32(_mm_unpacklo_epi16(b, zero), 1));
+            __m128i hi = _mm_add_epi32(_mm_add_epi32(_mm_unpackhi_epi16(a, zero), _mm_unpackhi_epi16(d, zero)),
+                                       _mm_slli_epi32(_mm_unpackhi_epi16(b, zero), 1));
+            _mm_storeu_si128((__m128i *)(V + c), lo);
+            _mm_storeu_si128((__m128i *)(V + c + 4), hi);
+        }
+        for (; c < w; c++)
+            V[c] = r0[c] + 2U * r1[c] + r2[c];
+
+        // horizontal pass: H = V[-1] + 2 * V[0] + V[+1]
+        __m128i vmax = zero;
+        int i = 0;
+        for (; i + 4 <= nout; i += 4)
+        {
+            __m128i l = _mm_loadu_si128((const __m128i *)(V + i));
+            __m128i m = _mm_loadu_si128((const __m128i *)(V + i + 1));
+            __m128i r = _mm_loadu_si128((const __m128i *)(V + i + 2));
+            __m128i h = _mm_add_epi32(_mm_add_epi32(l, r), _mm_slli_epi32(m, 1));
+            _mm_storeu_si128((__m128i *)(H + i), h);
+            vmax = Max32(vmax, h);
+        }
+        unsigned int rowmax = HMax32(vmax);
+        for (; i < nout; i++)
+        {
+            H[i] = V[i] + 2 * V[i + 1] + V[i + 2];
+            rowmax = std::max(rowmax, H[i]);
+        }
+
+        UpdatePeakFromRow(H, nout, rowmax, x0 + 1, y, res);
+
+        // raw top-3 of the interior pixels
+        const unsigned short *mid = r1 + 1;
+        i = 0;
+        for (; i + 8 <= nout; i += 8)
+        {
+            __m128i p = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(mid + i)), bias);
+            __m128i t = _mm_max_epi16(top[0], p);
+            p = _mm_min_epi16(top[0], p);
+            top[0] = t;
+            t = _mm_max_epi16(top[1], p);
+            p = _mm_min_epi16(top[1], p);
+            top[1] = t;
+            top[2] = _mm_max_epi16(top[2], p);
+        }
+        for (; i < nout; i++)
+            Insert3(res->max3, mid[i]);
+    }
+
+    MergeTop3(res, top, true);
+}
+
+static void SpanSSE2(const unsigned short *p, int len, unsigned short lo, unsigned short hi, SpanSums *acc)
+{
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const bias = _mm_set1_epi16((short) 0x8000);
+    __m128i const vlo = _mm_set1_epi16((short)(lo ^ 0x8000));
+    __m128i const vhi = _mm_set1_epi16((short)(hi ^ 0x8000));
+    __m128i const step = _mm_set1_epi16(8);
+
+    int i = 0;
+
+    // blocks of at most 256 pixels keep the 16-bit index and the 32-bit lane sums from overflowing
+    while (i + 8 <= len)
+    {
+        int const base = i;
+        int const blockend = base + ((std::min(len, base + 256) - base) & ~7);
+
+        __m128i idx = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+        __m128i cnt = zero, s = zero, s2 = zero, si = zero, siv = zero;
+
+        for (; i < blockend; i += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+            __m128i vb = _mm_xor_si128(v, bias);
+            __m128i mask = _mm_andnot_si128(_mm_or_si128(_mm_cmplt_epi16(vb, vlo), _mm_cmpgt_epi16(vb, vhi)),
+                                            _mm_set1_epi16(-1));
+            __m128i vm = _mm_and_si128(v, mask);
+
+            cnt = _mm_sub_epi16(cnt, mask);
+
+            __m128i vl = _mm_unpacklo_epi16(vm, zero);
+            __m128i vh = _mm_unpackhi_epi16(vm, zero);
+            s = _mm_add_epi32(s, _mm_add_epi32(vl, vh));
+
+            s2 = _mm_add_epi64(s2, _mm_mul_epu32(vl, vl));
+            s2 = _mm_add_epi64(s2, _mm_mul_epu32(_mm_srli_epi64(vl, 32), _mm_srli_epi64(vl, 32)));
+            s2 = _mm_add_epi64(s2, _mm_mul_epu32(vh, vh));
+            s2 = _mm_add_epi64(s2, _mm_mul_epu32(_mm_srli_epi64(vh, 32), _mm_srli_epi64(vh, 32)));
+
+            __m128i im = _mm_and_si128(idx, mask);
+            si = _mm_add_epi32(si, _mm_add_epi32(_mm_unpacklo_epi16(im, zero), _mm_unpackhi_epi16(im, zero)));
+
+            __m128i pl = _mm_mullo_epi16(idx, vm);
+            __m128i ph = _mm_mulhi_epu16(idx, vm);
+            siv = _mm_add_epi32(siv, _mm_add_epi32(_mm_unpacklo_epi16(pl, ph), _mm_unpackhi_epi16(pl, ph)));
+
+            idx = _mm_add_epi16(idx, step);
+        }
+
+        unsigned short c16[8];
+        unsigned int s32[4], si32[4], siv32[4];
+        unsigned long long s64[2];
+        _mm_storeu_si128((__m128i *) c16, cnt);
+        _mm_storeu_si128((__m128i *) s32, s);
+        _mm_storeu_si128((__m128i *) si32, si);
+        _mm_storeu_si128((__m128i *) siv32, siv);
+        _mm_storeu_si128((__m128i *) s64, s2);
+
+        unsigned int bn = 0;
+        for (int k = 0; k < 8; k++)
+            bn += c16[k];
+        unsigned long long bs = 0, bsi = 0, bsiv = 0;
+        for (int k = 0; k < 4; k++)
+        {
+            bs += s32[k];
+            bsi += si32[k];
+            bsiv += siv32[k];
+        }
+
+        // shift block-relative indexes to span-relative indexes
+        acc->n += bn;
+        acc->s += bs;
+        acc->s2 += s64[0] + s64[1];
+        acc->si += bsi + (unsigned long long) base * bn;
+        acc->siv += bsiv + (unsigned long long) base * bs;
+    }
+
+    SpanTail(p, i, len, lo, hi, acc);
+}
+
+#endif // STAR_KERNEL_SSE2
+
+//
+// AVX2 implementation (the span kernel works on short runs and shares the SSE2 code)
+//
+
+#ifdef STAR_KERNEL_AVX2
+
+AVX2_TARGET
+static void SmoothedPeakAVX2(const unsigned short *imgdata, int rowsize, int x0, int y0, int x1, int y1, PeakResult *res)
+{
+    InitPeak(res);
+
+    int const w = x1 - x0 + 1;
+    int const nout = w - 2;
+    if (nout <= 0 || y1 - y0 < 2)
+        return;
+
+    std::vector<unsigned int> vbuf(w + 8);
+    std::vector<unsigned int> hbuf(nout + 8);
+    unsigned int *V = &vbuf[0];
+    unsigned int *H = &hbuf[0];
+
+    __m128i top[3];
+    top[0] = top[1] = top[2] = _mm_setzero_si128();
+
+    for (int y = y0 + 1; y <= y1 - 1; y++)
+    {
+        const unsigned short *r0 = imgdata + (y - 1) * rowsize + x0;
+        const unsigned short *r1 = r0 + rowsize;
+        const unsigned short *r2 = r1 + rowsize;
+
+        int c = 0;
+        for (; c + 8 <= w; c += 8)
+        {
+            __m256i a = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(r0 + c)));
+            __m256i b = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(r1 + c)));
+            __m256i d = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(r2 + c)));
+            __m256i v = _mm256_add_epi32(_mm256_add_epi32(a, d), _mm256_slli_epi32(b, 1));
+            _mm256_storeu_si256((__m256i *)(V + c), v);
+        }
+        for (; c < w; c++)
+            V[c] = r0[c] + 2U * r1[c] + r2[c];
+
+        __m256i vmax = _mm256_setzero_si256();
+        int i = 0;
+        for (; i + 8 <= nout; i += 8)
+        {
+            __m256i l = _mm256_loadu_si256((const __m256i *)(V + i));
+            __m256i m = _mm256_loadu_si256((const __m256i *)(V + i + 1));
+            __m256i r = _mm256_loadu_si256((const __m256i *)(V + i + 2));
+            __m256i h = _mm256_add_epi32(_mm256_add_epi32(l, r), _mm256_slli_epi32(m, 1));
+            _mm256_storeu_si256((__m256i *)(H + i), h);
+            vmax = _mm256_max_epu32(vmax, h);
+        }
+        unsigned int a8[8];
+        _mm256_storeu_si256((__m256i *) a8, vmax);
+        unsigned int rowmax = *std::max_element(a8, a8 + 8);
+        for (; i < nout; i++)
+        {
+            H[i] = V[i] + 2 * V[i + 1] + V[i + 2];
+            rowmax = std::max(rowmax, H[i]);
+        }
+
+        UpdatePeakFromRow(H, nout, rowmax, x0 + 1, y, res);
+
+        const unsigned short *mid = r1 + 1;
+        i = 0;
+        for (; i + 8 <= nout; i += 8)
+        {
+            __m128i p = _mm_loadu_si128((const __m128i *)(mid + i));
+            __m128i t = _mm_max_epu16(top[0], p);
+            p = _mm_min_epu16(top[0], p);
+            top[0] = t;
+            t = _mm_max_epu16(top[1], p);
+            p = _mm_min_epu16(top[1], p);
+            top[1] = t;
+            top[2] = _mm_max_epu16(top[2], p);
+        }
+        for (; i < nout; i++)
+            Insert3(res->max3, mid[i]);
+    }
+
+    MergeTop3(res, top, false);
+}
+
+static bool CpuHasAVX2()
+{
+# if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx)
+        return false;
+    if ((_xgetbv(0) & 6) != 6) // OS saves xmm and ymm state
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+# else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+# endif
+}
+
+#endif // STAR_KERNEL_AVX2
+
+//
+// NEON implementation
+//
+
+#ifdef STAR_KERNEL_NEON
+
+static void SmoothedPeakNEON(const unsigned short *imgdata, int rowsize, int x0, int y0, int x1, int y1, PeakResult *res)
+{
+    InitPeak(res);
+
+    int const w = x1 - x0 + 1;
+    int const nout = w - 2;
+    if (nout <= 0 || y1 - y0 < 2)
+        return;
+
+    std::vector<unsigned int> vbuf(w + 4);
+    std::vector<unsigned int> hbuf(nout + 4);
+    unsigned int *V = &vbuf[0];
+    unsigned int *H = &hbuf[0];
+
+    uint16x8_t top[3];
+    top[0] = top[1] = top[2] = vdupq_n_u16(0);
+
+    for (int y = y0 + 1; y <= y1 - 1; y++)
+    {
+        const unsigned short *r0 = imgdata + (y - 1) * rowsize + x0;
+        const unsigned short *r1 = r0 + rowsize;
+        const unsigned short *r2 = r1 + rowsize;
+
+        int c = 0;
+        for (; c + 4 <= w; c += 4)
+        {
+            uint16x4_t a = vld1_u16(r0 + c);
+            uint16x4_t b = vld1_u16(r1 + c);
+            uint16x4_t d = vld1_u16(r2 + c);
+            uint32x4_t v = vaddq_u32(vaddl_u16(a, d), vshll_n_u16(b, 1));
+            vst1q_u32(V + c, v);
+        }
+        for (; c < w; c++)
+            V[c] = r0[c] + 2U * r1[c] + r2[c];
+
+        uint32x4_t vmax = vdupq_n_u32(0);
+        int i = 0;
+        for (; i + 4 <= nout; i += 4)
+        {
+            uint32x4_t l = vld1q_u32(V + i);
+            uint32x4_t m = vld1q_u32(V + i + 1);
+            uint32x4_t r = vld1q_u32(V + i + 2);
+            uint32x4_t h = vaddq_u32(vaddq_u32(l, r), vshlq_n_u32(m, 1));
+            vst1q_u32(H + i, h);
+            vmax = vmaxq_u32(vmax, h);
+        }
+        unsigned int a4[4];
+        vst1q_u32(a4, vmax);
+        unsigned int rowmax = std::max(std::max(a4[0], a4[1]), std::max(a4[2], a4[3]));
+        for (; i < nout; i++)
+        {
+            H[i] = V[i] + 2 * V[i + 1] + V[i + 2];
+            rowmax = std::max(rowmax, H[i]);
+        }
+
+        UpdatePeakFromRow(H, nout, rowmax, x0 + 1, y, res);
+
+        const unsigned short *mid = r1 + 1;
+        i = 0;
+        for (; i + 8 <= nout; i += 8)
+        {
+            uint16x8_t p = vld1q_u16(mid + i);
+            uint16x8_t t = vmaxq_u16(top[0], p);
+            p = vminq_u16(top[0], p);
+            top[0] = t;
+            t = vmaxq_u16(top[1], p);
+            p = vminq_u16(top[1], p);
+            top[1] = t;
+            top[2] = vmaxq_u16(top[2], p);
+        }
+        for (; i < nout; i++)
+            Insert3(res->max3, mid[i]);
+    }
+
+    unsigned short a[3][8];
+    for (int k = 0; k < 3; k++)
+        vst1q_u16(a[k], top[k]);
+    for (int k = 0; k < 3; k++)
+        for (int i = 0; i < 8; i++)
+            Insert3(res->max3, a[k][i]);
+}
+
+static void SpanNEON(const unsigned short *p, int len, unsigned short lo, unsigned short hi, SpanSums *acc)
+{
+    static const unsigned short s_idx[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
+    uint16x8_t const vlo = vdupq_n_u16(lo);
+    uint16x8_t const vhi = vdupq_n_u16(hi);
+    uint16x8_t const step = vdupq_n_u16(8);
+
+    int i = 0;
+
+    // blocks of at most 256 pixels keep the 16-bit index and the 32-bit lane sums from overflowing
+    while (i + 8 <= len)
+    {
+        int const base = i;
+        int const blockend = base + ((std::min(len, base + 256) - base) & ~7);
+
+        uint16x8_t idx = vld1q_u16(s_idx);
+        uint16x8_t cnt = vdupq_n_u16(0);
+        uint32x4_t s = vdupq_n_u32(0), si = vdupq_n_u32(0), siv = vdupq_n_u32(0);
+        uint64x2_t s2 = vdupq_n_u64(0);
+
+        for (; i < blockend; i += 8)
+        {
+            uint16x8_t v = vld1q_u16(p + i);
+            uint16x8_t mask = vandq_u16(vcgeq_u16(v, vlo), vcleq_u16(v, vhi));
+            uint16x8_t vm = vandq_u16(v, mask);
+
+            cnt = vsubq_u16(cnt, mask);
+            s = vpadalq_u16(s, vm);
+
+            s2 = vpadalq_u32(s2, vmull_u16(vget_low_u16(vm), vget_low_u16(vm)));
+            s2 = vpadalq_u32(s2, vmull_u16(vget_high_u16(vm), vget_high_u16(vm)));
+
+            si = vpadalq_u16(si, vandq_u16(idx, mask));
+
+            siv = vmlal_u16(siv, vget_low_u16(idx), vget_low_u16(vm));
+            siv = vmlal_u16(siv, vget_high_u16(idx), vget_high_u16(vm));
+
+            idx = vaddq_u16(idx, step);
+        }
+
+        unsigned short c16[8];
+        unsigned int s32[4], si32[4], siv32[4];
+        uint64_t s64[2];
+        vst1q_u16(c16, cnt);
+        vst1q_u32(s32, s);
+        vst1q_u32(si32, si);
+        vst1q_u32(siv32, siv);
+        vst1q_u64(s64, s2);
+
+        unsigned int bn = 0;
+        for (int k = 0; k < 8; k++)
+            bn += c16[k];
+        unsigned long long bs = 0, bsi = 0, bsiv = 0;
+        for (int k = 0; k < 4; k++)
+        {
+            bs += s32[k];
+            bsi += si32[k];
+            bsiv += siv32[k];
+        }
+
+        acc->n += bn;
+        acc->s += bs;
+        acc->s2 += s64[0] + s64[1];
+        acc->si += bsi + (unsigned long long) base * bn;
+        acc->siv += bsiv + (unsigned long long) base * bs;
+    }
+
+    SpanTail(p, i, len, lo, hi, acc);
+}
+
+#endif // STAR_KERNEL_NEON
+
+//
+// dispatch
+//
+
+static Impl BestImpl()
+{
+#if defined(STAR_KERNEL_AVX2)
+    if (CpuHasAVX2())
+        return IMPL_AVX2;
+#endif
+#if defined(STAR_KERNEL_SSE2)
+    return IMPL_SSE2;
+#elif defined(STAR_KERNEL_NEON)
+    return IMPL_NEON;
+#else
+    return IMPL_SCALAR;
+#endif
+}
+
+static Impl s_impl = BestImpl();
+static SmoothedPeakFn s_smoothedPeak;
+static SpanFn s_span;
+
+static void SelectImpl(Impl impl)
+{
+    switch (impl)
+    {
+#ifdef STAR_KERNEL_AVX2
+    case IMPL_AVX2:
+        s_smoothedPeak = SmoothedPeakAVX2;
+        s_span = SpanSSE2;
+        break;
+#endif
+#ifdef STAR_KERNEL_SSE2
+    case IMPL_SSE2:
+        s_smoothedPeak = SmoothedPeakSSE2;
+        s_span = SpanSSE2;
+        break;
+#endif
+#ifdef STAR_KERNEL_NEON
+    case IMPL_NEON:
+        s_smoothedPeak = SmoothedPeakNEON;
+        s_span = SpanNEON;
+        break;
+#endif
+    default:
+        impl = IMPL_SCALAR;
+        s_smoothedPeak = SmoothedPeakScalar;
+        s_span = SpanScalar;
+        break;
+    }
+    s_impl = impl;
+}
+
+static struct ImplInit { ImplInit() { SelectImpl(s_impl); } } s_implInit;
+
+bool IsSupported(Impl impl)
+{
+    switch (impl)
+    {
+    case IMPL_SCALAR:
+        return true;
+#ifdef STAR_KERNEL_SSE2
+    case IMPL_SSE2:
+        return true;
+#endif
+#ifdef STAR_KERNEL_AVX2
+    case IMPL_AVX2:
+        return CpuHasAVX2();
+#endif
+#ifdef STAR_KERNEL_NEON
+    case IMPL_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+Impl GetImpl()
+{
+    return s_impl;
+}
+
+bool SetImpl(Impl impl)
+{
+    if (!IsSupported(impl))
+        return false;
+    SelectImpl(impl);
+    return true;
+}
+
+const char *ImplName(Impl impl)
+{
+    switch (impl)
+    {
+    case IMPL_SSE2: return "SSE2";
+    case IMPL_AVX2: return "AVX2";
+    case IMPL_NEON: return "NEON";
+    default:        return "scalar";
+    }
+}
+
+void SmoothedPeak(const unsigned short *img, int rowsize, int x0, int y0, int x1, int y1, PeakResult *res)
+{
+    s_smoothedPeak(img, rowsize, x0, y0, x1, y1, res);
+}
+
+// largest k >= 0 with k * k <= v, or -1 if v < 0
+static int ISqrt(int v)
+{
+    if (v < 0)
+        return -1;
+    int k = (int) sqrt((double) v);
+    while (k * k > v)
+        --k;
+    while ((k + 1) * (k + 1) <= v)
+        ++k;
+    return k;
+}
+
+static void InitMoments(Moments *m)
+{
+    m->n = 0;
+    m->sum = m->sum2 = 0;
+    m->sumdx = m->sumdy = m->sumdxv = m->sumdyv = 0;
+}
+
+// a clipped run of pixels within one row
+struct Run
+{
+    const unsigned short *p;
+    int len;
+    int dx0;    // dx of the first pixel
+    int dy;
+};
+
+static void AddRun(std::vector<Run> *runs, const unsigned short *row, int x0, int x1, int cx, int dy, const Bounds& b)
+{
+    x0 = std::max(x0, b.minx);
+    x1 = std::min(x1, b.maxx);
+    if (x1 < x0)
+        return;
+
+    Run r;
+    r.p = row + x0;
+    r.len = x1 - x0 + 1;
+    r.dx0 = x0 - cx;
+    r.dy = dy;
+    runs->push_back(r);
+}
+
+static void AnnulusRuns(std::vector<Run> *runs, const unsigned short *img, int rowsize, int cx, int cy,
+                        int r_inner2, int r_outer2, const Bounds& b)
+{
+    int const ro = ISqrt(r_outer2);
+    int const y0 = std::max(cy - ro, b.miny);
+    int const y1 = std::min(cy + ro, b.maxy);
+
+    for (int y = y0; y <= y1; y++)
+    {
+        int const dy = y - cy;
+        int const dy2 = dy * dy;
+        int const xo = ISqrt(r_outer2 - dy2);   // |dx| <= xo is inside the outer radius
+        if (xo < 0)
+            continue;
+        int const xi = ISqrt(r_inner2 - dy2);   // |dx| <= xi is inside the inner radius
+        const unsigned short *row = img + y * rowsize;
+
+        if (xi < 0)
+            AddRun(runs, row, cx - xo, cx + xo, cx, dy, b);
+        else
+        {
+            AddRun(runs, row, cx - xo, cx - xi - 1, cx, dy, b);
+            AddRun(runs, row, cx + xi + 1, cx + xo, cx, dy, b);
+        }
+    }
+}
+
+// accumulate the pixels of the runs with values in [lo, hi]
+static void SumRuns(const std::vector<Run>& runs, unsigned short lo, unsigned short hi, Moments *m)
+{
+    InitMoments(m);
+
+    for (auto it = runs.begin(); it != runs.end(); ++it)
+    {
+        SpanSums acc;
+        s_span(it->p, it->len, lo, hi, &acc);
+
+        long long const off = it->dx0;
+
+        m->n += acc.n;
+        m->sum += acc.s;
+        m->sum2 += acc.s2;
+        m->sumdx += off * (long long) acc.n + (long long) acc.si;
+        m->sumdy += (long long) it->dy * (long long) acc.n;
+        m->sumdxv += off * (long long) acc.s + (long long) acc.siv;
+        m->sumdyv += (long long) it->dy * (long long) acc.s;
+    }
+}
+
+void AnnulusMoments(const unsigned short *img, int rowsize, int cx, int cy, int r_inner2, int r_outer2,
+                    const Bounds& b, unsigned short lo, unsigned short hi, Moments *m)
+{
+    std::vector<Run> runs;
+    AnnulusRuns(&runs, img, rowsize, cx, cy, r_inner2, r_outer2, b);
+    SumRuns(runs, lo, hi, m);
+}
+
+void AnnulusBackground(const unsigned short *img, int rowsize, int cx, int cy, int r_inner2, int r_outer2,
+                       const Bounds& b, Background *bg)
+{
+    bg->mean = bg->sigma2 = bg->sigma = 0.0;
+    bg->n = 0;
+    bg->ok = true;
+
+    std::vector<Run> runs;
+    AnnulusRuns(&runs, img, rowsize, cx, cy, r_inner2, r_outer2, b);
+
+    unsigned short lo = 0, hi = 65535;
+
+    for (int iter = 0; iter < 9; iter++)
+    {
+        Moments m;
+        SumRuns(runs, lo, hi, &m);
+
+        if (m.n < 10)
+        {
+            bg->n = m.n;
+            bg->ok = false;
+            break;
+        }
+
+        // the variance is computed from exact integer sums so the result does
+        // not depend on the order in which the pixels were visited
+        unsigned long long const var = (unsigned long long) m.n * m.sum2 - m.sum * m.sum;
+
+        double const prev_mean = bg->mean;
+        bg->n = m.n;
+        bg->mean = (double) m.sum / (double) m.n;
+        bg->sigma2 = (double) var / ((double) m.n * (double) (m.n - 1));
+        bg->sigma = sqrt(bg->sigma2);
+
+        if (iter > 0 && fabs(bg->mean - prev_mean) < 0.5)
+            break;
+
+        // integer window equivalent to mean - 2 sigma <= val <= mean + 2 sigma
+        double const l = ceil(bg->mean - 2.0 * bg->sigma);
+        double const h = floor(bg->mean + 2.0 * bg->sigma);
+        if (h < l || h < 0.0 || l > 65535.0)
+        {
+            bg->ok = false;
+            bg->n = 0;
+            break;
+        }
+        lo = (unsigned short) std::max(l, 0.0);
+        hi = (unsigned short) std::min(h, 65535.0);
+    }
+}
+
+void ApertureMoments(const unsigned short *img, int rowsize, int cx, int cy, int r2,
+                     const Bounds& b, unsigned short thresh, Moments *m)
+{
+    std::vector<Run> runs;
+
+    int const r = ISqrt(r2);
+    int const y0 = std::max(cy - r, b.miny);
+    int const y1 = std::min(cy + r, b.maxy);
+
+    for (int y = y0; y <= y1; y++)
+    {
+        int const dy = y - cy;
+        int const xr = ISqrt(r2 - dy * dy);
+        if (xr < 0)
+            continue;
+        AddRun(&runs, img + y * rowsize, cx - xr, cx + xr, cx, dy, b);
+    }
+
+    SumRuns(runs, thresh, 65535, m);
+}
+
+} // namespace StarKernel
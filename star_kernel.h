@@ -0,0 +1,114 @@
+/*
+ *  star_kernel.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef STAR_KERNEL_H_INCLUDED
+#define STAR_KERNEL_H_INCLUDED
+
+//
+// Pixel kernels used by Star::Find.
+//
+// The kernels only do integer arithmetic, so every implementation (scalar,
+// SSE2, AVX2, NEON) produces bit-identical results. The implementation is
+// selected at startup from the capabilities of the CPU. This file does not
+// depend on wxWidgets so that it can be built into the benchmark tool.
+//
+namespace StarKernel
+{
+    enum Impl
+    {
+        IMPL_SCALAR,
+        IMPL_SSE2,
+        IMPL_AVX2,
+        IMPL_NEON,
+    };
+
+    struct PeakResult
+    {
+        int x;                      // location of the smoothed peak
+        int y;
+        unsigned int val;           // smoothed peak value (x16 scale)
+        unsigned short max3[3];     // the three largest raw pixel values, descending
+    };
+
+    // sums over the pixels accepted by a pixel-value window, relative to a center (cx, cy)
+    struct Moments
+    {
+        unsigned int n;             // number of accepted pixels
+        unsigned long long sum;     // sum of val
+        unsigned long long sum2;    // sum of val^2
+        long long sumdx;            // sum of dx
+        long long sumdy;            // sum of dy
+        long long sumdxv;           // sum of dx * val
+        long long sumdyv;           // sum of dy * val
+    };
+
+    struct Background
+    {
+        double mean;
+        double sigma2;
+        double sigma;
+        unsigned int n;             // number of background pixels
+        bool ok;                    // false if too few pixels remained after clipping
+    };
+
+    struct Bounds
+    {
+        int minx, miny, maxx, maxy; // inclusive
+    };
+
+    bool IsSupported(Impl impl);
+    Impl GetImpl();
+    // select an implementation; returns false if the CPU does not support it
+    bool SetImpl(Impl impl);
+    const char *ImplName(Impl impl);
+
+    // 3x3 (1 2 1) smoothed peak over the interior of the inclusive rectangle
+    // [x0,x1]x[y0,y1]; also tracks the three largest raw interior pixel values.
+    // The first occurrence in row-major order wins ties.
+    void SmoothedPeak(const unsigned short *img, int rowsize, int x0, int y0, int x1, int y1, PeakResult *res);
+
+    // moments of the pixels with lo <= val <= hi in the annulus r_inner2 < r^2 <= r_outer2
+    // around (cx, cy), clipped to bounds
+    void AnnulusMoments(const unsigned short *img, int rowsize, int cx, int cy, int r_inner2, int r_outer2,
+                        const Bounds& bounds, unsigned short lo, unsigned short hi, Moments *m);
+
+    // iteratively 2-sigma clipped background in the annulus r_inner2 < r^2 <= r_outer2
+    void AnnulusBackground(const unsigned short *img, int rowsize, int cx, int cy, int r_inner2, int r_outer2,
+                           const Bounds& bounds, Background *bg);
+
+    // moments of the pixels with val >= thresh in the disk r^2 <= r2 around (cx, cy), clipped to bounds
+    void ApertureMoments(const unsigned short *img, int rowsize, int cx, int cy, int r2,
+                         const Bounds& bounds, unsigned short thresh, Moments *m);
+}
+
+#endif // STAR_KERNEL_H_INCLUDED
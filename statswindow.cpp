@@ -313,8 +313,9 @@ void StatsWindow::UpdateScopePointing()
 {
     if (pPointingSource)
     {
-        double declination = pPointingSource->GetDeclination();
-        PierSide pierSide = pPointingSource->SideOfPier();
+        PointingState state = PointingCache::Get();
+        double declination = state.declination;
+        PierSide pierSide = state.pierSide;
 
         m_grid2->BeginBatch();
         int row = 4, col = 1;
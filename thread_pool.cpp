@@ -0,0 +1,219 @@
+/*
+ *  thread_pool.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "phd.h"
+
+#include <algorithm>
+
+ThreadPool *ThreadPool::s_pool;
+static wxCriticalSection s_poolLock;
+
+class ThreadPool::Worker : public wxThread
+{
+    ThreadPool *m_pool;
+
+public:
+    Worker(ThreadPool *pool)
+        : wxThread(wxTHREAD_JOINABLE),
+          m_pool(pool)
+    {
+    }
+
+    ExitCode Entry() override
+    {
+        m_pool->WorkerLoop();
+        return 0;
+    }
+};
+
+ThreadPool *ThreadPool::Get()
+{
+    wxCriticalSectionLocker lck(s_poolLock);
+
+    if (!s_pool)
+    {
+        enum { MAX_WORKERS = 7 };
+        int ncpu = wxThread::GetCPUCount();
+        unsigned int nworkers = ncpu > 1 ? std::min(ncpu - 1, (int) MAX_WORKERS) : 0;
+        s_pool = new ThreadPool(nworkers);
+    }
+    return s_pool;
+}
+
+void ThreadPool::Destroy()
+{
+    wxCriticalSectionLocker lck(s_poolLock);
+
+    delete s_pool;
+    s_pool = nullptr;
+}
+
+ThreadPool::ThreadPool(unsigned int nworkers)
+    : m_wake(m_lock),
+      m_done(m_lock),
+      m_task(nullptr),
+      m_count(0),
+      m_generation(0),
+      m_busy(0),
+      m_shutdown(false),
+      m_next(0)
+{
+    for (unsigned int i = 0; i < nworkers; i++)
+    {
+        Worker *worker = new Worker(this);
+        if (worker->Run() != wxTHREAD_NO_ERROR)
+        {
+            Debug.Write("ThreadPool: could not start worker thread\n");
+            delete worker;
+            break;
+        }
+        m_workers.push_back(worker);
+    }
+
+    Debug.Write(wxString::Format("ThreadPool: started %u worker threads\n", (unsigned int) m_workers.size()));
+}
+
+ThreadPool::~ThreadPool()
+{
+    m_lock.Lock();
+    m_shutdown = true;
+    m_wake.Broadcast();
+    m_lock.Unlock();
+
+    for (auto it = m_workers.begin(); it != m_workers.end(); ++it)
+    {
+        (*it)->Wait();
+        delete *it;
+    }
+}
+
+unsigned int ThreadPool::Concurrency() const
+{
+    return m_workers.size() + 1;
+}
+
+void ThreadPool::RunTasks(const Task *task, unsigned int count)
+{
+    while (true)
+    {
+        unsigned int i = m_next.fetch_add(1);
+        if (i >= count)
+            break;
+        (*task)(i);
+    }
+}
+
+void ThreadPool::WorkerLoop()
+{
+    unsigned int seen = 0;
+
+    m_lock.Lock();
+
+    while (true)
+    {
+        while (!m_shutdown && m_generation == seen)
+            m_wake.Wait();
+
+        if (m_shutdown)
+            break;
+
+        seen = m_generation;
+        const Task *task = m_task;
+        unsigned int count = m_count;
+        ++m_busy;
+
+        m_lock.Unlock();
+        RunTasks(task, count);
+        m_lock.Lock();
+
+        if (--m_busy == 0)
+            m_done.Broadcast();
+    }
+
+    m_lock.Unlock();
+}
+
+void ThreadPool::ParallelFor(unsigned int count, const Task& task)
+{
+    if (count == 0)
+        return;
+
+    if (count == 1 || m_workers.empty() || m_jobLock.TryLock() != wxMUTEX_NO_ERROR)
+    {
+        for (unsigned int i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    m_lock.Lock();
+    // a worker that woke late for the previous job may still be finishing up
+    while (m_busy > 0)
+        m_done.Wait();
+    m_task = &task;
+    m_count = count;
+    m_next = 0;
+    ++m_generation;
+    m_wake.Broadcast();
+    m_lock.Unlock();
+
+    RunTasks(&task, count);
+
+    // all task indexes have been claimed; wait for the workers to finish theirs
+    m_lock.Lock();
+    while (m_busy > 0)
+        m_done.Wait();
+    m_task = nullptr;
+    m_lock.Unlock();
+
+    m_jobLock.Unlock();
+}
+
+void ThreadPool::ParallelRange(int count, int minRange, const RangeTask& task)
+{
+    if (count <= 0)
+        return;
+
+    // a few ranges per thread so that uneven ranges balance out
+    int nranges = std::min((int) Concurrency() * 4, count / std::max(minRange, 1));
+    if (nranges <= 1)
+    {
+        task(0, count);
+        return;
+    }
+
+    ParallelFor(nranges, [&](unsigned int i) {
+        int begin = (int)((long long) count * i / nranges);
+        int end = (int)((long long) count * (i + 1) / nranges);
+        task(begin, end);
+    });
+}
@@ -0,0 +1,93 @@
+/*
+ *  thread_pool.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+
+#include <atomic>
+
+//
+// A small pool of worker threads for splitting CPU-bound work on the current
+// frame (star measurements, image filters) across cores.
+//
+// ParallelFor runs task(i) for each i in [0, count) and returns when all of
+// them have completed. The calling thread takes part in the work. If the pool
+// is already busy (for example ParallelFor was called from inside a task) the
+// tasks are run serially on the calling thread.
+//
+class ThreadPool
+{
+public:
+    typedef std::function<void(unsigned int)> Task;
+    typedef std::function<void(int begin, int end)> RangeTask;
+
+    // the shared pool, created on first use
+    static ThreadPool *Get();
+    // stop the worker threads; called at application exit
+    static void Destroy();
+
+    // number of threads that can run tasks, including the calling thread
+    unsigned int Concurrency() const;
+
+    void ParallelFor(unsigned int count, const Task& task);
+
+    // split [0, count) into contiguous ranges of at least minRange items (image
+    // rows, typically) and run task(begin, end) on each
+    void ParallelRange(int count, int minRange, const RangeTask& task);
+
+private:
+    class Worker;
+
+    ThreadPool(unsigned int nworkers);
+    ~ThreadPool();
+
+    void WorkerLoop();
+    void RunTasks(const Task *task, unsigned int count);
+
+    std::vector<Worker *> m_workers;
+
+    wxMutex m_jobLock;          // held by the thread running ParallelFor
+    wxMutex m_lock;             // protects the fields below
+    wxCondition m_wake;
+    wxCondition m_done;
+    const Task *m_task;
+    unsigned int m_count;
+    unsigned int m_generation;  // incremented for each job
+    unsigned int m_busy;        // number of workers running tasks
+    bool m_shutdown;
+    std::atomic<unsigned int> m_next; // next task index to run
+
+    static ThreadPool *s_pool;
+};
+
+#endif // THREAD_POOL_H_INCLUDED
@@ -0,0 +1,322 @@
+/*
+ *  guidelog_binary_test.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2020 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of openphdguiding.org nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+
+//
+// Round-trip test for the binary guide log: random guide steps and dropped
+// frames are written both as the text guide log prints them and as binary
+// records, and the converted binary log must match the text byte for byte.
+//
+
+#include "guidelog_binary.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+using namespace GuideLogBinary;
+
+namespace
+{
+
+struct Logs
+{
+    std::string text;
+    std::string binary;
+    bool latencyColumns;
+
+    Logs(bool latency) : binary(FileHeaderBytes("GuideLogBinaryTest")), latencyColumns(latency) { }
+
+    void printf(const char *fmt, ...)
+    {
+        char buf[512];
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        text += buf;
+    }
+
+    template<typename T>
+    void append(const T& rec) { binary.append(reinterpret_cast<const char *>(&rec), sizeof(rec)); }
+
+    // the same as GuidingLog::WriteText
+    void Text(const std::string& str)
+    {
+        text += str;
+        TextRecord rec = { REC_TEXT };
+        rec.bytes = (uint32_t) str.size();
+        append(rec);
+        binary += str;
+    }
+
+    void Latency(const int32_t *usec)
+    {
+        LatencyRecord rec = { REC_LATENCY };
+        for (int i = 0; i < LATENCY_STAGES; i++)
+        {
+            if (i != 0)
+                text += ",";
+            if (usec[i] >= 0)
+                printf("%.1f", usec[i] / 1000.0);
+            rec.usec[i] = usec[i];
+        }
+        append(rec);
+    }
+
+    static StepRecord NewRecord(RecordType type, int frame, double time, double mass, double snr, int err, bool latency)
+    {
+        StepRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.type = type;
+        rec.flags = latency ? STEP_LATENCY : 0;
+        rec.frame = frame;
+        SetFixed(&rec, F_TIME, &rec.timeMs, time, 3);
+        SetFixed(&rec, F_MASS, &rec.starMass, mass, 0);
+        SetFixed(&rec, F_SNR, &rec.snr, snr, 2);
+        rec.errorCode = err;
+        return rec;
+    }
+
+    // the same columns as GuidingLog::GuideStep
+    void Step(int frame, double time, bool ao, const double *ofs, int raDur, char raDir, int decDur, char decDir,
+              double mass, double snr, int err, const int32_t *usec)
+    {
+        printf("%d,%.3f,\"%s\",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,", frame, time, ao ? "AO" : "Mount",
+               ofs[0], ofs[1], ofs[2], ofs[3], ofs[4], ofs[5]);
+        if (ao)
+            printf(",,,,%d,%d,", raDur, decDur);
+        else
+        {
+            char ra[2] = { raDur > 0 ? raDir : '\0', 0 };
+            char dec[2] = { decDur > 0 ? decDir : '\0', 0 };
+            printf("%d,%s,%d,%s,,,", raDur, ra, decDur, dec);
+        }
+        printf("%.f,%.2f,%d", mass, snr, err);
+
+        StepRecord rec = NewRecord(REC_STEP, frame, time, mass, snr, err, latencyColumns);
+        SetFixed(&rec, F_DX, &rec.dx, ofs[0], 3);
+        SetFixed(&rec, F_DY, &rec.dy, ofs[1], 3);
+        SetFixed(&rec, F_RA_RAW, &rec.raRaw, ofs[2], 3);
+        SetFixed(&rec, F_DEC_RAW, &rec.decRaw, ofs[3], 3);
+        SetFixed(&rec, F_RA_GUIDE, &rec.raGuide, ofs[4], 3);
+        SetFixed(&rec, F_DEC_GUIDE, &rec.decGuide, ofs[5], 3);
+        rec.raDuration = raDur;
+        rec.decDuration = decDur;
+        if (ao)
+            rec.flags |= STEP_AO;
+        else
+        {
+            if (raDur > 0)
+                rec.raDir = raDir;
+            if (decDur > 0)
+                rec.decDir = decDir;
+        }
+        append(rec);
+
+        if (latencyColumns)
+        {
+            text += ",,";
+            Latency(usec);
+        }
+        text += "\n";
+    }
+
+    // the same columns as GuidingLog::FrameDropped
+    void Drop(int frame, double time, double mass, double snr, int err, const std::string& status, const int32_t *usec)
+    {
+        printf("%d,%.3f,\"DROP\",,,,,,,,,,,,,%.f,%.2f,%d,\"%s\"", frame, time, mass, snr, err, status.c_str());
+
+        StepRecord rec = NewRecord(REC_DROP, frame, time, mass, snr, err, latencyColumns);
+        rec.statusBytes = (uint32_t) status.size();
+        append(rec);
+        binary += status;
+
+        if (latencyColumns)
+        {
+            text += ",";
+            Latency(usec);
+        }
+        text += "\n";
+    }
+
+    std::string Convert(std::string *error) const
+    {
+        FILE *in = tmpfile();
+        FILE *out = tmpfile();
+        fwrite(binary.data(), 1, binary.size(), in);
+        rewind(in);
+
+        std::string result;
+        if (!ConvertToText(in, out, error))
+        {
+            rewind(out);
+            char buf[4096];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), out)) > 0)
+                result.append(buf, n);
+        }
+
+        fclose(in);
+        fclose(out);
+        return result;
+    }
+};
+
+static void CheckRoundTrip(const Logs& logs)
+{
+    std::string error;
+    std::string text = logs.Convert(&error);
+    ASSERT_EQ(error, "");
+    ASSERT_EQ(text.size(), logs.text.size());
+    EXPECT_TRUE(text == logs.text);
+}
+
+static void RandomLog(Logs *logs, unsigned int seed, int count)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> ofs(-5.0, 5.0);
+    std::uniform_int_distribution<int> ties(-5000, 5000);
+    std::uniform_int_distribution<int> dur(0, 2000);
+    std::uniform_int_distribution<int> pct(0, 99);
+    std::uniform_int_distribution<int> usec(-1, 3000000);
+    const char dirs[] = "NSEW";
+
+    logs->Text("Guiding Begins at 2020-01-01 00:00:00\n");
+
+    double time = 0.0;
+    for (int frame = 1; frame <= count; frame++)
+    {
+        time += 0.5 + pct(rng) / 100.0;
+
+        double o[6];
+        for (int i = 0; i < 6; i++)
+        {
+            // a quarter of the values are ties at the printed precision,
+            // which printf and rounding away from zero disagree on
+            o[i] = pct(rng) < 25 ? ties(rng) / 1000.0 + 0.0005 : ofs(rng);
+        }
+        double mass = pct(rng) < 25 ? ties(rng) + 0.5 : ofs(rng) * 100000.0;
+        double snr = pct(rng) < 25 ? ties(rng) / 100.0 + 0.005 : 5.0 + ofs(rng) * 10.0;
+
+        int32_t lat[LATENCY_STAGES];
+        for (int i = 0; i < LATENCY_STAGES; i++)
+            lat[i] = usec(rng);
+
+        if (pct(rng) < 5)
+            logs->Drop(frame, time, mass, snr, pct(rng), "Star lost - low SNR", lat);
+        else
+        {
+            bool ao = pct(rng) < 20;
+            int raDur = dur(rng) - (ao ? 1000 : 500);
+            int decDur = dur(rng) - (ao ? 1000 : 500);
+            if (!ao)
+            {
+                raDur = raDur < 0 ? 0 : raDur;
+                decDur = decDur < 0 ? 0 : decDur;
+            }
+            logs->Step(frame, time, ao, o, raDur, dirs[pct(rng) % 2 + 2], decDur, dirs[pct(rng) % 2], mass, snr, 0, lat);
+        }
+
+        if (pct(rng) == 0)
+            logs->Text("INFO: DITHER by 1.234, -0.567, new lock pos = 100.000, 200.000\n");
+    }
+
+    logs->Text("Guiding Ends at 2020-01-01 01:00:00\n");
+}
+
+} // namespace
+
+TEST(GuideLogBinaryTest, set_fixed_matches_printf)
+{
+    struct { double val; int decimals; int32_t fixed; bool negZero; } const cases[] = {
+        { 1.0005, 3, 1000, false },
+        { 2.5, 0, 2, false },
+        { -2.5, 0, -2, false },
+        { 3.5, 0, 4, false },
+        { 0.125, 2, 12, false },
+        { -0.0004, 3, 0, true },
+        { -0.0, 3, 0, true },
+        { 0.0, 3, 0, false },
+        { 123456.789, 3, 123456789, false },
+        { -123456.789, 3, -123456789, false },
+        { 1e300, 3, 2147483647, false },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        StepRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        int32_t v;
+        SetFixed(&rec, F_DX, &v, cases[i].val, cases[i].decimals);
+        EXPECT_EQ(v, cases[i].fixed) << "value " << cases[i].val;
+        EXPECT_EQ((rec.negZero & (1 << F_DX)) != 0, cases[i].negZero) << "value " << cases[i].val;
+    }
+}
+
+TEST(GuideLogBinaryTest, round_trip)
+{
+    Logs logs(false);
+    RandomLog(&logs, 1, 100000);
+    CheckRoundTrip(logs);
+}
+
+TEST(GuideLogBinaryTest, round_trip_latency_columns)
+{
+    Logs logs(true);
+    RandomLog(&logs, 2, 100000);
+    CheckRoundTrip(logs);
+}
+
+TEST(GuideLogBinaryTest, truncated_file)
+{
+    Logs logs(false);
+    RandomLog(&logs, 3, 10);
+    logs.binary.resize(logs.binary.size() - 1);
+
+    std::string error;
+    logs.Convert(&error);
+    EXPECT_EQ(error, "truncated record at end of file");
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -35,6 +35,122 @@
 #include "phd.h"
 #include "image_math.h"
 
+enum
+{
+    BUFFER_ALIGN = 4096,    // page size
+    MAX_IDLE_BUFFERS = 4,
+};
+
+// the buffer size is kept in a header in the page before the pixels
+struct FrameBufferHeader
+{
+    size_t bytes;
+};
+
+static wxCriticalSection s_poolLock;    // protects the idle list and the counters
+static std::vector<unsigned short *> s_idle;
+static unsigned int s_hits;
+static unsigned int s_misses;
+
+inline static FrameBufferHeader *BufferHeader(unsigned short *buf)
+{
+    return reinterpret_cast<FrameBufferHeader *>(reinterpret_cast<char *>(buf) - BUFFER_ALIGN);
+}
+
+static unsigned short *AllocBuffer(size_t bytes)
+{
+    void *p;
+#ifdef __WINDOWS__
+    p = _aligned_malloc(bytes + BUFFER_ALIGN, BUFFER_ALIGN);
+#else
+    if (posix_memalign(&p, BUFFER_ALIGN, bytes + BUFFER_ALIGN) != 0)
+        p = nullptr;
+#endif
+    if (!p)
+        return nullptr;
+
+    static_cast<FrameBufferHeader *>(p)->bytes = bytes;
+    return reinterpret_cast<unsigned short *>(static_cast<char *>(p) + BUFFER_ALIGN);
+}
+
+static void FreeBuffer(unsigned short *buf)
+{
+    void *p = BufferHeader(buf);
+#ifdef __WINDOWS__
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+unsigned short *FrameBufferPool::Acquire(unsigned int npixels)
+{
+    size_t const bytes = ((size_t) npixels * sizeof(unsigned short) + BUFFER_ALIGN - 1) & ~((size_t) BUFFER_ALIGN - 1);
+
+    {
+        wxCriticalSectionLocker lck(s_poolLock);
+
+        for (auto it = s_idle.begin(); it != s_idle.end(); ++it)
+        {
+            if (BufferHeader(*it)->bytes == bytes)
+            {
+                unsigned short *buf = *it;
+                s_idle.erase(it);
+                ++s_hits;
+                return buf;
+            }
+        }
+
+        ++s_misses;
+
+        // the frame size changed, the idle buffers are not likely to be used again
+        for (auto it = s_idle.begin(); it != s_idle.end(); ++it)
+            FreeBuffer(*it);
+        s_idle.clear();
+    }
+
+    return AllocBuffer(bytes);
+}
+
+void FrameBufferPool::Release(unsigned short *buf)
+{
+    if (!buf)
+        return;
+
+    wxCriticalSectionLocker lck(s_poolLock);
+
+    if (s_idle.size() >= MAX_IDLE_BUFFERS)
+    {
+        FreeBuffer(s_idle.front());
+        s_idle.erase(s_idle.begin());
+    }
+
+    s_idle.push_back(buf);
+}
+
+void FrameBufferPool::GetStats(Stats *stats)
+{
+    wxCriticalSectionLocker lck(s_poolLock);
+
+    stats->hits = s_hits;
+    stats->misses = s_misses;
+    stats->idle = s_idle.size();
+    stats->idleBytes = 0;
+    for (auto it = s_idle.begin(); it != s_idle.end(); ++it)
+        stats->idleBytes += BufferHeader(*it)->bytes;
+}
+
+void FrameBufferPool::Destroy()
+{
+    wxCriticalSectionLocker lck(s_poolLock);
+
+    Debug.Write(wxString::Format("FrameBufferPool: hits=%u misses=%u\n", s_hits, s_misses));
+
+    for (auto it = s_idle.begin(); it != s_idle.end(); ++it)
+        FreeBuffer(*it);
+    std::vector<unsigned short *>().swap(s_idle);
+}
+
 bool usImage::Init(const wxSize& size)
 {
     // Allocates space for image and sets params up
@@ -48,11 +164,11 @@ bool usImage::Init(const wxSize& size)
 
     if (NPixels != prev)
     {
-        delete[] ImageData;
+        FrameBufferPool::Release(ImageData);
 
         if (NPixels)
         {
-            ImageData = new unsigned short[NPixels];
+            ImageData = FrameBufferPool::Acquire(NPixels);
             if (!ImageData)
             {
                 NPixels = 0;
@@ -78,124 +194,155 @@ void usImage::CalcStats()
     if (!ImageData || !NPixels)
         return;
 
-    Min = 65535; Max = 0;
-    FiltMin = 65535; FiltMax = 0;
-
-    if (Subframe.IsEmpty())
-    {
-        // full frame, no subframe
-
-        const unsigned short *src;
+    // one pass over the frame (or subframe) for the raw and the median-filtered
+    // min/max, without allocating a buffer for the filtered image
+    wxRect rect = Subframe.IsEmpty() ? wxRect(Size) : Subframe;
+    Median3MinMax(ImageData, Size, rect, &Min, &Max, &FiltMin, &FiltMax);
+}
 
-        src = ImageData;
-        for (unsigned int i = 0; i < NPixels; i++)
-        {
-            int d = (int) *src++;
-            if (d < Min) Min = d;
-            if (d > Max) Max = d;
-        }
+// maps raw pixel values to display values for one black level, white level and gamma
+struct DisplayLut
+{
+    bool valid;
+    int blevel;
+    int wlevel;
+    double power;
+    unsigned char map[65536];
 
-        unsigned short *tmpdata = new unsigned short[NPixels];
+    DisplayLut() : valid(false) { }
 
-        Median3(tmpdata, ImageData, Size, wxRect(Size));
+    const unsigned char *Get(int blevel_, int wlevel_, double power_)
+    {
+        if (!valid || blevel_ != blevel || wlevel_ != wlevel || power_ != power)
+            Build(blevel_, wlevel_, power_);
+        return map;
+    }
 
-        src = tmpdata;
-        for (unsigned int i = 0; i < NPixels; i++)
+    void Build(int blevel_, int wlevel_, double power_)
+    {
+        blevel = blevel_;
+        wlevel = wlevel_;
+        power = power_;
+        valid = true;
+
+        // The levels follow the image, so the table is rebuilt for most
+        // frames. Only the values between the levels are computed, the rest
+        // are filled with 0 or 255.
+        if (power == 1.0 || blevel >= wlevel)
         {
-            int d = (int) *src++;
-            if (d < FiltMin) FiltMin = d;
-            if (d > FiltMax) FiltMax = d;
+            float range = (float) wxMax(1, wlevel);  // Go 0-max
+            int const top = wxMin(wxMax(1, wlevel), 65536);
+            for (int v = 0; v < top; v++)
+                map[v] = (unsigned char) (((float) v / range) * 255.0);
+            memset(map + top, 255, 65536 - top);
         }
-
-        delete[] tmpdata;
-    }
-    else
-    {
-        // Subframe
-
-        unsigned int pixcnt = Subframe.width * Subframe.height;
-        unsigned short *tmpdata = new unsigned short[pixcnt];
-
-        unsigned short *dst;
-
-        dst = tmpdata;
-        for (int y = 0; y < Subframe.height; y++)
+        else
         {
-            const unsigned short *src = ImageData + Subframe.x + (Subframe.y + y) * Size.GetWidth();
-            for (int x = 0; x < Subframe.width; x++)
-            {
-               int d = (int) *src;
-               if (d < Min) Min = d;
-               if (d > Max) Max = d;
-               *dst++ = *src++;
-            }
+            int const lo = wxMin(wxMax(0, blevel + 1), 65536);
+            int const hi = wxMin(wxMax(lo, wlevel), 65536);
+            float range = (float) (wlevel - blevel);
+            memset(map, 0, lo);
+            for (int v = lo; v < hi; v++)
+                map[v] = (unsigned char) (pow(((float) v - (float) blevel) / range, (float) power) * 255.0);
+            memset(map + hi, 255, 65536 - hi);
         }
+    }
+};
 
-        dst = new unsigned short[pixcnt];
-
-        Median3(dst, tmpdata, Subframe.GetSize(), wxRect(Subframe.GetSize()));
+// the display is rendered on the main thread, so the table is only rebuilt
+// when the stretch changes; other threads (image rotation) use their own table
+static DisplayLut s_displayLut;
 
-        const unsigned short *src = dst;
-        for (unsigned int i = 0; i < pixcnt; i++)
-        {
-            int d = (int) *src++;
-            if (d < FiltMin) FiltMin = d;
-            if (d > FiltMax) FiltMax = d;
-        }
+static const unsigned char *GetDisplayLut(std::unique_ptr<DisplayLut>& local, int blevel, int wlevel, double power)
+{
+    if (wxThread::IsMain())
+        return s_displayLut.Get(blevel, wlevel, power);
+    local.reset(new DisplayLut());
+    return local->Get(blevel, wlevel, power);
+}
 
-        delete[] dst;
-        delete[] tmpdata;
+// write n gray RGB pixels, four at a time with one 12-byte store
+static void MapRow(unsigned char *dst, const unsigned short *src, int n, const unsigned char *lut)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4, src += 4, dst += 12)
+    {
+        unsigned char const a = lut[src[0]];
+        unsigned char const b = lut[src[1]];
+        unsigned char const c = lut[src[2]];
+        unsigned char const d = lut[src[3]];
+        unsigned char const px[12] = { a, a, a, b, b, b, c, c, c, d, d, d };
+        memcpy(dst, px, sizeof(px));
+    }
+    for (; i < n; i++)
+    {
+        unsigned char const v = lut[*src++];
+        *dst++ = v;
+        *dst++ = v;
+        *dst++ = v;
     }
 }
 
+// Subframe images only hold data inside the subframe and are zero elsewhere.
+// The displayed image remembers where the last subframe was drawn and the
+// background value, so the next frame only repaints those two areas.
+static const char *SUBFRAME_OPTION = "phd2.subframe";
+
 bool usImage::CopyToImage(wxImage **rawimg, int blevel, int wlevel, double power)
 {
     wxImage *img = *rawimg;
+    bool fresh = false;
 
     if (!img || !img->Ok() || (img->GetWidth() != Size.GetWidth()) || (img->GetHeight() != Size.GetHeight()) ) // can't reuse bitmap
     {
         delete img;
         img = new wxImage(Size.GetWidth(), Size.GetHeight(), false);
+        fresh = true;
     }
 
+    std::unique_ptr<DisplayLut> local;
+    const unsigned char *lut = GetDisplayLut(local, blevel, wlevel, power);
+
     unsigned char *ImgPtr = img->GetData();
-    unsigned short *RawPtr = ImageData;
+    int const width = Size.GetWidth();
+
+    wxRect valid(Size);
+    if (!Subframe.IsEmpty())
+        valid.Intersect(Subframe);
 
-    if (power == 1.0 || blevel >= wlevel)
+    if (valid == wxRect(Size))
     {
-        float range = (float) wxMax(1, wlevel);  // Go 0-max
-        for (unsigned int i = 0; i < NPixels; i++, RawPtr++)
-        {
-            float d;
-            if (*RawPtr >= range)
-                d = 255.0;
-            else
-                d = ((float) (*RawPtr) / range) * 255.0;
-
-            *ImgPtr++ = (unsigned char) d;
-            *ImgPtr++ = (unsigned char) d;
-            *ImgPtr++ = (unsigned char) d;
-        }
+        MapRow(ImgPtr, ImageData, NPixels, lut);
+        if (!fresh)
+            img->SetOption(SUBFRAME_OPTION, wxEmptyString);
     }
     else
     {
-        float range = (float) (wlevel - blevel);
-        for (unsigned int i = 0; i < NPixels; i++, RawPtr++ )
+        unsigned char const bg = lut[0];
+
+        wxRect prev;
+        int prevBg;
+        wxString opt = fresh ? wxString() : img->GetOption(SUBFRAME_OPTION);
+        bool const cached = !opt.IsEmpty() &&
+            sscanf(opt.c_str(), "%d %d %d %d %d", &prev.x, &prev.y, &prev.width, &prev.height, &prevBg) == 5 &&
+            prevBg == bg && wxRect(Size).Contains(prev);
+
+        if (cached)
         {
-            float d;
-            if (*RawPtr <= blevel)
-                d = 0.0;
-            else if (*RawPtr >= wlevel)
-                d = 255.0;
-            else
-            {
-                d = ((float) (*RawPtr) - (float) blevel) / range;
-                d = pow(d, (float) power) * 255.0;
-            }
-            *ImgPtr++ = (unsigned char) d;
-            *ImgPtr++ = (unsigned char) d;
-            *ImgPtr++ = (unsigned char) d;
+            // everything outside the previous subframe is already the background
+            for (int y = prev.y; y < prev.y + prev.height; y++)
+                memset(ImgPtr + 3 * (y * width + prev.x), bg, 3 * prev.width);
         }
+        else
+            memset(ImgPtr, bg, 3 * NPixels);
+
+        for (int y = valid.y; y < valid.y + valid.height; y++)
+        {
+            size_t const ofs = y * width + valid.x;
+            MapRow(ImgPtr + 3 * ofs, ImageData + ofs, valid.width, lut);
+        }
+
+        img->SetOption(SUBFRAME_OPTION, wxString::Format("%d %d %d %d %d", valid.x, valid.y, valid.width, valid.height, bg));
     }
 
     *rawimg = img;
@@ -204,70 +351,36 @@ bool usImage::CopyToImage(wxImage **rawimg, int blevel, int wlevel, double power
 
 bool usImage::BinnedCopyToImage(wxImage **rawimg, int blevel, int wlevel, double power)
 {
-    wxImage *img;
-    unsigned char *ImgPtr;
-    unsigned short *RawPtr;
-    int x,y;
-    float d;
-    //, s_factor;
-    int full_xsize, full_ysize;
-    int use_xsize, use_ysize;
-
-    full_xsize = Size.GetWidth();
-    full_ysize = Size.GetHeight();
-    use_xsize = full_xsize;
-    use_ysize = full_ysize;
-    if (use_xsize % 2) use_xsize--;
-    if (use_ysize % 2) use_ysize--;
-//  Binsize = 2;
-
-    img = *rawimg;
-    if ((!img->Ok()) || (img->GetWidth() != (full_xsize/2)) || (img->GetHeight() != (full_ysize/2)) ) {  // can't reuse bitmap
+    int full_xsize = Size.GetWidth();
+    int full_ysize = Size.GetHeight();
+    int use_xsize = full_xsize & ~1;
+    int use_ysize = full_ysize & ~1;
+
+    wxImage *img = *rawimg;
+    if (!img || (!img->Ok()) || (img->GetWidth() != (full_xsize/2)) || (img->GetHeight() != (full_ysize/2)) ) {  // can't reuse bitmap
         delete img;  // Clear out current image if it exists
         img = new wxImage(full_xsize/2, full_ysize/2, false);
     }
-    ImgPtr = img->GetData();
-    RawPtr = ImageData;
-//  s_factor = (((float) Max - (float) Min) / 255.0);
-    float range = (float) (wlevel - blevel);
-
-    if ((power == 1.0) || (range == 0.0)) {
-        range = wlevel;  // Go 0-max
-        if (range == 0.0) range = 0.001;
-        for (y=0; y<use_ysize; y+=2) {
-            for (x=0; x<use_xsize; x+=2) {
-                RawPtr = ImageData + x + y*full_xsize;
-                d = (float) (*RawPtr + *(RawPtr+1) + *(RawPtr+full_xsize) + *(RawPtr+1+full_xsize)) / 4.0;
-                d = (d / range) * 255.0;
-                if (d < 0.0) d = 0.0;
-                else if (d > 255.0) d = 255.0;
-                *ImgPtr = (unsigned char) d;
-                ImgPtr++;
-                *ImgPtr = (unsigned char) d;
-                ImgPtr++;
-                *ImgPtr = (unsigned char) d;
-                ImgPtr++;
-            }
-        }
-    }
-    else {
-        for (y=0; y<use_ysize; y+=2) {
-            for (x=0; x<use_xsize; x+=2) {
-                RawPtr = ImageData + x + y*full_xsize;
-                d = (float) (*RawPtr + *(RawPtr+1) + *(RawPtr+full_xsize) + *(RawPtr+1+full_xsize)) / 4.0;
-                d = (d - (float) blevel) / range ;
-                if (d < 0.0) d= 0.0;
-                else if (d > 1.0) d = 1.0;
-                d = pow(d, (float) power) * 255.0;
-                *ImgPtr = (unsigned char) d;
-                ImgPtr++;
-                *ImgPtr = (unsigned char) d;
-                ImgPtr++;
-                *ImgPtr = (unsigned char) d;
-                ImgPtr++;
-            }
+
+    std::unique_ptr<DisplayLut> local;
+    const unsigned char *lut = GetDisplayLut(local, blevel, wlevel, power);
+
+    unsigned char *ImgPtr = img->GetData();
+
+    for (int y = 0; y < use_ysize; y += 2)
+    {
+        const unsigned short *row0 = ImageData + y * full_xsize;
+        const unsigned short *row1 = row0 + full_xsize;
+        for (int x = 0; x < use_xsize; x += 2)
+        {
+            unsigned int const sum = row0[x] + row0[x + 1] + row1[x] + row1[x + 1];
+            unsigned char const v = lut[(sum + 2) >> 2];
+            *ImgPtr++ = v;
+            *ImgPtr++ = v;
+            *ImgPtr++ = v;
         }
     }
+
     *rawimg = img;
     return false;
 }
@@ -277,128 +390,134 @@ void usImage::InitImgStartTime()
     ImgStartTime = wxDateTime::UNow();
 }
 
-bool usImage::Save(const wxString& fname, const wxString& hdrNote) const
+// Collect the FITS header for the image. This reads the state of the camera,
+// mount and guider, so it must be called from the main thread.
+void usImage::GetFitsHeader(FITSHdrList *hdr, const wxString& hdrNote) const
 {
-    bool bError = false;
+    float exposure = (float) ImgExpDur / 1000.0;
+    hdr->write("EXPOSURE", exposure, "Exposure time in seconds");
 
-    try
-    {
-        fitsfile *fptr;  // FITS file pointer
-        int status = 0;  // CFITSIO status value MUST be initialized to zero!
-
-        PHD_fits_create_file(&fptr, fname, true, &status);
-
-        long fsize[] = {
-            (long) Size.GetWidth(),
-            (long) Size.GetHeight(),
-        };
-        fits_create_img(fptr, USHORT_IMG, 2, fsize, &status);
+    if (ImgStackCnt > 1)
+        hdr->write("STACKCNT", (unsigned int) ImgStackCnt, "Stacked frame count");
 
-        FITSHdrWriter hdr(fptr, &status);
+    if (!hdrNote.IsEmpty())
+        hdr->write("USERNOTE", hdrNote.utf8_str(), 0);
 
-        float exposure = (float) ImgExpDur / 1000.0;
-        hdr.write("EXPOSURE", exposure, "Exposure time in seconds");
+    hdr->write("DATE", wxDateTime::UNow(), wxDateTime::UTC, "file creation time, UTC");
+    hdr->write("DATE-OBS", ImgStartTime, wxDateTime::UTC, "Image capture start time, UTC");
+    hdr->write("CREATOR", wxString(APPNAME _T(" ") FULLVER).c_str(), "Capture software");
+    hdr->write("PHDPROFI", pConfig->GetCurrentProfile().c_str(), "PHD2 Equipment Profile");
 
-        if (ImgStackCnt > 1)
-            hdr.write("STACKCNT", (unsigned int) ImgStackCnt, "Stacked frame count");
-
-        if (!hdrNote.IsEmpty())
-            hdr.write("USERNOTE", hdrNote.utf8_str(), 0);
-
-        hdr.write("DATE", wxDateTime::UNow(), wxDateTime::UTC, "file creation time, UTC");
-        hdr.write("DATE-OBS", ImgStartTime, wxDateTime::UTC, "Image capture start time, UTC");
-        hdr.write("CREATOR", wxString(APPNAME _T(" ") FULLVER).c_str(), "Capture software");
-        hdr.write("PHDPROFI", pConfig->GetCurrentProfile().c_str(), "PHD2 Equipment Profile");
+    if (pCamera)
+    {
+        hdr->write("INSTRUME", pCamera->Name.c_str(), "Instrument name");
+        unsigned int b = pCamera->Binning;
+        hdr->write("XBINNING", b, "Camera X Bin");
+        hdr->write("YBINNING", b, "Camera Y Bin");
+        hdr->write("CCDXBIN", b, "Camera X Bin");
+        hdr->write("CCDYBIN", b, "Camera Y Bin");
+        float sz = b * pCamera->GetCameraPixelSize();
+        hdr->write("XPIXSZ", sz, "pixel size in microns (with binning)");
+        hdr->write("YPIXSZ", sz, "pixel size in microns (with binning)");
+        unsigned int g = (unsigned int) pCamera->GuideCameraGain;
+        hdr->write("GAIN", g, "PHD Gain Value (0-100)");
+        unsigned int bpp = pCamera->BitsPerPixel();
+        hdr->write("CAMBPP", bpp, "Camera resolution, bits per pixel");
+    }
 
-        if (pCamera)
+    if (pPointingSource)
+    {
+        PointingState state = PointingCache::Get();
+        double ra = state.ra, dec = state.dec;
+        if (state.haveCoordinates)
         {
-            hdr.write("INSTRUME", pCamera->Name.c_str(), "Instrument name");
-            unsigned int b = pCamera->Binning;
-            hdr.write("XBINNING", b, "Camera X Bin");
-            hdr.write("YBINNING", b, "Camera Y Bin");
-            hdr.write("CCDXBIN", b, "Camera X Bin");
-            hdr.write("CCDYBIN", b, "Camera Y Bin");
-            float sz = b * pCamera->GetCameraPixelSize();
-            hdr.write("XPIXSZ", sz, "pixel size in microns (with binning)");
-            hdr.write("YPIXSZ", sz, "pixel size in microns (with binning)");
-            unsigned int g = (unsigned int) pCamera->GuideCameraGain;
-            hdr.write("GAIN", g, "PHD Gain Value (0-100)");
-            unsigned int bpp = pCamera->BitsPerPixel();
-            hdr.write("CAMBPP", bpp, "Camera resolution, bits per pixel");
-        }
+            hdr->write("RA", (float) (ra * 360.0 / 24.0), "Object Right Ascension in degrees");
+            hdr->write("DEC", (float) dec, "Object Declination in degrees");
 
-        if (pPointingSource)
-        {
-            double ra, dec, st;
-            bool err = pPointingSource->GetCoordinates(&ra, &dec, &st);
-            if (!err)
             {
-                hdr.write("RA", (float) (ra * 360.0 / 24.0), "Object Right Ascension in degrees");
-                hdr.write("DEC", (float) dec, "Object Declination in degrees");
-
-                {
-                    int h = (int) ra;
-                    ra -= h;
-                    ra *= 60.0;
-                    int m = (int) ra;
-                    ra -= m;
-                    ra *= 60.0;
-                    hdr.write("OBJCTRA", wxString::Format("%02d %02d %06.3f", h, m, ra).c_str(), "Object Right Ascension in hms");
-                }
-
-                {
-                    int sign = dec < 0.0 ? -1 : +1;
-                    dec *= sign;
-                    int d = (int) dec;
-                    dec -= d;
-                    dec *= 60.0;
-                    int m = (int) dec;
-                    dec -= m;
-                    dec *= 60.0;
-                    hdr.write("OBJCTDEC", wxString::Format("%c%d %02d %06.3f", sign < 0 ? '-' : '+', d, m, dec).c_str(), "Object Declination in dms");
-                }
+                int h = (int) ra;
+                ra -= h;
+                ra *= 60.0;
+                int m = (int) ra;
+                ra -= m;
+                ra *= 60.0;
+                hdr->write("OBJCTRA", wxString::Format("%02d %02d %06.3f", h, m, ra).c_str(), "Object Right Ascension in hms");
             }
 
-            PierSide p = pPointingSource->SideOfPier();
-            if (p != PierSide::PIER_SIDE_UNKNOWN)
-                hdr.write("PIERSIDE", (unsigned int) p, "Side of Pier 0=East 1=West");
-        }
-
-        float sc = (float) pFrame->GetCameraPixelScale();
-        hdr.write("SCALE", sc, "Image scale (arcsec / pixel)");
-        hdr.write("PIXSCALE", sc, "Image scale (arcsec / pixel)");
-        hdr.write("PEDESTAL", (unsigned int) Pedestal, "dark subtraction bias value");
-        hdr.write("SATURATE", (1U << BitsPerPixel) - 1, "Data value at which saturation occurs");
-
-        const PHD_Point& lockPos = pFrame->pGuider->LockPosition();
-        if (lockPos.IsValid())
-        {
-            hdr.write("PHDLOCKX", (float) lockPos.X, "PHD2 lock position x");
-            hdr.write("PHDLOCKY", (float) lockPos.Y, "PHD2 lock position y");
-        }
-
-        if (!Subframe.IsEmpty())
-        {
-            hdr.write("PHDSUBFX", (unsigned int) Subframe.x, "PHD2 subframe x");
-            hdr.write("PHDSUBFY", (unsigned int) Subframe.y, "PHD2 subframe y");
-            hdr.write("PHDSUBFW", (unsigned int) Subframe.width, "PHD2 subframe width");
-            hdr.write("PHDSUBFH", (unsigned int) Subframe.height, "PHD2 subframe height");
+            {
+                int sign = dec < 0.0 ? -1 : +1;
+                dec *= sign;
+                int d = (int) dec;
+                dec -= d;
+                dec *= 60.0;
+                int m = (int) dec;
+                dec -= m;
+                dec *= 60.0;
+                hdr->write("OBJCTDEC", wxString::Format("%c%d %02d %06.3f", sign < 0 ? '-' : '+', d, m, dec).c_str(), "Object Declination in dms");
+            }
         }
 
-        long fpixel[3] = { 1, 1, 1 };
-        fits_write_pix(fptr, TUSHORT, fpixel, NPixels, ImageData, &status);
+        PierSide p = state.pierSide;
+        if (p != PierSide::PIER_SIDE_UNKNOWN)
+            hdr->write("PIERSIDE", (unsigned int) p, "Side of Pier 0=East 1=West");
+    }
 
-        PHD_fits_close_file(fptr);
+    float sc = (float) pFrame->GetCameraPixelScale();
+    hdr->write("SCALE", sc, "Image scale (arcsec / pixel)");
+    hdr->write("PIXSCALE", sc, "Image scale (arcsec / pixel)");
+    hdr->write("PEDESTAL", (unsigned int) Pedestal, "dark subtraction bias value");
+    hdr->write("SATURATE", (1U << BitsPerPixel) - 1, "Data value at which saturation occurs");
 
-        bError = status ? true : false;
+    const PHD_Point& lockPos = pFrame->pGuider->LockPosition();
+    if (lockPos.IsValid())
+    {
+        hdr->write("PHDLOCKX", (float) lockPos.X, "PHD2 lock position x");
+        hdr->write("PHDLOCKY", (float) lockPos.Y, "PHD2 lock position y");
     }
-    catch (const wxString& Msg)
+
+    if (!Subframe.IsEmpty())
     {
-        POSSIBLY_UNUSED(Msg);
-        bError = true;
+        hdr->write("PHDSUBFX", (unsigned int) Subframe.x, "PHD2 subframe x");
+        hdr->write("PHDSUBFY", (unsigned int) Subframe.y, "PHD2 subframe y");
+        hdr->write("PHDSUBFW", (unsigned int) Subframe.width, "PHD2 subframe width");
+        hdr->write("PHDSUBFH", (unsigned int) Subframe.height, "PHD2 subframe height");
     }
+}
 
-    return bError;
+bool usImage::Save(const wxString& fname, const wxString& hdrNote) const
+{
+    FITSHdrList hdr;
+    GetFitsHeader(&hdr, hdrNote);
+    return Save(fname, hdr, false);
+}
+
+// Write the image with a header collected by GetFitsHeader(). Only the image
+// itself is accessed, so this can be called from a background thread.
+bool usImage::Save(const wxString& fname, const FITSHdrList& hdr, bool compress) const
+{
+    FitsLock fitsLock;
+    fitsfile *fptr;  // FITS file pointer
+    int status = 0;  // CFITSIO status value MUST be initialized to zero!
+
+    PHD_fits_create_file(&fptr, fname, true, &status);
+
+    if (compress)
+        fits_set_compression_type(fptr, RICE_1, &status);
+
+    long fsize[] = {
+        (long) Size.GetWidth(),
+        (long) Size.GetHeight(),
+    };
+    fits_create_img(fptr, USHORT_IMG, 2, fsize, &status);
+
+    hdr.Write(fptr, &status);
+
+    long fpixel[3] = { 1, 1, 1 };
+    fits_write_pix(fptr, TUSHORT, fpixel, NPixels, ImageData, &status);
+
+    PHD_fits_close_file(fptr);
+
+    return status ? true : false;
 }
 
 static bool fhdr_int(fitsfile *fptr, const char *key, int *val)
@@ -421,6 +540,7 @@ bool usImage::Load(const wxString& fname)
             throw ERROR_INFO("File does not exist");
         }
 
+        FitsLock fitsLock;
         int status = 0;  // CFITSIO status value MUST be initialized to zero!
         fitsfile *fptr;  // FITS file pointer
         if (!PHD_fits_open_diskfile(&fptr, fname, READONLY, &status))
@@ -435,10 +555,19 @@ bool usImage::Load(const wxString& fname)
             // Get HDUs and size
             int naxis = 0;
             fits_get_img_dim(fptr, &naxis, &status);
-            long fsize[3];
-            fits_get_img_size(fptr, 2, fsize, &status);
             int nhdus = 0;
             fits_get_num_hdus(fptr, &nhdus, &status);
+            if (naxis == 0 && nhdus == 2)
+            {
+                // a tile-compressed image is stored in the first extension
+                fits_movabs_hdu(fptr, 2, &hdutype, &status);
+                int compressed = fits_is_compressed_image(fptr, &status);
+                fits_get_img_dim(fptr, &naxis, &status);
+                if (!status && compressed)
+                    nhdus = 1;
+            }
+            long fsize[3];
+            fits_get_img_size(fptr, 2, fsize, &status);
             if ((nhdus != 1) || (naxis != 2)) {
                 pFrame->Alert(wxString::Format(_("Unsupported type or read error loading FITS file %s"), fname));
                 throw ERROR_INFO("unsupported type");
@@ -35,6 +35,29 @@
 #ifndef USIMAGECLASS
 #define USIMAGECLASS
 
+class FITSHdrList;
+
+// Recycles usImage pixel buffers so that the capture loop does not allocate
+// and free a full frame for every exposure. Buffers are page-aligned and a
+// few idle buffers are kept for reuse by the next frame of the same size.
+class FrameBufferPool
+{
+public:
+    struct Stats
+    {
+        unsigned int hits;          // requests served from an idle buffer
+        unsigned int misses;        // requests that allocated a new buffer
+        unsigned int idle;          // idle buffers held by the pool
+        size_t idleBytes;
+    };
+
+    static unsigned short *Acquire(unsigned int npixels);
+    static void Release(unsigned short *buf);
+    static void GetStats(Stats *stats);
+    // free the idle buffers
+    static void Destroy();
+};
+
 class usImage
 {
 public:
@@ -68,7 +91,7 @@ public:
         FrameNum(0)
     {
     }
-    ~usImage() { delete[] ImageData; }
+    ~usImage() { FrameBufferPool::Release(ImageData); }
 
     bool                Init(const wxSize& size);
     bool                Init(int width, int height) { return Init(wxSize(width, height)); }
@@ -81,6 +104,8 @@ public:
     bool                CopyFromImage(const wxImage& img);
     bool                Load(const wxString& fname);
     bool                Save(const wxString& fname, const wxString& hdrComment = wxEmptyString) const;
+    void                GetFitsHeader(FITSHdrList *hdr, const wxString& hdrComment = wxEmptyString) const;
+    bool                Save(const wxString& fname, const FITSHdrList& hdr, bool compress) const;
     bool                Rotate(double theta, bool mirror=false);
     unsigned short&     Pixel(int x, int y) { return ImageData[y * Size.x + x]; }
     const unsigned short& Pixel(int x, int y) const { return ImageData[y * Size.x + x]; }
@@ -147,6 +147,9 @@ bool WorkerThread::HandleExpose(EXPOSE_REQUEST *req)
             throw ERROR_INFO("Time lapse interrupted");
         }
 
+        GuideLatency::CaptureStarted();
+        long long const captureStart = GuideLatency::Now();
+
         if (pCamera->HasNonGuiCapture())
         {
             Debug.Write(wxString::Format("Handling exposure in thread, d=%d o=%x r=(%d,%d,%d,%d)\n", req->exposureDuration,
@@ -176,6 +179,8 @@ bool WorkerThread::HandleExpose(EXPOSE_REQUEST *req)
             req->pSemaphore = NULL;
         }
 
+        GuideLatency::CaptureDone(captureStart);
+
         Debug.Write("Exposure complete\n");
 
         if (!bError)
@@ -206,6 +211,10 @@ bool WorkerThread::HandleExpose(EXPOSE_REQUEST *req)
 
 void WorkerThread::SendWorkerThreadExposeComplete(usImage *pImage, bool bError)
 {
+    // the frame goes to the main thread once its stars have been measured
+    if (m_pFrame->m_pFramePipeline && m_pFrame->m_pFramePipeline->Push(pImage, bError))
+        return;
+
     wxThreadEvent *event = new wxThreadEvent(wxEVT_THREAD, MYFRAME_WORKER_THREAD_EXPOSE_COMPLETE);
     event->SetPayload<usImage *>(pImage);
     event->SetInt(bError);